@@ -70,6 +70,7 @@ soup_auth_digest_finalize (GObject *object)
 
 	g_free (priv->user);
 	g_free (priv->nonce);
+	g_free (priv->opaque);
 	g_free (priv->domain);
 	g_free (priv->cnonce);
 
@@ -390,7 +391,9 @@ authentication_info_cb (SoupMessage *msg, gpointer data)
 	GHashTable *auth_params;
 	char *nextnonce;
 
-	if (auth != soup_message_get_auth (msg))
+	if (auth != (soup_auth_is_for_proxy (auth) ?
+		     soup_message_get_proxy_auth (msg) :
+		     soup_message_get_auth (msg)))
 		return;
 
 	header = soup_message_headers_get_one_common (soup_message_get_response_headers (msg),
@@ -405,8 +408,14 @@ authentication_info_cb (SoupMessage *msg, gpointer data)
 
 	nextnonce = g_strdup (g_hash_table_lookup (auth_params, "nextnonce"));
 	if (nextnonce) {
+		/* The nonce count restarts with each nonce. H(A1) is
+		 * kept as is, even for MD5-sess, which computes it only
+		 * once from the nonce of the first challenge (RFC 2617,
+		 * section 3.2.2.2).
+		 */
 		g_free (priv->nonce);
 		priv->nonce = nextnonce;
+		priv->nc = 1;
 	}
 
 	soup_header_free_param_list (auth_params);
@@ -421,6 +430,8 @@ soup_auth_digest_get_authorization (SoupAuth *auth, SoupMessage *msg)
 	char *url, *algorithm;
 	GString *out;
 	GUri *uri;
+	const char *handler_key;
+	guint handler_id;
 
 	uri = soup_message_get_uri (msg);
 	g_return_val_if_fail (uri != NULL, NULL);
@@ -468,13 +479,23 @@ soup_auth_digest_get_authorization (SoupAuth *auth, SoupMessage *msg)
 
 	token = g_string_free (out, FALSE);
 
-	soup_message_add_header_handler (msg,
-					 "got_headers",
-					 soup_auth_is_for_proxy (auth) ?
-					 "Proxy-Authentication-Info" :
-					 "Authentication-Info",
-					 G_CALLBACK (authentication_info_cb),
-					 auth);
+	/* The message may be authorized again if it is requeued. Header
+	 * handlers can't be matched by func, so keep the handler id.
+	 */
+	handler_key = soup_auth_is_for_proxy (auth) ?
+		"SoupAuthDigest-proxy-info-handler" :
+		"SoupAuthDigest-info-handler";
+	handler_id = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (msg), handler_key));
+	if (handler_id)
+		g_signal_handler_disconnect (msg, handler_id);
+	handler_id = soup_message_add_header_handler (msg,
+						      "got_headers",
+						      soup_auth_is_for_proxy (auth) ?
+						      "Proxy-Authentication-Info" :
+						      "Authentication-Info",
+						      G_CALLBACK (authentication_info_cb),
+						      auth);
+	g_object_set_data (G_OBJECT (msg), handler_key, GUINT_TO_POINTER (handler_id));
 	return token;
 }
 
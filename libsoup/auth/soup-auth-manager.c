@@ -13,6 +13,7 @@
 
 #include "soup-auth-manager.h"
 #include "soup.h"
+#include "auth/soup-auth-private.h"
 #include "soup-connection-auth.h"
 #include "soup-message-private.h"
 #include "soup-message-headers-private.h"
@@ -62,8 +63,14 @@ typedef struct {
 	GUri        *uri;
 	SoupPathMap *auth_realms;      /* path -> scheme:realm */
 	GHashTable  *auths;            /* scheme:realm -> SoupAuth */
+	GHashTable  *lookups;          /* path -> SoupAuth or NULL */
 } SoupAuthHost;
 
+/* Upper bound on the number of paths whose lookup result is kept per
+ * host; the index is simply reset when it fills up.
+ */
+#define MAX_HOST_LOOKUPS 256
+
 G_DEFINE_FINAL_TYPE_WITH_CODE (SoupAuthManager, soup_auth_manager, G_TYPE_OBJECT,
                                G_ADD_PRIVATE (SoupAuthManager)
 			       G_IMPLEMENT_INTERFACE (SOUP_TYPE_SESSION_FEATURE,
@@ -399,6 +406,7 @@ get_auth_host_for_uri (SoupAuthManagerPrivate *priv, GUri *uri)
 static void
 soup_auth_host_free (SoupAuthHost *host)
 {
+	g_clear_pointer (&host->lookups, g_hash_table_destroy);
 	g_clear_pointer (&host->auth_realms, soup_path_map_free);
 	g_clear_pointer (&host->auths, g_hash_table_destroy);
 
@@ -429,10 +437,23 @@ static void
 update_authorization_header (SoupMessage *msg, SoupAuth *auth, gboolean is_proxy)
 {
         SoupHeaderName authorization_header = is_proxy ? SOUP_HEADER_PROXY_AUTHORIZATION : SOUP_HEADER_AUTHORIZATION;
+        SoupMessageHeaders *request_headers = soup_message_get_request_headers (msg);
+        const char *cached;
 	char *token;
 
+        /* Restarted messages usually already carry the right value */
+        cached = auth ? soup_auth_peek_authorization (auth, msg) : NULL;
+        if (cached) {
+                const char *current;
+
+                current = soup_message_headers_get_one_common (request_headers, authorization_header);
+                if (g_strcmp0 (current, cached) != 0)
+                        soup_message_headers_replace_common (request_headers, authorization_header, cached);
+                return;
+        }
+
 	if (soup_message_get_auth (msg))
-		soup_message_headers_remove_common (soup_message_get_request_headers (msg), authorization_header);
+		soup_message_headers_remove_common (request_headers, authorization_header);
 
 	if (!auth)
 		return;
@@ -441,7 +462,7 @@ update_authorization_header (SoupMessage *msg, SoupAuth *auth, gboolean is_proxy
 	if (!token)
 		return;
 
-	soup_message_headers_replace_common (soup_message_get_request_headers (msg), authorization_header, token);
+	soup_message_headers_replace_common (request_headers, authorization_header, token);
 	g_free (token);
 }
 
@@ -480,11 +501,18 @@ lookup_auth (SoupAuthManagerPrivate *priv, SoupMessage *msg)
 	path = g_uri_get_path (uri);
 	if (!path)
 		path = "/";
+
+	if (g_hash_table_lookup_extended (host->lookups, path, NULL, (gpointer *)&auth))
+		return auth;
+
 	realm = soup_path_map_lookup (host->auth_realms, path);
-	if (realm)
-		return g_hash_table_lookup (host->auths, realm);
+	auth = realm ? g_hash_table_lookup (host->auths, realm) : NULL;
 
-	return NULL;
+	if (g_hash_table_size (host->lookups) >= MAX_HOST_LOOKUPS)
+		g_hash_table_remove_all (host->lookups);
+	g_hash_table_insert (host->lookups, g_strdup (path), auth);
+
+	return auth;
 }
 
 static SoupAuth *
@@ -580,7 +608,10 @@ record_auth_for_uri (SoupAuthManagerPrivate *priv, GUri *uri,
 		host->auth_realms = soup_path_map_new (g_free);
 		host->auths = g_hash_table_new_full (g_str_hash, g_str_equal,
 						     g_free, g_object_unref);
-	}
+		host->lookups = g_hash_table_new_full (g_str_hash, g_str_equal,
+						       g_free, NULL);
+	} else
+		g_hash_table_remove_all (host->lookups);
 
 	/* Record where this auth realm is used. */
 	pspace = soup_auth_get_protection_space (auth, uri);
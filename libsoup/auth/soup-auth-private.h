@@ -0,0 +1,15 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-auth-private.h: private SoupAuth API
+ */
+
+#pragma once
+
+#include "soup-auth.h"
+
+G_BEGIN_DECLS
+
+const char *soup_auth_peek_authorization (SoupAuth    *auth,
+					  SoupMessage *msg);
+
+G_END_DECLS
@@ -11,7 +11,8 @@
 
 #include <string.h>
 
-#include "soup-auth.h"
+#include "soup-auth-private.h"
+#include "soup-auth-basic.h"
 #include "soup.h"
 #include "soup-connection-auth.h"
 #include "soup-message-private.h"
@@ -35,6 +36,11 @@ typedef struct {
 	char *authority;
 	gboolean proxy;
 	gboolean cancelled;
+
+	/* Cached Authorization value, for schemes where it does not
+	 * depend on the message.
+	 */
+	char *authorization;
 } SoupAuthPrivate;
 
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (SoupAuth, soup_auth, G_TYPE_OBJECT)
@@ -59,6 +65,17 @@ soup_auth_init (SoupAuth *auth)
 {
 }
 
+static void
+clear_authorization (SoupAuthPrivate *priv)
+{
+	if (!priv->authorization)
+		return;
+
+	/* It holds the credentials */
+	memset (priv->authorization, 0, strlen (priv->authorization));
+	g_clear_pointer (&priv->authorization, g_free);
+}
+
 static void
 soup_auth_dispose (GObject *object)
 {
@@ -79,6 +96,7 @@ soup_auth_finalize (GObject *object)
 
 	g_free (priv->realm);
 	g_free (priv->authority);
+	clear_authorization (priv);
 
 	G_OBJECT_CLASS (soup_auth_parent_class)->finalize (object);
 }
@@ -340,6 +358,7 @@ soup_auth_update (SoupAuth *auth, SoupMessage *msg, const char *auth_header)
 		return FALSE;
 	}
 
+	clear_authorization (priv);
 	was_authenticated = soup_auth_is_authenticated (auth);
 	success = SOUP_AUTH_GET_CLASS (auth)->update (auth, msg, params);
 	if (was_authenticated != soup_auth_is_authenticated (auth))
@@ -373,6 +392,7 @@ soup_auth_authenticate (SoupAuth *auth, const char *username, const char *passwo
 	if (priv->cancelled)
 		return;
 
+	clear_authorization (priv);
 	was_authenticated = soup_auth_is_authenticated (auth);
 	SOUP_AUTH_GET_CLASS (auth)->authenticate (auth, username, password);
 	if (was_authenticated != soup_auth_is_authenticated (auth))
@@ -401,6 +421,7 @@ soup_auth_cancel (SoupAuth *auth)
 		return;
 
 	priv->cancelled = TRUE;
+	clear_authorization (priv);
 	g_object_notify_by_pspec (G_OBJECT (auth), properties[PROP_IS_CANCELLED]);
 }
 
@@ -571,6 +592,28 @@ soup_auth_get_authorization (SoupAuth *auth, SoupMessage *msg)
 	return SOUP_AUTH_GET_CLASS (auth)->get_authorization (auth, msg);
 }
 
+/* Returns the Authorization header value for @msg, computed once and
+ * kept until @auth is updated or (re)authenticated, or %NULL if the
+ * scheme's header depends on the message (as with Digest) or the
+ * connection (as with NTLM and Negotiate), in which case the caller
+ * must use soup_auth_get_authorization().
+ */
+const char *
+soup_auth_peek_authorization (SoupAuth    *auth,
+			      SoupMessage *msg)
+{
+	SoupAuthPrivate *priv = soup_auth_get_instance_private (auth);
+
+	if (!SOUP_IS_AUTH_BASIC (auth))
+		return NULL;
+
+	if (!priv->authorization && !priv->cancelled &&
+	    soup_auth_is_authenticated (auth))
+		priv->authorization = SOUP_AUTH_GET_CLASS (auth)->get_authorization (auth, msg);
+
+	return priv->authorization;
+}
+
 /**
  * soup_auth_is_ready:
  * @auth: a #SoupAuth
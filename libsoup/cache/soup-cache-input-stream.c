@@ -19,6 +19,11 @@ enum {
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Data read from the network is coalesced in buffers of this size
+ * before being written to the cache file.
+ */
+#define WRITE_BUFFER_SIZE (64 * 1024)
+
 struct _SoupCacheInputStream {
 	SoupFilterInputStream parent_instance;
 };
@@ -29,8 +34,14 @@ typedef struct {
 	gsize bytes_written;
 
 	gboolean read_finished;
+	gboolean caching_finished;
+	gboolean caching_dropped;
 	GBytes *current_writing_buffer;
-	GQueue *buffer_queue;
+	GByteArray *pending_buffer;
+
+	/* Bytes read but not written yet, accounted in write_budget */
+	gint *write_budget;
+	gsize reserved;
 } SoupCacheInputStreamPrivate;
 
 static void soup_cache_input_stream_pollable_init (GPollableInputStreamInterface *pollable_interface, gpointer interface_data);
@@ -43,11 +54,42 @@ G_DEFINE_FINAL_TYPE_WITH_CODE (SoupCacheInputStream, soup_cache_input_stream, SO
 
 static void soup_cache_input_stream_write_next_buffer (SoupCacheInputStream *istream);
 
+static gboolean
+reserve_write_budget (SoupCacheInputStream *istream, gsize size)
+{
+	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (istream);
+	gint budget;
+
+	do {
+		budget = g_atomic_int_get (priv->write_budget);
+		if (budget < 0 || (gsize) budget < size)
+			return FALSE;
+	} while (!g_atomic_int_compare_and_exchange (priv->write_budget, budget, budget - (gint) size));
+
+	priv->reserved += size;
+	return TRUE;
+}
+
+static void
+release_write_budget (SoupCacheInputStream *istream, gsize size)
+{
+	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (istream);
+
+	g_assert (size <= priv->reserved);
+
+	priv->reserved -= size;
+	g_atomic_int_add (priv->write_budget, (gint) size);
+}
+
 static inline void
 notify_and_clear (SoupCacheInputStream *istream, GError *error)
 {
 	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (istream);
 
+	priv->caching_finished = TRUE;
+	g_byte_array_set_size (priv->pending_buffer, 0);
+	release_write_budget (istream, priv->reserved);
+
 	g_signal_emit (istream, signals[CACHING_FINISHED], 0, priv->bytes_written, error);
 
 	g_clear_object (&priv->cancellable);
@@ -55,12 +97,50 @@ notify_and_clear (SoupCacheInputStream *istream, GError *error)
 	g_clear_error (&error);
 }
 
+static void
+notify_dropped (SoupCacheInputStream *istream)
+{
+	GError *error = NULL;
+
+	g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+			     _("Too many pending cache writes"));
+	notify_and_clear (istream, error);
+}
+
+/* Stops caching the resource when there are too many pending writes,
+ * the network must not be slowed down by the cache.
+ */
+static void
+drop_caching (SoupCacheInputStream *istream)
+{
+	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (istream);
+
+	priv->caching_dropped = TRUE;
+	release_write_budget (istream, priv->pending_buffer->len);
+	g_byte_array_set_size (priv->pending_buffer, 0);
+
+	/* Otherwise the operation in progress will notify */
+	if (priv->current_writing_buffer == NULL && priv->output_stream)
+		notify_dropped (istream);
+	else
+		g_cancellable_cancel (priv->cancellable);
+}
+
 static inline void
 try_write_next_buffer (SoupCacheInputStream *istream)
 {
 	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (istream);
 
-	if (priv->current_writing_buffer == NULL && priv->buffer_queue->length)
+	if (priv->current_writing_buffer != NULL)
+		return;
+
+	if (priv->caching_dropped) {
+		notify_dropped (istream);
+		return;
+	}
+
+	if (priv->pending_buffer->len >= WRITE_BUFFER_SIZE ||
+	    (priv->read_finished && priv->pending_buffer->len))
 		soup_cache_input_stream_write_next_buffer (istream);
 	else if (priv->read_finished)
 		notify_and_clear (istream, NULL);
@@ -83,9 +163,13 @@ file_replaced_cb (GObject      *source,
 
 	priv->output_stream = (GOutputStream *) g_file_replace_finish (G_FILE (source), res, &error);
 
-	if (error)
-		notify_and_clear (istream, error);
-	else
+	if (error) {
+		if (priv->caching_dropped) {
+			g_clear_error (&error);
+			notify_dropped (istream);
+		} else
+			notify_and_clear (istream, error);
+	} else
 		try_write_next_buffer (istream);
 
 	g_object_unref (istream);
@@ -96,7 +180,7 @@ soup_cache_input_stream_init (SoupCacheInputStream *self)
 {
 	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (self);
 
-	priv->buffer_queue = g_queue_new ();
+	priv->pending_buffer = g_byte_array_new ();
 }
 
 static void
@@ -108,7 +192,9 @@ soup_cache_input_stream_finalize (GObject *object)
 	g_clear_object (&priv->cancellable);
 	g_clear_object (&priv->output_stream);
 	g_clear_pointer (&priv->current_writing_buffer, g_bytes_unref);
-	g_queue_free_full (priv->buffer_queue, (GDestroyNotify) g_bytes_unref);
+	g_byte_array_unref (priv->pending_buffer);
+	if (priv->reserved)
+		release_write_budget (self, priv->reserved);
 
 	G_OBJECT_CLASS (soup_cache_input_stream_parent_class)->finalize (object);
 }
@@ -118,27 +204,23 @@ write_ready_cb (GObject *source, GAsyncResult *result, SoupCacheInputStream *ist
 {
 	GOutputStream *ostream = G_OUTPUT_STREAM (source);
 	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (istream);
-	gssize write_size;
-	gsize pending;
+	gsize write_size;
 	GError *error = NULL;
 
-	write_size = g_output_stream_write_finish (ostream, result, &error);
+	g_output_stream_write_all_finish (ostream, result, &write_size, &error);
+	g_clear_pointer (&priv->current_writing_buffer, g_bytes_unref);
 	if (error) {
-		notify_and_clear (istream, error);
+		if (priv->caching_dropped) {
+			g_clear_error (&error);
+			notify_dropped (istream);
+		} else
+			notify_and_clear (istream, error);
 		g_object_unref (istream);
 		return;
 	}
 
-	/* Check that we have written everything */
-	pending = g_bytes_get_size (priv->current_writing_buffer) - write_size;
-	if (pending) {
-		GBytes *subbuffer = g_bytes_new_from_bytes (priv->current_writing_buffer,
-							    write_size, pending);
-		g_queue_push_head (priv->buffer_queue, g_steal_pointer (&subbuffer));
-	}
-
 	priv->bytes_written += write_size;
-	g_clear_pointer (&priv->current_writing_buffer, g_bytes_unref);
+	release_write_budget (istream, write_size);
 
 	try_write_next_buffer (istream);
 	g_object_unref (istream);
@@ -148,25 +230,28 @@ static void
 soup_cache_input_stream_write_next_buffer (SoupCacheInputStream *istream)
 {
 	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (istream);
-	GBytes *buffer = g_queue_pop_head (priv->buffer_queue);
+	GBytes *buffer;
 	int priority;
 
 	g_assert (priv->output_stream && !g_output_stream_is_closed (priv->output_stream));
+	g_assert (priv->current_writing_buffer == NULL);
 
-	g_clear_pointer (&priv->current_writing_buffer, g_bytes_unref);
-	priv->current_writing_buffer = buffer;
-
-	if (priv->buffer_queue->length > 10)
+	/* Write everything read so far at once */
+	if (priv->pending_buffer->len > 2 * WRITE_BUFFER_SIZE)
 		priority = G_PRIORITY_DEFAULT;
 	else
 		priority = G_PRIORITY_LOW;
 
-	g_output_stream_write_async (priv->output_stream,
-                                     g_bytes_get_data (buffer, NULL),
-                                     g_bytes_get_size (buffer),
-				     priority, priv->cancellable,
-				     (GAsyncReadyCallback) write_ready_cb,
-				     g_object_ref (istream));
+	buffer = g_byte_array_free_to_bytes (priv->pending_buffer);
+	priv->pending_buffer = g_byte_array_sized_new (WRITE_BUFFER_SIZE);
+	priv->current_writing_buffer = buffer;
+
+	g_output_stream_write_all_async (priv->output_stream,
+					 g_bytes_get_data (buffer, NULL),
+					 g_bytes_get_size (buffer),
+					 priority, priv->cancellable,
+					 (GAsyncReadyCallback) write_ready_cb,
+					 g_object_ref (istream));
 }
 
 static gssize
@@ -186,20 +271,24 @@ read_internal (GInputStream  *stream,
 	nread = g_pollable_stream_read (base_stream, buffer, count, blocking,
 					cancellable, error);
 
-	if (G_UNLIKELY (nread == -1 || priv->read_finished))
+	if (G_UNLIKELY (nread == -1 || priv->read_finished || priv->caching_finished || priv->caching_dropped))
 		return nread;
 
 	if (nread == 0) {
 		priv->read_finished = TRUE;
 
 		if (priv->current_writing_buffer == NULL && priv->output_stream)
-			notify_and_clear (istream, NULL);
+			try_write_next_buffer (istream);
 	} else {
-		GBytes *local_buffer = g_bytes_new (buffer, nread);
-		g_queue_push_tail (priv->buffer_queue, g_steal_pointer (&local_buffer));
+		if (!reserve_write_budget (istream, nread)) {
+			drop_caching (istream);
+			return nread;
+		}
+
+		g_byte_array_append (priv->pending_buffer, buffer, nread);
 
 		if (priv->current_writing_buffer == NULL && priv->output_stream)
-			soup_cache_input_stream_write_next_buffer (istream);
+			try_write_next_buffer (istream);
 	}
 
 	return nread;
@@ -282,9 +371,14 @@ soup_cache_input_stream_class_init (SoupCacheInputStreamClass *klass)
 			      G_TYPE_INT, G_TYPE_ERROR);
 }
 
+/* @write_budget is the number of bytes that can still be queued for
+ * writing, shared by all the streams writing to the same cache. Caching
+ * is dropped when it runs out, instead of delaying the reads.
+ */
 GInputStream *
 soup_cache_input_stream_new (GInputStream *base_stream,
-			     GFile        *file)
+			     GFile        *file,
+			     gint         *write_budget)
 {
 	SoupCacheInputStream *istream = g_object_new (SOUP_TYPE_CACHE_INPUT_STREAM,
 					      "base-stream", base_stream,
@@ -292,6 +386,7 @@ soup_cache_input_stream_new (GInputStream *base_stream,
 					      NULL);
 	SoupCacheInputStreamPrivate *priv = soup_cache_input_stream_get_instance_private (istream);
 
+	priv->write_budget = write_budget;
 	priv->cancellable = g_cancellable_new ();
 	g_file_replace_async (file, NULL, FALSE,
 			      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION,
@@ -13,6 +13,7 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (SoupCacheInputStream, soup_cache_input_stream, SOUP, CACHE_INPUT_STREAM, SoupFilterInputStream)
 
 GInputStream *soup_cache_input_stream_new (GInputStream *base_stream,
-					   GFile        *file);
+					   GFile        *file,
+					   gint         *write_budget);
 
 G_END_DECLS
@@ -68,6 +68,11 @@ static SoupContentProcessorInterface *soup_cache_default_content_processor_inter
 static void soup_cache_content_processor_init (SoupContentProcessorInterface *interface, gpointer interface_data);
 
 #define DEFAULT_MAX_SIZE 50 * 1024 * 1024
+#define DEFAULT_MAX_MEMORY_SIZE 5 * 1024 * 1024
+#define MAX_PENDING_WRITE_SIZE 8 * 1024 * 1024 /* Data read from the network
+						* and not written to disk yet,
+						* resources are not cached
+						* above it */
 #define MAX_ENTRY_DATA_PERCENTAGE 10 /* Percentage of the total size
 	                                of the cache that can be
 	                                filled by a single entry */
@@ -89,14 +94,18 @@ static void soup_cache_content_processor_init (SoupContentProcessorInterface *in
  *   - entry key is now a uint32 instead of a (char *).
  *   - added uri, used to check for collisions
  *   - removed filename, it's built from the entry key.
+ *
+ * Version 6: support for several variants of the same URI.
+ *   - entry key is now a uint64, printed in hexadecimal in the filename.
+ *   - added the request header values selected by Vary.
  */
-#define SOUP_CACHE_CURRENT_VERSION 5
+#define SOUP_CACHE_CURRENT_VERSION 6
 
 #define OLD_SOUP_CACHE_FILE "soup.cache"
 #define SOUP_CACHE_FILE "soup.cache2"
 
 #define SOUP_CACHE_HEADERS_FORMAT "{ss}"
-#define SOUP_CACHE_PHEADERS_FORMAT "(sbuuuuuqa" SOUP_CACHE_HEADERS_FORMAT ")"
+#define SOUP_CACHE_PHEADERS_FORMAT "(ssbuuuuuqa" SOUP_CACHE_HEADERS_FORMAT ")"
 #define SOUP_CACHE_ENTRIES_FORMAT "(qa" SOUP_CACHE_PHEADERS_FORMAT ")"
 
 /* Basically the same format than above except that some strings are
@@ -105,9 +114,14 @@ static void soup_cache_content_processor_init (SoupContentProcessorInterface *in
 #define SOUP_CACHE_DECODE_HEADERS_FORMAT "{&s&s}"
 
 
-typedef struct _SoupCacheEntry {
-	guint32 key;
+typedef struct _SoupCacheEntry SoupCacheEntry;
+
+struct _SoupCacheEntry {
+	guint64 key;
 	char *uri;
+	char **vary_headers;
+	char *vary_key;
+	SoupCacheEntry *next_variant;
 	guint32 freshness_lifetime;
 	gboolean must_revalidate;
 	gsize length;
@@ -119,25 +133,85 @@ typedef struct _SoupCacheEntry {
 	guint32 hits;
 	GCancellable *cancellable;
 	guint16 status_code;
-} SoupCacheEntry;
+	GList lru_link;
+	guint lru_segment;
+	GBytes *body;
+	GList memory_link;
+};
+
+/* Maximum number of variants of the same URI selected by Vary */
+#define MAX_VARIANTS 8
+
+/* Segments of the eviction queues. With SOUP_CACHE_EVICTION_LRU only
+ * the probation segment is used. With SOUP_CACHE_EVICTION_SEGMENTED_LRU
+ * entries get promoted to the protected segment on their first hit,
+ * and are demoted back once the protected segment grows over its
+ * share of the cache.
+ */
+enum {
+	LRU_SEGMENT_PROBATION,
+	LRU_SEGMENT_PROTECTED,
+
+	LRU_N_SEGMENTS
+};
+
+#define PROTECTED_SEGMENT_PERCENTAGE 80 /* Percentage of the total size
+					   of the cache that can be
+					   filled by protected entries */
+
+/* Bodies of small or hot entries are also kept in memory, so that
+ * they can be served without any file I/O. Entries bigger than
+ * MAX_ENTRY_DATA_PERCENTAGE of the memory budget are never kept in
+ * memory.
+ */
+#define MEMORY_SMALL_ENTRY_SIZE 4096 /* Promoted on their first hit */
+#define MEMORY_PROMOTION_HITS 3      /* Hits needed to promote other entries */
+
+/* The index maps every URI to the list of its variants. It is split
+ * in shards, each one with its own lock, so that lookups from
+ * different threads don't contend with each other.
+ * Modifications of the index, the LRU queues and the cache size are
+ * serialized by the cache mutex, which must always be acquired
+ * before any shard lock.
+ */
+#define N_SHARDS 16
+
+typedef struct {
+	GMutex mutex;
+	GHashTable *entries;
+	guint n_entries;
+} SoupCacheShard;
 
 typedef struct {
 	char *cache_dir;
         GMutex mutex;
-	GHashTable *cache;
+	SoupCacheShard shards[N_SHARDS];
 	guint n_pending;
+	gint write_budget;
 	SoupSession *session;
 	SoupCacheType cache_type;
 	guint size;
 	guint max_size;
 	guint max_entry_data_size; /* Computed value. Here for performance reasons */
-	GList *lru_start;
+	SoupCacheEvictionPolicy eviction_policy;
+	/* Head is the next eviction candidate, tail the most recently used */
+	GQueue lru[LRU_N_SEGMENTS];
+	guint protected_size;
+	/* Memory tier, head is the next entry to demote to disk */
+	GQueue memory_lru;
+	gsize memory_size;
+	guint max_memory_size;
+	gint memory_hits;
+	gint memory_misses;
+	gint disk_hits;
+	gint disk_misses;
 } SoupCachePrivate;
 
 enum {
 	PROP_0,
 	PROP_CACHE_DIR,
 	PROP_CACHE_TYPE,
+	PROP_EVICTION_POLICY,
 
         LAST_PROPERTY
 };
@@ -154,13 +228,14 @@ G_DEFINE_TYPE_WITH_CODE (SoupCache, soup_cache, G_TYPE_OBJECT,
 static gboolean soup_cache_entry_remove (SoupCache *cache, SoupCacheEntry *entry, gboolean purge);
 static void make_room_for_new_entry (SoupCache *cache, guint length_to_add);
 static gboolean cache_accepts_entries_of_size (SoupCache *cache, guint length_to_add);
+static SoupCacheResponse soup_cache_entry_get_response (SoupCacheEntry *entry, SoupMessage *msg);
 
 static GFile *
 get_file_from_entry (SoupCache *cache, SoupCacheEntry *entry)
 {
         SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
-	char *filename = g_strdup_printf ("%s%s%u", priv->cache_dir,
-					  G_DIR_SEPARATOR_S, (guint) entry->key);
+	char *filename = g_strdup_printf ("%s%s%016" G_GINT64_MODIFIER "x", priv->cache_dir,
+					  G_DIR_SEPARATOR_S, entry->key);
 	GFile *file = g_file_new_for_path (filename);
 	g_free (filename);
 
@@ -189,6 +264,10 @@ get_cacheability (SoupCache *cache, SoupMessage *msg)
 	if (content_type && !g_ascii_strcasecmp (content_type, "multipart/x-mixed-replace"))
 		return SOUP_CACHE_UNCACHEABLE;
 
+	/* A Vary header field-value of "*" always fails to match */
+	if (soup_message_headers_header_contains_common (soup_message_get_response_headers (msg), SOUP_HEADER_VARY, "*"))
+		return SOUP_CACHE_UNCACHEABLE;
+
 	cache_control = soup_message_headers_get_list_common (soup_message_get_response_headers (msg), SOUP_HEADER_CACHE_CONTROL);
 	if (cache_control && *cache_control) {
 		GHashTable *hash;
@@ -294,7 +373,10 @@ static void
 soup_cache_entry_free (SoupCacheEntry *entry)
 {
 	g_free (entry->uri);
+	g_strfreev (entry->vary_headers);
+	g_free (entry->vary_key);
 	g_clear_pointer (&entry->headers, soup_message_headers_unref);
+	g_clear_pointer (&entry->body, g_bytes_unref);
 	g_clear_object (&entry->cancellable);
 
 	g_slice_free (SoupCacheEntry, entry);
@@ -351,10 +433,93 @@ soup_cache_entry_is_fresh_enough (SoupCacheEntry *entry, gint min_fresh)
 	return entry->freshness_lifetime > limit;
 }
 
-static inline guint32
-get_cache_key_from_uri (const char *uri)
+/* The key identifies a variant, it is also used as the name of the
+ * file storing its body, so it must be stable across sessions.
+ */
+static guint64
+get_cache_key (const char *uri, const char *vary_key)
+{
+	GChecksum *checksum;
+	guint8 digest[32];
+	gsize digest_len = sizeof (digest);
+	guint64 key;
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA256);
+	g_checksum_update (checksum, (const guchar *) uri, -1);
+	if (vary_key) {
+		/* Not allowed in URIs, keeps the two parts apart */
+		g_checksum_update (checksum, (const guchar *) " ", 1);
+		g_checksum_update (checksum, (const guchar *) vary_key, -1);
+	}
+	g_checksum_get_digest (checksum, digest, &digest_len);
+	g_checksum_free (checksum);
+
+	memcpy (&key, digest, sizeof (key));
+	return GUINT64_FROM_BE (key);
+}
+
+static char **
+get_vary_headers (SoupMessageHeaders *response_headers)
+{
+	const char *vary;
+	GSList *names, *l;
+	GPtrArray *headers;
+
+	vary = soup_message_headers_get_list_common (response_headers, SOUP_HEADER_VARY);
+	if (!vary || !*vary)
+		return NULL;
+
+	names = soup_header_parse_list (vary);
+	headers = g_ptr_array_new ();
+	for (l = names; l; l = l->next)
+		g_ptr_array_add (headers, g_ascii_strdown (l->data, -1));
+	g_ptr_array_add (headers, NULL);
+	soup_header_free_list (names);
+
+	return (char **) g_ptr_array_free (headers, FALSE);
+}
+
+/* Builds the string identifying the values of the request headers
+ * nominated by Vary, in the order they appear there.
+ */
+static char *
+get_vary_key (char **vary_headers, SoupMessageHeaders *request_headers)
 {
-	return (guint32) g_str_hash (uri);
+	GString *key;
+	guint i;
+
+	if (!vary_headers)
+		return NULL;
+
+	key = g_string_new (NULL);
+	for (i = 0; vary_headers[i]; i++) {
+		const char *value = soup_message_headers_get_list (request_headers, vary_headers[i]);
+
+		g_string_append (key, vary_headers[i]);
+		g_string_append_c (key, ':');
+		if (value)
+			g_string_append (key, value);
+		g_string_append_c (key, '\n');
+	}
+
+	return g_string_free (key, FALSE);
+}
+
+static gboolean
+soup_cache_entry_matches_request (SoupCacheEntry     *entry,
+				  SoupMessageHeaders *request_headers)
+{
+	char *vary_key;
+	gboolean matches;
+
+	if (!entry->vary_headers)
+		return TRUE;
+
+	vary_key = get_vary_key (entry->vary_headers, request_headers);
+	matches = g_strcmp0 (vary_key, entry->vary_key) == 0;
+	g_free (vary_key);
+
+	return matches;
 }
 
 static void
@@ -496,6 +661,10 @@ soup_cache_entry_new (SoupCache *cache, SoupMessage *msg, time_t request_time, t
 	entry->headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
 	copy_end_to_end_headers (soup_message_get_response_headers (msg), entry->headers);
 
+	/* Variant */
+	entry->vary_headers = get_vary_headers (entry->headers);
+	entry->vary_key = get_vary_key (entry->vary_headers, soup_message_get_request_headers (msg));
+
 	/* LRU list */
 	entry->hits = 0;
 
@@ -530,11 +699,196 @@ soup_cache_entry_new (SoupCache *cache, SoupMessage *msg, time_t request_time, t
 	return entry;
 }
 
+static inline guint
+lru_length (SoupCachePrivate *priv)
+{
+	return priv->lru[LRU_SEGMENT_PROBATION].length + priv->lru[LRU_SEGMENT_PROTECTED].length;
+}
+
+static inline SoupCacheShard *
+get_shard (SoupCachePrivate *priv, const char *uri)
+{
+	return &priv->shards[g_str_hash (uri) % N_SHARDS];
+}
+
+/* Must be called with the cache mutex held, so that the shards can't
+ * be modified meanwhile.
+ */
+static guint
+index_size (SoupCachePrivate *priv)
+{
+	guint i, size = 0;
+
+	for (i = 0; i < N_SHARDS; i++)
+		size += priv->shards[i].n_entries;
+
+	return size;
+}
+
+static void
+lru_insert (SoupCachePrivate *priv, SoupCacheEntry *entry)
+{
+	entry->lru_link.data = entry;
+	entry->lru_segment = LRU_SEGMENT_PROBATION;
+	g_queue_push_tail_link (&priv->lru[LRU_SEGMENT_PROBATION], &entry->lru_link);
+}
+
+static void
+lru_remove (SoupCachePrivate *priv, SoupCacheEntry *entry)
+{
+	g_queue_unlink (&priv->lru[entry->lru_segment], &entry->lru_link);
+	if (entry->lru_segment == LRU_SEGMENT_PROTECTED)
+		priv->protected_size -= entry->length;
+}
+
+static void
+lru_demote_protected (SoupCachePrivate *priv)
+{
+	GQueue *protected = &priv->lru[LRU_SEGMENT_PROTECTED];
+	guint max_protected_size = priv->max_size / 100 * PROTECTED_SEGMENT_PERCENTAGE;
+
+	/* Keep at least the most recently promoted entry protected */
+	while (priv->protected_size > max_protected_size && protected->length > 1) {
+		SoupCacheEntry *entry = protected->head->data;
+
+		lru_remove (priv, entry);
+		entry->lru_segment = LRU_SEGMENT_PROBATION;
+		g_queue_push_tail_link (&priv->lru[LRU_SEGMENT_PROBATION], &entry->lru_link);
+	}
+}
+
+/* Marks @entry as the most recently used one. Constant time. */
+static void
+lru_touch (SoupCachePrivate *priv, SoupCacheEntry *entry)
+{
+	lru_remove (priv, entry);
+
+	if (priv->eviction_policy == SOUP_CACHE_EVICTION_SEGMENTED_LRU)
+		entry->lru_segment = LRU_SEGMENT_PROTECTED;
+
+	g_queue_push_tail_link (&priv->lru[entry->lru_segment], &entry->lru_link);
+
+	if (entry->lru_segment == LRU_SEGMENT_PROTECTED) {
+		priv->protected_size += entry->length;
+		lru_demote_protected (priv);
+	}
+}
+
+static void
+lru_set_policy (SoupCachePrivate *priv, SoupCacheEvictionPolicy policy)
+{
+	GQueue *probation = &priv->lru[LRU_SEGMENT_PROBATION];
+	GQueue *protected = &priv->lru[LRU_SEGMENT_PROTECTED];
+	GList *link;
+
+	priv->eviction_policy = policy;
+	if (policy == SOUP_CACHE_EVICTION_SEGMENTED_LRU)
+		return;
+
+	/* Plain LRU only uses the probation queue, so move the
+	 * protected entries there keeping their relative order.
+	 */
+	while ((link = g_queue_pop_head_link (protected))) {
+		((SoupCacheEntry *) link->data)->lru_segment = LRU_SEGMENT_PROBATION;
+		g_queue_push_tail_link (probation, link);
+	}
+	priv->protected_size = 0;
+}
+
+static void
+memory_tier_remove (SoupCachePrivate *priv, SoupCacheEntry *entry)
+{
+	if (!entry->body)
+		return;
+
+	g_queue_unlink (&priv->memory_lru, &entry->memory_link);
+	priv->memory_size -= g_bytes_get_size (entry->body);
+	g_clear_pointer (&entry->body, g_bytes_unref);
+}
+
+static void
+memory_tier_make_room (SoupCachePrivate *priv, gsize length_to_add)
+{
+	/* Demoted entries are still available on disk */
+	while (priv->memory_lru.head &&
+	       (length_to_add + priv->memory_size > priv->max_memory_size))
+		memory_tier_remove (priv, (SoupCacheEntry *)priv->memory_lru.head->data);
+}
+
+static gboolean
+memory_tier_accepts (SoupCachePrivate *priv, SoupCacheEntry *entry)
+{
+	if (entry->length > priv->max_memory_size / MAX_ENTRY_DATA_PERCENTAGE)
+		return FALSE;
+
+	return entry->length <= MEMORY_SMALL_ENTRY_SIZE || entry->hits >= MEMORY_PROMOTION_HITS;
+}
+
+static void
+memory_tier_insert (SoupCachePrivate *priv, SoupCacheEntry *entry, GBytes *body)
+{
+	gsize length = g_bytes_get_size (body);
+
+	if (entry->body || length > priv->max_memory_size / MAX_ENTRY_DATA_PERCENTAGE)
+		return;
+
+	memory_tier_make_room (priv, length);
+
+	entry->body = g_bytes_ref (body);
+	entry->memory_link.data = entry;
+	g_queue_push_tail_link (&priv->memory_lru, &entry->memory_link);
+	priv->memory_size += length;
+}
+
+/* Returns a new reference to the body of @entry if it's in memory */
+static GBytes *
+memory_tier_lookup (SoupCachePrivate *priv, SoupCacheEntry *entry)
+{
+	if (!entry->body)
+		return NULL;
+
+	g_queue_unlink (&priv->memory_lru, &entry->memory_link);
+	g_queue_push_tail_link (&priv->memory_lru, &entry->memory_link);
+
+	return g_bytes_ref (entry->body);
+}
+
+/* Must be called with the shard lock held */
+static gboolean
+soup_cache_shard_remove (SoupCacheShard *shard, SoupCacheEntry *entry)
+{
+	SoupCacheEntry *head, *variant;
+
+	head = g_hash_table_lookup (shard->entries, entry->uri);
+	if (!head)
+		return FALSE;
+
+	if (head == entry) {
+		/* The key is owned by the head of the list */
+		if (entry->next_variant)
+			g_hash_table_replace (shard->entries, entry->next_variant->uri, entry->next_variant);
+		else
+			g_hash_table_remove (shard->entries, entry->uri);
+	} else {
+		for (variant = head; variant->next_variant != entry; variant = variant->next_variant) {
+			if (!variant->next_variant)
+				return FALSE;
+		}
+		variant->next_variant = entry->next_variant;
+	}
+
+	entry->next_variant = NULL;
+	shard->n_entries--;
+
+	return TRUE;
+}
+
 static gboolean
 soup_cache_entry_remove (SoupCache *cache, SoupCacheEntry *entry, gboolean purge)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
-	GList *lru_item;
+	SoupCacheShard *shard;
+	gboolean removed;
 
 	if (entry->dirty) {
 		g_cancellable_cancel (entry->cancellable);
@@ -542,21 +896,23 @@ soup_cache_entry_remove (SoupCache *cache, SoupCacheEntry *entry, gboolean purge
 	}
 
 	g_assert (!entry->dirty);
-	g_assert (g_list_length (priv->lru_start) == g_hash_table_size (priv->cache));
+	g_assert (lru_length (priv) == index_size (priv));
 
-	if (!g_hash_table_remove (priv->cache, GUINT_TO_POINTER (entry->key))) {
-                g_mutex_unlock (&priv->mutex);
+	shard = get_shard (priv, entry->uri);
+	g_mutex_lock (&shard->mutex);
+	removed = soup_cache_shard_remove (shard, entry);
+	g_mutex_unlock (&shard->mutex);
+	if (!removed)
 		return FALSE;
-        }
 
 	/* Remove from LRU */
-	lru_item = g_list_find (priv->lru_start, entry);
-	priv->lru_start = g_list_delete_link (priv->lru_start, lru_item);
+	lru_remove (priv, entry);
+	memory_tier_remove (priv, entry);
 
 	/* Adjust cache size */
 	priv->size -= entry->length;
 
-	g_assert (g_list_length (priv->lru_start) == g_hash_table_size (priv->cache));
+	g_assert (lru_length (priv) == index_size (priv));
 
 	/* Free resources */
 	if (purge) {
@@ -569,35 +925,6 @@ soup_cache_entry_remove (SoupCache *cache, SoupCacheEntry *entry, gboolean purge
 	return TRUE;
 }
 
-static gint
-lru_compare_func (gconstpointer a, gconstpointer b)
-{
-	SoupCacheEntry *entry_a = (SoupCacheEntry *)a;
-	SoupCacheEntry *entry_b = (SoupCacheEntry *)b;
-
-	/* The rationale of this sorting func is
-	 *
-	 * 1. sort by hits -> LRU algorithm, then
-	 *
-	 * 2. sort by freshness lifetime, we better discard first
-	 * entries that are close to expire
-	 *
-	 * 3. sort by size, replace first small size resources as they
-	 * are cheaper to download
-	 */
-
-	/* Sort by hits */
-	if (entry_a->hits != entry_b->hits)
-		return entry_a->hits - entry_b->hits;
-
-	/* Sort by freshness_lifetime */
-	if (entry_a->freshness_lifetime != entry_b->freshness_lifetime)
-		return entry_a->freshness_lifetime - entry_b->freshness_lifetime;
-
-	/* Sort by size */
-	return entry_a->length - entry_b->length;
-}
-
 static gboolean
 cache_accepts_entries_of_size (SoupCache *cache, guint length_to_add)
 {
@@ -612,38 +939,43 @@ static void
 make_room_for_new_entry (SoupCache *cache, guint length_to_add)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
-	GList *lru_entry = priv->lru_start;
+	guint i;
 
 	/* Check that there is enough room for the new entry. This is
 	   an approximation as we're not working out the size of the
 	   cache file or the size of the headers for performance
 	   reasons. TODO: check if that would be really that expensive */
 
-	while (lru_entry &&
-	       (length_to_add + priv->size > priv->max_size)) {
-		SoupCacheEntry *old_entry = (SoupCacheEntry *)lru_entry->data;
+	/* Probation entries are evicted before protected ones */
+	for (i = 0; i < LRU_N_SEGMENTS; i++) {
+		GList *lru_entry = priv->lru[i].head;
+
+		while (lru_entry &&
+		       (length_to_add + priv->size > priv->max_size)) {
+			SoupCacheEntry *old_entry = (SoupCacheEntry *)lru_entry->data;
 
-		/* Discard entries. Once cancelled resources will be
-		 * freed in close_ready_cb
-		 */
-		if (soup_cache_entry_remove (cache, old_entry, TRUE))
-			lru_entry = priv->lru_start;
-		else
 			lru_entry = g_list_next (lru_entry);
+
+			/* Discard entries. Once cancelled resources will be
+			 * freed in close_ready_cb
+			 */
+			soup_cache_entry_remove (cache, old_entry, TRUE);
+		}
 	}
 }
 
 static gboolean
 soup_cache_entry_insert (SoupCache *cache,
-			 SoupCacheEntry *entry,
-			 gboolean sort)
+			 SoupCacheEntry *entry)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
 	guint length_to_add = 0;
 	SoupCacheEntry *old_entry;
+	SoupCacheShard *shard;
+	guint i;
 
 	/* Fill the key */
-	entry->key = get_cache_key_from_uri ((const char *) entry->uri);
+	entry->key = get_cache_key (entry->uri, entry->vary_key);
 
 	if (soup_message_headers_get_encoding (entry->headers) == SOUP_ENCODING_CONTENT_LENGTH)
 		length_to_add = soup_message_headers_get_content_length (entry->headers);
@@ -657,57 +989,111 @@ soup_cache_entry_insert (SoupCache *cache,
 		make_room_for_new_entry (cache, length_to_add);
 	}
 
-	/* Remove any previous entry */
-	if ((old_entry = g_hash_table_lookup (priv->cache, GUINT_TO_POINTER (entry->key))) != NULL) {
+	/* Remove any previous entry for the same variant, and the
+	 * oldest variant if there are too many of them.
+	 */
+	shard = get_shard (priv, entry->uri);
+	g_mutex_lock (&shard->mutex);
+	old_entry = g_hash_table_lookup (shard->entries, entry->uri);
+	for (i = 0; old_entry; i++) {
+		if (g_strcmp0 (old_entry->vary_key, entry->vary_key) == 0 ||
+		    (i == MAX_VARIANTS - 1 && !old_entry->next_variant))
+			break;
+		old_entry = old_entry->next_variant;
+	}
+	g_mutex_unlock (&shard->mutex);
+	if (old_entry) {
 		if (!soup_cache_entry_remove (cache, old_entry, TRUE))
 			return FALSE;
 	}
 
-	/* Add to hash table */
-	g_hash_table_insert (priv->cache, GUINT_TO_POINTER (entry->key), entry);
+	/* Add to hash table, as the first variant */
+	g_mutex_lock (&shard->mutex);
+	entry->next_variant = g_hash_table_lookup (shard->entries, entry->uri);
+	g_hash_table_replace (shard->entries, entry->uri, entry);
+	shard->n_entries++;
+	g_mutex_unlock (&shard->mutex);
 
 	/* Compute new cache size */
 	priv->size += length_to_add;
 
 	/* Update LRU */
-	if (sort)
-		priv->lru_start = g_list_insert_sorted (priv->lru_start, entry, lru_compare_func);
-	else
-		priv->lru_start = g_list_prepend (priv->lru_start, entry);
+	lru_insert (priv, entry);
 
-	g_assert (g_list_length (priv->lru_start) == g_hash_table_size (priv->cache));
+	g_assert (lru_length (priv) == index_size (priv));
 
 	return TRUE;
 }
 
+/* Must be called with the shard lock of @uri held */
+static SoupCacheEntry *
+soup_cache_shard_lookup (SoupCacheShard     *shard,
+			 const char         *uri,
+			 SoupMessageHeaders *request_headers)
+{
+	SoupCacheEntry *entry;
+
+	entry = g_hash_table_lookup (shard->entries, uri);
+	while (entry && !soup_cache_entry_matches_request (entry, request_headers))
+		entry = entry->next_variant;
+
+	return entry;
+}
+
 static SoupCacheEntry*
 soup_cache_entry_lookup (SoupCache *cache,
 			 SoupMessage *msg)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	SoupCacheShard *shard;
 	SoupCacheEntry *entry;
-	guint32 key;
 	char *uri = NULL;
 
 	uri = g_uri_to_string_partial (soup_message_get_uri (msg), G_URI_HIDE_PASSWORD);
-	key = get_cache_key_from_uri ((const char *) uri);
-
-	entry = g_hash_table_lookup (priv->cache, GUINT_TO_POINTER (key));
+	shard = get_shard (priv, uri);
 
-	if (entry != NULL && (strcmp (entry->uri, uri) != 0))
-		entry = NULL;
+	g_mutex_lock (&shard->mutex);
+	entry = soup_cache_shard_lookup (shard, uri, soup_message_get_request_headers (msg));
+	g_mutex_unlock (&shard->mutex);
 
 	g_free (uri);
 	return entry;
 }
 
+/* Must be called with the cache mutex held */
+static void
+soup_cache_entry_remove_variants (SoupCache   *cache,
+				  SoupMessage *msg)
+{
+	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	SoupCacheShard *shard;
+	SoupCacheEntry *entry;
+	char *uri;
+
+	uri = g_uri_to_string_partial (soup_message_get_uri (msg), G_URI_HIDE_PASSWORD);
+	shard = get_shard (priv, uri);
+
+	g_mutex_lock (&shard->mutex);
+	entry = g_hash_table_lookup (shard->entries, uri);
+	g_mutex_unlock (&shard->mutex);
+
+	while (entry) {
+		SoupCacheEntry *next = entry->next_variant;
+
+		soup_cache_entry_remove (cache, entry, TRUE);
+		entry = next;
+	}
+
+	g_free (uri);
+}
+
 GInputStream *
 soup_cache_send_response (SoupCache *cache, SoupMessage *msg)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
 	SoupCacheEntry *entry;
 	GInputStream *file_stream, *body_stream, *cache_stream, *client_stream;
-	GFile *file;
+	GBytes *body = NULL;
         SoupMessageMetrics *metrics;
 
 	g_return_val_if_fail (SOUP_IS_CACHE (cache), NULL);
@@ -717,16 +1103,53 @@ soup_cache_send_response (SoupCache *cache, SoupMessage *msg)
 
         g_mutex_lock (&priv->mutex);
 	entry = soup_cache_entry_lookup (cache, msg);
+	if (entry)
+		body = memory_tier_lookup (priv, entry);
         g_mutex_unlock (&priv->mutex);
 	g_return_val_if_fail (entry, NULL);
 
-	file = get_file_from_entry (cache, entry);
-	file_stream = G_INPUT_STREAM (g_file_read (file, NULL, NULL));
-	g_object_unref (file);
+	if (body) {
+		g_atomic_int_inc (&priv->memory_hits);
+	} else {
+		g_atomic_int_inc (&priv->memory_misses);
+		g_atomic_int_inc (&priv->disk_hits);
+	}
 
-	/* Do not change the original message if there is no resource */
-	if (!file_stream)
-		return NULL;
+	if (!body && memory_tier_accepts (priv, entry)) {
+		GFile *file = get_file_from_entry (cache, entry);
+
+		/* Promote the entry to the memory tier */
+		body = g_file_load_bytes (file, NULL, NULL, NULL);
+		g_object_unref (file);
+
+		/* Do not change the original message if there is no resource */
+		if (!body)
+			return NULL;
+
+		if (g_bytes_get_size (body) != entry->length) {
+			g_bytes_unref (body);
+			return NULL;
+		}
+
+		g_mutex_lock (&priv->mutex);
+		if (soup_cache_entry_lookup (cache, msg) == entry)
+			memory_tier_insert (priv, entry, body);
+		g_mutex_unlock (&priv->mutex);
+	}
+
+	if (body) {
+		file_stream = g_memory_input_stream_new_from_bytes (body);
+		g_bytes_unref (body);
+	} else {
+		GFile *file = get_file_from_entry (cache, entry);
+
+		file_stream = G_INPUT_STREAM (g_file_read (file, NULL, NULL));
+		g_object_unref (file);
+
+		/* Do not change the original message if there is no resource */
+		if (!file_stream)
+			return NULL;
+	}
 
 	body_stream = soup_body_input_stream_new (file_stream, SOUP_ENCODING_CONTENT_LENGTH, entry->length);
 	g_object_unref (file_stream);
@@ -877,13 +1300,14 @@ soup_cache_content_processor_wrap_input (SoupContentProcessor *processor,
 	entry = soup_cache_entry_lookup (cache, msg);
 
 	if (cacheability & SOUP_CACHE_INVALIDATES) {
-		if (entry)
-			soup_cache_entry_remove (cache, entry, TRUE);
+		/* All the variants of the resource are invalidated */
+		soup_cache_entry_remove_variants (cache, msg);
                 g_mutex_unlock (&priv->mutex);
 		return NULL;
 	}
 
 	if (cacheability & SOUP_CACHE_VALIDATES) {
+                g_mutex_unlock (&priv->mutex);
 		/* It's possible to get a CACHE_VALIDATES with no
 		 * entry in the hash table. This could happen if for
 		 * example the soup client is the one creating the
@@ -891,7 +1315,6 @@ soup_cache_content_processor_wrap_input (SoupContentProcessor *processor,
 		 */
 		if (entry)
 			soup_cache_update_from_conditional_request (cache, msg);
-                g_mutex_unlock (&priv->mutex);
 		return NULL;
 	}
 
@@ -917,7 +1340,7 @@ soup_cache_content_processor_wrap_input (SoupContentProcessor *processor,
 	entry->dirty = TRUE;
 
 	/* Do not continue if it can not be stored */
-	if (!soup_cache_entry_insert (cache, entry, TRUE)) {
+	if (!soup_cache_entry_insert (cache, entry)) {
 		soup_cache_entry_free (entry);
                 g_mutex_unlock (&priv->mutex);
 		return NULL;
@@ -933,7 +1356,7 @@ soup_cache_content_processor_wrap_input (SoupContentProcessor *processor,
 	helper->entry = entry;
 
 	file = get_file_from_entry (cache, entry);
-	istream = soup_cache_input_stream_new (base_stream, file);
+	istream = soup_cache_input_stream_new (base_stream, file, &priv->write_budget);
 	g_object_unref (file);
 
 	g_signal_connect (istream, "caching-finished", G_CALLBACK (istream_caching_finished), helper);
@@ -956,13 +1379,28 @@ static void
 soup_cache_init (SoupCache *cache)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	guint i;
+
+	for (i = 0; i < N_SHARDS; i++) {
+		g_mutex_init (&priv->shards[i].mutex);
+		priv->shards[i].entries = g_hash_table_new (g_str_hash, g_str_equal);
+		priv->shards[i].n_entries = 0;
+	}
 
-	priv->cache = g_hash_table_new (g_direct_hash, g_direct_equal);
 	/* LRU */
-	priv->lru_start = NULL;
+	g_queue_init (&priv->lru[LRU_SEGMENT_PROBATION]);
+	g_queue_init (&priv->lru[LRU_SEGMENT_PROTECTED]);
+	priv->protected_size = 0;
+	priv->eviction_policy = SOUP_CACHE_EVICTION_SEGMENTED_LRU;
+
+	/* Memory tier */
+	g_queue_init (&priv->memory_lru);
+	priv->memory_size = 0;
+	priv->max_memory_size = DEFAULT_MAX_MEMORY_SIZE;
 
 	/* */
 	priv->n_pending = 0;
+	priv->write_budget = MAX_PENDING_WRITE_SIZE;
 
 	/* Cache size */
 	priv->max_size = DEFAULT_MAX_SIZE;
@@ -973,28 +1411,37 @@ soup_cache_init (SoupCache *cache)
 }
 
 static void
-remove_cache_item (gpointer data,
-		   gpointer user_data)
+remove_all_entries (SoupCache *cache, gboolean purge)
 {
-	soup_cache_entry_remove ((SoupCache *) user_data, (SoupCacheEntry *) data, FALSE);
+	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	guint i;
+
+	for (i = 0; i < LRU_N_SEGMENTS; i++) {
+		GList *lru_entry = priv->lru[i].head;
+
+		while (lru_entry) {
+			SoupCacheEntry *entry = (SoupCacheEntry *)lru_entry->data;
+
+			lru_entry = g_list_next (lru_entry);
+			soup_cache_entry_remove (cache, entry, purge);
+		}
+	}
 }
 
 static void
 soup_cache_finalize (GObject *object)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private ((SoupCache*)object);
-	GList *entries;
+	guint i;
 
-	/* Cannot use g_hash_table_foreach as callbacks must not modify the hash table */
-	entries = g_hash_table_get_values (priv->cache);
-	g_list_foreach (entries, remove_cache_item, object);
-	g_list_free (entries);
+	remove_all_entries ((SoupCache *)object, FALSE);
 
-	g_hash_table_destroy (priv->cache);
+	for (i = 0; i < N_SHARDS; i++) {
+		g_hash_table_destroy (priv->shards[i].entries);
+		g_mutex_clear (&priv->shards[i].mutex);
+	}
 	g_free (priv->cache_dir);
 
-	g_list_free (priv->lru_start);
-
         g_mutex_clear (&priv->mutex);
 
 	G_OBJECT_CLASS (soup_cache_parent_class)->finalize (object);
@@ -1026,6 +1473,9 @@ soup_cache_set_property (GObject *object, guint prop_id,
 		priv->cache_type = g_value_get_enum (value);
 		/* TODO: clear private entries and issue a warning if moving to shared? */
 		break;
+	case PROP_EVICTION_POLICY:
+		soup_cache_set_eviction_policy ((SoupCache *)object, g_value_get_enum (value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1045,6 +1495,9 @@ soup_cache_get_property (GObject *object, guint prop_id,
 	case PROP_CACHE_TYPE:
 		g_value_set_enum (value, priv->cache_type);
 		break;
+	case PROP_EVICTION_POLICY:
+		g_value_set_enum (value, priv->eviction_policy);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1087,6 +1540,22 @@ soup_cache_class_init (SoupCacheClass *cache_class)
                                    G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
                                    G_PARAM_STATIC_STRINGS);
 
+        /**
+         * SoupCache:eviction-policy:
+         * The policy used to choose which entries to discard when
+         * the cache is full.
+         *
+         * Since: 3.8
+         */
+        properties[PROP_EVICTION_POLICY] =
+                g_param_spec_enum ("eviction-policy",
+                                   "Eviction policy",
+                                   "The policy used to discard entries when the cache is full",
+                                   SOUP_TYPE_CACHE_EVICTION_POLICY,
+                                   SOUP_CACHE_EVICTION_SEGMENTED_LRU,
+                                   G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY |
+                                   G_PARAM_STATIC_STRINGS);
+
         g_object_class_install_properties (gobject_class, LAST_PROPERTY, properties);
 }
 
@@ -1100,6 +1569,33 @@ soup_cache_class_init (SoupCacheClass *cache_class)
  *
  */
 
+/**
+ * SoupCacheEvictionPolicy:
+ * @SOUP_CACHE_EVICTION_LRU: discard the least recently used entries first
+ * @SOUP_CACHE_EVICTION_SEGMENTED_LRU: entries that were used at least
+ *   once after being stored are kept in a protected segment, and are only
+ *   discarded after all the entries that were never reused
+ *
+ * The policy used by a #SoupCache to choose which entries are discarded
+ * to make room for new ones. Both policies update and evict entries in
+ * constant time.
+ *
+ * Since: 3.8
+ */
+
+/**
+ * SoupCacheTier:
+ * @SOUP_CACHE_TIER_MEMORY: responses kept in memory
+ * @SOUP_CACHE_TIER_DISK: responses stored in the cache directory
+ *
+ * The storage tiers of a #SoupCache. Every cached response is stored
+ * on disk, and the bodies of the small or frequently used ones are
+ * also kept in memory, so that they can be served without any file
+ * I/O.
+ *
+ * Since: 3.8
+ */
+
 /**
  * soup_cache_new:
  * @cache_dir: (nullable): the directory to store the cached data, or %NULL
@@ -1138,39 +1634,55 @@ SoupCacheResponse
 soup_cache_has_response (SoupCache *cache, SoupMessage *msg)
 {
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
+	SoupCacheShard *shard;
 	SoupCacheEntry *entry;
-	const char *cache_control;
-	gpointer value;
-	int max_age, max_stale, min_fresh;
-	GList *lru_item, *item;
+	SoupCacheResponse response;
+	char *uri;
 
-        g_mutex_lock (&priv->mutex);
+	uri = g_uri_to_string_partial (soup_message_get_uri (msg), G_URI_HIDE_PASSWORD);
+	shard = get_shard (priv, uri);
 
-	entry = soup_cache_entry_lookup (cache, msg);
+	/* Only the shard lock is held while the entry is in use, the
+	 * entry can't be removed from the index meanwhile.
+	 */
+	g_mutex_lock (&shard->mutex);
+
+	entry = soup_cache_shard_lookup (shard, uri, soup_message_get_request_headers (msg));
+	g_free (uri);
 
 	/* 1. The presented Request-URI and that of stored response
 	 * match
 	 */
 	if (!entry) {
-                g_mutex_unlock (&priv->mutex);
+		g_mutex_unlock (&shard->mutex);
+		g_atomic_int_inc (&priv->memory_misses);
+		g_atomic_int_inc (&priv->disk_misses);
 		return SOUP_CACHE_RESPONSE_STALE;
-        }
+	}
 
-	/* Increase hit count. Take sorting into account */
+	/* Increase hit count and move it to the most recently used
+	 * end. Reordering the LRU is skipped if the cache is busy
+	 * with a modification, it's not worth blocking a hit for it.
+	 */
 	entry->hits++;
-	lru_item = g_list_find (priv->lru_start, entry);
-	item = lru_item;
-	while (item->next && lru_compare_func (item->data, item->next->data) > 0)
-		item = g_list_next (item);
-
-	if (item != lru_item) {
-		priv->lru_start = g_list_remove_link (priv->lru_start, lru_item);
-		item = g_list_insert_sorted (item, lru_item->data, lru_compare_func);
-                (void)item; // Silence scan-build warning
-		g_list_free (lru_item);
+	if (!entry->dirty && g_mutex_trylock (&priv->mutex)) {
+		lru_touch (priv, entry);
+		g_mutex_unlock (&priv->mutex);
 	}
 
-        g_mutex_unlock (&priv->mutex);
+	response = soup_cache_entry_get_response (entry, msg);
+
+	g_mutex_unlock (&shard->mutex);
+
+	return response;
+}
+
+static SoupCacheResponse
+soup_cache_entry_get_response (SoupCacheEntry *entry, SoupMessage *msg)
+{
+	const char *cache_control;
+	gpointer value;
+	int max_age, max_stale, min_fresh;
 
 	if (entry->dirty || entry->being_validated)
 		return SOUP_CACHE_RESPONSE_STALE;
@@ -1191,7 +1703,7 @@ soup_cache_has_response (SoupCache *cache, SoupMessage *msg)
 	 * response (if any) match those presented.
 	 */
 
-	/* TODO */
+	/* Already done by the lookup, which selects the variant */
 
 	/* 4. The request is a conditional request issued by the client.
 	 */
@@ -1376,13 +1888,6 @@ soup_cache_foreach_file (SoupCache *cache, SoupCacheForeachFileFunc func, gpoint
 	g_dir_close (dir);
 }
 
-static void
-clear_cache_item (gpointer data,
-		  gpointer user_data)
-{
-	soup_cache_entry_remove ((SoupCache *) user_data, (SoupCacheEntry *) data, TRUE);
-}
-
 static void
 delete_cache_file (SoupCache *cache, const char *name, gpointer user_data)
 {
@@ -1411,16 +1916,14 @@ clear_cache_files (SoupCache *cache)
 void
 soup_cache_clear (SoupCache *cache)
 {
-	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
-	GList *entries;
+	SoupCachePrivate *priv;
 
 	g_return_if_fail (SOUP_IS_CACHE (cache));
-	g_return_if_fail (priv->cache);
 
-	/* Cannot use g_hash_table_foreach as callbacks must not modify the hash table */
-	entries = g_hash_table_get_values (priv->cache);
-	g_list_foreach (entries, clear_cache_item, cache);
-	g_list_free (entries);
+	priv = soup_cache_get_instance_private (cache);
+	g_mutex_lock (&priv->mutex);
+	remove_all_entries (cache, TRUE);
+	g_mutex_unlock (&priv->mutex);
 
 	/* Remove also any file not associated with a cache entry. */
 	clear_cache_files (cache);
@@ -1536,6 +2039,7 @@ pack_entry (gpointer data,
 
 	g_variant_builder_open (entries_builder, G_VARIANT_TYPE (SOUP_CACHE_PHEADERS_FORMAT));
 	g_variant_builder_add (entries_builder, "s", entry->uri);
+	g_variant_builder_add (entries_builder, "s", entry->vary_key ? entry->vary_key : "");
 	g_variant_builder_add (entries_builder, "b", entry->must_revalidate);
 	g_variant_builder_add (entries_builder, "u", entry->freshness_lifetime);
 	g_variant_builder_add (entries_builder, "u", entry->corrected_initial_age);
@@ -1567,8 +2071,6 @@ pack_entry (gpointer data,
  *
  * You must call this before exiting if you want your cache data to
  * persist between sessions.
- *
- * This is not thread safe and must be called only from the thread that created the #SoupCache
  */
 void
 soup_cache_dump (SoupCache *cache)
@@ -1578,16 +2080,24 @@ soup_cache_dump (SoupCache *cache)
 	GVariantBuilder entries_builder;
 	GVariant *cache_variant;
 
-	if (!g_list_length (priv->lru_start))
+	g_mutex_lock (&priv->mutex);
+
+	if (!lru_length (priv)) {
+		g_mutex_unlock (&priv->mutex);
 		return;
+	}
 
 	/* Create the builder and iterate over all entries */
 	g_variant_builder_init (&entries_builder, G_VARIANT_TYPE (SOUP_CACHE_ENTRIES_FORMAT));
 	g_variant_builder_add (&entries_builder, "q", SOUP_CACHE_CURRENT_VERSION);
 	g_variant_builder_open (&entries_builder, G_VARIANT_TYPE ("a" SOUP_CACHE_PHEADERS_FORMAT));
-	g_list_foreach (priv->lru_start, pack_entry, &entries_builder);
+	/* Keep the eviction order, so that it's preserved on load */
+	g_queue_foreach (&priv->lru[LRU_SEGMENT_PROBATION], pack_entry, &entries_builder);
+	g_queue_foreach (&priv->lru[LRU_SEGMENT_PROTECTED], pack_entry, &entries_builder);
 	g_variant_builder_close (&entries_builder);
 
+	g_mutex_unlock (&priv->mutex);
+
 	/* Serialize and dump */
 	cache_variant = g_variant_builder_end (&entries_builder);
 	g_variant_ref_sink (cache_variant);
@@ -1598,13 +2108,14 @@ soup_cache_dump (SoupCache *cache)
 	g_variant_unref (cache_variant);
 }
 
-static inline guint32
+static inline guint64
 get_key_from_cache_filename (const char *name)
 {
 	guint64 key;
 
-	key = g_ascii_strtoull (name, NULL, 10);
-	return key ? (guint32)key : 0;
+	if (!g_ascii_string_to_unsigned (name, 16, 0, G_MAXUINT64, &key, NULL))
+		return 0;
+	return key;
 }
 
 static void
@@ -1615,10 +2126,10 @@ insert_cache_file (SoupCache *cache, const char *name, GHashTable *leaked_entrie
 
 	path = g_build_filename (priv->cache_dir, name, NULL);
 	if (g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
-		guint32 key = get_key_from_cache_filename (name);
+		guint64 key = get_key_from_cache_filename (name);
 
 		if (key) {
-			g_hash_table_insert (leaked_entries, GUINT_TO_POINTER (key), path);
+			g_hash_table_insert (leaked_entries, g_memdup2 (&key, sizeof (key)), path);
 			return;
 		}
 	}
@@ -1639,7 +2150,7 @@ soup_cache_load (SoupCache *cache)
 	gboolean must_revalidate;
 	guint32 freshness_lifetime, hits;
 	guint32 corrected_initial_age, response_time;
-	char *url, *filename = NULL, *contents = NULL;
+	char *url, *vary_key, *filename = NULL, *contents = NULL;
 	GVariant *cache_variant;
 	GVariantIter *entries_iter = NULL, *headers_iter = NULL;
 	gsize length;
@@ -1669,11 +2180,11 @@ soup_cache_load (SoupCache *cache)
 		return;
 	}
 
-	leaked_entries = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+	leaked_entries = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_free);
 	soup_cache_foreach_file (cache, (SoupCacheForeachFileFunc)insert_cache_file, leaked_entries);
 
 	while (g_variant_iter_loop (entries_iter, SOUP_CACHE_PHEADERS_FORMAT,
-				    &url, &must_revalidate, &freshness_lifetime, &corrected_initial_age,
+				    &url, &vary_key, &must_revalidate, &freshness_lifetime, &corrected_initial_age,
 				    &response_time, &hits, &length, &status_code,
 				    &headers_iter)) {
 		const char *header_key, *header_value;
@@ -1696,6 +2207,9 @@ soup_cache_load (SoupCache *cache)
 		/* Insert in cache */
 		entry = g_slice_new0 (SoupCacheEntry);
 		entry->uri = g_strdup (url);
+		entry->vary_headers = get_vary_headers (headers);
+		if (entry->vary_headers)
+			entry->vary_key = g_strdup (vary_key);
 		entry->must_revalidate = must_revalidate;
 		entry->freshness_lifetime = freshness_lifetime;
 		entry->corrected_initial_age = corrected_initial_age;
@@ -1705,10 +2219,10 @@ soup_cache_load (SoupCache *cache)
 		entry->headers = headers;
 		entry->status_code = status_code;
 
-		if (!soup_cache_entry_insert (cache, entry, FALSE))
+		if (!soup_cache_entry_insert (cache, entry))
 			soup_cache_entry_free (entry);
 		else
-			g_hash_table_remove (leaked_entries, GUINT_TO_POINTER (entry->key));
+			g_hash_table_remove (leaked_entries, &entry->key);
 	}
 
 	/* Remove the leaked files */
@@ -1717,8 +2231,6 @@ soup_cache_load (SoupCache *cache)
 		g_unlink ((char *)value);
 	g_hash_table_destroy (leaked_entries);
 
-	priv->lru_start = g_list_reverse (priv->lru_start);
-
 	/* frees */
 	g_variant_iter_free (entries_iter);
 	g_variant_unref (cache_variant);
@@ -1754,3 +2266,161 @@ soup_cache_get_max_size (SoupCache *cache)
 	SoupCachePrivate *priv = soup_cache_get_instance_private (cache);
 	return priv->max_size;
 }
+
+/**
+ * soup_cache_set_eviction_policy:
+ * @cache: a #SoupCache
+ * @policy: a #SoupCacheEvictionPolicy
+ *
+ * Sets the policy used to discard entries when @cache is full.
+ *
+ * Since: 3.8
+ */
+void
+soup_cache_set_eviction_policy (SoupCache              *cache,
+				SoupCacheEvictionPolicy  policy)
+{
+	SoupCachePrivate *priv;
+
+	g_return_if_fail (SOUP_IS_CACHE (cache));
+
+	priv = soup_cache_get_instance_private (cache);
+	if (priv->eviction_policy == policy)
+		return;
+
+	g_mutex_lock (&priv->mutex);
+	lru_set_policy (priv, policy);
+	g_mutex_unlock (&priv->mutex);
+
+	g_object_notify_by_pspec (G_OBJECT (cache), properties[PROP_EVICTION_POLICY]);
+}
+
+/**
+ * soup_cache_get_eviction_policy:
+ * @cache: a #SoupCache
+ *
+ * Gets the policy used to discard entries when @cache is full.
+ *
+ * Returns: the #SoupCacheEvictionPolicy of @cache
+ *
+ * Since: 3.8
+ */
+SoupCacheEvictionPolicy
+soup_cache_get_eviction_policy (SoupCache *cache)
+{
+	SoupCachePrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_CACHE (cache), SOUP_CACHE_EVICTION_SEGMENTED_LRU);
+
+	priv = soup_cache_get_instance_private (cache);
+	return priv->eviction_policy;
+}
+
+/**
+ * soup_cache_set_max_memory_size:
+ * @cache: a #SoupCache
+ * @max_size: the maximum size of the memory tier, in bytes
+ *
+ * Sets the maximum size of the response bodies that @cache keeps in
+ * memory. Use 0 to disable the memory tier.
+ *
+ * Since: 3.8
+ */
+void
+soup_cache_set_max_memory_size (SoupCache *cache,
+				guint      max_size)
+{
+	SoupCachePrivate *priv;
+
+	g_return_if_fail (SOUP_IS_CACHE (cache));
+
+	priv = soup_cache_get_instance_private (cache);
+	g_mutex_lock (&priv->mutex);
+	priv->max_memory_size = max_size;
+	memory_tier_make_room (priv, 0);
+	g_mutex_unlock (&priv->mutex);
+}
+
+/**
+ * soup_cache_get_max_memory_size:
+ * @cache: a #SoupCache
+ *
+ * Gets the maximum size of the response bodies that @cache keeps in
+ * memory.
+ *
+ * Returns: the maximum size of the memory tier, in bytes.
+ *
+ * Since: 3.8
+ */
+guint
+soup_cache_get_max_memory_size (SoupCache *cache)
+{
+	SoupCachePrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_CACHE (cache), 0);
+
+	priv = soup_cache_get_instance_private (cache);
+	return priv->max_memory_size;
+}
+
+/**
+ * soup_cache_get_hits:
+ * @cache: a #SoupCache
+ * @tier: a #SoupCacheTier
+ *
+ * Gets the number of responses served from @tier of @cache.
+ *
+ * Returns: the number of hits in @tier
+ *
+ * Since: 3.8
+ */
+guint
+soup_cache_get_hits (SoupCache    *cache,
+		     SoupCacheTier tier)
+{
+	SoupCachePrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_CACHE (cache), 0);
+
+	priv = soup_cache_get_instance_private (cache);
+	switch (tier) {
+	case SOUP_CACHE_TIER_MEMORY:
+		return g_atomic_int_get (&priv->memory_hits);
+	case SOUP_CACHE_TIER_DISK:
+		return g_atomic_int_get (&priv->disk_hits);
+	}
+
+	g_return_val_if_reached (0);
+}
+
+/**
+ * soup_cache_get_misses:
+ * @cache: a #SoupCache
+ * @tier: a #SoupCacheTier
+ *
+ * Gets the number of requests for which @tier of @cache had no
+ * stored response. Misses in the memory tier are either served from
+ * disk or are misses in the disk tier too.
+ *
+ * Returns: the number of misses in @tier
+ *
+ * Since: 3.8
+ */
+guint
+soup_cache_get_misses (SoupCache    *cache,
+		       SoupCacheTier tier)
+{
+	SoupCachePrivate *priv;
+
+	g_return_val_if_fail (SOUP_IS_CACHE (cache), 0);
+
+	priv = soup_cache_get_instance_private (cache);
+	switch (tier) {
+	case SOUP_CACHE_TIER_MEMORY:
+		return g_atomic_int_get (&priv->memory_misses);
+	case SOUP_CACHE_TIER_DISK:
+		return g_atomic_int_get (&priv->disk_misses);
+	}
+
+	g_return_val_if_reached (0);
+}
@@ -42,6 +42,16 @@ typedef enum {
 	SOUP_CACHE_SHARED
 } SoupCacheType;
 
+typedef enum {
+	SOUP_CACHE_EVICTION_LRU,
+	SOUP_CACHE_EVICTION_SEGMENTED_LRU
+} SoupCacheEvictionPolicy;
+
+typedef enum {
+	SOUP_CACHE_TIER_MEMORY,
+	SOUP_CACHE_TIER_DISK
+} SoupCacheTier;
+
 struct _SoupCacheClass {
 	GObjectClass parent_class;
 
@@ -70,4 +80,23 @@ void       soup_cache_set_max_size (SoupCache     *cache,
 SOUP_AVAILABLE_IN_ALL
 guint      soup_cache_get_max_size (SoupCache     *cache);
 
+SOUP_AVAILABLE_IN_3_8
+void                    soup_cache_set_eviction_policy (SoupCache               *cache,
+							SoupCacheEvictionPolicy  policy);
+SOUP_AVAILABLE_IN_3_8
+SoupCacheEvictionPolicy soup_cache_get_eviction_policy (SoupCache               *cache);
+
+SOUP_AVAILABLE_IN_3_8
+void       soup_cache_set_max_memory_size (SoupCache     *cache,
+					   guint          max_size);
+SOUP_AVAILABLE_IN_3_8
+guint      soup_cache_get_max_memory_size (SoupCache     *cache);
+
+SOUP_AVAILABLE_IN_3_8
+guint      soup_cache_get_hits            (SoupCache     *cache,
+					   SoupCacheTier  tier);
+SOUP_AVAILABLE_IN_3_8
+guint      soup_cache_get_misses          (SoupCache     *cache,
+					   SoupCacheTier  tier);
+
 G_END_DECLS
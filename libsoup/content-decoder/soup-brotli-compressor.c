@@ -0,0 +1,132 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-brotli-compressor.c: Brotli GConverter
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <brotli/encode.h>
+#include <gio/gio.h>
+
+#include "soup-brotli-compressor.h"
+
+struct _SoupBrotliCompressor
+{
+	GObject parent_instance;
+	BrotliEncoderState *state;
+	int quality;
+};
+
+static void soup_brotli_compressor_iface_init (GConverterIface *iface);
+
+G_DEFINE_FINAL_TYPE_WITH_CODE (SoupBrotliCompressor, soup_brotli_compressor, G_TYPE_OBJECT,
+                               G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER, soup_brotli_compressor_iface_init))
+
+SoupBrotliCompressor *
+soup_brotli_compressor_new (int quality)
+{
+	SoupBrotliCompressor *self;
+
+	self = g_object_new (SOUP_TYPE_BROTLI_COMPRESSOR, NULL);
+	self->quality = CLAMP (quality, BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY);
+
+	return self;
+}
+
+static GConverterResult
+soup_brotli_compressor_convert (GConverter      *converter,
+				const void      *inbuf,
+				gsize            inbuf_size,
+				void            *outbuf,
+				gsize            outbuf_size,
+				GConverterFlags  flags,
+				gsize           *bytes_read,
+				gsize           *bytes_written,
+				GError         **error)
+{
+	SoupBrotliCompressor *self = SOUP_BROTLI_COMPRESSOR (converter);
+	BrotliEncoderOperation operation;
+	gsize available_in = inbuf_size;
+	const guint8 *next_in = inbuf;
+	gsize available_out = outbuf_size;
+	guint8 *next_out = outbuf;
+
+	if (outbuf_size == 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "SoupBrotliCompressorError: Larger output buffer required");
+		return G_CONVERTER_ERROR;
+	}
+
+	if (self->state == NULL) {
+		self->state = BrotliEncoderCreateInstance (NULL, NULL, NULL);
+		if (self->state == NULL) {
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "SoupBrotliCompressorError: Failed to initialize state");
+			return G_CONVERTER_ERROR;
+		}
+		BrotliEncoderSetParameter (self->state, BROTLI_PARAM_QUALITY, self->quality);
+	}
+
+	if (flags & G_CONVERTER_INPUT_AT_END)
+		operation = BROTLI_OPERATION_FINISH;
+	else if (flags & G_CONVERTER_FLUSH)
+		operation = BROTLI_OPERATION_FLUSH;
+	else
+		operation = BROTLI_OPERATION_PROCESS;
+
+	if (!BrotliEncoderCompressStream (self->state, operation, &available_in, &next_in, &available_out, &next_out, NULL)) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "SoupBrotliCompressorError: Compression failed");
+		return G_CONVERTER_ERROR;
+	}
+
+	/* available_in is now set to *unread* input size */
+	*bytes_read = inbuf_size - available_in;
+	/* available_out is now set to *unwritten* output size */
+	*bytes_written = outbuf_size - available_out;
+
+	if (operation == BROTLI_OPERATION_FINISH && BrotliEncoderIsFinished (self->state))
+		return G_CONVERTER_FINISHED;
+	if (operation == BROTLI_OPERATION_FLUSH && available_in == 0 && !BrotliEncoderHasMoreOutput (self->state))
+		return G_CONVERTER_FLUSHED;
+
+	if (*bytes_read || *bytes_written)
+		return G_CONVERTER_CONVERTED;
+
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "SoupBrotliCompressorError: More input required");
+	return G_CONVERTER_ERROR;
+}
+
+static void
+soup_brotli_compressor_reset (GConverter *converter)
+{
+	SoupBrotliCompressor *self = SOUP_BROTLI_COMPRESSOR (converter);
+
+	g_clear_pointer (&self->state, BrotliEncoderDestroyInstance);
+}
+
+static void
+soup_brotli_compressor_finalize (GObject *object)
+{
+	SoupBrotliCompressor *self = (SoupBrotliCompressor *)object;
+	g_clear_pointer (&self->state, BrotliEncoderDestroyInstance);
+	G_OBJECT_CLASS (soup_brotli_compressor_parent_class)->finalize (object);
+}
+
+static void soup_brotli_compressor_iface_init (GConverterIface *iface)
+{
+	iface->convert = soup_brotli_compressor_convert;
+	iface->reset = soup_brotli_compressor_reset;
+}
+
+static void
+soup_brotli_compressor_class_init (SoupBrotliCompressorClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = soup_brotli_compressor_finalize;
+}
+
+static void
+soup_brotli_compressor_init (SoupBrotliCompressor *self)
+{
+	self->quality = BROTLI_DEFAULT_QUALITY;
+}
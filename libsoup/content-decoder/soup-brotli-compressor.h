@@ -0,0 +1,19 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-brotli-compressor.h: Brotli GConverter
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include "soup-version.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_BROTLI_COMPRESSOR (soup_brotli_compressor_get_type())
+SOUP_AVAILABLE_IN_ALL
+G_DECLARE_FINAL_TYPE (SoupBrotliCompressor, soup_brotli_compressor, SOUP, BROTLI_COMPRESSOR, GObject)
+
+SoupBrotliCompressor *soup_brotli_compressor_new (int quality);
+
+G_END_DECLS
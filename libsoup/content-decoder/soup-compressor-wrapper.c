@@ -0,0 +1,154 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-compressor-wrapper.c: Content-Encoding compressors
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "soup-compressor-wrapper.h"
+#ifdef WITH_BROTLI_ENCODER
+#include "soup-brotli-compressor.h"
+#endif
+#ifdef WITH_ZSTD
+#include "soup-zstd-compressor.h"
+#endif
+
+/* SoupCompressorWrapper is a GConverter that creates the compressor
+ * for a Content-Encoding coding name and forwards to it, keeping
+ * count of the uncompressed bytes it was given. "high_ratio" trades
+ * speed for size, for bodies that are compressed once and sent many
+ * times.
+ */
+
+struct _SoupCompressorWrapper {
+	GObject parent;
+
+	GConverter *base_converter;
+	guint64 bytes_read;
+};
+
+static void soup_compressor_wrapper_iface_init (GConverterIface *iface);
+
+G_DEFINE_FINAL_TYPE_WITH_CODE (SoupCompressorWrapper, soup_compressor_wrapper, G_TYPE_OBJECT,
+			       G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+						      soup_compressor_wrapper_iface_init))
+
+static void
+soup_compressor_wrapper_init (SoupCompressorWrapper *wrapper)
+{
+}
+
+static void
+soup_compressor_wrapper_finalize (GObject *object)
+{
+	SoupCompressorWrapper *wrapper = SOUP_COMPRESSOR_WRAPPER (object);
+
+	g_clear_object (&wrapper->base_converter);
+
+	G_OBJECT_CLASS (soup_compressor_wrapper_parent_class)->finalize (object);
+}
+
+static void
+soup_compressor_wrapper_class_init (SoupCompressorWrapperClass *wrapper_class)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (wrapper_class);
+
+	object_class->finalize = soup_compressor_wrapper_finalize;
+}
+
+gboolean
+soup_compressor_wrapper_supports_coding (const char *coding)
+{
+	if (!g_ascii_strcasecmp (coding, "gzip") ||
+	    !g_ascii_strcasecmp (coding, "deflate"))
+		return TRUE;
+#ifdef WITH_BROTLI_ENCODER
+	if (!g_ascii_strcasecmp (coding, "br"))
+		return TRUE;
+#endif
+#ifdef WITH_ZSTD
+	if (!g_ascii_strcasecmp (coding, "zstd"))
+		return TRUE;
+#endif
+
+	return FALSE;
+}
+
+SoupCompressorWrapper *
+soup_compressor_wrapper_new (const char *coding,
+			     gboolean    high_ratio)
+{
+	SoupCompressorWrapper *wrapper;
+
+	g_return_val_if_fail (soup_compressor_wrapper_supports_coding (coding), NULL);
+
+	wrapper = g_object_new (SOUP_TYPE_COMPRESSOR_WRAPPER, NULL);
+#ifdef WITH_ZSTD
+	if (!g_ascii_strcasecmp (coding, "zstd"))
+		wrapper->base_converter = (GConverter *)soup_zstd_compressor_new (high_ratio ? 12 : 3);
+#endif
+#ifdef WITH_BROTLI_ENCODER
+	if (!g_ascii_strcasecmp (coding, "br"))
+		wrapper->base_converter = (GConverter *)soup_brotli_compressor_new (high_ratio ? 9 : 4);
+#endif
+	if (!g_ascii_strcasecmp (coding, "deflate")) {
+		wrapper->base_converter = (GConverter *)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB,
+									       high_ratio ? 9 : -1);
+	} else if (!wrapper->base_converter) {
+		wrapper->base_converter = (GConverter *)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP,
+									       high_ratio ? 9 : -1);
+	}
+
+	return wrapper;
+}
+
+guint64
+soup_compressor_wrapper_get_bytes_read (SoupCompressorWrapper *wrapper)
+{
+	return wrapper->bytes_read;
+}
+
+static GConverterResult
+soup_compressor_wrapper_convert (GConverter      *converter,
+				 const void      *inbuf,
+				 gsize            inbuf_size,
+				 void            *outbuf,
+				 gsize            outbuf_size,
+				 GConverterFlags  flags,
+				 gsize           *bytes_read,
+				 gsize           *bytes_written,
+				 GError         **error)
+{
+	SoupCompressorWrapper *wrapper = SOUP_COMPRESSOR_WRAPPER (converter);
+	GConverterResult result;
+
+	result = g_converter_convert (wrapper->base_converter,
+				      inbuf, inbuf_size,
+				      outbuf, outbuf_size,
+				      flags, bytes_read, bytes_written,
+				      error);
+	if (result != G_CONVERTER_ERROR)
+		wrapper->bytes_read += *bytes_read;
+
+	return result;
+}
+
+static void
+soup_compressor_wrapper_reset (GConverter *converter)
+{
+	SoupCompressorWrapper *wrapper = SOUP_COMPRESSOR_WRAPPER (converter);
+
+	g_converter_reset (wrapper->base_converter);
+	wrapper->bytes_read = 0;
+}
+
+static void
+soup_compressor_wrapper_iface_init (GConverterIface *iface)
+{
+	iface->convert = soup_compressor_wrapper_convert;
+	iface->reset = soup_compressor_wrapper_reset;
+}
@@ -0,0 +1,22 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-compressor-wrapper.h: Content-Encoding compressors
+ */
+
+#pragma once
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_COMPRESSOR_WRAPPER (soup_compressor_wrapper_get_type ())
+G_DECLARE_FINAL_TYPE (SoupCompressorWrapper, soup_compressor_wrapper, SOUP, COMPRESSOR_WRAPPER, GObject)
+
+gboolean               soup_compressor_wrapper_supports_coding (const char            *coding);
+
+SoupCompressorWrapper *soup_compressor_wrapper_new             (const char            *coding,
+								gboolean               high_ratio);
+
+guint64                soup_compressor_wrapper_get_bytes_read  (SoupCompressorWrapper *wrapper);
+
+G_END_DECLS
@@ -19,6 +19,9 @@
 #ifdef WITH_BROTLI
 #include "soup-brotli-decompressor.h"
 #endif
+#ifdef WITH_ZSTD
+#include "soup-zstd-decompressor.h"
+#endif
 
 /**
  * SoupContentDecoder:
@@ -27,8 +30,8 @@
  *
  * #SoupContentDecoder handles adding the "Accept-Encoding" header on
  * outgoing messages, and processing the "Content-Encoding" header on
- * incoming ones. Currently it supports the "gzip", "deflate", and "br"
- * content codings.
+ * incoming ones. Currently it supports the "gzip", "deflate", "br" and
+ * "zstd" content codings.
  *
  * A #SoupContentDecoder will automatically be
  * added to the session by default. (You can use
@@ -44,21 +47,44 @@
  * #SoupContentDecoder doesn't recognize, then none of the encodings
  * will be decoded.
  *
- * (Note that currently there is no way to (automatically) use
- * Content-Encoding when sending a request body, or to pick specific
- * encoding types to support.)
+ * Decoders are reused across responses once the message that was
+ * using them is done, so a session receiving many small compressed
+ * responses does not set up new decompression state for each one.
+ *
+ * (Note that currently there is no way to pick specific encoding types
+ * to support. To compress request bodies, see
+ * [method@Message.set_request_body_encoding].)
  **/
 
 struct _SoupContentDecoder {
 	GObject parent;
 };
 
+typedef GConverter * (*SoupContentDecoderCreator) (void);
+
+/* Decoders are reset and kept once the response they were decoding is
+ * done with them, so that the next responses do not have to allocate
+ * the decompression state again. The pool outlives the feature while
+ * response streams still hold decoders from it.
+ */
+#define DECODER_POOL_MAX_IDLE 4
+
+typedef struct {
+	GMutex mutex;
+	GHashTable *idle; /* SoupContentDecoderCreator -> GSList of GConverter */
+} SoupDecoderPool;
+
+typedef struct {
+	SoupDecoderPool *pool;
+	SoupContentDecoderCreator creator;
+	GConverter *converter;
+} SoupPooledDecoder;
+
 typedef struct {
 	GHashTable *decoders;
+	SoupDecoderPool *pool;
 } SoupContentDecoderPrivate;
 
-typedef GConverter * (*SoupContentDecoderCreator) (void);
-
 static void soup_content_decoder_session_feature_init (SoupSessionFeatureInterface *feature_interface, gpointer interface_data);
 
 static SoupContentProcessorInterface *soup_content_decoder_default_content_processor_interface;
@@ -72,6 +98,72 @@ G_DEFINE_FINAL_TYPE_WITH_CODE (SoupContentDecoder, soup_content_decoder, G_TYPE_
 			       G_IMPLEMENT_INTERFACE (SOUP_TYPE_CONTENT_PROCESSOR,
 						      soup_content_decoder_content_processor_init))
 
+static void
+decoder_pool_clear (SoupDecoderPool *pool)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init (&iter, pool->idle);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		g_slist_free_full (value, g_object_unref);
+	g_hash_table_destroy (pool->idle);
+	g_mutex_clear (&pool->mutex);
+}
+
+static SoupDecoderPool *
+decoder_pool_new (void)
+{
+	SoupDecoderPool *pool;
+
+	pool = g_atomic_rc_box_new0 (SoupDecoderPool);
+	g_mutex_init (&pool->mutex);
+	pool->idle = g_hash_table_new (NULL, NULL);
+
+	return pool;
+}
+
+static GConverter *
+decoder_pool_borrow (SoupDecoderPool           *pool,
+		     SoupContentDecoderCreator  creator)
+{
+	GConverter *converter = NULL;
+	GSList *idle;
+
+	g_mutex_lock (&pool->mutex);
+	idle = g_hash_table_lookup (pool->idle, creator);
+	if (idle) {
+		converter = idle->data;
+		g_hash_table_insert (pool->idle, creator, g_slist_delete_link (idle, idle));
+	}
+	g_mutex_unlock (&pool->mutex);
+
+	return converter ? converter : creator ();
+}
+
+static void
+decoder_pool_return (gpointer  data,
+		     GObject  *where_the_wrapper_was)
+{
+	SoupPooledDecoder *pooled = data;
+	SoupDecoderPool *pool = pooled->pool;
+	GSList *idle;
+
+	g_converter_reset (pooled->converter);
+
+	g_mutex_lock (&pool->mutex);
+	idle = g_hash_table_lookup (pool->idle, pooled->creator);
+	if (g_slist_length (idle) < DECODER_POOL_MAX_IDLE) {
+		g_hash_table_insert (pool->idle, pooled->creator,
+				     g_slist_prepend (idle, g_steal_pointer (&pooled->converter)));
+	}
+	g_mutex_unlock (&pool->mutex);
+
+	g_clear_object (&pooled->converter);
+	g_atomic_rc_box_release_full (pool, (GDestroyNotify)decoder_pool_clear);
+	g_free (pooled);
+}
+
 static GSList *
 soup_content_decoder_get_decoders_for_msg (SoupContentDecoder *decoder, SoupMessage *msg)
 {
@@ -79,7 +171,6 @@ soup_content_decoder_get_decoders_for_msg (SoupContentDecoder *decoder, SoupMess
 	const char *header;
 	GSList *encodings, *e, *decoders = NULL;
 	SoupContentDecoderCreator converter_creator;
-	GConverter *converter;
 
 	header = soup_message_headers_get_list_common (soup_message_get_response_headers (msg),
                                                        SOUP_HEADER_CONTENT_ENCODING);
@@ -113,14 +204,13 @@ soup_content_decoder_get_decoders_for_msg (SoupContentDecoder *decoder, SoupMess
 
 	for (e = encodings; e; e = e->next) {
 		converter_creator = g_hash_table_lookup (priv->decoders, e->data);
-		converter = converter_creator ();
 
 		/* Content-Encoding lists the codings in the order
 		 * they were applied in, so we put decoders in reverse
 		 * order so the last-applied will be the first
 		 * decoded.
 		 */
-		decoders = g_slist_prepend (decoders, converter);
+		decoders = g_slist_prepend (decoders, converter_creator);
 	}
 	soup_header_free_list (encodings);
 
@@ -133,6 +223,7 @@ soup_content_decoder_content_processor_wrap_input (SoupContentProcessor *process
 						   SoupMessage *msg,
 						   GError **error)
 {
+        SoupContentDecoderPrivate *priv = soup_content_decoder_get_instance_private (SOUP_CONTENT_DECODER (processor));
 	GSList *decoders, *d;
 	GInputStream *istream;
 
@@ -142,11 +233,17 @@ soup_content_decoder_content_processor_wrap_input (SoupContentProcessor *process
 
 	istream = g_object_ref (base_stream);
 	for (d = decoders; d; d = d->next) {
-		GConverter *decoder, *wrapper;
+		GConverter *wrapper;
 		GInputStream *filter;
+		SoupPooledDecoder *pooled;
+
+		pooled = g_new (SoupPooledDecoder, 1);
+		pooled->pool = g_atomic_rc_box_acquire (priv->pool);
+		pooled->creator = d->data;
+		pooled->converter = decoder_pool_borrow (priv->pool, pooled->creator);
 
-		decoder = d->data;
-		wrapper = soup_converter_wrapper_new (decoder, msg);
+		wrapper = soup_converter_wrapper_new (pooled->converter, msg);
+		g_object_weak_ref (G_OBJECT (wrapper), decoder_pool_return, pooled);
 		filter = g_object_new (G_TYPE_CONVERTER_INPUT_STREAM,
 				       "base-stream", istream,
 				       "converter", wrapper,
@@ -156,7 +253,7 @@ soup_content_decoder_content_processor_wrap_input (SoupContentProcessor *process
 		istream = filter;
 	}
 
-	g_slist_free_full (decoders, g_object_unref);
+	g_slist_free (decoders);
 
 	return istream;
 }
@@ -192,12 +289,21 @@ brotli_decoder_creator (void)
 }
 #endif
 
+#ifdef WITH_ZSTD
+static GConverter *
+zstd_decoder_creator (void)
+{
+	return (GConverter *)soup_zstd_decompressor_new ();
+}
+#endif
+
 static void
 soup_content_decoder_init (SoupContentDecoder *decoder)
 {
         SoupContentDecoderPrivate *priv = soup_content_decoder_get_instance_private (decoder);
 
 	priv->decoders = g_hash_table_new (g_str_hash, g_str_equal);
+	priv->pool = decoder_pool_new ();
 	/* Hardcoded for now */
 	g_hash_table_insert (priv->decoders, "gzip",
 			     gzip_decoder_creator);
@@ -209,6 +315,10 @@ soup_content_decoder_init (SoupContentDecoder *decoder)
 	g_hash_table_insert (priv->decoders, "br",
 			     brotli_decoder_creator);
 #endif
+#ifdef WITH_ZSTD
+	g_hash_table_insert (priv->decoders, "zstd",
+			     zstd_decoder_creator);
+#endif
 }
 
 static void
@@ -218,6 +328,7 @@ soup_content_decoder_finalize (GObject *object)
         SoupContentDecoderPrivate *priv = soup_content_decoder_get_instance_private (decoder);
 
 	g_hash_table_destroy (priv->decoders);
+	g_atomic_rc_box_release_full (priv->pool, (GDestroyNotify)decoder_pool_clear);
 
 	G_OBJECT_CLASS (soup_content_decoder_parent_class)->finalize (object);
 }
@@ -238,14 +349,21 @@ soup_content_decoder_request_queued (SoupSessionFeature *feature,
                                                   SOUP_HEADER_ACCEPT_ENCODING)) {
                 const char *header = "gzip, deflate";
 
-#ifdef WITH_BROTLI
-                /* brotli is only enabled over TLS connections
+#if defined(WITH_BROTLI) || defined(WITH_ZSTD)
+                /* brotli and zstd are only enabled over TLS connections
                  * as other browsers have found that some networks have expectations
                  * regarding the encoding of HTTP messages and this may break those
                  * expectations. Firefox and Chromium behave similarly.
                  */
-                if (soup_uri_is_https (soup_message_get_uri (msg)))
+                if (soup_uri_is_https (soup_message_get_uri (msg))) {
+#if defined(WITH_BROTLI) && defined(WITH_ZSTD)
+                        header = "gzip, deflate, br, zstd";
+#elif defined(WITH_BROTLI)
                         header = "gzip, deflate, br";
+#else
+                        header = "gzip, deflate, zstd";
+#endif
+                }
 #endif
 
 		soup_message_headers_append_common (soup_message_get_request_headers (msg),
@@ -0,0 +1,138 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-zstd-compressor.c: Zstandard GConverter
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <zstd.h>
+#include <gio/gio.h>
+
+#include "soup-zstd-compressor.h"
+
+/* Levels above 19 use windows larger than the 8 MB that RFC 9659
+ * allows HTTP recipients to refuse.
+ */
+#define SOUP_ZSTD_LEVEL_MAX 19
+
+struct _SoupZstdCompressor
+{
+	GObject parent_instance;
+	ZSTD_CStream *stream;
+	int level;
+};
+
+static void soup_zstd_compressor_iface_init (GConverterIface *iface);
+
+G_DEFINE_FINAL_TYPE_WITH_CODE (SoupZstdCompressor, soup_zstd_compressor, G_TYPE_OBJECT,
+                               G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER, soup_zstd_compressor_iface_init))
+
+SoupZstdCompressor *
+soup_zstd_compressor_new (int level)
+{
+	SoupZstdCompressor *self;
+
+	self = g_object_new (SOUP_TYPE_ZSTD_COMPRESSOR, NULL);
+	self->level = MIN (level, SOUP_ZSTD_LEVEL_MAX);
+
+	return self;
+}
+
+static GConverterResult
+soup_zstd_compressor_convert (GConverter      *converter,
+			      const void      *inbuf,
+			      gsize            inbuf_size,
+			      void            *outbuf,
+			      gsize            outbuf_size,
+			      GConverterFlags  flags,
+			      gsize           *bytes_read,
+			      gsize           *bytes_written,
+			      GError         **error)
+{
+	SoupZstdCompressor *self = SOUP_ZSTD_COMPRESSOR (converter);
+	ZSTD_inBuffer input = { inbuf, inbuf_size, 0 };
+	ZSTD_outBuffer output = { outbuf, outbuf_size, 0 };
+	ZSTD_EndDirective directive;
+	size_t remaining;
+
+	if (outbuf_size == 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "SoupZstdCompressorError: Larger output buffer required");
+		return G_CONVERTER_ERROR;
+	}
+
+	if (self->stream == NULL) {
+		self->stream = ZSTD_createCStream ();
+		if (self->stream == NULL) {
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "SoupZstdCompressorError: Failed to initialize state");
+			return G_CONVERTER_ERROR;
+		}
+		ZSTD_CCtx_setParameter (self->stream, ZSTD_c_compressionLevel, self->level);
+	}
+
+	if (flags & G_CONVERTER_INPUT_AT_END)
+		directive = ZSTD_e_end;
+	else if (flags & G_CONVERTER_FLUSH)
+		directive = ZSTD_e_flush;
+	else
+		directive = ZSTD_e_continue;
+
+	remaining = ZSTD_compressStream2 (self->stream, &output, &input, directive);
+	if (ZSTD_isError (remaining)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "SoupZstdCompressorError: %s", ZSTD_getErrorName (remaining));
+		return G_CONVERTER_ERROR;
+	}
+
+	*bytes_read = input.pos;
+	*bytes_written = output.pos;
+
+	if (remaining == 0 && input.pos == input.size) {
+		if (directive == ZSTD_e_end)
+			return G_CONVERTER_FINISHED;
+		if (directive == ZSTD_e_flush)
+			return G_CONVERTER_FLUSHED;
+	}
+
+	if (*bytes_read || *bytes_written)
+		return G_CONVERTER_CONVERTED;
+
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "SoupZstdCompressorError: More input required");
+	return G_CONVERTER_ERROR;
+}
+
+static void
+soup_zstd_compressor_reset (GConverter *converter)
+{
+	SoupZstdCompressor *self = SOUP_ZSTD_COMPRESSOR (converter);
+
+	if (self->stream)
+		ZSTD_CCtx_reset (self->stream, ZSTD_reset_session_only);
+}
+
+static void
+soup_zstd_compressor_finalize (GObject *object)
+{
+	SoupZstdCompressor *self = (SoupZstdCompressor *)object;
+	g_clear_pointer (&self->stream, ZSTD_freeCStream);
+	G_OBJECT_CLASS (soup_zstd_compressor_parent_class)->finalize (object);
+}
+
+static void soup_zstd_compressor_iface_init (GConverterIface *iface)
+{
+	iface->convert = soup_zstd_compressor_convert;
+	iface->reset = soup_zstd_compressor_reset;
+}
+
+static void
+soup_zstd_compressor_class_init (SoupZstdCompressorClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = soup_zstd_compressor_finalize;
+}
+
+static void
+soup_zstd_compressor_init (SoupZstdCompressor *self)
+{
+	self->level = ZSTD_CLEVEL_DEFAULT;
+}
@@ -0,0 +1,19 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-zstd-compressor.h: Zstandard GConverter
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include "soup-version.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_ZSTD_COMPRESSOR (soup_zstd_compressor_get_type())
+SOUP_AVAILABLE_IN_ALL
+G_DECLARE_FINAL_TYPE (SoupZstdCompressor, soup_zstd_compressor, SOUP, ZSTD_COMPRESSOR, GObject)
+
+SoupZstdCompressor *soup_zstd_compressor_new (int level);
+
+G_END_DECLS
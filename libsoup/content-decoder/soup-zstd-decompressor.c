@@ -0,0 +1,191 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-zstd-decompressor.c: Zstandard GConverter
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <zstd.h>
+#include <zstd_errors.h>
+#include <gio/gio.h>
+
+#include "soup-zstd-decompressor.h"
+
+/* RFC 9659: HTTP senders must not use a window larger than 8 MB, and
+ * recipients may refuse larger windows. Enforcing that bounds the
+ * decoder's memory regardless of the size of the frames.
+ */
+#define SOUP_ZSTD_WINDOW_LOG_MAX 23
+
+struct _SoupZstdDecompressor
+{
+	GObject parent_instance;
+	ZSTD_DStream *stream;
+	gboolean frame_finished;
+	GError *last_error;
+};
+
+static void soup_zstd_decompressor_iface_init (GConverterIface *iface);
+
+G_DEFINE_FINAL_TYPE_WITH_CODE (SoupZstdDecompressor, soup_zstd_decompressor, G_TYPE_OBJECT,
+                               G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER, soup_zstd_decompressor_iface_init))
+
+SoupZstdDecompressor *
+soup_zstd_decompressor_new (void)
+{
+	return g_object_new (SOUP_TYPE_ZSTD_DECOMPRESSOR, NULL);
+}
+
+static GError *
+soup_zstd_decompressor_create_error (size_t result)
+{
+	int code;
+
+	/* NOTE: all error domains/codes must match GZlibDecompressor,
+	 * in particular corrupt data must be G_IO_ERROR_INVALID_DATA.
+	 */
+	switch (ZSTD_getErrorCode (result)) {
+	case ZSTD_error_memory_allocation:
+	case ZSTD_error_frameParameter_windowTooLarge:
+		code = G_IO_ERROR_FAILED;
+		break;
+	default:
+		code = G_IO_ERROR_INVALID_DATA;
+		break;
+	}
+
+	return g_error_new (G_IO_ERROR, code, "SoupZstdDecompressorError: %s", ZSTD_getErrorName (result));
+}
+
+static GConverterResult
+soup_zstd_decompressor_convert (GConverter      *converter,
+				const void      *inbuf,
+				gsize            inbuf_size,
+				void            *outbuf,
+				gsize            outbuf_size,
+				GConverterFlags  flags,
+				gsize           *bytes_read,
+				gsize           *bytes_written,
+				GError         **error)
+{
+	SoupZstdDecompressor *self = SOUP_ZSTD_DECOMPRESSOR (converter);
+	ZSTD_inBuffer input = { inbuf, inbuf_size, 0 };
+	ZSTD_outBuffer output = { outbuf, outbuf_size, 0 };
+	size_t result;
+
+	g_return_val_if_fail (inbuf, G_CONVERTER_ERROR);
+
+	if (self->last_error) {
+		g_propagate_error (error, g_steal_pointer (&self->last_error));
+		return G_CONVERTER_ERROR;
+	}
+
+	if (outbuf_size == 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "SoupZstdDecompressorError: Larger output buffer required");
+		return G_CONVERTER_ERROR;
+	}
+
+	if (self->stream == NULL) {
+		self->stream = ZSTD_createDStream ();
+		if (self->stream == NULL) {
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "SoupZstdDecompressorError: Failed to initialize state");
+			return G_CONVERTER_ERROR;
+		}
+		ZSTD_DCtx_setParameter (self->stream, ZSTD_d_windowLogMax, SOUP_ZSTD_WINDOW_LOG_MAX);
+	}
+
+	/* A single call stops at the end of each frame, so keep going
+	 * to decode concatenated frames in one conversion.
+	 */
+	do {
+		gsize last_in = input.pos, last_out = output.pos;
+
+		result = ZSTD_decompressStream (self->stream, &output, &input);
+		if (ZSTD_isError (result))
+			break;
+
+		self->frame_finished = result == 0;
+		if (input.pos == last_in && output.pos == last_out)
+			break;
+	} while (input.pos < input.size && output.pos < output.size);
+
+	*bytes_read = input.pos;
+	*bytes_written = output.pos;
+
+	if (ZSTD_isError (result)) {
+		GError *result_error = soup_zstd_decompressor_create_error (result);
+
+		/* As per API docs: If any data was produced, and then an error happens, then only the successful
+		 * conversion is reported and the error is returned on the next call. Input that was only buffered
+		 * is dropped with the error, so that SoupConverterWrapper can still fall back to passing the
+		 * body through when it was not zstd at all. */
+		if (*bytes_written) {
+			self->last_error = result_error;
+			return G_CONVERTER_CONVERTED;
+		}
+
+		g_propagate_error (error, result_error);
+		return G_CONVERTER_ERROR;
+	}
+
+	if (self->frame_finished && input.pos == input.size && (flags & G_CONVERTER_INPUT_AT_END))
+		return G_CONVERTER_FINISHED;
+
+	if (*bytes_read || *bytes_written)
+		return G_CONVERTER_CONVERTED;
+
+	if (flags & G_CONVERTER_FLUSH)
+		return G_CONVERTER_FLUSHED;
+
+	if (self->frame_finished && !(flags & G_CONVERTER_INPUT_AT_END)) {
+		/* Between frames: wait for the next one or the end of input */
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "SoupZstdDecompressorError: More input required");
+		return G_CONVERTER_ERROR;
+	}
+
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "SoupZstdDecompressorError: More input required (corrupt input)");
+	return G_CONVERTER_ERROR;
+}
+
+static void
+soup_zstd_decompressor_reset (GConverter *converter)
+{
+	SoupZstdDecompressor *self = SOUP_ZSTD_DECOMPRESSOR (converter);
+
+	/* Keeps the decoding context and its parameters, only
+	 * the frame state is dropped.
+	 */
+	if (self->stream)
+		ZSTD_DCtx_reset (self->stream, ZSTD_reset_session_only);
+	self->frame_finished = FALSE;
+	g_clear_error (&self->last_error);
+}
+
+static void
+soup_zstd_decompressor_finalize (GObject *object)
+{
+	SoupZstdDecompressor *self = (SoupZstdDecompressor *)object;
+	g_clear_pointer (&self->stream, ZSTD_freeDStream);
+	g_clear_error (&self->last_error);
+	G_OBJECT_CLASS (soup_zstd_decompressor_parent_class)->finalize (object);
+}
+
+static void soup_zstd_decompressor_iface_init (GConverterIface *iface)
+{
+	iface->convert = soup_zstd_decompressor_convert;
+	iface->reset = soup_zstd_decompressor_reset;
+}
+
+static void
+soup_zstd_decompressor_class_init (SoupZstdDecompressorClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = soup_zstd_decompressor_finalize;
+}
+
+static void
+soup_zstd_decompressor_init (SoupZstdDecompressor *self)
+{
+}
@@ -0,0 +1,19 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-zstd-decompressor.h: Zstandard GConverter
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include "soup-version.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_ZSTD_DECOMPRESSOR (soup_zstd_decompressor_get_type())
+SOUP_AVAILABLE_IN_ALL
+G_DECLARE_FINAL_TYPE (SoupZstdDecompressor, soup_zstd_decompressor, SOUP, ZSTD_DECOMPRESSOR, GObject)
+
+SoupZstdDecompressor *soup_zstd_decompressor_new (void);
+
+G_END_DECLS
@@ -88,38 +88,153 @@ typedef struct {
 	const char   *sniffed_type;
 } SoupContentSnifferMediaPattern;
 
-static char*
-sniff_media (SoupContentSniffer *sniffer,
-	     GBytes *buffer,
-	     SoupContentSnifferMediaPattern table[],
-	     int table_length)
+/* A signature row, as compiled from the tables below */
+typedef struct {
+	const guchar *mask;
+	const guchar *pattern;
+	guint         pattern_length;
+	const char   *sniffed_type;
+	gboolean      scriptable;
+	gboolean      has_ws;
+	gboolean      has_tag_termination;
+} SoupContentSnifferRow;
+
+/* The rows of one or more tables grouped by the byte their pattern can
+ * start with, keeping the order of the tables within each group. The
+ * rows that can match a resource starting with byte @b are
+ * rows[offsets[b]] to rows[offsets[b + 1] - 1], so the cost of a sniff
+ * no longer depends on the total number of signatures.
+ */
+typedef struct {
+	guint16                offsets[257];
+	SoupContentSnifferRow *rows;
+} SoupContentSnifferDispatch;
+
+static SoupContentSnifferDispatch image_dispatch;
+static SoupContentSnifferDispatch audio_video_dispatch;
+static SoupContentSnifferDispatch unknown_dispatch;
+static SoupContentSnifferDispatch tag_dispatch;
+
+static void
+dispatch_build (SoupContentSnifferDispatch *dispatch,
+		GArray                     *rows)
 {
+	GArray *sorted;
+	guint b, i;
 
-        gsize resource_length;
-        const guchar *resource = g_bytes_get_data (buffer, &resource_length);
-        resource_length = MIN (512, resource_length);
-	int i;
+	sorted = g_array_new (FALSE, FALSE, sizeof (SoupContentSnifferRow));
+	for (b = 0; b < 256; b++) {
+		dispatch->offsets[b] = sorted->len;
 
-	for (i = 0; i < table_length; i++) {
-		SoupContentSnifferMediaPattern *type_row = &(table[i]);
-		guint j;
+		for (i = 0; i < rows->len; i++) {
+			SoupContentSnifferRow *row = &g_array_index (rows, SoupContentSnifferRow, i);
+
+			if ((row->mask[0] & b) == row->pattern[0])
+				g_array_append_val (sorted, *row);
+		}
+	}
+	dispatch->offsets[256] = sorted->len;
+	g_assert (sorted->len <= G_MAXUINT16);
 
-		if (resource_length < type_row->pattern_length)
+	dispatch->rows = (SoupContentSnifferRow *)g_array_free (sorted, FALSE);
+}
+
+#define LOOKS_LIKE_WS(c) ((c) == '\x09' || (c) == '\x0a' || (c) == '\x0c' || (c) == '\x0d' || (c) == '\x20')
+
+/* Spaces in the pattern of a has_ws row match any amount of white
+ * space. Sets *@end to the length of the matched data.
+ */
+static gboolean
+match_ws_row (const SoupContentSnifferRow *row,
+	      const guchar                *resource,
+	      gsize                        resource_length,
+	      gsize                       *end)
+{
+	gsize index_stream = 0;
+	guint index_pattern = 0;
+
+	while (index_pattern < row->pattern_length) {
+		if (index_stream >= resource_length)
+			return FALSE;
+
+		if (row->pattern[index_pattern] == ' ') {
+			if (LOOKS_LIKE_WS (resource[index_stream]))
+				index_stream++;
+			else
+				index_pattern++;
+		} else {
+			if ((row->mask[index_pattern] & resource[index_stream]) != row->pattern[index_pattern])
+				return FALSE;
+			index_pattern++;
+			index_stream++;
+		}
+	}
+
+	*end = index_stream;
+	return TRUE;
+}
+
+static const SoupContentSnifferRow *
+dispatch_match (const SoupContentSnifferDispatch *dispatch,
+		const guchar                     *resource,
+		gsize                             resource_length,
+		gboolean                          sniff_scriptable)
+{
+	guint i;
+
+	if (resource_length == 0)
+		return NULL;
+
+	for (i = dispatch->offsets[resource[0]]; i < dispatch->offsets[resource[0] + 1]; i++) {
+		const SoupContentSnifferRow *row = &dispatch->rows[i];
+		gsize end;
+
+		if (!sniff_scriptable && row->scriptable)
 			continue;
 
-		for (j = 0; j < type_row->pattern_length; j++) {
-			if ((type_row->mask[j] & resource[j]) != type_row->pattern[j])
-				break;
+		if (row->has_ws) {
+			if (!match_ws_row (row, resource, resource_length, &end))
+				continue;
+		} else {
+			if (resource_length < row->pattern_length)
+				continue;
+
+			/* The first byte is known to match */
+			for (end = 1; end < row->pattern_length; end++) {
+				if ((row->mask[end] & resource[end]) != row->pattern[end])
+					break;
+			}
+
+			if (end < row->pattern_length)
+				continue;
 		}
 
-		/* This means our comparison above matched completely */
-		if (j == type_row->pattern_length)
-			return g_strdup (type_row->sniffed_type);
+		if (row->has_tag_termination &&
+		    (end == resource_length ||
+		     (resource[end] != '\x20' && resource[end] != '\x3E')))
+			continue;
+
+		return row;
 	}
 
 	return NULL;
 }
 
+static char*
+sniff_media (SoupContentSniffer *sniffer,
+	     GBytes *buffer,
+	     const SoupContentSnifferDispatch *dispatch)
+{
+        gsize resource_length;
+        const guchar *resource = g_bytes_get_data (buffer, &resource_length);
+	const SoupContentSnifferRow *row;
+
+        resource_length = MIN (512, resource_length);
+	row = dispatch_match (dispatch, resource, resource_length, TRUE);
+
+	return row ? g_strdup (row->sniffed_type) : NULL;
+}
+
 /* This table is based on the MIMESNIFF spec;
  * See 6.1 Matching an image type pattern
  */
@@ -176,10 +291,7 @@ static SoupContentSnifferMediaPattern image_types_table[] = {
 static char*
 sniff_images (SoupContentSniffer *sniffer, GBytes *buffer)
 {
-	return sniff_media (sniffer,
-			    buffer,
-			    image_types_table,
-			    G_N_ELEMENTS (image_types_table));
+	return sniff_media (sniffer, buffer, &image_dispatch);
 }
 
 /* This table is based on the MIMESNIFF spec;
@@ -231,10 +343,12 @@ static SoupContentSnifferMediaPattern audio_video_types_table[] = {
 static gboolean
 data_has_prefix (const char *data, const char *prefix, gsize max_length)
 {
-        if (strlen (prefix) > max_length)
+        gsize prefix_length = strlen (prefix);
+
+        if (prefix_length > max_length)
                 return FALSE;
 
-        return memcmp (data, prefix, strlen (prefix)) == 0;
+        return memcmp (data, prefix, prefix_length) == 0;
 }
 
 static gboolean
@@ -275,10 +389,7 @@ sniff_audio_video (SoupContentSniffer *sniffer, GBytes *buffer)
 {
 	char *sniffed_type;
 
-	sniffed_type = sniff_media (sniffer,
-				    buffer,
-				    audio_video_types_table,
-				    G_N_ELEMENTS (audio_video_types_table));
+	sniffed_type = sniff_media (sniffer, buffer, &audio_video_dispatch);
 
 	if (sniffed_type != NULL)
 		return sniffed_type;
@@ -499,97 +610,155 @@ static char byte_looks_binary[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* 0xF0 - 0xFF */
 };
 
+/* Whether any of the @length bytes at @data looks binary. Only bytes
+ * below 0x20 can, so this looks at a whole word at a time and only
+ * checks individual bytes in the words that have such a byte.
+ */
+static gboolean
+data_looks_binary (const guchar *data, gsize length)
+{
+	const guint64 ones = G_GUINT64_CONSTANT (0x0101010101010101);
+	const guint64 highs = G_GUINT64_CONSTANT (0x8080808080808080);
+	gsize i = 0, j;
+
+	for (; i + sizeof (guint64) <= length; i += sizeof (guint64)) {
+		guint64 word;
+
+		memcpy (&word, data + i, sizeof (word));
+		/* Has a byte below 0x20 */
+		if (((word - ones * 0x20) & ~word & highs) == 0)
+			continue;
+
+		for (j = i; j < i + sizeof (guint64); j++) {
+			if (byte_looks_binary[data[j]])
+				return TRUE;
+		}
+	}
+
+	for (; i < length; i++) {
+		if (byte_looks_binary[data[i]])
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 /* HTML5: 2.7.4 Content-Type sniffing: unknown type */
 static char*
 sniff_unknown (SoupContentSniffer *sniffer, GBytes *buffer,
 	       gboolean sniff_scriptable)
 {
-	char *sniffed_type = NULL;
 	gsize resource_length;
 	const guchar *resource = g_bytes_get_data (buffer, &resource_length);
-	resource_length = MIN (512, resource_length);
-	guint i;
+	const SoupContentSnifferRow *row;
+	gsize pos;
 
+	resource_length = MIN (512, resource_length);
         if (resource_length == 0)
                 return g_strdup ("text/plain");
 
-	for (i = 0; i < G_N_ELEMENTS (types_table); i++) {
-		SoupContentSnifferPattern *type_row = &(types_table[i]);
+	/* The rows with insignificant leading white space (all of
+	 * them scriptable), which come first in types_table.
+	 */
+	if (sniff_scriptable) {
+		for (pos = 0; pos < resource_length && LOOKS_LIKE_WS (resource[pos]); pos++)
+			;
+
+		row = dispatch_match (&tag_dispatch, resource + pos,
+				      resource_length - pos, TRUE);
+		if (row)
+			return g_strdup (row->sniffed_type);
+	}
 
-		if (!sniff_scriptable && type_row->scriptable)
-			continue;
+	/* The rest of types_table, then the image and the audio and
+	 * video tables.
+	 */
+	row = dispatch_match (&unknown_dispatch, resource, resource_length,
+			      sniff_scriptable);
+	if (row)
+		return g_strdup (row->sniffed_type);
 
-		if (type_row->has_ws) {
-			guint index_stream = 0;
-			guint index_pattern = 0;
-			gboolean skip_row = FALSE;
-
-			while ((index_stream < resource_length) &&
-			       (index_pattern <= type_row->pattern_length)) {
-				/* Skip insignificant white space ("WS" in the spec) */
-				if (type_row->pattern[index_pattern] == ' ') {
-					if (resource[index_stream] == '\x09' ||
-					    resource[index_stream] == '\x0a' ||
-					    resource[index_stream] == '\x0c' ||
-					    resource[index_stream] == '\x0d' ||
-					    resource[index_stream] == '\x20')
-						index_stream++;
-					else
-						index_pattern++;
-				} else {
-					if ((type_row->mask[index_pattern] & resource[index_stream]) != type_row->pattern[index_pattern]) {
-						skip_row = TRUE;
-						break;
-					}
-					index_pattern++;
-					index_stream++;
-				}
-			}
+	if (sniff_mp4 (sniffer, buffer))
+		return g_strdup ("video/mp4");
 
-			if (skip_row)
-				continue;
+	if (data_looks_binary (resource, resource_length))
+		return g_strdup ("application/octet-stream");
 
-			if (index_pattern > type_row->pattern_length) {
-				if (type_row->has_tag_termination &&
-				    resource[index_stream] != '\x20' &&
-				    resource[index_stream] != '\x3E')
-					continue;
+	return g_strdup ("text/plain");
+}
 
-				return g_strdup (type_row->sniffed_type);
-			}
-		} else {
-			guint j;
+static void
+add_media_rows (GArray                               *rows,
+		const SoupContentSnifferMediaPattern *table,
+		guint                                 table_length)
+{
+	guint i;
 
-			if (resource_length < type_row->pattern_length)
-				continue;
+	for (i = 0; i < table_length; i++) {
+		SoupContentSnifferRow row = {
+			table[i].mask, table[i].pattern, table[i].pattern_length,
+			table[i].sniffed_type, FALSE, FALSE, FALSE
+		};
 
-			for (j = 0; j < type_row->pattern_length; j++) {
-				if ((type_row->mask[j] & resource[j]) != type_row->pattern[j])
-					break;
-			}
+		g_array_append_val (rows, row);
+	}
+}
+
+static void
+add_type_rows (GArray   *rows,
+	       gboolean  has_ws)
+{
+	guint i;
 
-			/* This means our comparison above matched completely */
-			if (j == type_row->pattern_length)
-				return g_strdup (type_row->sniffed_type);
+	for (i = 0; i < G_N_ELEMENTS (types_table); i++) {
+		const SoupContentSnifferPattern *type_row = &types_table[i];
+		SoupContentSnifferRow row = {
+			type_row->mask, type_row->pattern, type_row->pattern_length,
+			type_row->sniffed_type, type_row->scriptable,
+			type_row->has_ws, type_row->has_tag_termination
+		};
+
+		if (type_row->has_ws != has_ws)
+			continue;
+
+		if (has_ws) {
+			/* The leading space only stands for the white
+			 * space skipped before matching.
+			 */
+			g_assert (type_row->pattern[0] == ' ');
+			row.mask++;
+			row.pattern++;
 		}
+
+		g_array_append_val (rows, row);
 	}
+}
 
-	sniffed_type = sniff_images (sniffer, buffer);
+static void
+compile_tables (void)
+{
+	GArray *rows;
 
-	if (sniffed_type != NULL)
-		return sniffed_type;
+	rows = g_array_new (FALSE, FALSE, sizeof (SoupContentSnifferRow));
 
-	sniffed_type = sniff_audio_video (sniffer, buffer);
+	add_media_rows (rows, image_types_table, G_N_ELEMENTS (image_types_table));
+	dispatch_build (&image_dispatch, rows);
+	g_array_set_size (rows, 0);
 
-	if (sniffed_type != NULL)
-		return sniffed_type;
+	add_media_rows (rows, audio_video_types_table, G_N_ELEMENTS (audio_video_types_table));
+	dispatch_build (&audio_video_dispatch, rows);
+	g_array_set_size (rows, 0);
 
-	for (i = 0; i < resource_length; i++) {
-		if (byte_looks_binary[resource[i]])
-			return g_strdup ("application/octet-stream");
-	}
+	add_type_rows (rows, TRUE);
+	dispatch_build (&tag_dispatch, rows);
+	g_array_set_size (rows, 0);
 
-	return g_strdup ("text/plain");
+	add_type_rows (rows, FALSE);
+	add_media_rows (rows, image_types_table, G_N_ELEMENTS (image_types_table));
+	add_media_rows (rows, audio_video_types_table, G_N_ELEMENTS (audio_video_types_table));
+	dispatch_build (&unknown_dispatch, rows);
+
+	g_array_free (rows, TRUE);
 }
 
 /* MIMESNIFF: 7.2 Sniffing a mislabeled binary resource */
@@ -599,8 +768,6 @@ sniff_text_or_binary (SoupContentSniffer *sniffer, GBytes *buffer)
 	gsize resource_length;
 	const guchar *resource = g_bytes_get_data (buffer, &resource_length);
 	resource_length = MIN (512, resource_length);
-	gboolean looks_binary = FALSE;
-	int i;
 
 	/* 2. Detecting UTF-16BE, UTF-16LE BOMs means it's text/plain */
 	if (resource_length >= 2) {
@@ -616,14 +783,7 @@ sniff_text_or_binary (SoupContentSniffer *sniffer, GBytes *buffer)
 	}
 
 	/* 4. Look to see if any of the first n bytes looks binary */
-	for (i = 0; i < resource_length; i++) {
-		if (byte_looks_binary[resource[i]]) {
-			looks_binary = TRUE;
-			break;
-		}
-	}
-
-	if (!looks_binary)
+	if (!data_looks_binary (resource, resource_length))
 		return g_strdup ("text/plain");
 
 	/* 5. Execute 7.1 Identifying a resource with an unknown MIME type.
@@ -888,6 +1048,7 @@ soup_content_sniffer_request_unqueued (SoupSessionFeature *feature,
 static void
 soup_content_sniffer_class_init (SoupContentSnifferClass *content_sniffer_class)
 {
+	compile_tables ();
 }
 
 static void
@@ -16,6 +16,7 @@
 #include <sqlite3.h>
 
 #include "soup-cookie-jar-db.h"
+#include "soup-db-writer.h"
 #include "soup.h"
 
 /**
@@ -26,6 +27,11 @@
  * #SoupCookieJarDB is a [class@CookieJar] that reads cookies from and writes
  * them to a sqlite database in the new Mozilla format.
  *
+ * Changes are not written immediately: they are queued, coalesced per
+ * cookie name and domain, and written in a single transaction from a
+ * background thread, either after a short delay or once enough changes are
+ * pending. Use [method@CookieJarDB.flush] to write them synchronously.
+ *
  * (This is identical to `SoupCookieJarSqlite` in
  * libsoup-gnome; it has just been moved into libsoup proper, and
  * renamed to avoid conflicting.)
@@ -49,15 +55,46 @@ struct _SoupCookieJarDB {
 typedef struct {
 	char *filename;
 	sqlite3 *db;
+	sqlite3_stmt *insert_stmt;
+	sqlite3_stmt *delete_stmt;
+
+	SoupDBWriter *writer; /* pending: "name\nhost" -> PendingChange */
 } SoupCookieJarDBPrivate;
 
+/* The changes done to the rows with a given name and host: the result is
+ * the same as running DELETE, if delete is set, and then INSERT for each
+ * cookie in inserts.
+ */
+typedef struct {
+	char *name;
+	char *host;
+	gboolean delete;
+	GSList *inserts;
+} PendingChange;
+
 G_DEFINE_FINAL_TYPE_WITH_PRIVATE (SoupCookieJarDB, soup_cookie_jar_db, SOUP_TYPE_COOKIE_JAR)
 
 static void load (SoupCookieJar *jar);
+static sqlite3 *open_for_write (gpointer user_data);
+static void write_change (sqlite3 *db, const char *key, gpointer change, gpointer user_data);
+
+static void
+pending_change_free (PendingChange *change)
+{
+	g_free (change->name);
+	g_free (change->host);
+	g_slist_free_full (change->inserts, (GDestroyNotify) soup_cookie_free);
+	g_free (change);
+}
 
 static void
 soup_cookie_jar_db_init (SoupCookieJarDB *db)
 {
+	SoupCookieJarDBPrivate *priv = soup_cookie_jar_db_get_instance_private (db);
+
+	priv->writer = soup_db_writer_new ("SoupCookieJarDB",
+					   (GDestroyNotify) pending_change_free,
+					   open_for_write, write_change, db);
 }
 
 static void
@@ -66,7 +103,11 @@ soup_cookie_jar_db_finalize (GObject *object)
 	SoupCookieJarDBPrivate *priv =
 		soup_cookie_jar_db_get_instance_private (SOUP_COOKIE_JAR_DB (object));
 
+	soup_db_writer_free (priv->writer);
+
 	g_free (priv->filename);
+	g_clear_pointer (&priv->insert_stmt, sqlite3_finalize);
+	g_clear_pointer (&priv->delete_stmt, sqlite3_finalize);
 	g_clear_pointer (&priv->db, sqlite3_close);
 
 	G_OBJECT_CLASS (soup_cookie_jar_db_parent_class)->finalize (object);
@@ -135,8 +176,8 @@ soup_cookie_jar_db_new (const char *filename, gboolean read_only)
 
 #define QUERY_ALL "SELECT id, name, value, host, path, expiry, lastAccessed, isSecure, isHttpOnly, sameSite FROM moz_cookies;"
 #define CREATE_TABLE "CREATE TABLE moz_cookies (id INTEGER PRIMARY KEY, name TEXT, value TEXT, host TEXT, path TEXT, expiry INTEGER, lastAccessed INTEGER, isSecure INTEGER, isHttpOnly INTEGER, sameSite INTEGER)"
-#define QUERY_INSERT "INSERT INTO moz_cookies VALUES(NULL, %Q, %Q, %Q, %Q, %d, NULL, %d, %d, %d);"
-#define QUERY_DELETE "DELETE FROM moz_cookies WHERE name=%Q AND host=%Q;"
+#define QUERY_INSERT "INSERT INTO moz_cookies VALUES(NULL, ?1, ?2, ?3, ?4, ?5, NULL, ?6, ?7, ?8);"
+#define QUERY_DELETE "DELETE FROM moz_cookies WHERE name=?1 AND host=?2;"
 
 enum {
 	COL_ID,
@@ -277,6 +318,82 @@ load (SoupCookieJar *jar)
 	exec_query_with_try_create_table (priv->db, QUERY_ALL, callback, jar);
 }
 
+/* Called by the writer, with its database lock held */
+static sqlite3 *
+open_for_write (gpointer user_data)
+{
+	SoupCookieJarDBPrivate *priv =
+		soup_cookie_jar_db_get_instance_private (SOUP_COOKIE_JAR_DB (user_data));
+
+	if (priv->db == NULL && open_db (SOUP_COOKIE_JAR (user_data)))
+		return NULL;
+
+	if (!priv->delete_stmt)
+		priv->delete_stmt = soup_db_prepare_statement (priv->db, QUERY_DELETE, CREATE_TABLE);
+	if (!priv->insert_stmt)
+		priv->insert_stmt = soup_db_prepare_statement (priv->db, QUERY_INSERT, CREATE_TABLE);
+	if (!priv->delete_stmt || !priv->insert_stmt)
+		return NULL;
+
+	return priv->db;
+}
+
+static void
+write_change (sqlite3    *db,
+	      const char *key,
+	      gpointer    data,
+	      gpointer    user_data)
+{
+	SoupCookieJarDBPrivate *priv =
+		soup_cookie_jar_db_get_instance_private (SOUP_COOKIE_JAR_DB (user_data));
+	PendingChange *change = data;
+	GSList *l;
+
+	if (change->delete) {
+		sqlite3_bind_text (priv->delete_stmt, 1, change->name, -1, SQLITE_STATIC);
+		sqlite3_bind_text (priv->delete_stmt, 2, change->host, -1, SQLITE_STATIC);
+		soup_db_step_statement (db, priv->delete_stmt);
+	}
+
+	for (l = change->inserts; l; l = l->next) {
+		SoupCookie *cookie = l->data;
+		sqlite3_stmt *stmt = priv->insert_stmt;
+
+		sqlite3_bind_text (stmt, 1, soup_cookie_get_name (cookie), -1, SQLITE_STATIC);
+		sqlite3_bind_text (stmt, 2, soup_cookie_get_value (cookie), -1, SQLITE_STATIC);
+		sqlite3_bind_text (stmt, 3, soup_cookie_get_domain (cookie), -1, SQLITE_STATIC);
+		sqlite3_bind_text (stmt, 4, soup_cookie_get_path (cookie), -1, SQLITE_STATIC);
+		sqlite3_bind_int64 (stmt, 5, g_date_time_to_unix (soup_cookie_get_expires (cookie)));
+		sqlite3_bind_int (stmt, 6, soup_cookie_get_secure (cookie));
+		sqlite3_bind_int (stmt, 7, soup_cookie_get_http_only (cookie));
+		sqlite3_bind_int (stmt, 8, soup_cookie_get_same_site_policy (cookie));
+		soup_db_step_statement (db, stmt);
+	}
+}
+
+static PendingChange *
+lookup_pending_change (GHashTable *pending,
+		       SoupCookie *cookie)
+{
+	PendingChange *change;
+	char *key;
+
+	key = g_strdup_printf ("%s\n%s", soup_cookie_get_name (cookie),
+			       soup_cookie_get_domain (cookie));
+	change = g_hash_table_lookup (pending, key);
+	if (change) {
+		g_free (key);
+		return change;
+	}
+
+	change = g_new0 (PendingChange, 1);
+	change->name = g_strdup (soup_cookie_get_name (cookie));
+	change->host = g_strdup (soup_cookie_get_domain (cookie));
+	g_hash_table_insert (pending, key, change);
+
+	return change;
+}
+
 static void
 soup_cookie_jar_db_changed (SoupCookieJar *jar,
 			    SoupCookie    *old_cookie,
@@ -284,37 +401,27 @@ soup_cookie_jar_db_changed (SoupCookieJar *jar,
 {
 	SoupCookieJarDBPrivate *priv =
 		soup_cookie_jar_db_get_instance_private (SOUP_COOKIE_JAR_DB (jar));
-	char *query;
+	GHashTable *pending;
+	PendingChange *change;
 
-	if (priv->db == NULL) {
-		if (open_db (jar))
-			return;
-	}
+	if (!old_cookie && !(new_cookie && soup_cookie_get_expires (new_cookie)))
+		return;
+
+	pending = soup_db_writer_lock_pending (priv->writer);
 
 	if (old_cookie) {
-		query = sqlite3_mprintf (QUERY_DELETE,
-					 soup_cookie_get_name (old_cookie),
-					 soup_cookie_get_domain (old_cookie));
-		exec_query_with_try_create_table (priv->db, query, NULL, NULL);
-		sqlite3_free (query);
+		/* The DELETE replaces whatever was queued before for the key */
+		change = lookup_pending_change (pending, old_cookie);
+		change->delete = TRUE;
+		g_slist_free_full (g_steal_pointer (&change->inserts), (GDestroyNotify) soup_cookie_free);
 	}
 
 	if (new_cookie && soup_cookie_get_expires (new_cookie)) {
-		gulong expires;
-		
-		expires = (gulong)g_date_time_to_unix (soup_cookie_get_expires (new_cookie));
-		query = sqlite3_mprintf (QUERY_INSERT, 
-					 soup_cookie_get_name (new_cookie),
-					 soup_cookie_get_value (new_cookie),
-					 soup_cookie_get_domain (new_cookie),
-					 soup_cookie_get_path (new_cookie),
-					 expires,
-					 soup_cookie_get_secure (new_cookie),
-					 soup_cookie_get_http_only (new_cookie),
-					 soup_cookie_get_same_site_policy (new_cookie));
-		exec_query_with_try_create_table (priv->db, query, NULL, NULL);
-		sqlite3_free (query);
+		change = lookup_pending_change (pending, new_cookie);
+		change->inserts = g_slist_append (change->inserts, soup_cookie_copy (new_cookie));
 	}
+
+	soup_db_writer_unlock_pending (priv->writer, TRUE);
 }
 
 static gboolean
@@ -352,3 +459,26 @@ soup_cookie_jar_db_class_init (SoupCookieJarDBClass *db_class)
 
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
+
+/**
+ * soup_cookie_jar_db_flush:
+ * @jar: a #SoupCookieJarDB
+ *
+ * Writes to the database the cookie changes that are still pending.
+ *
+ * Changes are written in the background shortly after they happen; this
+ * function can be used when they need to be on disk right away, for example
+ * before another process opens the database.
+ *
+ * Since: 3.8
+ */
+void
+soup_cookie_jar_db_flush (SoupCookieJarDB *jar)
+{
+	SoupCookieJarDBPrivate *priv;
+
+	g_return_if_fail (SOUP_IS_COOKIE_JAR_DB (jar));
+
+	priv = soup_cookie_jar_db_get_instance_private (jar);
+	soup_db_writer_flush (priv->writer);
+}
@@ -17,4 +17,7 @@ SOUP_AVAILABLE_IN_ALL
 SoupCookieJar *soup_cookie_jar_db_new (const char *filename,
 				       gboolean    read_only);
 
+SOUP_AVAILABLE_IN_3_8
+void           soup_cookie_jar_db_flush (SoupCookieJarDB *jar);
+
 G_END_DECLS
@@ -13,7 +13,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <glib/gstdio.h>
+
 #include "soup-cookie-jar-text.h"
+#include "soup-date-utils-private.h"
 #include "soup.h"
 
 /**
@@ -23,12 +26,20 @@
  *
  * #SoupCookieJarText is a [class@CookieJar] that reads cookies from and writes
  * them to a text file in format similar to Mozilla's "cookies.txt".
+ *
+ * Changes are appended to a journal next to the cookies file, named like it
+ * with a ".journal" suffix. The cookies file is rewritten from scratch only
+ * when the journal grows too large, so that a change does not cost a
+ * rewrite of the whole file.
  **/
 
+#define COMPACT_MIN_RECORDS 1024 /* Journal records before compaction, or the number of cookies if larger */
+
 enum {
 	PROP_0,
 
 	PROP_FILENAME,
+	PROP_BATCH_SIZE,
 
 	LAST_PROPERTY
 };
@@ -43,16 +54,31 @@ struct _SoupCookieJarText {
 
 typedef struct {
 	char *filename;
+	char *journal_filename;
 
+	/* Persistent cookies as stored in filename plus the journal */
+	GHashTable *cookies;
+	guint n_journal_records;
+
+	GString *journal_buffer;
+	guint n_buffered_records;
+	guint batch_size;
 } SoupCookieJarTextPrivate;
 
 G_DEFINE_FINAL_TYPE_WITH_PRIVATE (SoupCookieJarText, soup_cookie_jar_text, SOUP_TYPE_COOKIE_JAR)
 
 static void load (SoupCookieJar *jar);
+static void flush_journal (SoupCookieJarText *jar);
 
 static void
 soup_cookie_jar_text_init (SoupCookieJarText *text)
 {
+	SoupCookieJarTextPrivate *priv = soup_cookie_jar_text_get_instance_private (text);
+
+	priv->cookies = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+					       (GDestroyNotify) soup_cookie_free);
+	priv->journal_buffer = g_string_new (NULL);
+	priv->batch_size = 1;
 }
 
 static void
@@ -61,7 +87,12 @@ soup_cookie_jar_text_finalize (GObject *object)
 	SoupCookieJarTextPrivate *priv =
 		soup_cookie_jar_text_get_instance_private (SOUP_COOKIE_JAR_TEXT (object));
 
+	flush_journal (SOUP_COOKIE_JAR_TEXT (object));
+
 	g_free (priv->filename);
+	g_free (priv->journal_filename);
+	g_hash_table_destroy (priv->cookies);
+	g_string_free (priv->journal_buffer, TRUE);
 
 	G_OBJECT_CLASS (soup_cookie_jar_text_parent_class)->finalize (object);
 }
@@ -76,8 +107,14 @@ soup_cookie_jar_text_set_property (GObject *object, guint prop_id,
 	switch (prop_id) {
 	case PROP_FILENAME:
 		priv->filename = g_value_dup_string (value);
+		priv->journal_filename = g_strconcat (priv->filename, ".journal", NULL);
 		load (SOUP_COOKIE_JAR (object));
 		break;
+	case PROP_BATCH_SIZE:
+		priv->batch_size = g_value_get_uint (value);
+		if (priv->n_buffered_records >= priv->batch_size)
+			flush_journal (SOUP_COOKIE_JAR_TEXT (object));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -95,6 +132,9 @@ soup_cookie_jar_text_get_property (GObject *object, guint prop_id,
 	case PROP_FILENAME:
 		g_value_set_string (value, priv->filename);
 		break;
+	case PROP_BATCH_SIZE:
+		g_value_set_uint (value, priv->batch_size);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -219,27 +259,69 @@ parse_cookie (char *line, time_t now)
 	return cookie;
 }
 
+static char *
+cookie_key (SoupCookie *cookie)
+{
+	return g_strdup_printf ("%s\t%s\t%s", soup_cookie_get_domain (cookie),
+				soup_cookie_get_name (cookie),
+				soup_cookie_get_path (cookie) ? soup_cookie_get_path (cookie) : "");
+}
+
 static void
 parse_line (SoupCookieJar *jar, char *line, time_t now)
 {
+	SoupCookieJarTextPrivate *priv =
+		soup_cookie_jar_text_get_instance_private (SOUP_COOKIE_JAR_TEXT (jar));
 	SoupCookie *cookie;
 
 	cookie = parse_cookie (line, now);
-	if (cookie)
+	if (cookie) {
+		g_hash_table_replace (priv->cookies, cookie_key (cookie), soup_cookie_copy (cookie));
 		soup_cookie_jar_add_cookie (jar, cookie);
+	}
 }
 
+/* Journal lines are cookie lines prefixed by '+' when the cookie
+ * was added and '-' when it was removed.
+ */
 static void
-load (SoupCookieJar *jar)
+parse_journal_line (SoupCookieJar *jar, char *line, time_t now)
 {
 	SoupCookieJarTextPrivate *priv =
 		soup_cookie_jar_text_get_instance_private (SOUP_COOKIE_JAR_TEXT (jar));
+	SoupCookie *cookie;
+
+	if (*line != '+' && *line != '-')
+		return;
+
+	priv->n_journal_records++;
+	if (*line == '+') {
+		parse_line (jar, line + 1, now);
+		return;
+	}
+
+	cookie = parse_cookie (line + 1, now);
+	if (cookie) {
+		char *key = cookie_key (cookie);
+
+		g_hash_table_remove (priv->cookies, key);
+		soup_cookie_jar_delete_cookie (jar, cookie);
+		soup_cookie_free (cookie);
+		g_free (key);
+	}
+}
+
+static void
+load_file (SoupCookieJar *jar,
+	   const char    *filename,
+	   void         (*parse) (SoupCookieJar *, char *, time_t))
+{
 	char *contents = NULL, *line, *p;
 	gsize length = 0;
 	time_t now = time (NULL);
 
 	/* FIXME: error? */
-	if (!g_file_get_contents (priv->filename, &contents, &length, NULL))
+	if (!g_file_get_contents (filename, &contents, &length, NULL))
 		return;
 
 	line = contents;
@@ -247,73 +329,109 @@ load (SoupCookieJar *jar)
 		/* \r\n comes out as an extra empty line and gets ignored */
 		if (*p == '\r' || *p == '\n') {
 			*p = '\0';
-			parse_line (jar, line, now);
+			parse (jar, line, now);
 			line = p + 1;
 		}
 	}
-	parse_line (jar, line, now);
+	parse (jar, line, now);
 
 	g_free (contents);
 }
 
 static void
-write_cookie (FILE *out, SoupCookie *cookie)
+load (SoupCookieJar *jar)
 {
-	fseek (out, 0, SEEK_END);
-
-	fprintf (out, "%s%s\t%s\t%s\t%s\t%lu\t%s\t%s\t%s\n",
-		 soup_cookie_get_http_only (cookie) ? "#HttpOnly_" : "",
-		 soup_cookie_get_domain (cookie),
-		 *soup_cookie_get_domain (cookie) == '.' ? "TRUE" : "FALSE",
-		 soup_cookie_get_path (cookie),
-		 soup_cookie_get_secure (cookie) ? "TRUE" : "FALSE",
-		 (gulong)g_date_time_to_unix (soup_cookie_get_expires (cookie)),
-		 soup_cookie_get_name (cookie),
-		 soup_cookie_get_value (cookie),
-		 same_site_policy_to_string (soup_cookie_get_same_site_policy (cookie)));
+	SoupCookieJarTextPrivate *priv =
+		soup_cookie_jar_text_get_instance_private (SOUP_COOKIE_JAR_TEXT (jar));
+
+	load_file (jar, priv->filename, parse_line);
+	load_file (jar, priv->journal_filename, parse_journal_line);
 }
 
 static void
-delete_cookie (const char *filename, SoupCookie *cookie)
+append_cookie_line (GString *out, SoupCookie *cookie)
 {
-	char *contents = NULL, *line, *p;
-	gsize length = 0;
-	FILE *f;
-	SoupCookie *c;
-	time_t now = time (NULL);
+	g_string_append_printf (out, "%s%s\t%s\t%s\t%s\t%lu\t%s\t%s\t%s\n",
+				soup_cookie_get_http_only (cookie) ? "#HttpOnly_" : "",
+				soup_cookie_get_domain (cookie),
+				*soup_cookie_get_domain (cookie) == '.' ? "TRUE" : "FALSE",
+				soup_cookie_get_path (cookie),
+				soup_cookie_get_secure (cookie) ? "TRUE" : "FALSE",
+				(gulong)g_date_time_to_unix (soup_cookie_get_expires (cookie)),
+				soup_cookie_get_name (cookie),
+				soup_cookie_get_value (cookie),
+				same_site_policy_to_string (soup_cookie_get_same_site_policy (cookie)));
+}
 
-	if (!g_file_get_contents (filename, &contents, &length, NULL))
+/* Rewrites the cookies file atomically from the cookies
+ * in memory, and then removes the journal.
+ */
+static gboolean
+compact (SoupCookieJarText *jar)
+{
+	SoupCookieJarTextPrivate *priv = soup_cookie_jar_text_get_instance_private (jar);
+	GString *contents;
+	GHashTableIter iter;
+	SoupCookie *cookie;
+	gboolean written;
+
+	contents = g_string_new ("# HTTP Cookie File\n"
+				 "# http://www.netscape.com/newsref/std/cookie_spec.html\n"
+				 "# This is a generated file!  Do not edit.\n"
+				 "# To delete cookies, use the Cookie Manager.\n\n");
+
+	g_hash_table_iter_init (&iter, priv->cookies);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&cookie)) {
+		if (soup_date_time_is_past (soup_cookie_get_expires (cookie)))
+			g_hash_table_iter_remove (&iter);
+		else
+			append_cookie_line (contents, cookie);
+	}
+
+	written = g_file_set_contents (priv->filename, contents->str, contents->len, NULL);
+	if (written) {
+		g_unlink (priv->journal_filename);
+		priv->n_journal_records = 0;
+	}
+
+	g_string_free (contents, TRUE);
+
+	return written;
+}
+
+static void
+flush_journal (SoupCookieJarText *jar)
+{
+	SoupCookieJarTextPrivate *priv = soup_cookie_jar_text_get_instance_private (jar);
+	FILE *out;
+	gboolean written;
+
+	if (!priv->n_buffered_records)
 		return;
 
-	f = fopen (filename, "w");
-	if (!f) {
-		g_free (contents);
+	/* The buffered records are already applied to the cookies
+	 * written by compact(). If that fails, they still go to the
+	 * journal.
+	 */
+	if (priv->n_journal_records + priv->n_buffered_records > MAX (COMPACT_MIN_RECORDS, g_hash_table_size (priv->cookies)) &&
+	    compact (jar))
+		goto out;
+
+	/* Otherwise the records are kept buffered until the next flush */
+	out = fopen (priv->journal_filename, "a");
+	if (!out)
 		return;
-	}
 
-	line = contents;
-	for (p = contents; *p; p++) {
-		/* \r\n comes out as an extra empty line and gets ignored */
-		if (*p == '\r' || *p == '\n') {
-			*p = '\0';
-			c = parse_cookie (line, now);
-			line = p + 1;
-			if (!c)
-				continue;
-			if (!soup_cookie_equal (cookie, c))
-				write_cookie (f, c);
-			soup_cookie_free (c);
-		}
-	}
-	c = parse_cookie (line, now);
-	if (c) {
-		if (!soup_cookie_equal (cookie, c))
-			write_cookie (f, c);
-		soup_cookie_free (c);
-	}
+	written = fwrite (priv->journal_buffer->str, 1, priv->journal_buffer->len, out) == priv->journal_buffer->len;
+	written = fclose (out) == 0 && written;
+	if (!written)
+		return;
 
-	g_free (contents);
-	fclose (f);
+	priv->n_journal_records += priv->n_buffered_records;
+
+ out:
+	g_string_truncate (priv->journal_buffer, 0);
+	priv->n_buffered_records = 0;
 }
 
 static void
@@ -321,7 +439,6 @@ soup_cookie_jar_text_changed (SoupCookieJar *jar,
 			      SoupCookie    *old_cookie,
 			      SoupCookie    *new_cookie)
 {
-	FILE *out;
 	SoupCookieJarTextPrivate *priv =
 		soup_cookie_jar_text_get_instance_private (SOUP_COOKIE_JAR_TEXT (jar));
 
@@ -331,40 +448,25 @@ soup_cookie_jar_text_changed (SoupCookieJar *jar,
 	 * right thing for all 'added', 'deleted' and 'modified'
 	 * meanings.
 	 */
-	/* Also, delete_cookie takes the filename and write_cookie
-	 * a FILE pointer. Seems more convenient that way considering
-	 * the implementations of the functions
-	 */
-	if (old_cookie)
-		delete_cookie (priv->filename, old_cookie);
-
-	if (new_cookie) {
-		gboolean write_header = FALSE;
-
-		if (!g_file_test (priv->filename, G_FILE_TEST_EXISTS))
-			write_header = TRUE;
-
-		out = fopen (priv->filename, "a");
-		if (!out) {
-			/* FIXME: error? */
-			return;
-		}
-
-		if (write_header) {
-			fprintf (out, "# HTTP Cookie File\n");
-			fprintf (out, "# http://www.netscape.com/newsref/std/cookie_spec.html\n");
-			fprintf (out, "# This is a generated file!  Do not edit.\n");
-			fprintf (out, "# To delete cookies, use the Cookie Manager.\n\n");
-		}
-
-		if (soup_cookie_get_expires (new_cookie))
-			write_cookie (out, new_cookie);
+	if (old_cookie && soup_cookie_get_expires (old_cookie)) {
+		char *key = cookie_key (old_cookie);
+
+		g_hash_table_remove (priv->cookies, key);
+		g_string_append_c (priv->journal_buffer, '-');
+		append_cookie_line (priv->journal_buffer, old_cookie);
+		priv->n_buffered_records++;
+		g_free (key);
+	}
 
-		if (fclose (out) != 0) {
-			/* FIXME: error? */
-			return;
-		}
+	if (new_cookie && soup_cookie_get_expires (new_cookie)) {
+		g_hash_table_replace (priv->cookies, cookie_key (new_cookie), soup_cookie_copy (new_cookie));
+		g_string_append_c (priv->journal_buffer, '+');
+		append_cookie_line (priv->journal_buffer, new_cookie);
+		priv->n_buffered_records++;
 	}
+
+	if (priv->n_buffered_records >= priv->batch_size)
+		flush_journal (SOUP_COOKIE_JAR_TEXT (jar));
 }
 
 static gboolean
@@ -400,5 +502,23 @@ soup_cookie_jar_text_class_init (SoupCookieJarTextClass *text_class)
 				     G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
 				     G_PARAM_STATIC_STRINGS);
 
+	/**
+	 * SoupCookieJarText:batch-size:
+	 *
+	 * Number of changes kept in memory before appending them to the
+	 * journal.
+	 *
+	 * The default, 1, writes every change right away. Pending changes
+	 * are written when the jar is destroyed.
+	 *
+	 * Since: 3.8
+	 */
+        properties[PROP_BATCH_SIZE] =
+		g_param_spec_uint ("batch-size",
+				   "Batch size",
+				   "Number of changes written to the journal at once",
+				   1, G_MAXUINT, 1,
+				   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
@@ -16,6 +16,7 @@
 #include "soup-message-private.h"
 #include "soup-message-headers-private.h"
 #include "soup-misc.h"
+#include "soup-rcu.h"
 #include "soup.h"
 #include "soup-session-feature-private.h"
 #include "soup-uri-utils-private.h"
@@ -52,14 +53,62 @@ enum {
 
 static GParamSpec *properties[LAST_PROPERTY] = { NULL, };
 
+#define MAX_CACHED_HEADERS 1024
+
+/* The cookies set for a given domain, sorted as in compare_cookies() */
+typedef struct _SoupCookieDomainNode SoupCookieDomainNode;
+
+typedef struct {
+	char *domain;
+	GPtrArray *cookies;
+	SoupCookieDomainNode *node;
+} SoupCookieDomain;
+
+/* Domains are indexed in a tree of labels starting from the last one,
+ * so that the domains matching a host are found walking down from the
+ * root: "www.example.com" is found at root -> com -> example -> www.
+ */
+struct _SoupCookieDomainNode {
+	SoupCookieDomainNode *parent;
+	char *label;
+	GHashTable *children;
+	SoupCookieDomain *host;       /* "www.example.com" */
+	SoupCookieDomain *subdomains; /* ".www.example.com" */
+};
+
+typedef struct {
+	gint64 expires;
+	SoupCookie *cookie;
+	guint serial;
+} SoupCookieExpiry;
+
 typedef struct {
         GMutex mutex;
 	gboolean constructed, read_only;
 	GHashTable *domains, *serials;
+	SoupCookieDomainNode *domain_root;
 	guint serial;
 	SoupCookieJarAcceptPolicy accept_policy;
+
+	/* Min-heap of SoupCookieExpiry, entries of removed cookies
+	 * are skipped when they get to the top.
+	 */
+	GArray *expiry_heap;
+
+	/* Cookie headers by request, cleared when the jar changes:
+	 * header_snapshot is read without the mutex, new headers are
+	 * added to header_cache and published in batches.
+	 */
+	SoupRcuPointer header_snapshot;
+	GHashTable *header_cache;
+	guint header_generation;
 } SoupCookieJarPrivate;
 
+typedef struct {
+	GHashTable *headers;
+	gint64 valid_until;
+} SoupCookieHeaderSnapshot;
+
 static void soup_cookie_jar_session_feature_init (SoupSessionFeatureInterface *feature_interface, gpointer interface_data);
 
 G_DEFINE_TYPE_WITH_CODE (SoupCookieJar, soup_cookie_jar, G_TYPE_OBJECT,
@@ -67,6 +116,234 @@ G_DEFINE_TYPE_WITH_CODE (SoupCookieJar, soup_cookie_jar, G_TYPE_OBJECT,
 			 G_IMPLEMENT_INTERFACE (SOUP_TYPE_SESSION_FEATURE,
 						soup_cookie_jar_session_feature_init))
 
+static void
+soup_cookie_header_snapshot_free (SoupCookieHeaderSnapshot *snapshot)
+{
+	g_hash_table_destroy (snapshot->headers);
+	g_free (snapshot);
+}
+
+static void
+soup_cookie_domain_free (SoupCookieDomain *domain)
+{
+	g_free (domain->domain);
+	g_ptr_array_unref (domain->cookies);
+	g_free (domain);
+}
+
+static SoupCookieDomainNode *
+soup_cookie_domain_node_new (SoupCookieDomainNode *parent,
+			     const char           *label)
+{
+	SoupCookieDomainNode *node = g_new0 (SoupCookieDomainNode, 1);
+
+	node->parent = parent;
+	node->label = g_strdup (label);
+	return node;
+}
+
+static void
+soup_cookie_domain_node_free (SoupCookieDomainNode *node)
+{
+	g_clear_pointer (&node->children, g_hash_table_destroy);
+	g_free (node->label);
+	g_free (node);
+}
+
+/* Returns the child of @node for the label of @len bytes at @label */
+static SoupCookieDomainNode *
+soup_cookie_domain_node_get_child (SoupCookieDomainNode *node,
+				   const char           *label,
+				   gsize                 len,
+				   gboolean              create)
+{
+	SoupCookieDomainNode *child = NULL;
+	char buffer[64]; /* Enough for any valid label */
+	char *key;
+	gsize i;
+
+	key = len < sizeof (buffer) ? buffer : g_malloc (len + 1);
+	for (i = 0; i < len; i++)
+		key[i] = g_ascii_tolower (label[i]);
+	key[len] = '\0';
+
+	if (node->children)
+		child = g_hash_table_lookup (node->children, key);
+	if (!child && create) {
+		if (!node->children) {
+			node->children = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+								(GDestroyNotify) soup_cookie_domain_node_free);
+		}
+		child = soup_cookie_domain_node_new (node, key);
+		g_hash_table_insert (node->children, child->label, child);
+	}
+
+	if (key != buffer)
+		g_free (key);
+
+	return child;
+}
+
+static SoupCookieDomain *
+lookup_domain (SoupCookieJarPrivate *priv,
+	       const char           *domain,
+	       gboolean              create)
+{
+	SoupCookieDomain *cookie_domain;
+	SoupCookieDomainNode *node;
+	const char *name, *start, *end;
+
+	cookie_domain = g_hash_table_lookup (priv->domains, domain);
+	if (cookie_domain || !create)
+		return cookie_domain;
+
+	cookie_domain = g_new0 (SoupCookieDomain, 1);
+	cookie_domain->domain = g_strdup (domain);
+	cookie_domain->cookies = g_ptr_array_new_with_free_func ((GDestroyNotify) soup_cookie_free);
+	g_hash_table_insert (priv->domains, cookie_domain->domain, cookie_domain);
+
+	name = domain[0] == '.' ? domain + 1 : domain;
+	node = priv->domain_root;
+	end = name + strlen (name);
+	while (TRUE) {
+		start = end;
+		while (start > name && start[-1] != '.')
+			start--;
+		node = soup_cookie_domain_node_get_child (node, start, end - start, TRUE);
+		if (start == name)
+			break;
+		end = start - 1;
+	}
+
+	if (domain[0] == '.')
+		node->subdomains = cookie_domain;
+	else
+		node->host = cookie_domain;
+	cookie_domain->node = node;
+
+	return cookie_domain;
+}
+
+static void
+remove_domain (SoupCookieJarPrivate *priv,
+	       SoupCookieDomain     *cookie_domain)
+{
+	SoupCookieDomainNode *node = cookie_domain->node;
+
+	if (node->host == cookie_domain)
+		node->host = NULL;
+	else
+		node->subdomains = NULL;
+
+	while (node->parent && !node->host && !node->subdomains &&
+	       (!node->children || g_hash_table_size (node->children) == 0)) {
+		SoupCookieDomainNode *parent = node->parent;
+
+		g_hash_table_remove (parent->children, node->label);
+		node = parent;
+	}
+
+	g_hash_table_remove (priv->domains, cookie_domain->domain);
+}
+
+/* @cookie is the newest cookie, so it goes after the ones with the same
+ * path length.
+ */
+static void
+cookie_domain_add_cookie (SoupCookieDomain *cookie_domain,
+			  SoupCookie       *cookie)
+{
+	const char *path = soup_cookie_get_path (cookie);
+	gsize len = path ? strlen (path) : 0;
+	guint i;
+
+	for (i = cookie_domain->cookies->len; i > 0; i--) {
+		SoupCookie *c = g_ptr_array_index (cookie_domain->cookies, i - 1);
+		const char *cpath = soup_cookie_get_path (c);
+
+		if ((cpath ? strlen (cpath) : 0) >= len)
+			break;
+	}
+	g_ptr_array_insert (cookie_domain->cookies, i, cookie);
+}
+
+#define EXPIRY_AT(heap, i) (&g_array_index ((heap), SoupCookieExpiry, (i)))
+
+static void
+expiry_heap_sift_down (GArray *heap, guint i)
+{
+	while (TRUE) {
+		guint smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+		SoupCookieExpiry tmp;
+
+		if (left < heap->len && EXPIRY_AT (heap, left)->expires < EXPIRY_AT (heap, smallest)->expires)
+			smallest = left;
+		if (right < heap->len && EXPIRY_AT (heap, right)->expires < EXPIRY_AT (heap, smallest)->expires)
+			smallest = right;
+		if (smallest == i)
+			return;
+
+		tmp = *EXPIRY_AT (heap, i);
+		*EXPIRY_AT (heap, i) = *EXPIRY_AT (heap, smallest);
+		*EXPIRY_AT (heap, smallest) = tmp;
+		i = smallest;
+	}
+}
+
+static void
+expiry_heap_push (GArray *heap, SoupCookieExpiry *expiry)
+{
+	guint i = heap->len;
+
+	g_array_append_val (heap, *expiry);
+	while (i > 0) {
+		guint parent = (i - 1) / 2;
+		SoupCookieExpiry tmp;
+
+		if (EXPIRY_AT (heap, parent)->expires <= EXPIRY_AT (heap, i)->expires)
+			break;
+
+		tmp = *EXPIRY_AT (heap, i);
+		*EXPIRY_AT (heap, i) = *EXPIRY_AT (heap, parent);
+		*EXPIRY_AT (heap, parent) = tmp;
+		i = parent;
+	}
+}
+
+static void
+expiry_heap_pop (GArray *heap)
+{
+	*EXPIRY_AT (heap, 0) = *EXPIRY_AT (heap, heap->len - 1);
+	g_array_set_size (heap, heap->len - 1);
+	expiry_heap_sift_down (heap, 0);
+}
+
+static gboolean
+expiry_is_valid (SoupCookieJarPrivate *priv,
+		 SoupCookieExpiry     *expiry)
+{
+	return GPOINTER_TO_UINT (g_hash_table_lookup (priv->serials, expiry->cookie)) == expiry->serial;
+}
+
+/* Drops the entries of cookies no longer in the jar once they outnumber the valid ones */
+static void
+expiry_heap_maybe_compact (SoupCookieJarPrivate *priv)
+{
+	GArray *heap = priv->expiry_heap;
+	guint i, n_valid = 0;
+
+	if (heap->len < 64 || heap->len < 2 * g_hash_table_size (priv->serials))
+		return;
+
+	for (i = 0; i < heap->len; i++) {
+		if (expiry_is_valid (priv, EXPIRY_AT (heap, i)))
+			*EXPIRY_AT (heap, n_valid++) = *EXPIRY_AT (heap, i);
+	}
+	g_array_set_size (heap, n_valid);
+	for (i = heap->len / 2; i > 0; i--)
+		expiry_heap_sift_down (heap, i - 1);
+}
+
 static void
 soup_cookie_jar_init (SoupCookieJar *jar)
 {
@@ -74,7 +351,11 @@ soup_cookie_jar_init (SoupCookieJar *jar)
 
 	priv->domains = g_hash_table_new_full (soup_str_case_hash,
 					       soup_str_case_equal,
-					       g_free, NULL);
+					       NULL, (GDestroyNotify) soup_cookie_domain_free);
+	priv->domain_root = soup_cookie_domain_node_new (NULL, NULL);
+	priv->expiry_heap = g_array_new (FALSE, FALSE, sizeof (SoupCookieExpiry));
+	priv->header_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	soup_rcu_pointer_init (&priv->header_snapshot, (GDestroyNotify) soup_cookie_header_snapshot_free);
 	priv->serials = g_hash_table_new (NULL, NULL);
 	priv->accept_policy = SOUP_COOKIE_JAR_ACCEPT_ALWAYS;
         g_mutex_init (&priv->mutex);
@@ -94,13 +375,12 @@ soup_cookie_jar_finalize (GObject *object)
 {
 	SoupCookieJarPrivate *priv =
 		soup_cookie_jar_get_instance_private (SOUP_COOKIE_JAR (object));
-	GHashTableIter iter;
-	gpointer key, value;
 
-	g_hash_table_iter_init (&iter, priv->domains);
-	while (g_hash_table_iter_next (&iter, &key, &value))
-		soup_cookies_free (value);
 	g_hash_table_destroy (priv->domains);
+	soup_cookie_domain_node_free (priv->domain_root);
+	g_array_unref (priv->expiry_heap);
+	g_hash_table_destroy (priv->header_cache);
+	soup_rcu_pointer_clear (&priv->header_snapshot);
 	g_hash_table_destroy (priv->serials);
         g_mutex_clear (&priv->mutex);
 
@@ -249,7 +529,21 @@ soup_cookie_jar_changed (SoupCookieJar *jar,
 	if (new) {
 		priv->serial++;
 		g_hash_table_insert (priv->serials, new, GUINT_TO_POINTER (priv->serial));
+
+		if (soup_cookie_get_expires (new)) {
+			SoupCookieExpiry expiry;
+
+			expiry.expires = g_date_time_to_unix (soup_cookie_get_expires (new));
+			expiry.cookie = new;
+			expiry.serial = priv->serial;
+			expiry_heap_push (priv->expiry_heap, &expiry);
+			expiry_heap_maybe_compact (priv);
+		}
 	}
+	g_hash_table_remove_all (priv->header_cache);
+	priv->header_generation++;
+	if (soup_rcu_pointer_get (&priv->header_snapshot))
+		soup_rcu_pointer_replace (&priv->header_snapshot, NULL);
 
 	if (priv->read_only || !priv->constructed)
 		return;
@@ -283,6 +577,12 @@ compare_cookies (gconstpointer a, gconstpointer b, gpointer jar)
 	return aserial - bserial;
 }
 
+static int
+compare_cookies_indirect (gconstpointer a, gconstpointer b, gpointer jar)
+{
+	return compare_cookies (*(SoupCookie **)a, *(SoupCookie **)b, jar);
+}
+
 static gboolean
 cookie_is_valid_for_same_site_policy (SoupCookie *cookie,
                                       gboolean    is_safe_method,
@@ -310,6 +610,36 @@ cookie_is_valid_for_same_site_policy (SoupCookie *cookie,
 	return !g_ascii_strcasecmp (g_uri_get_host (cookie_uri), g_uri_get_host (uri));
 }
 
+/* Removes the cookies that have expired, must be called with the mutex held */
+static void
+remove_expired_cookies (SoupCookieJar *jar)
+{
+	SoupCookieJarPrivate *priv = soup_cookie_jar_get_instance_private (jar);
+	GArray *heap = priv->expiry_heap;
+	gint64 now = time (NULL);
+
+	while (heap->len && EXPIRY_AT (heap, 0)->expires < now) {
+		SoupCookieExpiry expiry = *EXPIRY_AT (heap, 0);
+		SoupCookieDomain *cookie_domain;
+		guint index;
+
+		expiry_heap_pop (heap);
+		if (!expiry_is_valid (priv, &expiry))
+			continue;
+
+		cookie_domain = lookup_domain (priv, soup_cookie_get_domain (expiry.cookie), FALSE);
+		if (!g_ptr_array_find (cookie_domain->cookies, expiry.cookie, &index))
+			continue;
+
+		g_ptr_array_steal_index (cookie_domain->cookies, index);
+		if (cookie_domain->cookies->len == 0)
+			remove_domain (priv, cookie_domain);
+
+		soup_cookie_jar_changed (jar, expiry.cookie, NULL);
+		soup_cookie_free (expiry.cookie);
+	}
+}
+
 static GSList *
 get_cookies (SoupCookieJar *jar,
              GUri          *uri,
@@ -321,9 +651,12 @@ get_cookies (SoupCookieJar *jar,
              gboolean       copy_cookies)
 {
 	SoupCookieJarPrivate *priv;
-	GSList *cookies, *domain_cookies;
-	char *domain, *cur, *next_domain;
-	GSList *new_head, *cookies_to_remove = NULL, *p;
+	SoupCookieDomainNode *node;
+	SoupCookieDomain *domains[2];
+	GPtrArray *cookies;
+	GSList *result = NULL;
+	guint n_domains = 0, i, j;
+	const char *start, *end;
         const char *host = g_uri_get_host (uri);
 
 	priv = soup_cookie_jar_get_instance_private (jar);
@@ -331,61 +664,192 @@ get_cookies (SoupCookieJar *jar,
 	if (!host)
 		return NULL;
 
-	/* The logic here is a little weird, but the plan is that if
-	 * host is "www.foo.com", we will end up looking up
-	 * cookies for ".www.foo.com", "www.foo.com", ".foo.com", and
-	 * ".com", in that order. (Logic stolen from Mozilla.)
-	 */
-	cookies = NULL;
-        if (host[0]) {
-                domain = cur = g_strdup_printf (".%s", host);
-                next_domain = domain + 1;
-        } else {
-                domain = cur = g_strdup (host);
-                next_domain = NULL;
-        }
+	cookies = g_ptr_array_new ();
 
         g_mutex_lock (&priv->mutex);
 
-	do {
-		new_head = domain_cookies = g_hash_table_lookup (priv->domains, cur);
-		while (domain_cookies) {
-			GSList *next = domain_cookies->next;
-			SoupCookie *cookie = domain_cookies->data;
-
-			if (soup_cookie_get_expires (cookie) && soup_date_time_is_past (soup_cookie_get_expires (cookie))) {
-				cookies_to_remove = g_slist_append (cookies_to_remove,
-								    cookie);
-				new_head = g_slist_delete_link (new_head, domain_cookies);
-				g_hash_table_insert (priv->domains,
-						     g_strdup (cur),
-						     new_head);
-			} else if (soup_cookie_applies_to_uri (cookie, uri) &&
-			           cookie_is_valid_for_same_site_policy (cookie, is_safe_method, uri, top_level,
-				                                         site_for_cookies, is_top_level_navigation,
-									 for_http) &&
-				   (for_http || !soup_cookie_get_http_only (cookie)))
-				cookies = g_slist_append (cookies, copy_cookies ? soup_cookie_copy (cookie) : cookie);
-
-			domain_cookies = next;
+	remove_expired_cookies (jar);
+
+	/* If host is "www.foo.com", we will end up looking up cookies
+	 * for ".com", ".foo.com", ".www.foo.com" and "www.foo.com", in
+	 * that order.
+	 */
+	node = priv->domain_root;
+	end = host + strlen (host);
+	while (TRUE) {
+		start = end;
+		while (start > host && start[-1] != '.')
+			start--;
+
+		node = soup_cookie_domain_node_get_child (node, start, end - start, FALSE);
+		if (!node)
+			break;
+
+		domains[0] = node->subdomains;
+		domains[1] = start == host ? node->host : NULL;
+		for (i = 0; i < G_N_ELEMENTS (domains); i++) {
+			gboolean matched = FALSE;
+
+			if (!domains[i])
+				continue;
+
+			for (j = 0; j < domains[i]->cookies->len; j++) {
+				SoupCookie *cookie = g_ptr_array_index (domains[i]->cookies, j);
+
+				if (soup_cookie_applies_to_uri (cookie, uri) &&
+				    cookie_is_valid_for_same_site_policy (cookie, is_safe_method, uri, top_level,
+									  site_for_cookies, is_top_level_navigation,
+									  for_http) &&
+				    (for_http || !soup_cookie_get_http_only (cookie))) {
+					g_ptr_array_add (cookies, cookie);
+					matched = TRUE;
+				}
+			}
+			if (matched)
+				n_domains++;
 		}
-		cur = next_domain;
-		if (cur)
-			next_domain = strchr (cur + 1, '.');
-	} while (cur);
-	g_free (domain);
 
-	for (p = cookies_to_remove; p; p = p->next) {
-		SoupCookie *cookie = p->data;
+		if (start == host)
+			break;
+		end = start - 1;
+	}
+
+	/* The cookies of each domain are already sorted */
+	if (n_domains > 1)
+		g_ptr_array_sort_with_data (cookies, compare_cookies_indirect, jar);
 
-		soup_cookie_jar_changed (jar, cookie, NULL);
-		soup_cookie_free (cookie);
+	for (i = cookies->len; i > 0; i--) {
+		SoupCookie *cookie = g_ptr_array_index (cookies, i - 1);
+
+		result = g_slist_prepend (result, copy_cookies ? soup_cookie_copy (cookie) : cookie);
+	}
+
+        g_mutex_unlock (&priv->mutex);
+
+	g_ptr_array_free (cookies, TRUE);
+
+	return result;
+}
+
+/* Publishes a new header snapshot with the headers added to
+ * header_cache, must be called with the mutex held.
+ */
+static void
+publish_header_snapshot (SoupCookieJarPrivate *priv)
+{
+	SoupCookieHeaderSnapshot *old_snapshot, *snapshot;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	old_snapshot = soup_rcu_pointer_get (&priv->header_snapshot);
+
+	snapshot = g_new (SoupCookieHeaderSnapshot, 1);
+	snapshot->headers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	/* Until the first expiration, which might be of a cookie
+	 * already removed.
+	 */
+	snapshot->valid_until = priv->expiry_heap->len ? EXPIRY_AT (priv->expiry_heap, 0)->expires : G_MAXINT64;
+
+	if (old_snapshot &&
+	    g_hash_table_size (old_snapshot->headers) + g_hash_table_size (priv->header_cache) <= MAX_CACHED_HEADERS) {
+		g_hash_table_iter_init (&iter, old_snapshot->headers);
+		while (g_hash_table_iter_next (&iter, &key, &value))
+			g_hash_table_insert (snapshot->headers, g_strdup (key), g_strdup (value));
+	}
+
+	g_hash_table_iter_init (&iter, priv->header_cache);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_hash_table_iter_steal (&iter);
+		g_hash_table_replace (snapshot->headers, key, value);
+	}
+
+	soup_rcu_pointer_replace (&priv->header_snapshot, snapshot);
+}
+
+/* Returns the Cookie header for the request, the result is cached
+ * until the jar changes.
+ */
+static char *
+get_cookie_header (SoupCookieJar *jar,
+		   GUri          *uri,
+		   GUri          *top_level,
+		   GUri          *site_for_cookies,
+		   gboolean       is_safe_method,
+		   gboolean       for_http,
+		   gboolean       is_top_level_navigation)
+{
+	SoupCookieJarPrivate *priv = soup_cookie_jar_get_instance_private (jar);
+	SoupCookieHeaderSnapshot *snapshot;
+	GSList *cookies;
+	char *key, *header;
+	gboolean same_site, found;
+	guint generation, slot;
+
+	if (!g_uri_get_host (uri))
+		return NULL;
+
+	/* Everything cookie_is_valid_for_same_site_policy() and
+	 * soup_cookie_applies_to_uri() depend on.
+	 */
+	same_site = site_for_cookies &&
+		!g_ascii_strcasecmp (g_uri_get_host (site_for_cookies), g_uri_get_host (uri));
+	key = g_strdup_printf ("%d%d%d%d%d%d%d %s %s",
+			       soup_uri_is_https (uri), for_http, is_safe_method,
+			       is_top_level_navigation, top_level != NULL,
+			       site_for_cookies != NULL, same_site,
+			       g_uri_get_host (uri), g_uri_get_path (uri));
+
+	/* Requests that were already seen do not take the mutex */
+	snapshot = soup_rcu_pointer_read_lock (&priv->header_snapshot, &slot);
+	found = snapshot && time (NULL) <= snapshot->valid_until &&
+		g_hash_table_lookup_extended (snapshot->headers, key, NULL, (gpointer *)&header);
+	if (found)
+		header = g_strdup (header);
+	soup_rcu_pointer_read_unlock (&priv->header_snapshot, slot);
+	if (found) {
+		g_free (key);
+		return header;
 	}
-	g_slist_free (cookies_to_remove);
 
+        g_mutex_lock (&priv->mutex);
+	remove_expired_cookies (jar);
+	snapshot = soup_rcu_pointer_get (&priv->header_snapshot);
+	if (snapshot && time (NULL) > snapshot->valid_until)
+		publish_header_snapshot (priv);
+	if (g_hash_table_lookup_extended (priv->header_cache, key, NULL, (gpointer *)&header)) {
+		header = g_strdup (header);
+		g_mutex_unlock (&priv->mutex);
+		g_free (key);
+		return header;
+	}
+	generation = priv->header_generation;
         g_mutex_unlock (&priv->mutex);
 
-	return g_slist_sort_with_data (cookies, compare_cookies, jar);
+	cookies = get_cookies (jar, uri, top_level, site_for_cookies, is_safe_method,
+			       for_http, is_top_level_navigation, TRUE);
+	header = cookies ? soup_cookies_to_cookie_header (cookies) : NULL;
+	if (header && !*header)
+		g_clear_pointer (&header, g_free);
+	g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
+
+	/* The header is not cached if the jar changed meanwhile, but
+	 * it is still valid for the request.
+	 */
+        g_mutex_lock (&priv->mutex);
+	if (generation == priv->header_generation) {
+		if (g_hash_table_size (priv->header_cache) >= MAX_CACHED_HEADERS)
+			g_hash_table_remove_all (priv->header_cache);
+		g_hash_table_replace (priv->header_cache, key, g_strdup (header));
+
+		/* Batched so that publishing stays cheap on average */
+		snapshot = soup_rcu_pointer_get (&priv->header_snapshot);
+		if (!snapshot || g_hash_table_size (priv->header_cache) > g_hash_table_size (snapshot->headers) / 8)
+			publish_header_snapshot (priv);
+	} else
+		g_free (key);
+        g_mutex_unlock (&priv->mutex);
+
+	return header;
 }
 
 /**
@@ -413,24 +877,10 @@ char *
 soup_cookie_jar_get_cookies (SoupCookieJar *jar, GUri *uri,
 			     gboolean for_http)
 {
-	GSList *cookies;
-
 	g_return_val_if_fail (SOUP_IS_COOKIE_JAR (jar), NULL);
 	g_return_val_if_fail (uri != NULL, NULL);
 
-	cookies = get_cookies (jar, uri, NULL, NULL, TRUE, for_http, FALSE, FALSE);
-
-	if (cookies) {
-		char *result = soup_cookies_to_cookie_header (cookies);
-		g_slist_free (cookies);
-
-		if (!*result) {
-			g_free (result);
-			result = NULL;
-		}
-		return result;
-	} else
-		return NULL;
+	return get_cookie_header (jar, uri, NULL, NULL, TRUE, for_http, FALSE);
 }
 
 /**
@@ -558,7 +1008,7 @@ incoming_cookie_is_third_party (SoupCookieJar            *jar,
 	 */
 	priv = soup_cookie_jar_get_instance_private (jar);
         g_mutex_lock (&priv->mutex);
-	retval = !g_hash_table_lookup (priv->domains, soup_cookie_get_domain (cookie));
+	retval = !lookup_domain (priv, soup_cookie_get_domain (cookie), FALSE);
         g_mutex_unlock (&priv->mutex);
 
         return retval;
@@ -604,8 +1054,9 @@ void
 soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *uri, GUri *first_party)
 {
 	SoupCookieJarPrivate *priv;
-	GSList *old_cookies, *oc, *last = NULL;
+	SoupCookieDomain *cookie_domain;
 	SoupCookie *old_cookie;
+	guint i;
 
 	g_return_if_fail (SOUP_IS_COOKIE_JAR (jar));
 	g_return_if_fail (cookie != NULL);
@@ -677,12 +1128,12 @@ soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *u
 	
         g_mutex_lock (&priv->mutex);
 
-	old_cookies = g_hash_table_lookup (priv->domains, soup_cookie_get_domain (cookie));
-	for (oc = old_cookies; oc; oc = oc->next) {
-		old_cookie = oc->data;
+	cookie_domain = lookup_domain (priv, soup_cookie_get_domain (cookie), FALSE);
+	for (i = 0; cookie_domain && i < cookie_domain->cookies->len; i++) {
+		old_cookie = g_ptr_array_index (cookie_domain->cookies, i);
 		if (!strcmp (soup_cookie_get_name (cookie), soup_cookie_get_name (old_cookie)) &&
 		    !g_strcmp0 (soup_cookie_get_path (cookie), soup_cookie_get_path (old_cookie))) {
-			if (soup_cookie_get_secure (oc->data) && uri != NULL && !soup_uri_is_https (uri)) {
+			if (soup_cookie_get_secure (old_cookie) && uri != NULL && !soup_uri_is_https (uri)) {
 				/* We do not allow overwriting secure cookies from an insecure origin
 				 * https://tools.ietf.org/html/draft-ietf-httpbis-cookie-alone-01
 				 */
@@ -693,15 +1144,15 @@ soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *u
 				 * of telling us that we have to
 				 * remove the cookie.
 				 */
-				old_cookies = g_slist_delete_link (old_cookies, oc);
-				g_hash_table_insert (priv->domains,
-						     g_strdup (soup_cookie_get_domain (cookie)),
-						     old_cookies);
+				g_ptr_array_steal_index (cookie_domain->cookies, i);
+				if (cookie_domain->cookies->len == 0)
+					remove_domain (priv, cookie_domain);
 				soup_cookie_jar_changed (jar, old_cookie, NULL);
 				soup_cookie_free (old_cookie);
 				soup_cookie_free (cookie);
 			} else {
-				oc->data = cookie;
+				g_ptr_array_steal_index (cookie_domain->cookies, i);
+				cookie_domain_add_cookie (cookie_domain, cookie);
 				soup_cookie_jar_changed (jar, old_cookie, cookie);
 				soup_cookie_free (old_cookie);
 			}
@@ -710,7 +1161,6 @@ soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *u
 
 			return;
 		}
-		last = oc;
 	}
 
 	/* The new cookie is... a new cookie */
@@ -720,13 +1170,8 @@ soup_cookie_jar_add_cookie_full (SoupCookieJar *jar, SoupCookie *cookie, GUri *u
 		return;
 	}
 
-	if (last)
-		last->next = g_slist_append (NULL, cookie);
-	else {
-		old_cookies = g_slist_append (NULL, cookie);
-		g_hash_table_insert (priv->domains, g_strdup (soup_cookie_get_domain (cookie)),
-				     old_cookies);
-	}
+	cookie_domain = lookup_domain (priv, soup_cookie_get_domain (cookie), TRUE);
+	cookie_domain_add_cookie (cookie_domain, cookie);
 
 	soup_cookie_jar_changed (jar, NULL, cookie);
 
@@ -883,19 +1328,17 @@ static void
 msg_starting_cb (SoupMessage *msg, gpointer feature)
 {
 	SoupCookieJar *jar = SOUP_COOKIE_JAR (feature);
-	GSList *cookies;
-
-	cookies = soup_cookie_jar_get_cookie_list_with_same_site_info (jar, soup_message_get_uri (msg),
-	                                                               soup_message_get_first_party (msg),
-							               soup_message_get_site_for_cookies (msg),
-								       TRUE,
-							               SOUP_METHOD_IS_SAFE (soup_message_get_method (msg)),
-							               soup_message_get_is_top_level_navigation (msg));
-	if (cookies != NULL) {
-		char *cookie_header = soup_cookies_to_cookie_header (cookies);
+	char *cookie_header;
+
+	cookie_header = get_cookie_header (jar, soup_message_get_uri (msg),
+					   soup_message_get_first_party (msg),
+					   soup_message_get_site_for_cookies (msg),
+					   SOUP_METHOD_IS_SAFE (soup_message_get_method (msg)),
+					   TRUE,
+					   soup_message_get_is_top_level_navigation (msg));
+	if (cookie_header != NULL) {
 		soup_message_headers_replace_common (soup_message_get_request_headers (msg), SOUP_HEADER_COOKIE, cookie_header);
 		g_free (cookie_header);
-		g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
 	} else {
 		soup_message_headers_remove_common (soup_message_get_request_headers (msg), SOUP_HEADER_COOKIE);
 	}
@@ -952,7 +1395,8 @@ soup_cookie_jar_all_cookies (SoupCookieJar *jar)
 	SoupCookieJarPrivate *priv;
 	GHashTableIter iter;
 	GSList *l = NULL;
-	gpointer key, value;
+	SoupCookieDomain *cookie_domain;
+	guint i;
 
 	g_return_val_if_fail (SOUP_IS_COOKIE_JAR (jar), NULL);
 
@@ -962,10 +1406,9 @@ soup_cookie_jar_all_cookies (SoupCookieJar *jar)
 
 	g_hash_table_iter_init (&iter, priv->domains);
 
-	while (g_hash_table_iter_next (&iter, &key, &value)) {
-		GSList *p, *cookies = value;
-		for (p = cookies; p; p = p->next)
-			l = g_slist_prepend (l, soup_cookie_copy (p->data));
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&cookie_domain)) {
+		for (i = 0; i < cookie_domain->cookies->len; i++)
+			l = g_slist_prepend (l, soup_cookie_copy (g_ptr_array_index (cookie_domain->cookies, i)));
 	}
 
         g_mutex_unlock (&priv->mutex);
@@ -987,7 +1430,8 @@ soup_cookie_jar_delete_cookie (SoupCookieJar *jar,
 			       SoupCookie    *cookie)
 {
 	SoupCookieJarPrivate *priv;
-	GSList *cookies, *p;
+	SoupCookieDomain *cookie_domain;
+	guint i;
 
 	g_return_if_fail (SOUP_IS_COOKIE_JAR (jar));
 	g_return_if_fail (cookie != NULL);
@@ -996,19 +1440,18 @@ soup_cookie_jar_delete_cookie (SoupCookieJar *jar,
 
         g_mutex_lock (&priv->mutex);
 
-	cookies = g_hash_table_lookup (priv->domains, soup_cookie_get_domain (cookie));
-	if (cookies == NULL) {
+	cookie_domain = lookup_domain (priv, soup_cookie_get_domain (cookie), FALSE);
+	if (cookie_domain == NULL) {
                 g_mutex_unlock (&priv->mutex);
 		return;
         }
 
-	for (p = cookies; p; p = p->next ) {
-		SoupCookie *c = (SoupCookie*)p->data;
+	for (i = 0; i < cookie_domain->cookies->len; i++) {
+		SoupCookie *c = g_ptr_array_index (cookie_domain->cookies, i);
 		if (soup_cookie_equal (cookie, c)) {
-			cookies = g_slist_delete_link (cookies, p);
-			g_hash_table_insert (priv->domains,
-					     g_strdup (soup_cookie_get_domain (cookie)),
-					     cookies);
+			g_ptr_array_steal_index (cookie_domain->cookies, i);
+			if (cookie_domain->cookies->len == 0)
+				remove_domain (priv, cookie_domain);
 			soup_cookie_jar_changed (jar, c, NULL);
 			soup_cookie_free (c);
                         g_mutex_unlock (&priv->mutex);
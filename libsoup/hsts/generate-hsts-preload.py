@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+#
+# Generates the HSTS preload list read by SoupHSTSEnforcer from a
+# Chromium transport_security_state_static.json file, or from a text
+# file with a domain per line optionally followed by "include_subdomains".
+
+import json
+import re
+import struct
+import sys
+
+MAGIC = b'SOUPHSTS'
+VERSION = 1
+INCLUDE_SUBDOMAINS = 1 << 0
+
+def to_unicode(domain):
+    # SoupHSTSEnforcer matches hosts in their unicode form
+    try:
+        return domain.encode('ascii').decode('idna')
+    except UnicodeError:
+        return domain
+
+def read_json(path):
+    with open(path, encoding='utf-8') as f:
+        # The Chromium file has // comments
+        contents = re.sub(r'^\s*//.*$', '', f.read(), flags=re.MULTILINE)
+    for entry in json.loads(contents)['entries']:
+        if entry.get('mode') != 'force-https':
+            continue
+        yield entry['name'], entry.get('include_subdomains', False)
+
+def read_text(path):
+    with open(path, encoding='utf-8') as f:
+        for line in f:
+            fields = line.split('#', 1)[0].split()
+            if not fields:
+                continue
+            yield fields[0], len(fields) > 1 and fields[1] == 'include_subdomains'
+
+input_file = sys.argv[1]
+output_file = sys.argv[2]
+
+reader = read_json if input_file.endswith('.json') else read_text
+domains = {}
+for name, include_subdomains in reader(input_file):
+    # Reversed byte by byte and only ASCII lowercased, like the lookups
+    key = to_unicode(name.strip('.')).encode('utf-8').lower()[::-1]
+    domains[key] = domains.get(key, False) or include_subdomains
+
+entries = sorted(domains.items())
+header_size = len(MAGIC) + 8 + 4 * len(entries)
+offsets = []
+data = bytearray()
+for key, include_subdomains in entries:
+    offsets.append(header_size + len(data))
+    data.append(INCLUDE_SUBDOMAINS if include_subdomains else 0)
+    data += key + b'\0'
+
+with open(output_file, 'wb') as f:
+    f.write(MAGIC)
+    f.write(struct.pack('<II', VERSION, len(entries)))
+    f.write(struct.pack('<%dI' % len(offsets), *offsets))
+    f.write(data)
@@ -16,6 +16,8 @@
 #include <sqlite3.h>
 
 #include "soup-hsts-enforcer-db.h"
+#include "soup-hsts-enforcer-private.h"
+#include "soup-db-writer.h"
 #include "soup.h"
 
 /**
@@ -25,12 +27,31 @@
  *
  * #SoupHSTSEnforcerDB is a [class@HSTSEnforcer] that uses a SQLite
  * database as a backend for persistency.
+ *
+ * Changes are not written immediately: they are queued per host and
+ * written in a single transaction from a background thread, either after
+ * a short delay or once enough changes are pending. Use
+ * [method@HSTSEnforcerDB.flush] to write them synchronously. A policy
+ * refreshed with the same directives is not written again until its
+ * expiration moved significantly, so sites sending
+ * `Strict-Transport-Security` in every response do not cause a write per
+ * response.
+ *
+ * By default all the stored policies are loaded at construction. When
+ * [property@HSTSEnforcerDB:lazy-load] is set, the policies of a host are
+ * only read from the database the first time the host is checked; then
+ * [method@HSTSEnforcer.get_domains] and [method@HSTSEnforcer.get_policies]
+ * only return the policies loaded so far.
  **/
 
+#define EXPIRY_UPDATE_THRESHOLD (24 * 60 * 60) /* Expiration changes that are not written, in seconds */
+#define MAX_LOADED_DOMAINS 4096                /* Domains remembered as looked up with lazy loading */
+
 enum {
 	PROP_0,
 
 	PROP_FILENAME,
+	PROP_LAZY_LOAD,
 
 	LAST_PROPERTY
 };
@@ -43,17 +64,67 @@ struct _SoupHSTSEnforcerDB {
 
 typedef struct {
 	char *filename;
+	gboolean lazy_load;
 	sqlite3 *db;
+	sqlite3_stmt *insert_stmt;
+	sqlite3_stmt *delete_stmt;
+	sqlite3_stmt *select_stmt;
+
+	/* The writer database lock is held while using db, and taken
+	 * before the enforcer and the pending lock.
+	 */
+	SoupDBWriter *writer; /* pending: host -> SoupHSTSPolicy to write, or NULL to delete */
+
+	/* Checked on every request, so not behind the database lock */
+	GMutex loaded_mutex;
+	GHashTable *loaded_domains; /* domain -> link in loaded_lru */
+	GQueue loaded_lru;          /* Most recently checked domains first */
+
+	/* Protected by the pending lock */
+	GHashTable *stored;  /* host -> SoupHSTSPolicy as stored once pending is written */
 } SoupHSTSEnforcerDBPrivate;
 
 G_DEFINE_FINAL_TYPE_WITH_CODE (SoupHSTSEnforcerDB, soup_hsts_enforcer_db, SOUP_TYPE_HSTS_ENFORCER,
 			       G_ADD_PRIVATE(SoupHSTSEnforcerDB))
 
 static void load (SoupHSTSEnforcer *hsts_enforcer);
+static void load_domain (SoupHSTSEnforcer *hsts_enforcer, const char *domain);
+static sqlite3 *open_for_write (gpointer user_data);
+static void write_policy (sqlite3 *db, const char *host, gpointer policy, gpointer user_data);
+
+static void
+pending_policy_free (SoupHSTSPolicy *policy)
+{
+	if (policy)
+		soup_hsts_policy_free (policy);
+}
 
 static void
 soup_hsts_enforcer_db_init (SoupHSTSEnforcerDB *db)
 {
+        SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private (db);
+
+	priv->writer = soup_db_writer_new ("SoupHSTSEnforcerDB",
+					   (GDestroyNotify) pending_policy_free,
+					   open_for_write, write_policy, db);
+	priv->stored = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+					      (GDestroyNotify) soup_hsts_policy_free);
+	g_mutex_init (&priv->loaded_mutex);
+	g_queue_init (&priv->loaded_lru);
+}
+
+static void
+soup_hsts_enforcer_db_constructed (GObject *object)
+{
+        SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)object);
+
+	G_OBJECT_CLASS (soup_hsts_enforcer_db_parent_class)->constructed (object);
+
+	if (priv->lazy_load) {
+		priv->loaded_domains = g_hash_table_new (g_str_hash, g_str_equal);
+		soup_hsts_enforcer_set_load_func (SOUP_HSTS_ENFORCER (object), load_domain);
+	} else
+		load (SOUP_HSTS_ENFORCER (object));
 }
 
 static void
@@ -61,8 +132,17 @@ soup_hsts_enforcer_db_finalize (GObject *object)
 {
         SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)object);
 
+	soup_db_writer_free (priv->writer);
+
 	g_free (priv->filename);
-	sqlite3_close (priv->db);
+	g_clear_pointer (&priv->insert_stmt, sqlite3_finalize);
+	g_clear_pointer (&priv->delete_stmt, sqlite3_finalize);
+	g_clear_pointer (&priv->select_stmt, sqlite3_finalize);
+	g_clear_pointer (&priv->db, sqlite3_close);
+	g_clear_pointer (&priv->loaded_domains, g_hash_table_destroy);
+	g_queue_clear_full (&priv->loaded_lru, g_free);
+	g_mutex_clear (&priv->loaded_mutex);
+	g_hash_table_destroy (priv->stored);
 
 	G_OBJECT_CLASS (soup_hsts_enforcer_db_parent_class)->finalize (object);
 }
@@ -76,7 +156,9 @@ soup_hsts_enforcer_db_set_property (GObject *object, guint prop_id,
 	switch (prop_id) {
 	case PROP_FILENAME:
 		priv->filename = g_value_dup_string (value);
-		load (SOUP_HSTS_ENFORCER (object));
+		break;
+	case PROP_LAZY_LOAD:
+		priv->lazy_load = g_value_get_boolean (value);
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -94,6 +176,9 @@ soup_hsts_enforcer_db_get_property (GObject *object, guint prop_id,
 	case PROP_FILENAME:
 		g_value_set_string (value, priv->filename);
 		break;
+	case PROP_LAZY_LOAD:
+		g_value_set_boolean (value, priv->lazy_load);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -126,9 +211,10 @@ soup_hsts_enforcer_db_new (const char *filename)
 }
 
 #define QUERY_ALL "SELECT id, host, max_age, expiry, include_subdomains FROM soup_hsts_policies;"
+#define QUERY_HOST "SELECT id, host, max_age, expiry, include_subdomains FROM soup_hsts_policies WHERE host=?1;"
 #define CREATE_TABLE "CREATE TABLE soup_hsts_policies (id INTEGER PRIMARY KEY, host TEXT UNIQUE, max_age INTEGER, expiry INTEGER, include_subdomains INTEGER)"
-#define QUERY_INSERT "INSERT OR REPLACE INTO soup_hsts_policies VALUES((SELECT id FROM soup_hsts_policies WHERE host=%Q), %Q, %lu, %lu, %u);"
-#define QUERY_DELETE "DELETE FROM soup_hsts_policies WHERE host=%Q;"
+#define QUERY_INSERT "INSERT OR REPLACE INTO soup_hsts_policies (host, max_age, expiry, include_subdomains) VALUES(?1, ?2, ?3, ?4);"
+#define QUERY_DELETE "DELETE FROM soup_hsts_policies WHERE host=?1;"
 
 enum {
 	COL_ID,
@@ -139,38 +225,44 @@ enum {
 	N_COL,
 };
 
-static int
-query_all_callback (void *data, int argc, char **argv, char **colname)
+/* Called with the database lock held, or at construction */
+static void
+add_stored_policy (SoupHSTSEnforcer *hsts_enforcer,
+		   const char       *host,
+		   gulong            max_age,
+		   gulong            expire_time,
+		   gboolean          include_subdomains)
 {
-	SoupHSTSPolicy *policy = NULL;
-	SoupHSTSEnforcer *hsts_enforcer = SOUP_HSTS_ENFORCER (data);
-
-	char *host;
-	gulong expire_time;
-	unsigned long max_age;
-	time_t now;
+	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)hsts_enforcer);
+	SoupHSTSPolicy *policy;
 	GDateTime *expires;
-	gboolean include_subdomains = FALSE;
-
-	now = time (NULL);
 
-	host = argv[COL_HOST];
-	expire_time = strtoul (argv[COL_EXPIRY], NULL, 10);
-
-	if (now >= expire_time)
-		return 0;
+	if (time (NULL) >= expire_time)
+		return;
 
 	expires = g_date_time_new_from_unix_utc (expire_time);
-	max_age = strtoul (argv[COL_MAX_AGE], NULL, 10);
-	include_subdomains = (g_strcmp0 (argv[COL_SUBDOMAINS], "1") == 0);
-
 	policy = soup_hsts_policy_new_full (host, max_age, expires, include_subdomains);
+	g_date_time_unref (expires);
+	if (!policy)
+		return;
 
-	if (policy) {
-		soup_hsts_enforcer_set_policy (hsts_enforcer, policy);
-		soup_hsts_policy_free (policy);
-	} else
-		g_date_time_unref (expires);
+	soup_db_writer_lock_pending (priv->writer);
+	g_hash_table_replace (priv->stored, g_strdup (soup_hsts_policy_get_domain (policy)),
+			      soup_hsts_policy_copy (policy));
+	soup_db_writer_unlock_pending (priv->writer, FALSE);
+
+	soup_hsts_enforcer_add_loaded_policy (hsts_enforcer, policy);
+	soup_hsts_policy_free (policy);
+}
+
+static int
+query_all_callback (void *data, int argc, char **argv, char **colname)
+{
+	add_stored_policy (SOUP_HSTS_ENFORCER (data),
+			   argv[COL_HOST],
+			   strtoul (argv[COL_MAX_AGE], NULL, 10),
+			   strtoul (argv[COL_EXPIRY], NULL, 10),
+			   g_strcmp0 (argv[COL_SUBDOMAINS], "1") == 0);
 
 	return 0;
 }
@@ -248,47 +340,196 @@ load (SoupHSTSEnforcer *hsts_enforcer)
 	exec_query_with_try_create_table (priv->db, QUERY_ALL, query_all_callback, hsts_enforcer);
 }
 
+/* Returns whether @domain was already looked up, and makes it the
+ * most recently checked one.
+ */
+static gboolean
+domain_is_loaded (SoupHSTSEnforcerDBPrivate *priv,
+		  const char                *domain)
+{
+	GList *link;
+
+	g_mutex_lock (&priv->loaded_mutex);
+	link = g_hash_table_lookup (priv->loaded_domains, domain);
+	if (link) {
+		g_queue_unlink (&priv->loaded_lru, link);
+		g_queue_push_head_link (&priv->loaded_lru, link);
+	}
+	g_mutex_unlock (&priv->loaded_mutex);
+
+	return link != NULL;
+}
+
+/* Forgets the least recently checked domains one at a time, so that
+ * they are not all looked up again at once.
+ */
+static void
+mark_domain_loaded (SoupHSTSEnforcerDBPrivate *priv,
+		    const char                *domain)
+{
+	GList *link;
+
+	g_mutex_lock (&priv->loaded_mutex);
+	if (g_queue_get_length (&priv->loaded_lru) >= MAX_LOADED_DOMAINS) {
+		link = g_queue_pop_tail_link (&priv->loaded_lru);
+		g_hash_table_remove (priv->loaded_domains, link->data);
+		g_free (link->data);
+		g_list_free_1 (link);
+	}
+	g_queue_push_head (&priv->loaded_lru, g_strdup (domain));
+	g_hash_table_insert (priv->loaded_domains, priv->loaded_lru.head->data, priv->loaded_lru.head);
+	g_mutex_unlock (&priv->loaded_mutex);
+}
+
+static void
+load_domain (SoupHSTSEnforcer *hsts_enforcer,
+	     const char       *domain)
+{
+	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)hsts_enforcer);
+	gboolean is_pending;
+
+	if (domain_is_loaded (priv, domain))
+		return;
+
+	/* The database lock is kept until the policy is added, so
+	 * that the policy cannot be removed from the enforcer before that.
+	 * The domain is only marked as loaded then, so concurrent checks
+	 * wait for it here.
+	 */
+	soup_db_writer_lock (priv->writer);
+
+	if (domain_is_loaded (priv, domain)) {
+		soup_db_writer_unlock (priv->writer);
+		return;
+	}
+
+	/* The enforcer already has the latest policy of pending hosts */
+	is_pending = g_hash_table_contains (soup_db_writer_lock_pending (priv->writer), domain);
+	soup_db_writer_unlock_pending (priv->writer, FALSE);
+
+	if (!is_pending && (priv->db || !open_db (hsts_enforcer))) {
+		if (!priv->select_stmt)
+			priv->select_stmt = soup_db_prepare_statement (priv->db, QUERY_HOST, CREATE_TABLE);
+		if (priv->select_stmt) {
+			sqlite3_stmt *stmt = priv->select_stmt;
+
+			sqlite3_bind_text (stmt, 1, domain, -1, SQLITE_STATIC);
+			if (sqlite3_step (stmt) == SQLITE_ROW) {
+				add_stored_policy (hsts_enforcer,
+						   (const char *)sqlite3_column_text (stmt, COL_HOST),
+						   (gulong)sqlite3_column_int64 (stmt, COL_MAX_AGE),
+						   (gulong)sqlite3_column_int64 (stmt, COL_EXPIRY),
+						   sqlite3_column_int (stmt, COL_SUBDOMAINS) == 1);
+			}
+			sqlite3_reset (stmt);
+			sqlite3_clear_bindings (stmt);
+		}
+	}
+
+	mark_domain_loaded (priv, domain);
+	soup_db_writer_unlock (priv->writer);
+}
+
+/* Called by the writer, with its database lock held */
+static sqlite3 *
+open_for_write (gpointer user_data)
+{
+	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)user_data);
+
+	if (priv->db == NULL && open_db (SOUP_HSTS_ENFORCER (user_data)))
+		return NULL;
+
+	if (!priv->delete_stmt)
+		priv->delete_stmt = soup_db_prepare_statement (priv->db, QUERY_DELETE, CREATE_TABLE);
+	if (!priv->insert_stmt)
+		priv->insert_stmt = soup_db_prepare_statement (priv->db, QUERY_INSERT, CREATE_TABLE);
+	if (!priv->delete_stmt || !priv->insert_stmt)
+		return NULL;
+
+	return priv->db;
+}
+
+static void
+write_policy (sqlite3    *db,
+	      const char *host,
+	      gpointer    data,
+	      gpointer    user_data)
+{
+	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)user_data);
+	SoupHSTSPolicy *policy = data;
+	sqlite3_stmt *stmt;
+
+	if (!policy) {
+		sqlite3_bind_text (priv->delete_stmt, 1, host, -1, SQLITE_STATIC);
+		soup_db_step_statement (db, priv->delete_stmt);
+		return;
+	}
+
+	stmt = priv->insert_stmt;
+	sqlite3_bind_text (stmt, 1, host, -1, SQLITE_STATIC);
+	sqlite3_bind_int64 (stmt, 2, soup_hsts_policy_get_max_age (policy));
+	sqlite3_bind_int64 (stmt, 3, g_date_time_to_unix (soup_hsts_policy_get_expires (policy)));
+	sqlite3_bind_int (stmt, 4, soup_hsts_policy_includes_subdomains (policy));
+	soup_db_step_statement (db, stmt);
+}
+
+/* Whether @policy only differs from the stored one by an expiration
+ * slightly later, which happens every time a known host sends the
+ * header again.
+ */
+static gboolean
+is_stored (SoupHSTSEnforcerDBPrivate *priv,
+	   SoupHSTSPolicy            *policy)
+{
+	SoupHSTSPolicy *stored;
+	gint64 expiry, stored_expiry, threshold;
+
+	stored = g_hash_table_lookup (priv->stored, soup_hsts_policy_get_domain (policy));
+	if (!stored ||
+	    soup_hsts_policy_get_max_age (stored) != soup_hsts_policy_get_max_age (policy) ||
+	    soup_hsts_policy_includes_subdomains (stored) != soup_hsts_policy_includes_subdomains (policy))
+		return FALSE;
+
+	expiry = g_date_time_to_unix (soup_hsts_policy_get_expires (policy));
+	stored_expiry = g_date_time_to_unix (soup_hsts_policy_get_expires (stored));
+	threshold = MIN (EXPIRY_UPDATE_THRESHOLD, (gint64)soup_hsts_policy_get_max_age (policy) / 2);
+
+	return expiry >= stored_expiry && expiry - stored_expiry < threshold;
+}
+
 static void
 soup_hsts_enforcer_db_changed (SoupHSTSEnforcer *hsts_enforcer,
 			       SoupHSTSPolicy   *old_policy,
 			       SoupHSTSPolicy   *new_policy)
 {
 	SoupHSTSEnforcerDBPrivate *priv = soup_hsts_enforcer_db_get_instance_private ((SoupHSTSEnforcerDB*)hsts_enforcer);
-	char *query;
+	GHashTable *pending;
+	const char *host;
+	gboolean queued = FALSE;
 
 	/* Session policies do not need to be stored in the database. */
 	if ((old_policy && soup_hsts_policy_is_session_policy (old_policy)) ||
 	    (new_policy && soup_hsts_policy_is_session_policy (new_policy)))
 		return;
 
-	if (priv->db == NULL) {
-		if (open_db (hsts_enforcer))
-			return;
-	}
-
-	if (old_policy && !new_policy) {
-		query = sqlite3_mprintf (QUERY_DELETE,
-					 soup_hsts_policy_get_domain (old_policy));
-		g_assert (query);
-		exec_query_with_try_create_table (priv->db, query, NULL, NULL);
-		sqlite3_free (query);
-	}
+	pending = soup_db_writer_lock_pending (priv->writer);
 
-	/* Insert the new policy or update the existing one. */
 	if (new_policy && soup_hsts_policy_get_expires (new_policy)) {
-		gulong expires;
-
-		expires = (gulong)g_date_time_to_unix (soup_hsts_policy_get_expires (new_policy));
-		query = sqlite3_mprintf (QUERY_INSERT,
-					 soup_hsts_policy_get_domain (new_policy),
-					 soup_hsts_policy_get_domain (new_policy),
-					 soup_hsts_policy_get_max_age (new_policy),
-					 expires,
-					 soup_hsts_policy_includes_subdomains (new_policy));
-		g_assert (query);
-		exec_query_with_try_create_table (priv->db, query, NULL, NULL);
-		sqlite3_free (query);
+		if (!is_stored (priv, new_policy)) {
+			/* Insert the new policy or update the existing one. */
+			host = soup_hsts_policy_get_domain (new_policy);
+			g_hash_table_replace (pending, g_strdup (host), soup_hsts_policy_copy (new_policy));
+			g_hash_table_replace (priv->stored, g_strdup (host), soup_hsts_policy_copy (new_policy));
+			queued = TRUE;
+		}
+	} else if (old_policy && !new_policy) {
+		host = soup_hsts_policy_get_domain (old_policy);
+		g_hash_table_replace (pending, g_strdup (host), NULL);
+		g_hash_table_remove (priv->stored, host);
+		queued = TRUE;
 	}
+
+	soup_db_writer_unlock_pending (priv->writer, queued);
 }
 
 static gboolean
@@ -297,20 +538,6 @@ soup_hsts_enforcer_db_is_persistent (SoupHSTSEnforcer *hsts_enforcer)
 	return TRUE;
 }
 
-static gboolean
-soup_hsts_enforcer_db_has_valid_policy (SoupHSTSEnforcer *hsts_enforcer,
-					const char *domain)
-{
-	/* TODO: In the future we should not load the full contents of
-	   this database into the enforcer, and instead query the
-	   database on request here. Loading the entire database for a
-	   potentially large amount of domains is probably not the
-	   best approach.
-	*/
-
-	return SOUP_HSTS_ENFORCER_CLASS (soup_hsts_enforcer_db_parent_class)->has_valid_policy (hsts_enforcer, domain);
-}
-
 static void
 soup_hsts_enforcer_db_class_init (SoupHSTSEnforcerDBClass *db_class)
 {
@@ -319,9 +546,9 @@ soup_hsts_enforcer_db_class_init (SoupHSTSEnforcerDBClass *db_class)
 	GObjectClass *object_class = G_OBJECT_CLASS (db_class);
 
 	hsts_enforcer_class->is_persistent = soup_hsts_enforcer_db_is_persistent;
-	hsts_enforcer_class->has_valid_policy = soup_hsts_enforcer_db_has_valid_policy;
 	hsts_enforcer_class->changed       = soup_hsts_enforcer_db_changed;
 
+	object_class->constructed  = soup_hsts_enforcer_db_constructed;
 	object_class->finalize     = soup_hsts_enforcer_db_finalize;
 	object_class->set_property = soup_hsts_enforcer_db_set_property;
 	object_class->get_property = soup_hsts_enforcer_db_get_property;
@@ -339,5 +566,46 @@ soup_hsts_enforcer_db_class_init (SoupHSTSEnforcerDBClass *db_class)
 				     G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
 				     G_PARAM_STATIC_STRINGS);
 
+	/**
+	 * SoupHSTSEnforcerDB:lazy-load:
+	 *
+	 * Whether the policies of a host are read from the database the
+	 * first time they are needed, instead of all of them at construction.
+	 *
+	 * Since: 3.8
+	 **/
+        properties[PROP_LAZY_LOAD] =
+		g_param_spec_boolean ("lazy-load",
+				      "Lazy load",
+				      "Whether policies are loaded on demand",
+				      FALSE,
+				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+				      G_PARAM_STATIC_STRINGS);
+
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
+
+/**
+ * soup_hsts_enforcer_db_flush:
+ * @hsts_enforcer_db: a #SoupHSTSEnforcerDB
+ *
+ * Writes to the database the policies that were added, updated or
+ * removed since the last write.
+ *
+ * Policies learned from `Strict-Transport-Security` headers are only
+ * stored after a delay, so this can be used to make sure that a host just
+ * marked as HSTS is still enforced by a #SoupHSTSEnforcerDB created for
+ * the same file, or after a crash.
+ *
+ * Since: 3.8
+ **/
+void
+soup_hsts_enforcer_db_flush (SoupHSTSEnforcerDB *hsts_enforcer_db)
+{
+	SoupHSTSEnforcerDBPrivate *priv;
+
+	g_return_if_fail (SOUP_IS_HSTS_ENFORCER_DB (hsts_enforcer_db));
+
+	priv = soup_hsts_enforcer_db_get_instance_private (hsts_enforcer_db);
+	soup_db_writer_flush (priv->writer);
+}
@@ -15,6 +15,9 @@ SOUP_AVAILABLE_IN_ALL
 G_DECLARE_FINAL_TYPE (SoupHSTSEnforcerDB, soup_hsts_enforcer_db, SOUP, HSTS_ENFORCER_DB, SoupHSTSEnforcer)
 
 SOUP_AVAILABLE_IN_ALL
-SoupHSTSEnforcer *soup_hsts_enforcer_db_new (const char *filename);
+SoupHSTSEnforcer *soup_hsts_enforcer_db_new   (const char         *filename);
+
+SOUP_AVAILABLE_IN_3_8
+void              soup_hsts_enforcer_db_flush (SoupHSTSEnforcerDB *hsts_enforcer_db);
 
 G_END_DECLS
@@ -0,0 +1,24 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-hsts-enforcer-private.h: private HSTS enforcer API
+ */
+
+#pragma once
+
+#include "soup-hsts-enforcer.h"
+
+G_BEGIN_DECLS
+
+typedef void (*SoupHSTSEnforcerLoadFunc) (SoupHSTSEnforcer *hsts_enforcer,
+					  const char       *domain);
+
+void soup_hsts_enforcer_set_load_func     (SoupHSTSEnforcer        *hsts_enforcer,
+					   SoupHSTSEnforcerLoadFunc load_func);
+void soup_hsts_enforcer_add_loaded_policy (SoupHSTSEnforcer        *hsts_enforcer,
+					   SoupHSTSPolicy          *policy);
+
+gboolean soup_hsts_enforcer_must_enforce_secure_transport (SoupHSTSEnforcer *hsts_enforcer,
+							   const char       *domain);
+guint    soup_hsts_enforcer_get_n_snapshot_builds         (SoupHSTSEnforcer *hsts_enforcer);
+
+G_END_DECLS
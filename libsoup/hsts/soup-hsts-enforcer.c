@@ -11,7 +11,10 @@
 #endif
 
 #include "soup-hsts-enforcer.h"
+#include "soup-hsts-enforcer-private.h"
+#include "soup-hsts-preload.h"
 #include "soup-misc.h"
+#include "soup-rcu.h"
 #include "soup.h"
 #include "soup-session-private.h"
 #include "soup-session-feature-private.h"
@@ -43,6 +46,10 @@
  * Note that #SoupHSTSEnforcer does not support any form of long-term
  * HSTS policy persistence. See [class@HSTSEnforcerDB] for a persistent
  * enforcer.
+ *
+ * Hosts in a preload list, see [method@HSTSEnforcer.load_preload_list],
+ * are always contacted over HTTPS. A preload list can be installed with
+ * libsoup and is then loaded by every #SoupHSTSEnforcer.
  **/
 
 static void soup_hsts_enforcer_session_feature_init (SoupSessionFeatureInterface *feature_interface, gpointer interface_data);
@@ -59,13 +66,51 @@ typedef struct {
         GMutex mutex;
 	GHashTable *host_policies;
 	GHashTable *session_policies;
+
+	/* Looked up without the mutex, replaced lists are
+	 * kept until finalize for concurrent readers.
+	 */
+	SoupHSTSPreloadList *preload_list;
+	GSList *old_preload_lists;
+
+	/* Set by subclasses that load policies on demand,
+	 * called without the mutex held.
+	 */
+	SoupHSTSEnforcerLoadFunc load_func;
+
+	/* Immutable copy of the policies read without the mutex,
+	 * rebuilt by a locked read after it is cleared.
+	 */
+	SoupRcuPointer snapshot;
+	guint n_locked_reads;
+	guint n_snapshot_builds;
 } SoupHSTSEnforcerPrivate;
 
+typedef struct {
+	GHashTable *entries; /* domain -> SoupHSTSSnapshotEntry */
+} SoupHSTSSnapshot;
+
+typedef struct {
+	gboolean permanent;
+	gint64 expires;
+	gboolean include_subdomains;
+} SoupHSTSSnapshotEntry;
+
+/* Policies copied to the snapshot for each read that takes the mutex */
+#define SNAPSHOT_POLICIES_PER_READ 64
+
 G_DEFINE_TYPE_WITH_CODE (SoupHSTSEnforcer, soup_hsts_enforcer, G_TYPE_OBJECT,
 			 G_IMPLEMENT_INTERFACE (SOUP_TYPE_SESSION_FEATURE,
 						soup_hsts_enforcer_session_feature_init)
 			 G_ADD_PRIVATE(SoupHSTSEnforcer))
 
+static void
+soup_hsts_snapshot_free (SoupHSTSSnapshot *snapshot)
+{
+	g_hash_table_destroy (snapshot->entries);
+	g_free (snapshot);
+}
+
 static void
 soup_hsts_enforcer_init (SoupHSTSEnforcer *hsts_enforcer)
 {
@@ -79,6 +124,11 @@ soup_hsts_enforcer_init (SoupHSTSEnforcer *hsts_enforcer)
 								       soup_str_case_equal,
 								       g_free, NULL);
         g_mutex_init (&priv->mutex);
+	soup_rcu_pointer_init (&priv->snapshot, (GDestroyNotify)soup_hsts_snapshot_free);
+
+#ifdef HSTS_PRELOAD_LIST
+	priv->preload_list = soup_hsts_preload_list_new (HSTS_PRELOAD_LIST, NULL);
+#endif
 }
 
 static void
@@ -98,6 +148,10 @@ soup_hsts_enforcer_finalize (GObject *object)
 		soup_hsts_policy_free (value);
 	g_hash_table_destroy (priv->session_policies);
 
+	g_clear_pointer (&priv->preload_list, soup_hsts_preload_list_free);
+	g_slist_free_full (priv->old_preload_lists, (GDestroyNotify) soup_hsts_preload_list_free);
+	soup_rcu_pointer_clear (&priv->snapshot);
+
         g_mutex_clear (&priv->mutex);
 
 	G_OBJECT_CLASS (soup_hsts_enforcer_parent_class)->finalize (object);
@@ -141,6 +195,59 @@ soup_hsts_enforcer_real_has_valid_policy (SoupHSTSEnforcer *hsts_enforcer,
 	return FALSE;
 }
 
+static void
+add_policy_to_snapshot (GHashTable     *snapshot,
+			SoupHSTSPolicy *policy)
+{
+	SoupHSTSSnapshotEntry *entry;
+	GDateTime *expires;
+	const char *domain = soup_hsts_policy_get_domain (policy);
+
+	entry = g_hash_table_lookup (snapshot, domain);
+	if (!entry) {
+		entry = g_new0 (SoupHSTSSnapshotEntry, 1);
+		g_hash_table_insert (snapshot, g_strdup (domain), entry);
+	}
+
+	expires = soup_hsts_policy_get_expires (policy);
+	if (soup_hsts_policy_is_session_policy (policy) || !expires)
+		entry->permanent = TRUE;
+	else if (!soup_hsts_policy_is_expired (policy))
+		entry->expires = g_date_time_to_unix (expires);
+	entry->include_subdomains |= soup_hsts_policy_includes_subdomains (policy);
+}
+
+/* Must be called with the mutex held */
+static SoupHSTSSnapshot *
+build_snapshot (SoupHSTSEnforcerPrivate *priv)
+{
+	SoupHSTSSnapshot *snapshot;
+	GHashTableIter iter;
+	SoupHSTSPolicy *policy;
+
+	snapshot = g_new (SoupHSTSSnapshot, 1);
+	snapshot->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	g_hash_table_iter_init (&iter, priv->session_policies);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&policy))
+		add_policy_to_snapshot (snapshot->entries, policy);
+	g_hash_table_iter_init (&iter, priv->host_policies);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&policy))
+		add_policy_to_snapshot (snapshot->entries, policy);
+
+	priv->n_snapshot_builds++;
+
+	return snapshot;
+}
+
+/* Must be called with the mutex held */
+static void
+invalidate_snapshot (SoupHSTSEnforcerPrivate *priv)
+{
+	if (soup_rcu_pointer_get (&priv->snapshot))
+		soup_rcu_pointer_replace (&priv->snapshot, NULL);
+}
+
 static void
 soup_hsts_enforcer_class_init (SoupHSTSEnforcerClass *hsts_enforcer_class)
 {
@@ -213,6 +320,8 @@ should_remove_expired_host_policy (G_GNUC_UNUSED gpointer key,
 				   SoupHSTSEnforcer *enforcer)
 {
 	if (soup_hsts_policy_is_expired (policy)) {
+		invalidate_snapshot (soup_hsts_enforcer_get_instance_private (enforcer));
+
 		/* This will emit the ::changed signal before the
 		   policy is actually removed from the policies hash
 		   table, which could be problematic, or not.
@@ -248,6 +357,7 @@ soup_hsts_enforcer_remove_host_policy (SoupHSTSEnforcer *hsts_enforcer,
 		return;
 
 	g_hash_table_remove (priv->host_policies, domain);
+	invalidate_snapshot (priv);
 	soup_hsts_enforcer_changed (hsts_enforcer, policy, NULL);
 	soup_hsts_policy_free (policy);
 
@@ -275,6 +385,18 @@ soup_hsts_enforcer_replace_policy (SoupHSTSEnforcer *hsts_enforcer,
 	old_policy = g_hash_table_lookup (policies, domain);
 	g_assert (old_policy);
 
+	/* The snapshot is still right if the policy only lasts longer,
+	 * as happens every time a known host sends the header again:
+	 * readers fall back to the policies once the old expiration is
+	 * reached.
+	 */
+	if (soup_hsts_policy_includes_subdomains (old_policy) != soup_hsts_policy_includes_subdomains (new_policy) ||
+	    (soup_hsts_policy_get_expires (new_policy) &&
+	     (!soup_hsts_policy_get_expires (old_policy) ||
+	      g_date_time_compare (soup_hsts_policy_get_expires (new_policy),
+				   soup_hsts_policy_get_expires (old_policy)) < 0)))
+		invalidate_snapshot (priv);
+
 	g_hash_table_replace (policies, g_strdup (domain), soup_hsts_policy_copy (new_policy));
 	if (!soup_hsts_policy_equal (old_policy, new_policy))
 		soup_hsts_enforcer_changed (hsts_enforcer, old_policy, new_policy);
@@ -308,6 +430,7 @@ soup_hsts_enforcer_insert_policy (SoupHSTSEnforcer *hsts_enforcer,
 	g_assert (!g_hash_table_contains (policies, domain));
 
 	g_hash_table_insert (policies, g_strdup (domain), soup_hsts_policy_copy (policy));
+	invalidate_snapshot (priv);
 	soup_hsts_enforcer_changed (hsts_enforcer, NULL, policy);
 }
 
@@ -341,6 +464,10 @@ soup_hsts_enforcer_set_policy (SoupHSTSEnforcer *hsts_enforcer,
 	domain = soup_hsts_policy_get_domain (policy);
 	g_return_if_fail (domain != NULL);
 
+	/* A stored policy must be known to be replaced or removed */
+	if (priv->load_func)
+		priv->load_func (hsts_enforcer, domain);
+
         g_mutex_lock (&priv->mutex);
 
 	is_session_policy = soup_hsts_policy_is_session_policy (policy);
@@ -424,33 +551,116 @@ super_domain_of (const char *domain)
 	return iter;
 }
 
+/* Like soup_hsts_enforcer_has_valid_policy(), for domains already
+ * canonicalized and loaded, with the mutex held.
+ */
 static gboolean
+has_valid_policy_internal (SoupHSTSEnforcer *hsts_enforcer,
+			   const char       *domain)
+{
+	return SOUP_HSTS_ENFORCER_GET_CLASS (hsts_enforcer)->has_valid_policy (hsts_enforcer, domain);
+}
+
+/* Looks @domain up in the snapshot, returns %FALSE if the policies
+ * have to be checked instead.
+ */
+static gboolean
+snapshot_must_enforce (SoupHSTSEnforcerPrivate *priv,
+		       const char              *domain,
+		       gboolean                *must_enforce)
+{
+	SoupHSTSSnapshot *snapshot;
+	SoupHSTSSnapshotEntry *entry;
+	const char *super_domain = domain;
+	gboolean found = TRUE;
+	gint64 now;
+	guint slot;
+
+	snapshot = soup_rcu_pointer_read_lock (&priv->snapshot, &slot);
+	if (!snapshot) {
+		soup_rcu_pointer_read_unlock (&priv->snapshot, slot);
+		return FALSE;
+	}
+
+	now = time (NULL);
+	*must_enforce = FALSE;
+
+	entry = g_hash_table_lookup (snapshot->entries, domain);
+	while (TRUE) {
+		if (entry && (entry->include_subdomains || super_domain == domain)) {
+			if (entry->permanent || entry->expires >= now)
+				*must_enforce = TRUE;
+			else
+				found = FALSE;
+			break;
+		}
+
+		super_domain = super_domain_of (super_domain);
+		if (!super_domain)
+			break;
+		entry = g_hash_table_lookup (snapshot->entries, super_domain);
+	}
+
+	soup_rcu_pointer_read_unlock (&priv->snapshot, slot);
+
+	return found;
+}
+
+/* Whether requests to @domain, which must be canonicalized, must
+ * be upgraded to https.
+ */
+gboolean
 soup_hsts_enforcer_must_enforce_secure_transport (SoupHSTSEnforcer *hsts_enforcer,
 						  const char *domain)
 {
         SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	SoupHSTSPreloadList *preload_list;
 	const char *super_domain = domain;
+	gboolean use_snapshot, must_enforce;
 
 	g_return_val_if_fail (domain != NULL, FALSE);
 
+	preload_list = g_atomic_pointer_get (&priv->preload_list);
+	if (preload_list && soup_hsts_preload_list_must_enforce (preload_list, domain))
+		return TRUE;
+
+	if (priv->load_func) {
+		priv->load_func (hsts_enforcer, domain);
+		while ((super_domain = super_domain_of (super_domain)) != NULL)
+			priv->load_func (hsts_enforcer, super_domain);
+		super_domain = domain;
+	}
+
+	/* The snapshot can only be used if policies are not checked
+	 * by a subclass.
+	 */
+	use_snapshot = SOUP_HSTS_ENFORCER_GET_CLASS (hsts_enforcer)->has_valid_policy == soup_hsts_enforcer_real_has_valid_policy;
+	if (use_snapshot && snapshot_must_enforce (priv, domain, &must_enforce))
+		return must_enforce;
+
         g_mutex_lock (&priv->mutex);
 
-	if (soup_hsts_enforcer_has_valid_policy (hsts_enforcer, domain)) {
-                g_mutex_unlock (&priv->mutex);
-		return TRUE;
-        }
-
-	while ((super_domain = super_domain_of (super_domain)) != NULL) {
-		if (soup_hsts_enforcer_host_includes_subdomains (hsts_enforcer, super_domain) &&
-		    soup_hsts_enforcer_has_valid_policy (hsts_enforcer, super_domain)) {
-                        g_mutex_unlock (&priv->mutex);
-			return TRUE;
-                }
+	/* The snapshot is missing or out of date. Rebuilding it copies
+	 * every policy, so when policies change often it is only done
+	 * once enough reads took the mutex to pay for it.
+	 */
+	if (use_snapshot &&
+	    ++priv->n_locked_reads * SNAPSHOT_POLICIES_PER_READ >=
+	    g_hash_table_size (priv->host_policies) + g_hash_table_size (priv->session_policies)) {
+		remove_expired_host_policies (hsts_enforcer);
+		soup_rcu_pointer_replace (&priv->snapshot, build_snapshot (priv));
+		priv->n_locked_reads = 0;
+	}
+
+	must_enforce = has_valid_policy_internal (hsts_enforcer, domain);
+	while (!must_enforce && (super_domain = super_domain_of (super_domain)) != NULL) {
+		must_enforce = soup_hsts_enforcer_host_includes_subdomains (hsts_enforcer, super_domain) &&
+			has_valid_policy_internal (hsts_enforcer, super_domain);
 	}
 
         g_mutex_unlock (&priv->mutex);
 
-	return FALSE;
+	return must_enforce;
 }
 
 static void
@@ -615,6 +825,7 @@ gboolean
 soup_hsts_enforcer_has_valid_policy (SoupHSTSEnforcer *hsts_enforcer,
 				     const char *domain)
 {
+        SoupHSTSEnforcerPrivate *priv;
 	char *canonicalized = NULL;
 	gboolean retval;
 
@@ -626,6 +837,10 @@ soup_hsts_enforcer_has_valid_policy (SoupHSTSEnforcer *hsts_enforcer,
 		g_return_val_if_fail (canonicalized, FALSE);
 	}
 
+	priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	if (priv->load_func)
+		priv->load_func (hsts_enforcer, canonicalized ? canonicalized : domain);
+
 	retval = SOUP_HSTS_ENFORCER_GET_CLASS (hsts_enforcer)->has_valid_policy (hsts_enforcer,
 										 canonicalized ? canonicalized : domain);
 
@@ -705,3 +920,98 @@ soup_hsts_enforcer_get_policies (SoupHSTSEnforcer *hsts_enforcer,
 
 	return policies;
 }
+
+/**
+ * soup_hsts_enforcer_load_preload_list:
+ * @hsts_enforcer: a #SoupHSTSEnforcer
+ * @filename: the preload list file
+ * @error: return location for a #GError
+ *
+ * Loads a list of hosts that must always be contacted over HTTPS.
+ *
+ * The list replaces any preload list loaded before. It is generated with
+ * the `libsoup/hsts/generate-hsts-preload.py` script of the libsoup sources, from a
+ * Chromium `transport_security_state_static.json` file or a text file with
+ * a domain per line, optionally followed by `include_subdomains`.
+ *
+ * The file is mapped in memory rather than adding a policy per host, so
+ * large lists are cheap to load and to look up. Preloaded hosts are not
+ * returned by [method@HSTSEnforcer.get_domains] or
+ * [method@HSTSEnforcer.get_policies].
+ *
+ * Returns: %TRUE if the list was loaded, %FALSE otherwise.
+ *
+ * Since: 3.8
+ **/
+gboolean
+soup_hsts_enforcer_load_preload_list (SoupHSTSEnforcer *hsts_enforcer,
+				      const char       *filename,
+				      GError          **error)
+{
+        SoupHSTSEnforcerPrivate *priv;
+	SoupHSTSPreloadList *preload_list, *old_preload_list;
+
+	g_return_val_if_fail (SOUP_IS_HSTS_ENFORCER (hsts_enforcer), FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	preload_list = soup_hsts_preload_list_new (filename, error);
+	if (!preload_list)
+		return FALSE;
+
+        g_mutex_lock (&priv->mutex);
+	old_preload_list = priv->preload_list;
+	g_atomic_pointer_set (&priv->preload_list, preload_list);
+	if (old_preload_list)
+		priv->old_preload_lists = g_slist_prepend (priv->old_preload_lists, old_preload_list);
+        g_mutex_unlock (&priv->mutex);
+
+	return TRUE;
+}
+
+void
+soup_hsts_enforcer_set_load_func (SoupHSTSEnforcer        *hsts_enforcer,
+				  SoupHSTSEnforcerLoadFunc load_func)
+{
+        SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+
+	priv->load_func = load_func;
+}
+
+/* Adds a policy read from storage: unlike soup_hsts_enforcer_set_policy()
+ * it does not emit ::changed, and it never replaces a policy that is
+ * already known since that one is more recent.
+ */
+void
+soup_hsts_enforcer_add_loaded_policy (SoupHSTSEnforcer *hsts_enforcer,
+				      SoupHSTSPolicy   *policy)
+{
+        SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	const char *domain = soup_hsts_policy_get_domain (policy);
+
+	g_assert (!soup_hsts_policy_is_session_policy (policy));
+
+	if (soup_hsts_policy_is_expired (policy))
+		return;
+
+        g_mutex_lock (&priv->mutex);
+	if (!g_hash_table_contains (priv->host_policies, domain)) {
+		g_hash_table_insert (priv->host_policies, g_strdup (domain), soup_hsts_policy_copy (policy));
+		invalidate_snapshot (priv);
+	}
+        g_mutex_unlock (&priv->mutex);
+}
+
+/* Number of times the snapshot read without the mutex was built */
+guint
+soup_hsts_enforcer_get_n_snapshot_builds (SoupHSTSEnforcer *hsts_enforcer)
+{
+        SoupHSTSEnforcerPrivate *priv = soup_hsts_enforcer_get_instance_private (hsts_enforcer);
+	guint n_builds;
+
+        g_mutex_lock (&priv->mutex);
+	n_builds = priv->n_snapshot_builds;
+        g_mutex_unlock (&priv->mutex);
+
+	return n_builds;
+}
@@ -0,0 +1,179 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-hsts-preload.c: precompiled HSTS preload list
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <glib/gi18n-lib.h>
+
+#include "soup-hsts-preload.h"
+
+/* The list is a file generated by generate-hsts-preload.py, mapped in
+ * memory and never modified, so it can be looked up without locking:
+ *
+ *   magic      "SOUPHSTS"
+ *   version    guint32, little endian
+ *   n_entries  guint32, little endian
+ *   offsets    n_entries guint32, little endian, from the start of the file
+ *   entries    a flags byte followed by the domain, nul-terminated
+ *
+ * Domains are stored lowercase and reversed byte by byte
+ * ("moc.elpmaxe" for "example.com") and sorted, so that every super
+ * domain of a host is a prefix of the reversed host.
+ */
+
+#define HEADER_SIZE 16
+#define MAX_DOMAIN_LENGTH 255
+
+struct _SoupHSTSPreloadList {
+	GMappedFile *file;
+	const guint8 *data;
+	gsize size;
+	const guint32 *offsets;
+	guint n_entries;
+};
+
+SoupHSTSPreloadList *
+soup_hsts_preload_list_new (const char *filename,
+			    GError    **error)
+{
+	SoupHSTSPreloadList *list;
+	GMappedFile *file;
+	const guint8 *data;
+	gsize size;
+	guint32 version, n_entries, i;
+
+	file = g_mapped_file_new (filename, FALSE, error);
+	if (!file)
+		return NULL;
+
+	data = (const guint8 *)g_mapped_file_get_contents (file);
+	size = g_mapped_file_get_length (file);
+	if (size < HEADER_SIZE || memcmp (data, SOUP_HSTS_PRELOAD_MAGIC, 8) != 0)
+		goto invalid;
+
+	memcpy (&version, data + 8, sizeof (guint32));
+	memcpy (&n_entries, data + 12, sizeof (guint32));
+	version = GUINT32_FROM_LE (version);
+	n_entries = GUINT32_FROM_LE (n_entries);
+	if (version != SOUP_HSTS_PRELOAD_VERSION ||
+	    n_entries > (size - HEADER_SIZE) / sizeof (guint32) ||
+	    data[size - 1] != '\0')
+		goto invalid;
+
+	/* Entries must be inside the file, the last byte being a
+	 * nul makes sure all of them are terminated.
+	 */
+	for (i = 0; i < n_entries; i++) {
+		guint32 offset;
+
+		memcpy (&offset, data + HEADER_SIZE + i * sizeof (guint32), sizeof (guint32));
+		offset = GUINT32_FROM_LE (offset);
+		if (offset < HEADER_SIZE + n_entries * sizeof (guint32) || offset >= size - 1)
+			goto invalid;
+	}
+
+	list = g_new0 (SoupHSTSPreloadList, 1);
+	list->file = file;
+	list->data = data;
+	list->size = size;
+	list->offsets = (const guint32 *)(data + HEADER_SIZE);
+	list->n_entries = n_entries;
+
+	return list;
+
+invalid:
+	g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		     _("Invalid HSTS preload list %s"), filename);
+	g_mapped_file_unref (file);
+
+	return NULL;
+}
+
+void
+soup_hsts_preload_list_free (SoupHSTSPreloadList *list)
+{
+	g_mapped_file_unref (list->file);
+	g_free (list);
+}
+
+guint
+soup_hsts_preload_list_get_size (SoupHSTSPreloadList *list)
+{
+	return list->n_entries;
+}
+
+static inline const char *
+get_entry (SoupHSTSPreloadList *list,
+	   guint                index)
+{
+	guint32 offset;
+
+	/* The mapping is not guaranteed to be aligned for 32 bits */
+	memcpy (&offset, &list->offsets[index], sizeof (guint32));
+	return (const char *)list->data + GUINT32_FROM_LE (offset);
+}
+
+/* Looks up the reversed domain of @len bytes at @domain */
+static const char *
+lookup (SoupHSTSPreloadList *list,
+	const char          *domain,
+	gsize                len)
+{
+	guint low = 0, high = list->n_entries;
+
+	while (low < high) {
+		guint mid = low + (high - low) / 2;
+		const char *entry = get_entry (list, mid);
+		int cmp;
+
+		cmp = strncmp (entry + 1, domain, len);
+		if (cmp == 0 && entry[len + 1] != '\0')
+			cmp = 1;
+
+		if (cmp == 0)
+			return entry;
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return NULL;
+}
+
+gboolean
+soup_hsts_preload_list_must_enforce (SoupHSTSPreloadList *list,
+				     const char          *host)
+{
+	char reversed[MAX_DOMAIN_LENGTH + 1];
+	const char *entry;
+	gsize len, i;
+
+	len = strlen (host);
+	if (len == 0 || len > MAX_DOMAIN_LENGTH)
+		return FALSE;
+
+	for (i = 0; i < len; i++)
+		reversed[i] = g_ascii_tolower (host[len - i - 1]);
+	reversed[len] = '\0';
+
+	if (lookup (list, reversed, len))
+		return TRUE;
+
+	/* Super domains from the longest one */
+	for (i = len - 1; i > 0; i--) {
+		if (reversed[i] != '.')
+			continue;
+
+		entry = lookup (list, reversed, i);
+		if (entry && (entry[0] & SOUP_HSTS_PRELOAD_INCLUDE_SUBDOMAINS))
+			return TRUE;
+	}
+
+	return FALSE;
+}
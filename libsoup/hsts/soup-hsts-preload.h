@@ -0,0 +1,25 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-hsts-preload.h: precompiled HSTS preload list
+ */
+
+#pragma once
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+typedef struct _SoupHSTSPreloadList SoupHSTSPreloadList;
+
+#define SOUP_HSTS_PRELOAD_MAGIC "SOUPHSTS"
+#define SOUP_HSTS_PRELOAD_VERSION 1
+#define SOUP_HSTS_PRELOAD_INCLUDE_SUBDOMAINS (1 << 0)
+
+SoupHSTSPreloadList *soup_hsts_preload_list_new          (const char          *filename,
+							  GError             **error);
+void                 soup_hsts_preload_list_free         (SoupHSTSPreloadList *list);
+guint                soup_hsts_preload_list_get_size     (SoupHSTSPreloadList *list);
+gboolean             soup_hsts_preload_list_must_enforce (SoupHSTSPreloadList *list,
+							  const char          *host);
+
+G_END_DECLS
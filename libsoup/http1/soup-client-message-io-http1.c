@@ -146,8 +146,14 @@ request_body_stream_wrote_data_cb (SoupMessage *msg,
 
         if (client_io->msg_io->metrics) {
                 client_io->msg_io->metrics->request_body_bytes_sent += count;
-                if (!is_metadata)
-                        client_io->msg_io->metrics->request_body_size += count;
+                if (!is_metadata) {
+                        gint64 bytes_encoded = soup_message_get_request_body_bytes_encoded (msg);
+
+                        if (bytes_encoded != -1)
+                                client_io->msg_io->metrics->request_body_size = bytes_encoded;
+                        else
+                                client_io->msg_io->metrics->request_body_size += count;
+                }
         }
 
         if (!is_metadata) {
@@ -467,8 +473,13 @@ parse_headers (SoupMessage  *msg,
         soup_message_set_status (msg, status, reason_phrase);
         g_free (reason_phrase);
 
-        if (version < soup_message_get_http_version (msg))
+        if (version < soup_message_get_http_version (msg)) {
+                SoupConnection *conn = soup_message_get_connection (msg);
+
                 soup_message_set_http_version (msg, version);
+                soup_connection_set_server_http_version (conn, version);
+                g_object_unref (conn);
+        }
 
         if ((soup_message_get_method (msg) == SOUP_METHOD_HEAD ||
              soup_message_get_status (msg)  == SOUP_STATUS_NO_CONTENT ||
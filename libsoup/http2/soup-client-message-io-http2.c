@@ -79,6 +79,7 @@ typedef struct {
         gboolean session_terminated;
         gboolean goaway_sent;
         gboolean ever_used;
+        gboolean ping_pending;
 
         guint in_callback;
 } SoupClientMessageIOHTTP2;
@@ -683,6 +684,9 @@ on_frame_recv_callback (nghttp2_session     *session,
 
         io->in_callback++;
 
+        /* Any frame answers a liveness PING */
+        io->ping_pending = FALSE;
+
         if (frame->hd.stream_id == 0) {
                 h2_debug (io, NULL, "[RECV] [%s] Received: stream_id=%u, flags=%u", soup_http2_frame_type_to_string (frame->hd.type), frame->hd.stream_id, frame->hd.flags);
 
@@ -919,8 +923,13 @@ on_frame_send_callback (nghttp2_session     *session,
                 h2_debug (io, data, "[SEND] [DATA] stream_id=%u, bytes=%zu, finished=%d",
                           frame->hd.stream_id, frame->data.hd.length, frame->hd.flags & NGHTTP2_FLAG_END_STREAM);
                 if (data->metrics) {
+                        gint64 bytes_encoded = soup_message_get_request_body_bytes_encoded (data->msg);
+
                         data->metrics->request_body_bytes_sent += frame->hd.length + FRAME_HEADER_SIZE;
-                        data->metrics->request_body_size += frame->data.hd.length;
+                        if (bytes_encoded != -1)
+                                data->metrics->request_body_size = bytes_encoded;
+                        else
+                                data->metrics->request_body_size += frame->data.hd.length;
                 }
                 if (frame->data.hd.length)
                         soup_message_wrote_body_data (data->msg, frame->data.hd.length);
@@ -1899,6 +1908,53 @@ soup_client_message_io_http2_owner_changed (SoupClientMessageIO *iface)
         soup_client_message_io_http2_set_owner (io, g_thread_self ());
 }
 
+static gboolean
+soup_client_message_io_http2_ping (SoupClientMessageIO *iface)
+{
+        SoupClientMessageIOHTTP2 *io = (SoupClientMessageIOHTTP2 *)iface;
+
+        if (io->ping_pending)
+                return FALSE;
+
+        /* The answer is only read without a message in progress when
+         * the connection is used asynchronously from this thread.
+         */
+        if (!io->async || io->owner != g_thread_self ())
+                return TRUE;
+
+        if (nghttp2_submit_ping (io->session, NGHTTP2_FLAG_NONE, NULL) != 0)
+                return FALSE;
+
+        h2_debug (io, NULL, "[SEND] PING");
+        io->ping_pending = TRUE;
+        io_try_write (io, FALSE);
+
+        return TRUE;
+}
+
+static guint
+soup_client_message_io_http2_get_n_streams (SoupClientMessageIO *iface)
+{
+        SoupClientMessageIOHTTP2 *io = (SoupClientMessageIOHTTP2 *)iface;
+
+        return g_hash_table_size (io->messages);
+}
+
+static gboolean
+soup_client_message_io_http2_is_saturated (SoupClientMessageIO *iface)
+{
+        SoupClientMessageIOHTTP2 *io = (SoupClientMessageIOHTTP2 *)iface;
+        guint32 max_streams;
+
+        /* New streams are queued by nghttp2 until others are closed */
+        max_streams = nghttp2_session_get_remote_settings (io->session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+        if (g_hash_table_size (io->messages) >= max_streams)
+                return TRUE;
+
+        /* Request bodies are blocked by connection-level flow control */
+        return nghttp2_session_get_remote_window_size (io->session) <= 0;
+}
+
 static const SoupClientMessageIOFuncs io_funcs = {
         soup_client_message_io_http2_destroy,
         soup_client_message_io_http2_finished,
@@ -1917,7 +1973,10 @@ static const SoupClientMessageIOFuncs io_funcs = {
         soup_client_message_io_http2_in_progress,
         soup_client_message_io_http2_is_reusable,
         soup_client_message_io_http2_get_cancellable,
-        soup_client_message_io_http2_owner_changed
+        soup_client_message_io_http2_owner_changed,
+        soup_client_message_io_http2_ping,
+        soup_client_message_io_http2_get_n_streams,
+        soup_client_message_io_http2_is_saturated
 };
 
 static void
@@ -19,6 +19,7 @@
 #include "soup-message-io-data.h"
 #include "soup-message-headers-private.h"
 #include "soup-server-message-private.h"
+#include "soup-content-encoder-private.h"
 #include "soup-misc.h"
 
 typedef struct {
@@ -29,6 +30,13 @@ typedef struct {
         GBytes  *write_chunk;
 	goffset  write_body_offset;
 
+        /* Content-Encoding applied while writing the body */
+        GConverter *encoder;
+        GBytes     *write_encoded;
+        gboolean    encoder_flush;
+        goffset     encoder_length;
+        gboolean    encoder_finished;
+
         GSource *unpause_source;
 
 	GMainContext *async_context;
@@ -86,6 +94,8 @@ soup_message_io_http1_free (SoupMessageIOHTTP1 *msg_io)
         g_clear_object (&msg_io->msg);
         g_clear_pointer (&msg_io->async_context, g_main_context_unref);
         g_clear_pointer (&msg_io->write_chunk, g_bytes_unref);
+        g_clear_pointer (&msg_io->write_encoded, g_bytes_unref);
+        g_clear_object (&msg_io->encoder);
 
         g_free (msg_io);
 }
@@ -331,10 +341,11 @@ handle_partial_get (SoupServerMessage *msg)
 }
 
 static void
-write_headers (SoupServerMessage  *msg,
+write_headers (SoupMessageIOHTTP1 *msg_io,
                GString            *headers,
                SoupEncoding       *encoding)
 {
+        SoupServerMessage *msg = msg_io->msg;
         SoupEncoding claimed_encoding;
         SoupMessageHeadersIter iter;
         const char *name, *value;
@@ -351,12 +362,32 @@ write_headers (SoupServerMessage  *msg,
 	status_code = soup_server_message_get_status (msg);
         reason_phrase = soup_server_message_get_reason_phrase (msg);
 
+	response_headers = soup_server_message_get_response_headers (msg);
+        if (!SOUP_STATUS_IS_INFORMATIONAL (status_code)) {
+                SoupEncoding body_encoding = soup_message_headers_get_encoding (response_headers);
+                goffset content_length = soup_message_headers_get_content_length (response_headers);
+
+                /* HTTP/1.0 clients only get bodies that can be compressed up front */
+                g_clear_object (&msg_io->encoder);
+                msg_io->encoder = soup_server_message_setup_content_encoding (msg,
+                                                                              soup_server_message_get_http_version (msg) >= SOUP_HTTP_1_1);
+                if (msg_io->encoder) {
+                        /* A body that is still being written must not be held back in
+                         * the encoder, and with a Content-Length nothing marks the end
+                         * of the body but its length.
+                         */
+                        msg_io->encoder_flush = body_encoding != SOUP_ENCODING_CONTENT_LENGTH;
+                        msg_io->encoder_length = body_encoding == SOUP_ENCODING_CONTENT_LENGTH ? content_length : -1;
+                        msg_io->encoder_finished = FALSE;
+                        soup_message_headers_set_encoding (response_headers, SOUP_ENCODING_CHUNKED);
+                }
+        }
+
         g_string_append_printf (headers, "HTTP/1.%c %d %s\r\n",
 				soup_server_message_get_http_version (msg) == SOUP_HTTP_1_0 ? '0' : '1',
 				status_code, reason_phrase);
 
 	method = soup_server_message_get_method (msg);
-	response_headers = soup_server_message_get_response_headers (msg);
         claimed_encoding = soup_message_headers_get_encoding (response_headers);
         if ((method == SOUP_METHOD_HEAD ||
              status_code  == SOUP_STATUS_NO_CONTENT ||
@@ -404,6 +435,7 @@ io_write (SoupServerMessageIOHTTP1 *server_io,
         SoupServerMessage *msg = server_io->msg_io->msg;
 	SoupMessageIOData *io = &server_io->msg_io->base;
         GBytes *chunk;
+        GBytes *out;
         gssize nwrote;
 	guint status_code;
 
@@ -429,7 +461,7 @@ io_write (SoupServerMessageIOHTTP1 *server_io,
                 }
 
                 if (!io->write_buf->len)
-                        write_headers (msg, io->write_buf, &io->write_encoding);
+                        write_headers (server_io->msg_io, io->write_buf, &io->write_encoding);
 
                 while (io->written < io->write_buf->len) {
                         nwrote = g_pollable_stream_write (server_io->ostream,
@@ -504,32 +536,57 @@ io_write (SoupServerMessageIOHTTP1 *server_io,
                 }
 
                 if (!server_io->msg_io->write_chunk) {
-                        server_io->msg_io->write_chunk = soup_message_body_get_chunk (soup_server_message_get_response_body (msg),
+                        SoupMessageBody *body = soup_server_message_get_response_body (msg);
+
+                        server_io->msg_io->write_chunk = soup_message_body_get_chunk (body,
                                                                                       server_io->msg_io->write_body_offset);
                         if (!server_io->msg_io->write_chunk) {
                                 soup_server_message_pause (msg);
                                 return FALSE;
                         }
-                        if (!g_bytes_get_size (server_io->msg_io->write_chunk)) {
+
+                        if (server_io->msg_io->encoder) {
+                                gsize size = g_bytes_get_size (server_io->msg_io->write_chunk);
+                                goffset end = server_io->msg_io->write_body_offset + (goffset)size;
+                                GConverterFlags flags = G_CONVERTER_NO_FLAGS;
+
+                                if (size == 0 ||
+                                    (server_io->msg_io->encoder_length >= 0 && end >= server_io->msg_io->encoder_length))
+                                        flags = G_CONVERTER_INPUT_AT_END;
+                                else if (server_io->msg_io->encoder_flush && end >= body->length)
+                                        flags = G_CONVERTER_FLUSH;
+                                server_io->msg_io->encoder_finished = flags == G_CONVERTER_INPUT_AT_END;
+
+                                server_io->msg_io->write_encoded = soup_content_encoder_convert (server_io->msg_io->encoder,
+                                                                                                 server_io->msg_io->write_chunk,
+                                                                                                 flags, error);
+                                if (!server_io->msg_io->write_encoded)
+                                        return FALSE;
+                                if (!g_bytes_get_size (server_io->msg_io->write_encoded)) {
+                                        io->write_state = SOUP_MESSAGE_IO_STATE_BODY_DATA;
+                                        break;
+                                }
+                        } else if (!g_bytes_get_size (server_io->msg_io->write_chunk)) {
                                 io->write_state = SOUP_MESSAGE_IO_STATE_BODY_FLUSH;
                                 break;
                         }
                 }
 
+                out = server_io->msg_io->write_encoded ? server_io->msg_io->write_encoded : server_io->msg_io->write_chunk;
                 nwrote = g_pollable_stream_write (io->body_ostream,
-                                                  (guchar*)g_bytes_get_data (server_io->msg_io->write_chunk, NULL) + io->written,
-                                                  g_bytes_get_size (server_io->msg_io->write_chunk) - io->written,
+                                                  (guchar*)g_bytes_get_data (out, NULL) + io->written,
+                                                  g_bytes_get_size (out) - io->written,
                                                   FALSE,
                                                   NULL, error);
                 if (nwrote == -1)
                         return FALSE;
 
-                chunk = g_bytes_new_from_bytes (server_io->msg_io->write_chunk, io->written, nwrote);
+                chunk = g_bytes_new_from_bytes (out, io->written, nwrote);
                 io->written += nwrote;
                 if (io->write_length)
                         io->write_length -= nwrote;
 
-                if (io->written == g_bytes_get_size (server_io->msg_io->write_chunk))
+                if (io->written == g_bytes_get_size (out))
                         io->write_state = SOUP_MESSAGE_IO_STATE_BODY_DATA;
 
                 soup_server_message_wrote_body_data (msg, g_bytes_get_size (chunk));
@@ -538,6 +595,7 @@ io_write (SoupServerMessageIOHTTP1 *server_io,
 
         case SOUP_MESSAGE_IO_STATE_BODY_DATA:
                 io->written = 0;
+                g_clear_pointer (&server_io->msg_io->write_encoded, g_bytes_unref);
                 if (g_bytes_get_size (server_io->msg_io->write_chunk) == 0) {
                         io->write_state = SOUP_MESSAGE_IO_STATE_BODY_FLUSH;
                         break;
@@ -548,7 +606,11 @@ io_write (SoupServerMessageIOHTTP1 *server_io,
                 server_io->msg_io->write_body_offset += g_bytes_get_size (server_io->msg_io->write_chunk);
                 g_clear_pointer (&server_io->msg_io->write_chunk, g_bytes_unref);
 
-                io->write_state = SOUP_MESSAGE_IO_STATE_BODY;
+                /* The encoder was given the last chunk of the body */
+                if (server_io->msg_io->encoder_finished)
+                        io->write_state = SOUP_MESSAGE_IO_STATE_BODY_FLUSH;
+                else
+                        io->write_state = SOUP_MESSAGE_IO_STATE_BODY;
                 soup_server_message_wrote_chunk (msg);
                 break;
 
@@ -22,6 +22,7 @@
 #include "soup-message-io-data.h"
 #include "soup-message-headers-private.h"
 #include "soup-server-message-private.h"
+#include "soup-content-encoder-private.h"
 #include "soup-misc.h"
 #include "soup-http2-utils.h"
 
@@ -42,6 +43,10 @@ typedef struct {
         GBytes *write_chunk;
         goffset write_offset;
         goffset chunk_written;
+
+        GConverter *encoder;
+        GBytes *write_encoded;
+        gboolean encoder_finished;
 } SoupMessageIOHTTP2;
 
 typedef struct {
@@ -138,6 +143,8 @@ soup_message_io_http2_free (SoupMessageIOHTTP2 *msg_io)
         g_free (msg_io->authority);
         g_free (msg_io->path);
         g_clear_pointer (&msg_io->write_chunk, g_bytes_unref);
+        g_clear_pointer (&msg_io->write_encoded, g_bytes_unref);
+        g_clear_object (&msg_io->encoder);
         g_free (msg_io);
 }
 
@@ -647,6 +654,91 @@ on_data_chunk_recv_callback (nghttp2_session *session,
         return 0;
 }
 
+static gboolean
+encode_next_chunk (SoupServerMessageIOHTTP2 *io,
+                   SoupMessageIOHTTP2       *msg_io,
+                   SoupMessageBody          *response_body)
+{
+        GBytes *chunk;
+        GConverterFlags flags = G_CONVERTER_NO_FLAGS;
+        GError *error = NULL;
+
+        if (msg_io->write_offset < response_body->length)
+                chunk = soup_message_body_get_chunk (response_body, msg_io->write_offset);
+        else
+                chunk = g_bytes_new_static (NULL, 0);
+
+        if (msg_io->write_offset + (goffset)g_bytes_get_size (chunk) >= response_body->length)
+                flags = G_CONVERTER_INPUT_AT_END;
+
+        msg_io->write_encoded = soup_content_encoder_convert (msg_io->encoder, chunk, flags, &error);
+        if (!msg_io->write_encoded) {
+                h2_debug (io, msg_io, "[SEND_BODY] Failed to encode: %s", error->message);
+                g_error_free (error);
+                g_bytes_unref (chunk);
+                return FALSE;
+        }
+
+        msg_io->chunk_written = 0;
+        if (g_bytes_get_size (chunk)) {
+                msg_io->write_offset += g_bytes_get_size (chunk);
+                soup_message_body_wrote_chunk (response_body, chunk);
+                soup_server_message_wrote_chunk (msg_io->msg);
+        }
+        if (flags & G_CONVERTER_INPUT_AT_END)
+                msg_io->encoder_finished = TRUE;
+        g_bytes_unref (chunk);
+
+        return TRUE;
+}
+
+static ssize_t
+on_data_source_read_encoded (SoupServerMessageIOHTTP2 *io,
+                             SoupMessageIOHTTP2       *msg_io,
+                             uint8_t                  *buf,
+                             size_t                    length,
+                             uint32_t                 *data_flags,
+                             SoupMessageBody          *response_body)
+{
+        gsize bytes_written = 0;
+
+        while (bytes_written < length) {
+                gconstpointer data;
+                gsize data_length;
+                gsize bytes_to_write;
+
+                if (!msg_io->write_encoded) {
+                        if (msg_io->encoder_finished)
+                                break;
+                        if (!encode_next_chunk (io, msg_io, response_body))
+                                return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+                }
+
+                data = g_bytes_get_data (msg_io->write_encoded, &data_length);
+                bytes_to_write = MIN (length - bytes_written, data_length - msg_io->chunk_written);
+                memcpy (buf + bytes_written, (uint8_t *)data + msg_io->chunk_written, bytes_to_write);
+                bytes_written += bytes_to_write;
+                msg_io->chunk_written += bytes_to_write;
+                if (bytes_to_write)
+                        soup_server_message_wrote_body_data (msg_io->msg, bytes_to_write);
+
+                if (msg_io->chunk_written == data_length) {
+                        g_clear_pointer (&msg_io->write_encoded, g_bytes_unref);
+                        msg_io->chunk_written = 0;
+                }
+        }
+
+        h2_debug (io, msg_io, "[SEND_BODY] wrote %zd encoded, %u/%u", bytes_written, msg_io->write_offset, response_body->length);
+
+        if (msg_io->encoder_finished && !msg_io->write_encoded) {
+                soup_server_message_wrote_body (msg_io->msg);
+                h2_debug (io, msg_io, "[SEND_BODY] EOF");
+                *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        }
+
+        return bytes_written;
+}
+
 static ssize_t
 on_data_source_read_callback (nghttp2_session     *session,
                               int32_t              stream_id,
@@ -667,6 +759,14 @@ on_data_source_read_callback (nghttp2_session     *session,
 
         h2_debug (user_data, msg_io, "[SEND_BODY] paused=%d", msg_io->paused);
 
+        if (msg_io->encoder) {
+                ssize_t retval;
+
+                retval = on_data_source_read_encoded (io, msg_io, buf, length, data_flags, response_body);
+                io->in_callback--;
+                return retval;
+        }
+
         while (bytes_written < length && msg_io->write_offset < response_body->length) {
                 gconstpointer data;
                 gsize data_length;
@@ -723,8 +823,13 @@ soup_server_message_io_http2_send_response (SoupServerMessageIOHTTP2 *io,
         g_array_append_val (headers, status_nv);
 
         SoupMessageHeaders *response_headers = soup_server_message_get_response_headers (msg);
+        if (!SOUP_STATUS_IS_INFORMATIONAL (status_code))
+                msg_io->encoder = soup_server_message_setup_content_encoding (msg, TRUE);
+
         if (status_code == SOUP_STATUS_NO_CONTENT || SOUP_STATUS_IS_INFORMATIONAL (status_code)) {
                 soup_message_headers_remove (response_headers, "Content-Length");
+        } else if (msg_io->encoder) {
+                /* The encoded length is only known once the last DATA frame is sent */
         } else if (!soup_message_headers_get_content_length (response_headers)) {
                 SoupMessageBody *response_body;
 
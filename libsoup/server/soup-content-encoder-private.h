@@ -0,0 +1,24 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-content-encoder-private.h: private SoupContentEncoder API
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "soup-content-encoder.h"
+#include "soup-server-message.h"
+
+G_BEGIN_DECLS
+
+GConverter *soup_content_encoder_setup_response (SoupContentEncoder *encoder,
+						 SoupServerMessage  *msg,
+						 gboolean            can_stream);
+
+GBytes     *soup_content_encoder_convert        (GConverter         *converter,
+						 GBytes             *chunk,
+						 GConverterFlags     flags,
+						 GError            **error);
+
+G_END_DECLS
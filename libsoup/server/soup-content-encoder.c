@@ -0,0 +1,699 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-content-encoder.c: server-side response compression
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "soup-content-encoder-private.h"
+#include "soup.h"
+#include "soup-message-headers-private.h"
+#include "soup-misc.h"
+#include "content-decoder/soup-compressor-wrapper.h"
+
+/**
+ * SoupContentEncoder:
+ *
+ * Compresses the responses of a [class@Server].
+ *
+ * #SoupContentEncoder is the server-side counterpart of
+ * [class@ContentDecoder]. Once set on a server with
+ * [method@Server.set_content_encoder], responses whose Content-Type
+ * is one of [property@ContentEncoder:content-types] are compressed
+ * with the best coding the client accepts, according to its
+ * "Accept-Encoding" header. "gzip" is always available, and "br" and
+ * "zstd" are available when libsoup was built with them.
+ *
+ * Bodies that are complete when the response headers are written
+ * are only compressed if they are at least
+ * [property@ContentEncoder:min-size] bytes long. Otherwise the body
+ * is compressed as it is written, with chunked encoding over
+ * HTTP/1.1. Responses that already have a "Content-Encoding", partial
+ * responses, and responses to HEAD requests are left untouched.
+ *
+ * When [property@ContentEncoder:cache-size] is not 0, the compressed
+ * variants of complete bodies that consist of a single [struct@GLib.Bytes]
+ * are kept, keyed by the contents of the body, so that static responses
+ * served many times are only compressed once (and with a higher
+ * compression level).
+ *
+ * Since: 3.8
+ */
+
+/* In order of preference when the client accepts several
+ * of them equally.
+ */
+static const char * const codings[] = {
+#ifdef WITH_ZSTD
+	"zstd",
+#endif
+#ifdef WITH_BROTLI_ENCODER
+	"br",
+#endif
+	"gzip",
+	NULL
+};
+#define N_CODINGS (G_N_ELEMENTS (codings) - 1)
+
+static const char * const default_content_types[] = {
+	"text/*",
+	"application/javascript",
+	"application/json",
+	"application/wasm",
+	"application/xhtml+xml",
+	"application/xml",
+	"image/svg+xml",
+	NULL
+};
+
+#define CONVERT_BLOCK_SIZE 16384
+
+typedef struct {
+	GBytes *body;
+	GBytes *variants[N_CODINGS];
+	GList link;
+} SoupContentEncoderCacheEntry;
+
+struct _SoupContentEncoder {
+	GObject parent;
+
+	char **content_types;
+	guint min_size;
+	guint cache_size;
+
+	GMutex cache_mutex;
+	GHashTable *cache;
+	GQueue lru;
+};
+
+enum {
+	PROP_0,
+
+	PROP_CONTENT_TYPES,
+	PROP_MIN_SIZE,
+	PROP_CACHE_SIZE,
+
+	LAST_PROPERTY
+};
+
+static GParamSpec *properties[LAST_PROPERTY] = { NULL, };
+
+G_DEFINE_FINAL_TYPE (SoupContentEncoder, soup_content_encoder, G_TYPE_OBJECT)
+
+static void
+cache_entry_free (SoupContentEncoderCacheEntry *entry)
+{
+	guint i;
+
+	g_bytes_unref (entry->body);
+	for (i = 0; i < N_CODINGS; i++)
+		g_clear_pointer (&entry->variants[i], g_bytes_unref);
+	g_free (entry);
+}
+
+static void
+soup_content_encoder_init (SoupContentEncoder *encoder)
+{
+	encoder->content_types = g_strdupv ((char **)default_content_types);
+	encoder->min_size = 256;
+
+	g_mutex_init (&encoder->cache_mutex);
+	encoder->cache = g_hash_table_new_full (g_bytes_hash, g_bytes_equal, NULL,
+						(GDestroyNotify)cache_entry_free);
+}
+
+static void
+soup_content_encoder_finalize (GObject *object)
+{
+	SoupContentEncoder *encoder = SOUP_CONTENT_ENCODER (object);
+
+	g_strfreev (encoder->content_types);
+	g_hash_table_destroy (encoder->cache);
+	g_mutex_clear (&encoder->cache_mutex);
+
+	G_OBJECT_CLASS (soup_content_encoder_parent_class)->finalize (object);
+}
+
+static void
+soup_content_encoder_set_property (GObject *object, guint prop_id,
+				   const GValue *value, GParamSpec *pspec)
+{
+	SoupContentEncoder *encoder = SOUP_CONTENT_ENCODER (object);
+
+	switch (prop_id) {
+	case PROP_CONTENT_TYPES:
+		soup_content_encoder_set_content_types (encoder, g_value_get_boxed (value));
+		break;
+	case PROP_MIN_SIZE:
+		soup_content_encoder_set_min_size (encoder, g_value_get_uint (value));
+		break;
+	case PROP_CACHE_SIZE:
+		soup_content_encoder_set_cache_size (encoder, g_value_get_uint (value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+soup_content_encoder_get_property (GObject *object, guint prop_id,
+				   GValue *value, GParamSpec *pspec)
+{
+	SoupContentEncoder *encoder = SOUP_CONTENT_ENCODER (object);
+
+	switch (prop_id) {
+	case PROP_CONTENT_TYPES:
+		g_value_set_boxed (value, encoder->content_types);
+		break;
+	case PROP_MIN_SIZE:
+		g_value_set_uint (value, encoder->min_size);
+		break;
+	case PROP_CACHE_SIZE:
+		g_value_set_uint (value, encoder->cache_size);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+soup_content_encoder_class_init (SoupContentEncoderClass *encoder_class)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (encoder_class);
+
+	object_class->finalize = soup_content_encoder_finalize;
+	object_class->set_property = soup_content_encoder_set_property;
+	object_class->get_property = soup_content_encoder_get_property;
+
+	/**
+	 * SoupContentEncoder:content-types: (attributes org.gtk.Property.get=soup_content_encoder_get_content_types org.gtk.Property.set=soup_content_encoder_set_content_types)
+	 *
+	 * The media types of the responses to compress. An entry like
+	 * "text/*" matches all the subtypes of a type.
+	 *
+	 * The default list contains the common text based types.
+	 *
+	 * Since: 3.8
+	 */
+	properties[PROP_CONTENT_TYPES] =
+		g_param_spec_boxed ("content-types",
+				    "Content types",
+				    "The media types of the responses to compress",
+				    G_TYPE_STRV,
+				    G_PARAM_READWRITE |
+				    G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupContentEncoder:min-size: (attributes org.gtk.Property.get=soup_content_encoder_get_min_size org.gtk.Property.set=soup_content_encoder_set_min_size)
+	 *
+	 * The size, in bytes, below which complete response bodies
+	 * are sent uncompressed, as compressing them would not save
+	 * enough to be worth it.
+	 *
+	 * Since: 3.8
+	 */
+	properties[PROP_MIN_SIZE] =
+		g_param_spec_uint ("min-size",
+				   "Minimum size",
+				   "The size below which bodies are not compressed",
+				   0, G_MAXUINT, 256,
+				   G_PARAM_READWRITE |
+				   G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupContentEncoder:cache-size: (attributes org.gtk.Property.get=soup_content_encoder_get_cache_size org.gtk.Property.set=soup_content_encoder_set_cache_size)
+	 *
+	 * The number of response bodies whose compressed variants are
+	 * kept for reuse, or 0 to compress every response.
+	 *
+	 * Since: 3.8
+	 */
+	properties[PROP_CACHE_SIZE] =
+		g_param_spec_uint ("cache-size",
+				   "Cache size",
+				   "The number of bodies whose compressed variants are kept",
+				   0, G_MAXUINT, 0,
+				   G_PARAM_READWRITE |
+				   G_PARAM_STATIC_STRINGS);
+
+	g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
+}
+
+/**
+ * soup_content_encoder_new:
+ *
+ * Creates a new #SoupContentEncoder, to be set on a server with
+ * [method@Server.set_content_encoder].
+ *
+ * Returns: (transfer full): a new #SoupContentEncoder
+ *
+ * Since: 3.8
+ */
+SoupContentEncoder *
+soup_content_encoder_new (void)
+{
+	return g_object_new (SOUP_TYPE_CONTENT_ENCODER, NULL);
+}
+
+/**
+ * soup_content_encoder_set_content_types: (attributes org.gtk.Method.set_property=content-types)
+ * @encoder: a #SoupContentEncoder
+ * @content_types: (array zero-terminated=1): the media types to compress
+ *
+ * Sets the media types of the responses that @encoder compresses.
+ *
+ * Since: 3.8
+ */
+void
+soup_content_encoder_set_content_types (SoupContentEncoder *encoder,
+					const char * const *content_types)
+{
+	g_return_if_fail (SOUP_IS_CONTENT_ENCODER (encoder));
+
+	g_strfreev (encoder->content_types);
+	encoder->content_types = g_strdupv ((char **)content_types);
+	if (!encoder->content_types)
+		encoder->content_types = g_new0 (char *, 1);
+
+	g_object_notify_by_pspec (G_OBJECT (encoder), properties[PROP_CONTENT_TYPES]);
+}
+
+/**
+ * soup_content_encoder_get_content_types: (attributes org.gtk.Method.get_property=content-types)
+ * @encoder: a #SoupContentEncoder
+ *
+ * Gets the media types of the responses that @encoder compresses.
+ *
+ * Returns: (transfer none) (array zero-terminated=1): the media types
+ *
+ * Since: 3.8
+ */
+const char * const *
+soup_content_encoder_get_content_types (SoupContentEncoder *encoder)
+{
+	g_return_val_if_fail (SOUP_IS_CONTENT_ENCODER (encoder), NULL);
+
+	return (const char * const *)encoder->content_types;
+}
+
+/**
+ * soup_content_encoder_set_min_size: (attributes org.gtk.Method.set_property=min-size)
+ * @encoder: a #SoupContentEncoder
+ * @min_size: a size in bytes
+ *
+ * Sets the size below which complete response bodies are not
+ * compressed.
+ *
+ * Since: 3.8
+ */
+void
+soup_content_encoder_set_min_size (SoupContentEncoder *encoder,
+				   guint               min_size)
+{
+	g_return_if_fail (SOUP_IS_CONTENT_ENCODER (encoder));
+
+	if (encoder->min_size == min_size)
+		return;
+
+	encoder->min_size = min_size;
+	g_object_notify_by_pspec (G_OBJECT (encoder), properties[PROP_MIN_SIZE]);
+}
+
+/**
+ * soup_content_encoder_get_min_size: (attributes org.gtk.Method.get_property=min-size)
+ * @encoder: a #SoupContentEncoder
+ *
+ * Gets the size below which complete response bodies are not
+ * compressed.
+ *
+ * Returns: the minimum size in bytes
+ *
+ * Since: 3.8
+ */
+guint
+soup_content_encoder_get_min_size (SoupContentEncoder *encoder)
+{
+	g_return_val_if_fail (SOUP_IS_CONTENT_ENCODER (encoder), 0);
+
+	return encoder->min_size;
+}
+
+static void
+cache_trim (SoupContentEncoder *encoder)
+{
+	while (g_hash_table_size (encoder->cache) > encoder->cache_size) {
+		SoupContentEncoderCacheEntry *entry = g_queue_peek_tail (&encoder->lru);
+
+		g_queue_unlink (&encoder->lru, &entry->link);
+		g_hash_table_remove (encoder->cache, entry->body);
+	}
+}
+
+/**
+ * soup_content_encoder_set_cache_size: (attributes org.gtk.Method.set_property=cache-size)
+ * @encoder: a #SoupContentEncoder
+ * @cache_size: the number of bodies to keep compressed variants of
+ *
+ * Sets the number of response bodies whose compressed variants
+ * @encoder keeps for reuse. 0 disables the cache.
+ *
+ * Since: 3.8
+ */
+void
+soup_content_encoder_set_cache_size (SoupContentEncoder *encoder,
+				     guint               cache_size)
+{
+	g_return_if_fail (SOUP_IS_CONTENT_ENCODER (encoder));
+
+	if (encoder->cache_size == cache_size)
+		return;
+
+	g_mutex_lock (&encoder->cache_mutex);
+	encoder->cache_size = cache_size;
+	cache_trim (encoder);
+	g_mutex_unlock (&encoder->cache_mutex);
+
+	g_object_notify_by_pspec (G_OBJECT (encoder), properties[PROP_CACHE_SIZE]);
+}
+
+/**
+ * soup_content_encoder_get_cache_size: (attributes org.gtk.Method.get_property=cache-size)
+ * @encoder: a #SoupContentEncoder
+ *
+ * Gets the number of response bodies whose compressed variants
+ * @encoder keeps for reuse.
+ *
+ * Returns: the cache size
+ *
+ * Since: 3.8
+ */
+guint
+soup_content_encoder_get_cache_size (SoupContentEncoder *encoder)
+{
+	g_return_val_if_fail (SOUP_IS_CONTENT_ENCODER (encoder), 0);
+
+	return encoder->cache_size;
+}
+
+static GConverter *
+create_converter (guint    coding,
+		  gboolean precompress)
+{
+	return (GConverter *)soup_compressor_wrapper_new (codings[coding], precompress);
+}
+
+/* Runs @chunk (if any) through @converter, and returns everything it
+ * produced. With %G_CONVERTER_FLUSH or %G_CONVERTER_INPUT_AT_END
+ * the result also contains whatever @converter had buffered.
+ */
+GBytes *
+soup_content_encoder_convert (GConverter      *converter,
+			      GBytes          *chunk,
+			      GConverterFlags  flags,
+			      GError         **error)
+{
+	static const guint8 empty[1];
+	GByteArray *output;
+	const guint8 *data = NULL;
+	gsize size = 0, offset = 0;
+
+	if (chunk)
+		data = g_bytes_get_data (chunk, &size);
+	if (!data)
+		data = empty;
+
+	output = g_byte_array_sized_new (MIN (size, CONVERT_BLOCK_SIZE));
+	while (TRUE) {
+		GConverterResult result;
+		gsize bytes_read, bytes_written;
+		guint len = output->len;
+		GError *my_error = NULL;
+
+		g_byte_array_set_size (output, len + CONVERT_BLOCK_SIZE);
+		result = g_converter_convert (converter,
+					      data + offset, size - offset,
+					      output->data + len, CONVERT_BLOCK_SIZE,
+					      flags, &bytes_read, &bytes_written,
+					      &my_error);
+		if (result == G_CONVERTER_ERROR) {
+			g_byte_array_set_size (output, len);
+
+			/* Without a flag, this is how converters say that
+			 * they consumed everything and have nothing to add.
+			 */
+			if (offset == size && flags == G_CONVERTER_NO_FLAGS &&
+			    (g_error_matches (my_error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT) ||
+			     g_error_matches (my_error, G_IO_ERROR, G_IO_ERROR_NO_SPACE))) {
+				g_error_free (my_error);
+				break;
+			}
+
+			g_propagate_error (error, my_error);
+			g_byte_array_unref (output);
+			return NULL;
+		}
+
+		g_byte_array_set_size (output, len + bytes_written);
+		offset += bytes_read;
+
+		if (result == G_CONVERTER_FINISHED || result == G_CONVERTER_FLUSHED)
+			break;
+		if (offset == size && flags == G_CONVERTER_NO_FLAGS &&
+		    bytes_written < CONVERT_BLOCK_SIZE)
+			break;
+	}
+
+	return g_byte_array_free_to_bytes (output);
+}
+
+static GBytes *
+compress_body (SoupMessageBody *body,
+	       guint            coding,
+	       gboolean         precompress)
+{
+	GConverter *converter;
+	GByteArray *output;
+	goffset offset = 0;
+
+	converter = create_converter (coding, precompress);
+	output = g_byte_array_new ();
+	while (TRUE) {
+		GBytes *chunk, *compressed;
+		GConverterFlags flags;
+		gsize size;
+
+		chunk = soup_message_body_get_chunk (body, offset);
+		size = chunk ? g_bytes_get_size (chunk) : 0;
+		flags = offset + size >= body->length ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS;
+		compressed = soup_content_encoder_convert (converter, chunk, flags, NULL);
+		g_clear_pointer (&chunk, g_bytes_unref);
+		if (!compressed) {
+			g_byte_array_unref (output);
+			g_object_unref (converter);
+			return NULL;
+		}
+
+		g_byte_array_append (output, g_bytes_get_data (compressed, NULL), g_bytes_get_size (compressed));
+		g_bytes_unref (compressed);
+
+		offset += size;
+		if (flags == G_CONVERTER_INPUT_AT_END)
+			break;
+	}
+	g_object_unref (converter);
+
+	return g_byte_array_free_to_bytes (output);
+}
+
+static GBytes *
+lookup_or_compress_body (SoupContentEncoder *encoder,
+			 SoupMessageBody    *body,
+			 guint               coding)
+{
+	SoupContentEncoderCacheEntry *entry;
+	GBytes *key, *compressed;
+
+	if (!encoder->cache_size)
+		return compress_body (body, coding, FALSE);
+
+	/* Only bodies made of a single GBytes are cached, which is
+	 * what static responses usually look like.
+	 */
+	key = soup_message_body_get_chunk (body, 0);
+	if (!key || g_bytes_get_size (key) != (gsize)body->length) {
+		g_clear_pointer (&key, g_bytes_unref);
+		return compress_body (body, coding, FALSE);
+	}
+
+	g_mutex_lock (&encoder->cache_mutex);
+	entry = g_hash_table_lookup (encoder->cache, key);
+	if (entry && entry->variants[coding]) {
+		g_queue_unlink (&encoder->lru, &entry->link);
+		g_queue_push_head_link (&encoder->lru, &entry->link);
+		compressed = g_bytes_ref (entry->variants[coding]);
+		g_mutex_unlock (&encoder->cache_mutex);
+		g_bytes_unref (key);
+		return compressed;
+	}
+	g_mutex_unlock (&encoder->cache_mutex);
+
+	compressed = compress_body (body, coding, TRUE);
+	if (!compressed) {
+		g_bytes_unref (key);
+		return NULL;
+	}
+
+	g_mutex_lock (&encoder->cache_mutex);
+	entry = g_hash_table_lookup (encoder->cache, key);
+	if (!entry) {
+		entry = g_new0 (SoupContentEncoderCacheEntry, 1);
+		entry->body = g_bytes_ref (key);
+		entry->link.data = entry;
+		g_hash_table_insert (encoder->cache, entry->body, entry);
+	} else
+		g_queue_unlink (&encoder->lru, &entry->link);
+	g_queue_push_head_link (&encoder->lru, &entry->link);
+	if (!entry->variants[coding])
+		entry->variants[coding] = g_bytes_ref (compressed);
+	cache_trim (encoder);
+	g_mutex_unlock (&encoder->cache_mutex);
+
+	g_bytes_unref (key);
+	return compressed;
+}
+
+static gboolean
+content_type_matches (SoupContentEncoder *encoder,
+		      const char         *content_type)
+{
+	guint i;
+
+	for (i = 0; encoder->content_types[i]; i++) {
+		const char *pattern = encoder->content_types[i];
+		gsize len = strlen (pattern);
+
+		if (len >= 2 && !strcmp (pattern + len - 2, "/*")) {
+			if (!g_ascii_strncasecmp (content_type, pattern, len - 1))
+				return TRUE;
+		} else if (!g_ascii_strcasecmp (content_type, pattern))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+set_content_encoding (SoupMessageHeaders *response_headers,
+		      guint               coding)
+{
+	const char *etag;
+
+	soup_message_headers_replace_common (response_headers, SOUP_HEADER_CONTENT_ENCODING, codings[coding]);
+
+	/* The representation is not byte-for-byte the one the
+	 * strong validator was computed for anymore.
+	 */
+	etag = soup_message_headers_get_one_common (response_headers, SOUP_HEADER_ETAG);
+	if (etag && !g_str_has_prefix (etag, "W/")) {
+		char *weak_etag = g_strdup_printf ("W/%s", etag);
+
+		soup_message_headers_replace_common (response_headers, SOUP_HEADER_ETAG, weak_etag);
+		g_free (weak_etag);
+	}
+}
+
+/* Called right before the headers of @msg's response are written.
+ * Either compresses the (complete) body in place, or returns the
+ * converter the body must go through as it is written, in which case
+ * the caller must not send a Content-Length. If @can_stream is
+ * %FALSE, only complete bodies are compressed.
+ */
+GConverter *
+soup_content_encoder_setup_response (SoupContentEncoder *encoder,
+				     SoupServerMessage  *msg,
+				     gboolean            can_stream)
+{
+	SoupMessageHeaders *request_headers, *response_headers;
+	SoupMessageBody *response_body;
+	const char *content_type, *accept_encoding;
+	goffset content_length;
+	gboolean complete;
+	guint status;
+	int coding;
+
+	status = soup_server_message_get_status (msg);
+	if (!SOUP_STATUS_IS_SUCCESSFUL (status) ||
+	    status == SOUP_STATUS_NO_CONTENT ||
+	    status == SOUP_STATUS_PARTIAL_CONTENT ||
+	    soup_server_message_get_method (msg) == SOUP_METHOD_HEAD ||
+	    soup_server_message_get_method (msg) == SOUP_METHOD_CONNECT)
+		return NULL;
+
+	request_headers = soup_server_message_get_request_headers (msg);
+	response_headers = soup_server_message_get_response_headers (msg);
+	response_body = soup_server_message_get_response_body (msg);
+
+	if (soup_message_headers_get_one_common (response_headers, SOUP_HEADER_CONTENT_ENCODING) ||
+	    soup_message_headers_get_one_common (response_headers, SOUP_HEADER_CONTENT_RANGE))
+		return NULL;
+
+	content_type = soup_message_headers_get_content_type (response_headers, NULL);
+	if (!content_type || !content_type_matches (encoder, content_type))
+		return NULL;
+
+	/* With an explicit Content-Length the handler may still be
+	 * writing the body, but its size is known anyway.
+	 */
+	complete = soup_message_headers_get_encoding (response_headers) == SOUP_ENCODING_CONTENT_LENGTH;
+	content_length = soup_message_headers_get_content_length (response_headers);
+	if (complete && content_length && content_length != response_body->length)
+		complete = FALSE;
+	if (complete || content_length) {
+		if ((complete ? response_body->length : content_length) < encoder->min_size)
+			return NULL;
+	} else if (!can_stream)
+		return NULL;
+
+	/* From here on, the response depends on Accept-Encoding */
+	if (!soup_message_headers_header_contains_common (response_headers, SOUP_HEADER_VARY, "Accept-Encoding"))
+		soup_message_headers_append_common (response_headers, SOUP_HEADER_VARY, "Accept-Encoding");
+
+	accept_encoding = soup_message_headers_get_list_common (request_headers, SOUP_HEADER_ACCEPT_ENCODING);
+	if (!accept_encoding)
+		return NULL;
+	coding = soup_header_choose_quality_item (accept_encoding, codings);
+	if (coding < 0)
+		return NULL;
+
+	if (complete) {
+		GBytes *compressed;
+
+		compressed = lookup_or_compress_body (encoder, response_body, coding);
+		if (!compressed)
+			return NULL;
+
+		if (g_bytes_get_size (compressed) < (gsize)response_body->length) {
+			soup_message_body_truncate (response_body);
+			soup_message_body_append_bytes (response_body, compressed);
+			soup_message_headers_set_content_length (response_headers, g_bytes_get_size (compressed));
+			set_content_encoding (response_headers, coding);
+		}
+		g_bytes_unref (compressed);
+
+		return NULL;
+	}
+
+	if (!can_stream)
+		return NULL;
+
+	set_content_encoding (response_headers, coding);
+	soup_message_headers_remove_common (response_headers, SOUP_HEADER_CONTENT_LENGTH);
+
+	return create_converter (coding, FALSE);
+}
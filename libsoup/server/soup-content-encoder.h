@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-content-encoder.h: server-side response compression
+ */
+
+#pragma once
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_CONTENT_ENCODER (soup_content_encoder_get_type ())
+SOUP_AVAILABLE_IN_3_8
+G_DECLARE_FINAL_TYPE (SoupContentEncoder, soup_content_encoder, SOUP, CONTENT_ENCODER, GObject)
+
+SOUP_AVAILABLE_IN_3_8
+SoupContentEncoder *soup_content_encoder_new               (void);
+
+SOUP_AVAILABLE_IN_3_8
+void                soup_content_encoder_set_content_types (SoupContentEncoder *encoder,
+							    const char * const *content_types);
+SOUP_AVAILABLE_IN_3_8
+const char * const *soup_content_encoder_get_content_types (SoupContentEncoder *encoder);
+
+SOUP_AVAILABLE_IN_3_8
+void                soup_content_encoder_set_min_size      (SoupContentEncoder *encoder,
+							    guint               min_size);
+SOUP_AVAILABLE_IN_3_8
+guint               soup_content_encoder_get_min_size      (SoupContentEncoder *encoder);
+
+SOUP_AVAILABLE_IN_3_8
+void                soup_content_encoder_set_cache_size    (SoupContentEncoder *encoder,
+							    guint               cache_size);
+SOUP_AVAILABLE_IN_3_8
+guint               soup_content_encoder_get_cache_size    (SoupContentEncoder *encoder);
+
+G_END_DECLS
@@ -7,6 +7,7 @@
 
 #include "soup-server-message.h"
 #include "soup-auth-domain.h"
+#include "soup-content-encoder.h"
 #include "soup-message-io-data.h"
 #include "soup-server-connection.h"
 
@@ -43,5 +44,10 @@ void               soup_server_message_set_options_ping    (SoupServerMessage
 
 SoupServerMessageIO *soup_server_message_get_io_data       (SoupServerMessage        *msg);
 
+void               soup_server_message_set_content_encoder (SoupServerMessage        *msg,
+                                                            SoupContentEncoder       *encoder);
+GConverter        *soup_server_message_setup_content_encoding (SoupServerMessage     *msg,
+                                                               gboolean               can_stream);
+
 
 #endif /* __SOUP_SERVER_MESSAGE_PRIVATE_H__ */
@@ -14,6 +14,7 @@
 #include "soup.h"
 #include "soup-connection.h"
 #include "soup-server-message-private.h"
+#include "soup-content-encoder-private.h"
 #include "soup-message-headers-private.h"
 #include "soup-uri-utils-private.h"
 
@@ -64,6 +65,8 @@ struct _SoupServerMessage {
 
         GTlsCertificate      *tls_peer_certificate;
         GTlsCertificateFlags  tls_peer_certificate_errors;
+
+        SoupContentEncoder   *content_encoder;
 };
 
 struct _SoupServerMessageClass {
@@ -137,6 +140,8 @@ soup_server_message_finalize (GObject *object)
         soup_message_body_unref (msg->response_body);
         soup_message_headers_unref (msg->response_headers);
 
+        g_clear_object (&msg->content_encoder);
+
         G_OBJECT_CLASS (soup_server_message_parent_class)->finalize (object);
 }
 
@@ -568,6 +573,26 @@ soup_server_message_get_io_data (SoupServerMessage *msg)
         return msg->io_data;
 }
 
+void
+soup_server_message_set_content_encoder (SoupServerMessage  *msg,
+                                         SoupContentEncoder *encoder)
+{
+        g_set_object (&msg->content_encoder, encoder);
+}
+
+/* Returns the converter the response body must be written through,
+ * if any. See soup_content_encoder_setup_response().
+ */
+GConverter *
+soup_server_message_setup_content_encoding (SoupServerMessage *msg,
+                                            gboolean           can_stream)
+{
+        if (!msg->content_encoder)
+                return NULL;
+
+        return soup_content_encoder_setup_response (msg->content_encoder, msg, can_stream);
+}
+
 /**
  * soup_server_message_pause:
  * @msg: a SoupServerMessage
@@ -165,6 +165,8 @@ typedef struct {
 
 	GPtrArray         *websocket_extension_types;
 
+        SoupContentEncoder *content_encoder;
+
 	gboolean           disposed;
         gboolean           http2_enabled;
 
@@ -180,6 +182,7 @@ enum {
         PROP_TLS_AUTH_MODE,
 	PROP_RAW_PATHS,
 	PROP_SERVER_HEADER,
+        PROP_CONTENT_ENCODER,
 
 	LAST_PROPERTY
 };
@@ -253,6 +256,8 @@ soup_server_finalize (GObject *object)
 
 	g_ptr_array_free (priv->websocket_extension_types, TRUE);
 
+        g_clear_object (&priv->content_encoder);
+
 	G_OBJECT_CLASS (soup_server_parent_class)->finalize (object);
 }
 
@@ -292,6 +297,9 @@ soup_server_set_property (GObject *object, guint prop_id,
 		} else
 			priv->server_header = g_strdup (header);
 		break;
+        case PROP_CONTENT_ENCODER:
+                soup_server_set_content_encoder (server, g_value_get_object (value));
+                break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -321,6 +329,9 @@ soup_server_get_property (GObject *object, guint prop_id,
 	case PROP_SERVER_HEADER:
 		g_value_set_string (value, priv->server_header);
 		break;
+        case PROP_CONTENT_ENCODER:
+                g_value_set_object (value, priv->content_encoder);
+                break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -539,6 +550,22 @@ soup_server_class_init (SoupServerClass *server_class)
                                      G_PARAM_CONSTRUCT |
                                      G_PARAM_STATIC_STRINGS);
 
+        /**
+         * SoupServer:content-encoder: (attributes org.gtk.Property.get=soup_server_get_content_encoder org.gtk.Property.set=soup_server_set_content_encoder)
+         *
+         * The [class@ContentEncoder] used to compress responses, or
+         * %NULL to send them as the handlers provide them.
+         *
+         * Since: 3.8
+         */
+        properties[PROP_CONTENT_ENCODER] =
+                g_param_spec_object ("content-encoder",
+                                     "Content encoder",
+                                     "SoupContentEncoder used to compress responses",
+                                     SOUP_TYPE_CONTENT_ENCODER,
+                                     G_PARAM_READWRITE |
+                                     G_PARAM_STATIC_STRINGS);
+
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
 
@@ -656,6 +683,52 @@ soup_server_get_tls_database (SoupServer *server)
         return priv->tls_database;
 }
 
+/**
+ * soup_server_set_content_encoder: (attributes org.gtk.Method.set_property=content-encoder)
+ * @server: a #SoupServer
+ * @encoder: (nullable): a #SoupContentEncoder
+ *
+ * Sets the [class@ContentEncoder] that compresses the responses of
+ * @server. It applies to the requests received after this call.
+ *
+ * Since: 3.8
+ */
+void
+soup_server_set_content_encoder (SoupServer         *server,
+                                 SoupContentEncoder *encoder)
+{
+        SoupServerPrivate *priv;
+
+        g_return_if_fail (SOUP_IS_SERVER (server));
+        g_return_if_fail (!encoder || SOUP_IS_CONTENT_ENCODER (encoder));
+
+        priv = soup_server_get_instance_private (server);
+        if (g_set_object (&priv->content_encoder, encoder))
+                g_object_notify_by_pspec (G_OBJECT (server), properties[PROP_CONTENT_ENCODER]);
+}
+
+/**
+ * soup_server_get_content_encoder: (attributes org.gtk.Method.get_property=content-encoder)
+ * @server: a #SoupServer
+ *
+ * Gets the [class@ContentEncoder] that compresses the responses of
+ * @server.
+ *
+ * Returns: (transfer none) (nullable): a #SoupContentEncoder or %NULL
+ *
+ * Since: 3.8
+ */
+SoupContentEncoder *
+soup_server_get_content_encoder (SoupServer *server)
+{
+        SoupServerPrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_SERVER (server), NULL);
+
+        priv = soup_server_get_instance_private (server);
+        return priv->content_encoder;
+}
+
 /**
  * soup_server_set_tls_auth_mode: (attributes org.gtk.Method.set_property=tls-auth-mode)
  * @server: a #SoupServer
@@ -1039,6 +1112,8 @@ request_started_cb (SoupServer           *server,
                                                     priv->server_header);
         }
 
+        soup_server_message_set_content_encoder (msg, priv->content_encoder);
+
         g_signal_emit (server, signals[REQUEST_STARTED], 0, msg);
 
         if (soup_server_message_get_io_data (msg)) {
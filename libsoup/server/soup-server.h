@@ -8,6 +8,7 @@
 #include "soup-types.h"
 #include "soup-uri-utils.h"
 #include "soup-websocket-connection.h"
+#include "soup-content-encoder.h"
 
 G_BEGIN_DECLS
 
@@ -62,6 +63,12 @@ GTlsAuthenticationMode soup_server_get_tls_auth_mode (SoupServer               *
 SOUP_AVAILABLE_IN_ALL
 gboolean        soup_server_is_https           (SoupServer               *server);
 
+SOUP_AVAILABLE_IN_3_8
+void            soup_server_set_content_encoder (SoupServer              *server,
+                                                 SoupContentEncoder      *encoder);
+SOUP_AVAILABLE_IN_3_8
+SoupContentEncoder *soup_server_get_content_encoder (SoupServer          *server);
+
 SOUP_AVAILABLE_IN_ALL
 gboolean        soup_server_listen             (SoupServer               *server,
 					        GSocketAddress           *address,
@@ -147,3 +147,32 @@ soup_client_message_io_owner_changed (SoupClientMessageIO *io)
         if (io->funcs->owner_changed)
                 io->funcs->owner_changed (io);
 }
+
+/* Returns %FALSE if the peer didn't answer the previous ping */
+gboolean
+soup_client_message_io_ping (SoupClientMessageIO *io)
+{
+        if (io->funcs->ping)
+                return io->funcs->ping (io);
+
+        return TRUE;
+}
+
+guint
+soup_client_message_io_get_n_streams (SoupClientMessageIO *io)
+{
+        if (io->funcs->get_n_streams)
+                return io->funcs->get_n_streams (io);
+
+        return 0;
+}
+
+/* Whether new messages would have to wait for others to make progress */
+gboolean
+soup_client_message_io_is_saturated (SoupClientMessageIO *io)
+{
+        if (io->funcs->is_saturated)
+                return io->funcs->is_saturated (io);
+
+        return FALSE;
+}
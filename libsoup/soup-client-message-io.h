@@ -56,6 +56,9 @@ typedef struct {
         GCancellable *(*get_cancellable)      (SoupClientMessageIO       *io,
                                                SoupMessage               *msg);
         void          (*owner_changed)        (SoupClientMessageIO       *io);
+        gboolean      (*ping)                 (SoupClientMessageIO       *io);
+        guint         (*get_n_streams)        (SoupClientMessageIO       *io);
+        gboolean      (*is_saturated)         (SoupClientMessageIO       *io);
 } SoupClientMessageIOFuncs;
 
 struct _SoupClientMessageIO {
@@ -107,3 +110,6 @@ gboolean      soup_client_message_io_is_reusable          (SoupClientMessageIO
 GCancellable *soup_client_message_io_get_cancellable      (SoupClientMessageIO       *io,
                                                            SoupMessage               *msg);
 void          soup_client_message_io_owner_changed        (SoupClientMessageIO       *io);
+gboolean      soup_client_message_io_ping                 (SoupClientMessageIO       *io);
+guint         soup_client_message_io_get_n_streams        (SoupClientMessageIO       *io);
+gboolean      soup_client_message_io_is_saturated         (SoupClientMessageIO       *io);
@@ -8,6 +8,7 @@
 #endif
 
 #include "soup-connection-manager.h"
+#include "soup-dns-cache-private.h"
 #include "soup-message-private.h"
 #include "soup-misc.h"
 #include "soup-session-private.h"
@@ -22,15 +23,40 @@ struct _SoupConnectionManager {
         GSocketConnectable *remote_connectable;
         guint max_conns;
         guint max_conns_per_host;
+        guint max_http2_conns_per_host;
         guint num_conns;
 
         GHashTable *http_hosts;
         GHashTable *https_hosts;
         GHashTable *conns;
 
+        GHashTable *warm_origins;
+        GSource *warm_src;
+
+        guint health_check_interval;
+        GSource *health_check_src;
+        guint64 num_stale_conns;
+
         guint64 last_connection_id;
 };
 
+typedef struct {
+        GUri *uri;
+        guint min_idle_conns;
+
+        /* Preconnects started and not finished yet */
+        guint pending;
+
+        /* Backoff after failed preconnects */
+        guint failures;
+        gint64 retry_time;
+} SoupWarmOrigin;
+
+typedef struct {
+        SoupConnectionManager *manager;
+        GUri *uri;
+} SoupWarmPreconnect;
+
 typedef struct {
         GUri *uri;
         GMutex *mutex;
@@ -40,12 +66,26 @@ typedef struct {
         GList *conns;
         guint  num_conns;
 
+        /* Last TLS connection handshaked with the host, used to
+         * resume its session on the next new connection only: a
+         * TLS 1.3 ticket must not be used twice, so the connections
+         * created before another handshake do a full one.
+         */
+        GTlsClientConnection *tls_session;
+
+        /* Whether the server answered with HTTP/1.0 */
+        gboolean http_1_0_server;
+
         GMainContext *context;
         GSource *keep_alive_src;
 } SoupHost;
 
 #define HOST_KEEP_ALIVE 5 * 60 * 1000 /* 5 min in msecs */
 
+#define WARM_INTERVAL 1000 /* msecs */
+#define WARM_REFRESH_MARGIN 5 /* secs */
+#define WARM_MAX_BACKOFF 60 /* secs */
+
 static SoupHost *
 soup_host_new (GUri         *uri,
                GHashTable   *owner_map,
@@ -90,6 +130,7 @@ soup_host_free (SoupHost *host)
 
         g_uri_unref (host->uri);
         g_object_unref (host->addr);
+        g_clear_object (&host->tls_session);
         g_free (host);
 }
 
@@ -166,6 +207,12 @@ soup_host_remove_connection (SoupHost       *host,
         host->conns = g_list_remove (host->conns, conn);
         host->num_conns--;
 
+        /* HTTP/1.0 servers usually close the connection after each
+         * response, so the new connections must know it beforehand.
+         */
+        if (soup_connection_get_server_http_version (conn) == SOUP_HTTP_1_0)
+                host->http_1_0_server = TRUE;
+
         /* Free the SoupHost (and its GNetworkAddress) if there
          * has not been any new connection to the host during
          * the last HOST_KEEP_ALIVE msecs.
@@ -226,6 +273,47 @@ remove_connection (gpointer key,
         soup_connection_manager_drop_connection (manager, key);
 }
 
+/* Origins are keyed like hosts: ws and wss URIs share the http and https ones */
+static GUri *
+soup_warm_origin_uri_new (GUri *uri)
+{
+        GUri *origin_uri, *host_uri;
+
+        origin_uri = soup_uri_copy (uri,
+                                    SOUP_URI_SCHEME, soup_uri_is_https (uri) ? "https" : "http",
+                                    SOUP_URI_NONE);
+        host_uri = soup_uri_copy_host (origin_uri);
+        g_uri_unref (origin_uri);
+
+        return host_uri;
+}
+
+static SoupWarmOrigin *
+soup_warm_origin_new (GUri *uri)
+{
+        SoupWarmOrigin *origin;
+
+        origin = g_new0 (SoupWarmOrigin, 1);
+        origin->uri = g_uri_ref (uri);
+
+        return origin;
+}
+
+static void
+soup_warm_origin_free (SoupWarmOrigin *origin)
+{
+        g_uri_unref (origin->uri);
+        g_free (origin);
+}
+
+static void
+soup_connection_manager_kick_warming_locked (SoupConnectionManager *manager,
+                                             SoupHost              *host)
+{
+        if (manager->warm_src && g_hash_table_contains (manager->warm_origins, host->uri))
+                g_source_set_ready_time (manager->warm_src, 0);
+}
+
 SoupConnectionManager *
 soup_connection_manager_new (SoupSession *session,
                              guint        max_conns,
@@ -237,6 +325,7 @@ soup_connection_manager_new (SoupSession *session,
         manager->session = session;
         manager->max_conns = max_conns;
         manager->max_conns_per_host = max_conns_per_host;
+        manager->max_http2_conns_per_host = 1;
         manager->http_hosts = g_hash_table_new_full (soup_host_uri_hash,
                                                      soup_host_uri_equal,
                                                      NULL,
@@ -246,6 +335,10 @@ soup_connection_manager_new (SoupSession *session,
                                                       NULL,
                                                       (GDestroyNotify)soup_host_free);
         manager->conns = g_hash_table_new (NULL, NULL);
+        manager->warm_origins = g_hash_table_new_full (soup_uri_host_hash,
+                                                       soup_uri_host_equal,
+                                                       NULL,
+                                                       (GDestroyNotify)soup_warm_origin_free);
         g_mutex_init (&manager->mutex);
         g_cond_init (&manager->cond);
 
@@ -255,6 +348,10 @@ soup_connection_manager_new (SoupSession *session,
 void
 soup_connection_manager_free (SoupConnectionManager *manager)
 {
+        soup_connection_manager_set_health_check_interval (manager, 0);
+        soup_connection_manager_stop_warming (manager);
+        g_hash_table_destroy (manager->warm_origins);
+
         g_hash_table_foreach (manager->conns, remove_connection, manager);
         g_assert (manager->num_conns == 0);
 
@@ -296,6 +393,31 @@ soup_connection_manager_get_max_conns_per_host (SoupConnectionManager *manager)
         return manager->max_conns_per_host;
 }
 
+void
+soup_connection_manager_set_max_http2_conns_per_host (SoupConnectionManager *manager,
+                                                      guint                  max_http2_conns_per_host)
+{
+        g_mutex_lock (&manager->mutex);
+        manager->max_http2_conns_per_host = MAX (max_http2_conns_per_host, 1);
+        g_mutex_unlock (&manager->mutex);
+}
+
+guint
+soup_connection_manager_get_max_http2_conns_per_host (SoupConnectionManager *manager)
+{
+        return manager->max_http2_conns_per_host;
+}
+
+void
+soup_connection_manager_set_misdirected (SoupConnectionManager *manager,
+                                         SoupConnection        *conn,
+                                         GUri                  *uri)
+{
+        g_mutex_lock (&manager->mutex);
+        soup_connection_set_misdirected (conn, uri);
+        g_mutex_unlock (&manager->mutex);
+}
+
 void
 soup_connection_manager_set_remote_connectable (SoupConnectionManager *manager,
                                                 GSocketConnectable    *connectable)
@@ -345,6 +467,8 @@ soup_connection_manager_cleanup_locked (SoupConnectionManager *manager,
 
                 state = soup_connection_get_state (conn);
                 if (state == SOUP_CONNECTION_IDLE && (cleanup_idle || !soup_connection_is_idle_open (conn))) {
+                        if (!cleanup_idle && soup_connection_is_stale (conn))
+                                manager->num_stale_conns++;
                         conns = g_list_prepend (conns, g_object_ref (conn));
                         g_hash_table_iter_remove (&iter);
                         soup_host_remove_connection (host, conn);
@@ -355,6 +479,24 @@ soup_connection_manager_cleanup_locked (SoupConnectionManager *manager,
         return conns;
 }
 
+/* Drops an idle connection that was closed by the server. The signals
+ * are disconnected by then, so it's ok to disconnect with the mutex locked.
+ */
+static void
+soup_connection_manager_discard_stale_locked (SoupConnectionManager *manager,
+                                              SoupHost              *host,
+                                              SoupConnection        *conn)
+{
+        g_object_ref (conn);
+        g_hash_table_remove (manager->conns, conn);
+        soup_host_remove_connection (host, conn);
+        soup_connection_manager_drop_connection (manager, conn);
+        manager->num_stale_conns++;
+
+        soup_connection_disconnect (conn);
+        g_object_unref (conn);
+}
+
 static void
 connection_disconnected (SoupConnection        *conn,
                          SoupConnectionManager *manager)
@@ -363,8 +505,10 @@ connection_disconnected (SoupConnection        *conn,
 
         g_mutex_lock (&manager->mutex);
         g_hash_table_steal_extended (manager->conns, conn, NULL, (gpointer *)&host);
-        if (host)
+        if (host) {
                 soup_host_remove_connection (host, conn);
+                soup_connection_manager_kick_warming_locked (manager, host);
+        }
         soup_connection_manager_drop_connection (manager, conn);
         g_mutex_unlock (&manager->mutex);
 
@@ -386,6 +530,90 @@ connection_state_changed (SoupConnection        *conn,
         soup_session_kick_queue (manager->session);
 }
 
+static void
+connection_event (SoupConnection        *conn,
+                  GSocketClientEvent     event,
+                  GIOStream             *connection,
+                  SoupConnectionManager *manager)
+{
+        SoupHost *host;
+
+        if (event != G_SOCKET_CLIENT_TLS_HANDSHAKED || !G_IS_TLS_CLIENT_CONNECTION (connection))
+                return;
+
+        g_mutex_lock (&manager->mutex);
+        host = g_hash_table_lookup (manager->conns, conn);
+        if (host)
+                g_set_object (&host->tls_session, G_TLS_CLIENT_CONNECTION (connection));
+        g_mutex_unlock (&manager->mutex);
+}
+
+/* Looks for an HTTP/2 connection to another host that can carry the
+ * requests for @host (RFC 7540 section 9.1.1). Only hosts with known
+ * addresses are considered: IP literals, or names in the session's
+ * DNS cache, since resolving them here would block.
+ */
+static SoupConnection *
+soup_connection_manager_find_coalescing_connection_locked (SoupConnectionManager *manager,
+                                                           SoupHost              *host,
+                                                           SoupMessageQueueItem  *item)
+{
+        SoupSessionFeature *dns_cache;
+        SoupConnection *coalescing_conn = NULL;
+        const char *hostname;
+        GList *addresses;
+        GHashTableIter iter;
+        gpointer key, value;
+
+        if (!soup_uri_is_https (host->uri) || manager->remote_connectable)
+                return NULL;
+
+        hostname = g_uri_get_host (host->uri);
+        if (g_hostname_is_ip_address (hostname)) {
+                addresses = g_list_prepend (NULL, g_inet_address_new_from_string (hostname));
+        } else {
+                dns_cache = soup_session_get_feature (item->session, SOUP_TYPE_DNS_CACHE);
+                if (!dns_cache)
+                        return NULL;
+
+                addresses = soup_dns_cache_get_cached_addresses (SOUP_DNS_CACHE (dns_cache), hostname);
+        }
+
+        if (!addresses)
+                return NULL;
+
+        g_hash_table_iter_init (&iter, manager->conns);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                SoupConnection *conn = key;
+
+                if (value == host)
+                        continue;
+
+                switch (soup_connection_get_state (conn)) {
+                case SOUP_CONNECTION_IN_USE:
+                        if (soup_connection_get_owner (conn) != g_thread_self () || !soup_connection_is_reusable (conn))
+                                continue;
+                        break;
+                case SOUP_CONNECTION_IDLE:
+                        if (!soup_connection_is_idle_open (conn))
+                                continue;
+                        break;
+                default:
+                        continue;
+                }
+
+                if (soup_connection_is_saturated (conn) || !soup_connection_can_coalesce (conn, host->uri, addresses))
+                        continue;
+
+                if (!coalescing_conn || soup_connection_get_n_streams (conn) < soup_connection_get_n_streams (coalescing_conn))
+                        coalescing_conn = conn;
+        }
+
+        g_resolver_free_addresses (addresses);
+
+        return coalescing_conn;
+}
+
 static SoupConnection *
 soup_connection_manager_get_connection_locked (SoupConnectionManager *manager,
                                                SoupMessageQueueItem  *item)
@@ -397,9 +625,12 @@ soup_connection_manager_get_connection_locked (SoupConnectionManager *manager,
         SoupSocketProperties *socket_props;
         SoupHost *host;
         guint8 force_http_version;
-        GList *l;
+        GList *l, *next;
         GSocketConnectable *remote_connectable;
         gboolean try_cleanup = TRUE;
+        SoupConnection *shared_conn, *saturated_conn;
+        guint n_http2_conns;
+        gboolean wait_for_pending;
 
         if (env_force_http1 == -1)
                 env_force_http1 = g_getenv ("SOUP_FORCE_HTTP1") != NULL ? 1 : 0;
@@ -414,10 +645,16 @@ soup_connection_manager_get_connection_locked (SoupConnectionManager *manager,
 
         force_http_version = env_force_http1 ? SOUP_HTTP_1_1 : soup_message_get_force_http_version (msg);
         while (TRUE) {
-                for (l = host->conns; l && l->data; l = g_list_next (l)) {
+                shared_conn = NULL;
+                saturated_conn = NULL;
+                n_http2_conns = 0;
+                wait_for_pending = FALSE;
+
+                for (l = host->conns; l && l->data; l = next) {
                         SoupHTTPVersion http_version;
 
                         conn = (SoupConnection *)l->data;
+                        next = g_list_next (l);
 
                         http_version = soup_connection_get_negotiated_protocol (conn);
                         if (force_http_version <= SOUP_HTTP_2_0 && http_version != force_http_version)
@@ -425,12 +662,24 @@ soup_connection_manager_get_connection_locked (SoupConnectionManager *manager,
 
                         switch (soup_connection_get_state (conn)) {
                         case SOUP_CONNECTION_IN_USE:
-                                if (!need_new_connection && http_version == SOUP_HTTP_2_0 && soup_connection_get_owner (conn) == g_thread_self () && soup_connection_is_reusable (conn))
-                                        return conn;
+                                if (http_version == SOUP_HTTP_2_0)
+                                        n_http2_conns++;
+                                /* Share the least loaded h2 connection that is not saturated */
+                                if (!need_new_connection && http_version == SOUP_HTTP_2_0 && soup_connection_get_owner (conn) == g_thread_self () && soup_connection_is_reusable (conn)) {
+                                        SoupConnection **least_loaded;
+
+                                        least_loaded = soup_connection_is_saturated (conn) ? &saturated_conn : &shared_conn;
+                                        if (!*least_loaded || soup_connection_get_n_streams (conn) < soup_connection_get_n_streams (*least_loaded))
+                                                *least_loaded = conn;
+                                }
                                 break;
                         case SOUP_CONNECTION_IDLE:
-                                if (!need_new_connection && soup_connection_is_idle_open (conn))
+                                if (!need_new_connection && soup_connection_is_idle_open (conn)) {
+                                        soup_connection_manager_kick_warming_locked (manager, host);
                                         return conn;
+                                }
+                                if (soup_connection_is_stale (conn))
+                                        soup_connection_manager_discard_stale_locked (manager, host, conn);
                                 break;
                         case SOUP_CONNECTION_CONNECTING:
                                 if (soup_session_steal_preconnection (item->session, item, conn))
@@ -440,12 +689,33 @@ soup_connection_manager_get_connection_locked (SoupConnectionManager *manager,
                                  * an h2 connection which will be shared. http/1.x connections
                                  * will only be slightly delayed. */
                                 if (force_http_version > SOUP_HTTP_1_1 && !need_new_connection && !item->connect_only && item->async && soup_connection_get_owner (conn) == g_thread_self ())
-                                        return NULL;
+                                        wait_for_pending = TRUE;
                         default:
                                 break;
                         }
                 }
 
+                if (shared_conn)
+                        return shared_conn;
+
+                if (!saturated_conn && !need_new_connection && !item->connect_only && force_http_version > SOUP_HTTP_1_1) {
+                        conn = soup_connection_manager_find_coalescing_connection_locked (manager, host, item);
+                        if (conn)
+                                return conn;
+                }
+
+                if (wait_for_pending)
+                        return NULL;
+
+                /* All the h2 connections are saturated: open another one if
+                 * allowed, otherwise queue on the least loaded one.
+                 */
+                if (saturated_conn &&
+                    (n_http2_conns >= manager->max_http2_conns_per_host ||
+                     host->num_conns >= manager->max_conns_per_host ||
+                     manager->num_conns >= manager->max_conns))
+                        return saturated_conn;
+
                 if (host->num_conns >= manager->max_conns_per_host) {
                         if (need_new_connection && try_cleanup) {
                                 GList *conns;
@@ -496,7 +766,17 @@ soup_connection_manager_get_connection_locked (SoupConnectionManager *manager,
         }
 
         /* Create a new connection */
-        remote_connectable = manager->remote_connectable ? manager->remote_connectable : G_SOCKET_CONNECTABLE (host->addr);
+        if (manager->remote_connectable) {
+                remote_connectable = g_object_ref (manager->remote_connectable);
+        } else {
+                SoupSessionFeature *dns_cache;
+
+                dns_cache = soup_session_get_feature (item->session, SOUP_TYPE_DNS_CACHE);
+                if (dns_cache)
+                        remote_connectable = soup_dns_cache_create_connectable (SOUP_DNS_CACHE (dns_cache), host->uri);
+                else
+                        remote_connectable = g_object_ref (G_SOCKET_CONNECTABLE (host->addr));
+        }
         socket_props = soup_session_ensure_socket_props (item->session);
         conn = g_object_new (SOUP_TYPE_CONNECTION,
                              "id", ++manager->last_connection_id,
@@ -506,6 +786,16 @@ soup_connection_manager_get_connection_locked (SoupConnectionManager *manager,
                              "socket-properties", socket_props,
                              "force-http-version", force_http_version,
                              NULL);
+        g_object_unref (remote_connectable);
+
+        if (host->tls_session) {
+                soup_connection_set_tls_session (conn, host->tls_session);
+                g_clear_object (&host->tls_session);
+        }
+        if (host->http_1_0_server)
+                soup_connection_set_server_http_version (conn, SOUP_HTTP_1_0);
+        if (g_hash_table_contains (manager->warm_origins, host->uri))
+                soup_connection_set_warm (conn, TRUE);
 
         g_signal_connect (conn, "disconnected",
                           G_CALLBACK (connection_disconnected),
@@ -513,6 +803,9 @@ soup_connection_manager_get_connection_locked (SoupConnectionManager *manager,
         g_signal_connect (conn, "notify::state",
                           G_CALLBACK (connection_state_changed),
                           manager);
+        g_signal_connect (conn, "event",
+                          G_CALLBACK (connection_event),
+                          manager);
 
         g_hash_table_insert (manager->conns, conn, host);
 
@@ -595,3 +888,298 @@ soup_connection_manager_steal_connection (SoupConnectionManager *manager,
 
         return stream;
 }
+
+static guint
+soup_connection_manager_get_missing_conns_locked (SoupConnectionManager *manager,
+                                                  SoupWarmOrigin        *origin,
+                                                  gint64                 refresh_margin)
+{
+        GHashTable *map;
+        SoupHost *host;
+        GList *l;
+        guint warm_conns = 0;
+        guint num_conns = 0;
+        guint room;
+        gint64 now = g_get_monotonic_time ();
+
+        map = soup_uri_is_https (origin->uri) ? manager->https_hosts : manager->http_hosts;
+        host = g_hash_table_lookup (map, origin->uri);
+        if (host) {
+                for (l = host->conns; l; l = g_list_next (l)) {
+                        SoupConnection *conn = l->data;
+                        gint64 deadline;
+
+                        switch (soup_connection_get_state (conn)) {
+                        case SOUP_CONNECTION_IDLE:
+                                /* Connections about to be closed by the idle timeout
+                                 * are replaced in advance.
+                                 */
+                                deadline = soup_connection_get_idle_deadline (conn);
+                                if (deadline < 0 || deadline - now > refresh_margin)
+                                        warm_conns++;
+                                break;
+                        case SOUP_CONNECTION_IN_USE:
+                                /* New requests can be sent right away on a shared http/2 connection */
+                                if (soup_connection_get_negotiated_protocol (conn) == SOUP_HTTP_2_0 &&
+                                    soup_connection_is_reusable (conn))
+                                        warm_conns++;
+                                break;
+                        default:
+                                break;
+                        }
+                }
+                num_conns = host->num_conns;
+        }
+
+        warm_conns += origin->pending;
+        if (warm_conns >= origin->min_idle_conns)
+                return 0;
+
+        num_conns += origin->pending;
+        room = num_conns < manager->max_conns_per_host ? manager->max_conns_per_host - num_conns : 0;
+        if (manager->num_conns + origin->pending < manager->max_conns)
+                room = MIN (room, manager->max_conns - manager->num_conns - origin->pending);
+        else
+                room = 0;
+
+        return MIN (origin->min_idle_conns - warm_conns, room);
+}
+
+static void
+warm_preconnect_complete (SoupSession        *session,
+                          GAsyncResult       *result,
+                          SoupWarmPreconnect *preconnect)
+{
+        SoupConnectionManager *manager = preconnect->manager;
+        SoupWarmOrigin *origin;
+        GError *error = NULL;
+
+        soup_session_preconnect_finish (session, result, &error);
+
+        g_mutex_lock (&manager->mutex);
+        origin = g_hash_table_lookup (manager->warm_origins, preconnect->uri);
+        if (origin) {
+                if (origin->pending > 0)
+                        origin->pending--;
+                if (!error) {
+                        origin->failures = 0;
+                        origin->retry_time = 0;
+                } else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        origin->failures = MIN (origin->failures + 1, 6);
+                        origin->retry_time = g_get_monotonic_time () +
+                                MIN (1 << origin->failures, WARM_MAX_BACKOFF) * G_USEC_PER_SEC;
+                }
+        }
+        g_mutex_unlock (&manager->mutex);
+
+        g_clear_error (&error);
+        g_uri_unref (preconnect->uri);
+        g_free (preconnect);
+}
+
+static gboolean
+warm_origins (SoupConnectionManager *manager)
+{
+        GHashTableIter iter;
+        SoupWarmOrigin *origin;
+        GList *preconnects = NULL, *l;
+        guint idle_timeout;
+        gint64 refresh_margin;
+        gint64 now = g_get_monotonic_time ();
+
+        /* Drop the idle connections closed by the server */
+        soup_connection_manager_cleanup (manager, FALSE);
+
+        idle_timeout = soup_session_get_idle_timeout (manager->session);
+        refresh_margin = (gint64)MIN (WARM_REFRESH_MARGIN, idle_timeout / 2) * G_USEC_PER_SEC;
+
+        g_mutex_lock (&manager->mutex);
+        g_hash_table_iter_init (&iter, manager->warm_origins);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&origin)) {
+                guint missing;
+
+                if (origin->retry_time > now)
+                        continue;
+
+                missing = soup_connection_manager_get_missing_conns_locked (manager, origin, refresh_margin);
+                origin->pending += missing;
+                while (missing--)
+                        preconnects = g_list_prepend (preconnects, g_uri_ref (origin->uri));
+        }
+        g_mutex_unlock (&manager->mutex);
+
+        for (l = preconnects; l; l = g_list_next (l)) {
+                SoupWarmPreconnect *preconnect;
+                SoupMessage *msg;
+
+                preconnect = g_new (SoupWarmPreconnect, 1);
+                preconnect->manager = manager;
+                preconnect->uri = l->data;
+
+                msg = soup_message_new_from_uri (SOUP_METHOD_HEAD, preconnect->uri);
+                soup_message_add_flags (msg, SOUP_MESSAGE_NEW_CONNECTION);
+                soup_session_preconnect_async (manager->session, msg, G_PRIORITY_LOW, NULL,
+                                               (GAsyncReadyCallback)warm_preconnect_complete,
+                                               preconnect);
+                g_object_unref (msg);
+        }
+        g_list_free (preconnects);
+
+        return G_SOURCE_CONTINUE;
+}
+
+void
+soup_connection_manager_set_min_idle_conns (SoupConnectionManager *manager,
+                                            GUri                  *uri,
+                                            guint                  min_idle_conns)
+{
+        SoupWarmOrigin *origin;
+        GUri *origin_uri;
+
+        origin_uri = soup_warm_origin_uri_new (uri);
+
+        g_mutex_lock (&manager->mutex);
+        if (min_idle_conns == 0) {
+                g_hash_table_remove (manager->warm_origins, origin_uri);
+        } else {
+                origin = g_hash_table_lookup (manager->warm_origins, origin_uri);
+                if (!origin) {
+                        origin = soup_warm_origin_new (origin_uri);
+                        g_hash_table_insert (manager->warm_origins, origin->uri, origin);
+                }
+                origin->min_idle_conns = min_idle_conns;
+                origin->failures = 0;
+                origin->retry_time = 0;
+        }
+
+        if (g_hash_table_size (manager->warm_origins) == 0) {
+                if (manager->warm_src) {
+                        g_source_destroy (manager->warm_src);
+                        g_clear_pointer (&manager->warm_src, g_source_unref);
+                }
+        } else {
+                if (!manager->warm_src) {
+                        manager->warm_src = soup_add_timeout (soup_session_get_context (manager->session),
+                                                              WARM_INTERVAL,
+                                                              (GSourceFunc)warm_origins,
+                                                              manager);
+                }
+                g_source_set_ready_time (manager->warm_src, 0);
+        }
+        g_mutex_unlock (&manager->mutex);
+
+        g_uri_unref (origin_uri);
+}
+
+guint
+soup_connection_manager_get_min_idle_conns (SoupConnectionManager *manager,
+                                            GUri                  *uri)
+{
+        SoupWarmOrigin *origin;
+        GUri *origin_uri;
+        guint min_idle_conns;
+
+        origin_uri = soup_warm_origin_uri_new (uri);
+
+        g_mutex_lock (&manager->mutex);
+        origin = g_hash_table_lookup (manager->warm_origins, origin_uri);
+        min_idle_conns = origin ? origin->min_idle_conns : 0;
+        g_mutex_unlock (&manager->mutex);
+
+        g_uri_unref (origin_uri);
+
+        return min_idle_conns;
+}
+
+void
+soup_connection_manager_stop_warming (SoupConnectionManager *manager)
+{
+        g_mutex_lock (&manager->mutex);
+        g_hash_table_remove_all (manager->warm_origins);
+        if (manager->warm_src) {
+                g_source_destroy (manager->warm_src);
+                g_clear_pointer (&manager->warm_src, g_source_unref);
+        }
+        g_mutex_unlock (&manager->mutex);
+}
+
+static gboolean
+health_check (SoupConnectionManager *manager)
+{
+        GList *stale_conns = NULL, *idle_conns = NULL, *l;
+        GHashTableIter iter;
+        SoupConnection *conn;
+        SoupHost *host;
+
+        g_mutex_lock (&manager->mutex);
+        g_hash_table_iter_init (&iter, manager->conns);
+        while (g_hash_table_iter_next (&iter, (gpointer *)&conn, (gpointer *)&host)) {
+                if (soup_connection_get_state (conn) != SOUP_CONNECTION_IDLE)
+                        continue;
+
+                if (soup_connection_is_stale (conn)) {
+                        stale_conns = g_list_prepend (stale_conns, g_object_ref (conn));
+                        g_hash_table_iter_remove (&iter);
+                        soup_host_remove_connection (host, conn);
+                        soup_connection_manager_drop_connection (manager, conn);
+                        manager->num_stale_conns++;
+                } else
+                        idle_conns = g_list_prepend (idle_conns, g_object_ref (conn));
+        }
+        g_mutex_unlock (&manager->mutex);
+
+        soup_connection_list_disconnect_all (stale_conns);
+
+        /* Pinging can write to the connection, so do it without the lock */
+        for (l = idle_conns; l; l = g_list_next (l)) {
+                conn = l->data;
+
+                if (!soup_connection_ping (conn)) {
+                        g_mutex_lock (&manager->mutex);
+                        manager->num_stale_conns++;
+                        g_mutex_unlock (&manager->mutex);
+                        soup_connection_disconnect (conn);
+                }
+                g_object_unref (conn);
+        }
+        g_list_free (idle_conns);
+
+        return G_SOURCE_CONTINUE;
+}
+
+void
+soup_connection_manager_set_health_check_interval (SoupConnectionManager *manager,
+                                                   guint                  interval)
+{
+        g_mutex_lock (&manager->mutex);
+        manager->health_check_interval = interval;
+        if (manager->health_check_src) {
+                g_source_destroy (manager->health_check_src);
+                g_clear_pointer (&manager->health_check_src, g_source_unref);
+        }
+        if (interval) {
+                manager->health_check_src = soup_add_timeout (soup_session_get_context (manager->session),
+                                                              interval * 1000,
+                                                              (GSourceFunc)health_check,
+                                                              manager);
+        }
+        g_mutex_unlock (&manager->mutex);
+}
+
+guint
+soup_connection_manager_get_health_check_interval (SoupConnectionManager *manager)
+{
+        return manager->health_check_interval;
+}
+
+guint64
+soup_connection_manager_get_n_stale_conns (SoupConnectionManager *manager)
+{
+        guint64 num_stale_conns;
+
+        g_mutex_lock (&manager->mutex);
+        num_stale_conns = manager->num_stale_conns;
+        g_mutex_unlock (&manager->mutex);
+
+        return num_stale_conns;
+}
@@ -22,6 +22,12 @@ guint                  soup_connection_manager_get_max_conns          (SoupConne
 void                   soup_connection_manager_set_max_conns_per_host (SoupConnectionManager *manager,
                                                                        guint                  max_conns_per_host);
 guint                  soup_connection_manager_get_max_conns_per_host (SoupConnectionManager *manager);
+void                   soup_connection_manager_set_max_http2_conns_per_host (SoupConnectionManager *manager,
+                                                                             guint                  max_http2_conns_per_host);
+guint                  soup_connection_manager_get_max_http2_conns_per_host (SoupConnectionManager *manager);
+void                   soup_connection_manager_set_misdirected        (SoupConnectionManager *manager,
+                                                                       SoupConnection        *conn,
+                                                                       GUri                  *uri);
 void                   soup_connection_manager_set_remote_connectable (SoupConnectionManager *manager,
                                                                        GSocketConnectable    *connectable);
 GSocketConnectable    *soup_connection_manager_get_remote_connectable (SoupConnectionManager *manager);
@@ -32,5 +38,15 @@ gboolean               soup_connection_manager_cleanup                (SoupConne
                                                                        gboolean               cleanup_idle);
 GIOStream             *soup_connection_manager_steal_connection       (SoupConnectionManager *manager,
                                                                        SoupMessage           *msg);
+void                   soup_connection_manager_set_min_idle_conns     (SoupConnectionManager *manager,
+                                                                       GUri                  *uri,
+                                                                       guint                  min_idle_conns);
+guint                  soup_connection_manager_get_min_idle_conns     (SoupConnectionManager *manager,
+                                                                       GUri                  *uri);
+void                   soup_connection_manager_stop_warming           (SoupConnectionManager *manager);
+void                   soup_connection_manager_set_health_check_interval (SoupConnectionManager *manager,
+                                                                          guint                  interval);
+guint                  soup_connection_manager_get_health_check_interval (SoupConnectionManager *manager);
+guint64                soup_connection_manager_get_n_stale_conns      (SoupConnectionManager *manager);
 
 #endif /* __SOUP_CONNECTION_MANAGER_H__ */
@@ -40,11 +40,18 @@ typedef struct {
         SoupClientMessageIO *io_data;
 	SoupConnectionState state;
 	time_t       unused_timeout;
+        gboolean     warm;
 	GSource     *idle_timeout_src;
         guint        in_use;
         SoupHTTPVersion http_version;
+        /* The version the server answered with, if lower */
+        SoupHTTPVersion server_http_version;
 
         GTlsCertificate *tls_client_cert;
+        GTlsClientConnection *tls_session;
+        GHashTable *misdirected_hosts;
+        /* Hosts the certificate was verified for, when coalescing */
+        GHashTable *coalescing_hosts;
 
 	GCancellable *cancellable;
         GThread *owner;
@@ -103,6 +110,7 @@ soup_connection_init (SoupConnection *conn)
         SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
 
         priv->http_version = SOUP_HTTP_1_1;
+        priv->server_http_version = SOUP_HTTP_2_0;
         priv->force_http_version = G_MAXUINT8;
         priv->owner = g_thread_self ();
         priv->window_size = HTTP2_INITIAL_WINDOW_SIZE;
@@ -118,6 +126,9 @@ soup_connection_finalize (GObject *object)
 	g_clear_pointer (&priv->socket_props, soup_socket_properties_unref);
         g_clear_pointer (&priv->io_data, soup_client_message_io_destroy);
 	g_clear_object (&priv->remote_connectable);
+        g_clear_object (&priv->tls_session);
+        g_clear_pointer (&priv->misdirected_hosts, g_hash_table_destroy);
+        g_clear_pointer (&priv->coalescing_hosts, g_hash_table_destroy);
         g_clear_object (&priv->remote_address);
 	g_clear_object (&priv->proxy_msg);
 
@@ -638,6 +649,11 @@ new_tls_connection (SoupConnection    *conn,
         if (!tls_connection)
                 return NULL;
 
+        if (priv->tls_session) {
+                g_tls_client_connection_copy_session_state (tls_connection, priv->tls_session);
+                g_clear_object (&priv->tls_session);
+        }
+
 	if (!priv->socket_props->tlsdb_use_default)
 		g_tls_connection_set_database (G_TLS_CONNECTION (tls_connection), priv->socket_props->tlsdb);
 
@@ -657,6 +673,24 @@ new_tls_connection (SoupConnection    *conn,
         return tls_connection;
 }
 
+static void
+set_tcp_keepalive (GSocket *socket,
+                   guint    keepalive)
+{
+        g_socket_set_keepalive (socket, TRUE);
+#ifdef TCP_KEEPIDLE
+        g_socket_set_option (socket, IPPROTO_TCP, TCP_KEEPIDLE, keepalive, NULL);
+#elif defined(TCP_KEEPALIVE)
+        g_socket_set_option (socket, IPPROTO_TCP, TCP_KEEPALIVE, keepalive, NULL);
+#endif
+#ifdef TCP_KEEPINTVL
+        g_socket_set_option (socket, IPPROTO_TCP, TCP_KEEPINTVL, MAX (keepalive / 3, 1), NULL);
+#endif
+#ifdef TCP_KEEPCNT
+        g_socket_set_option (socket, IPPROTO_TCP, TCP_KEEPCNT, 3, NULL);
+#endif
+}
+
 static gboolean
 soup_connection_connected (SoupConnection    *conn,
                            GSocketConnection *connection,
@@ -668,6 +702,8 @@ soup_connection_connected (SoupConnection    *conn,
         socket = g_socket_connection_get_socket (connection);
         g_socket_set_timeout (socket, priv->socket_props->io_timeout);
         g_socket_set_option (socket, IPPROTO_TCP, TCP_NODELAY, TRUE, NULL);
+        if (priv->socket_props->tcp_keepalive)
+                set_tcp_keepalive (socket, priv->socket_props->tcp_keepalive);
 
         g_clear_object (&priv->remote_address);
         priv->remote_address = g_socket_get_remote_address (socket, NULL);
@@ -728,7 +764,7 @@ soup_connection_complete (SoupConnection *conn)
         soup_connection_create_io_data (conn);
 
         soup_connection_set_state (conn, SOUP_CONNECTION_IN_USE);
-        priv->unused_timeout = time (NULL) + SOUP_CONNECTION_UNUSED_TIMEOUT;
+        priv->unused_timeout = priv->warm ? 0 : time (NULL) + SOUP_CONNECTION_UNUSED_TIMEOUT;
         start_idle_timer (conn);
 }
 
@@ -833,6 +869,92 @@ soup_connection_connect_finish (SoupConnection  *conn,
         return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+static void
+connect_sync_ready_cb (GSocketClient *client,
+                       GAsyncResult  *result,
+                       GAsyncResult **result_out)
+{
+        *result_out = g_object_ref (result);
+}
+
+/* The client can be finalized from another thread, by a lookup */
+typedef struct {
+        GMainContext *context;
+        GMutex mutex;
+        gboolean finalized;
+} SocketClientRace;
+
+static void
+socket_client_finalized (SocketClientRace *race,
+                         GObject          *client)
+{
+        g_mutex_lock (&race->mutex);
+        race->finalized = TRUE;
+        g_main_context_wakeup (race->context);
+        g_mutex_unlock (&race->mutex);
+}
+
+static gboolean
+socket_client_race_is_finished (SocketClientRace *race)
+{
+        gboolean finalized;
+
+        g_mutex_lock (&race->mutex);
+        finalized = race->finalized;
+        g_mutex_unlock (&race->mutex);
+
+        return finalized;
+}
+
+/* g_socket_client_connect() tries the addresses of the remote host one
+ * after the other, waiting for each attempt to time out before moving
+ * on to the next one. The asynchronous version interleaves IPv6 and
+ * IPv4 addresses and starts a new attempt every 250ms while the
+ * previous ones are still pending (RFC 8305), keeping the first one
+ * that succeeds. Run that one on a private context so that synchronous
+ * connections do not get stuck on an unreachable address family.
+ *
+ * The attempts that lost the race, and the lookups still running, are
+ * cancelled once there's a winner, and complete later on the private
+ * context. They all keep @client alive, so the context is iterated
+ * until @client, which is consumed, is finalized.
+ */
+static GSocketConnection *
+socket_client_connect_racing (GSocketClient      *client,
+                              GSocketConnectable *connectable,
+                              GCancellable       *cancellable,
+                              GError            **error)
+{
+        SocketClientRace race;
+        GAsyncResult *result = NULL;
+        GSocketConnection *connection;
+
+        race.context = g_main_context_new ();
+        g_mutex_init (&race.mutex);
+        race.finalized = FALSE;
+        g_main_context_push_thread_default (race.context);
+
+        g_socket_client_connect_async (client, connectable, cancellable,
+                                       (GAsyncReadyCallback)connect_sync_ready_cb,
+                                       &result);
+        while (!result)
+                g_main_context_iteration (race.context, TRUE);
+
+        connection = g_socket_client_connect_finish (client, result, error);
+        g_object_unref (result);
+
+        g_object_weak_ref (G_OBJECT (client), (GWeakNotify)socket_client_finalized, &race);
+        g_object_unref (client);
+        while (!socket_client_race_is_finished (&race))
+                g_main_context_iteration (race.context, TRUE);
+
+        g_main_context_pop_thread_default (race.context);
+        g_main_context_unref (race.context);
+        g_mutex_clear (&race.mutex);
+
+        return connection;
+}
+
 gboolean
 soup_connection_connect (SoupConnection  *conn,
 			 GCancellable    *cancellable,
@@ -851,11 +973,10 @@ soup_connection_connect (SoupConnection  *conn,
         priv->cancellable = cancellable ? g_object_ref (cancellable) : g_cancellable_new ();
 
         client = new_socket_client (conn);
-        connection = g_socket_client_connect (client,
-                                              priv->remote_connectable,
-                                              priv->cancellable,
-                                              error);
-        g_object_unref (client);
+        connection = socket_client_connect_racing (client,
+                                                   priv->remote_connectable,
+                                                   priv->cancellable,
+                                                   error);
 
         if (!connection) {
                 g_clear_object (&priv->cancellable);
@@ -1145,13 +1266,128 @@ soup_connection_is_idle_open (SoupConnection *conn)
         if (g_atomic_int_get (&priv->state) != SOUP_CONNECTION_IDLE)
                 return FALSE;
 
-	if (!g_socket_is_connected (soup_connection_get_socket (conn)))
-		return FALSE;
-
 	if (priv->unused_timeout && priv->unused_timeout < time (NULL))
 		return FALSE;
 
-        return soup_client_message_io_is_open (priv->io_data);
+        return !soup_connection_is_stale (conn);
+}
+
+/* Whether @conn was closed by the peer or can't be used anymore */
+gboolean
+soup_connection_is_stale (SoupConnection *conn)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+	if (!g_socket_is_connected (soup_connection_get_socket (conn)))
+		return TRUE;
+
+        return !soup_client_message_io_is_open (priv->io_data);
+}
+
+guint
+soup_connection_get_n_streams (SoupConnection *conn)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        return priv->io_data ? soup_client_message_io_get_n_streams (priv->io_data) : 0;
+}
+
+gboolean
+soup_connection_is_saturated (SoupConnection *conn)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        return priv->io_data ? soup_client_message_io_is_saturated (priv->io_data) : FALSE;
+}
+
+/* Whether @conn can also carry requests for @uri, whose host resolves
+ * to @addresses, as allowed by RFC 7540 section 9.1.1: it must be a
+ * direct https connection to one of @addresses, on the same port, and
+ * its certificate must be valid for the host of @uri. Hosts the
+ * certificate was found valid for are remembered, as this is checked
+ * for every request to a coalesced host.
+ */
+gboolean
+soup_connection_can_coalesce (SoupConnection *conn,
+                              GUri           *uri,
+                              GList          *addresses)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+        GInetAddress *remote_inet_addr;
+        GSocketConnectable *identity;
+        GTlsCertificate *certificate;
+        GTlsCertificateFlags errors;
+        GList *l;
+
+        if (!priv->ssl || priv->proxy_uri || priv->http_version != SOUP_HTTP_2_0)
+                return FALSE;
+
+        if (!G_IS_INET_SOCKET_ADDRESS (priv->remote_address))
+                return FALSE;
+
+        if (g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (priv->remote_address)) != g_uri_get_port (uri))
+                return FALSE;
+
+        if (priv->misdirected_hosts && g_hash_table_contains (priv->misdirected_hosts, g_uri_get_host (uri)))
+                return FALSE;
+
+        remote_inet_addr = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (priv->remote_address));
+        for (l = addresses; l; l = g_list_next (l)) {
+                if (g_inet_address_equal (remote_inet_addr, l->data))
+                        break;
+        }
+        if (!l)
+                return FALSE;
+
+        /* Certificates accepted despite errors are only trusted for
+         * the host they were accepted for.
+         */
+        certificate = soup_connection_get_tls_certificate (conn);
+        if (!certificate || soup_connection_get_tls_certificate_errors (conn))
+                return FALSE;
+
+        if (priv->coalescing_hosts && g_hash_table_contains (priv->coalescing_hosts, g_uri_get_host (uri)))
+                return TRUE;
+
+        identity = g_network_address_new (g_uri_get_host (uri), g_uri_get_port (uri));
+        errors = g_tls_certificate_verify (certificate, identity, NULL);
+        g_object_unref (identity);
+        if (errors & G_TLS_CERTIFICATE_BAD_IDENTITY)
+                return FALSE;
+
+        if (!priv->coalescing_hosts)
+                priv->coalescing_hosts = g_hash_table_new_full (soup_str_case_hash, soup_str_case_equal, g_free, NULL);
+        g_hash_table_add (priv->coalescing_hosts, g_strdup (g_uri_get_host (uri)));
+
+        return TRUE;
+}
+
+/* Called when the server of @conn answered a request for @uri with
+ * 421 Misdirected Request, so that @conn is not used for it again.
+ */
+void
+soup_connection_set_misdirected (SoupConnection *conn,
+                                 GUri           *uri)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        if (!priv->misdirected_hosts)
+                priv->misdirected_hosts = g_hash_table_new_full (soup_str_case_hash, soup_str_case_equal, g_free, NULL);
+        g_hash_table_add (priv->misdirected_hosts, g_strdup (g_uri_get_host (uri)));
+}
+
+/* Sends a liveness probe on an idle @conn. Returns %FALSE if the
+ * previous one was not answered.
+ */
+gboolean
+soup_connection_ping (SoupConnection *conn)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        if (g_atomic_int_get (&priv->state) != SOUP_CONNECTION_IDLE || !priv->io_data)
+                return TRUE;
+
+        return soup_client_message_io_ping (priv->io_data);
 }
 
 SoupConnectionState
@@ -1383,6 +1619,26 @@ soup_connection_get_negotiated_protocol (SoupConnection *conn)
         return priv->http_version;
 }
 
+/* Returns the HTTP version the server is known to speak: the
+ * negotiated one, unless the server answered with a lower one.
+ */
+SoupHTTPVersion
+soup_connection_get_server_http_version (SoupConnection *conn)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        return MIN (priv->http_version, priv->server_http_version);
+}
+
+void
+soup_connection_set_server_http_version (SoupConnection *conn,
+                                         SoupHTTPVersion version)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        priv->server_http_version = version;
+}
+
 gboolean
 soup_connection_is_reusable (SoupConnection *conn)
 {
@@ -1399,6 +1655,44 @@ soup_connection_get_owner (SoupConnection *conn)
         return priv->owner;
 }
 
+/* Warm connections are opened ahead of any request, so they are not
+ * dropped for staying unused for SOUP_CONNECTION_UNUSED_TIMEOUT.
+ */
+void
+soup_connection_set_warm (SoupConnection *conn,
+                          gboolean        warm)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        priv->warm = warm;
+}
+
+/* Returns the monotonic time at which @conn will be closed for being
+ * idle, or -1 if it's not idle or it has no idle timeout.
+ */
+gint64
+soup_connection_get_idle_deadline (SoupConnection *conn)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        if (g_atomic_int_get (&priv->state) != SOUP_CONNECTION_IDLE || !priv->idle_timeout_src)
+                return -1;
+
+        return g_source_get_ready_time (priv->idle_timeout_src);
+}
+
+/* @session is a previous connection to the same origin whose TLS
+ * session will be offered for resumption by the next handshake.
+ */
+void
+soup_connection_set_tls_session (SoupConnection       *conn,
+                                 GTlsClientConnection *session)
+{
+        SoupConnectionPrivate *priv = soup_connection_get_instance_private (conn);
+
+        g_set_object (&priv->tls_session, session);
+}
+
 void
 soup_connection_set_http2_initial_window_size (SoupConnection *conn,
                                                int             window_size)
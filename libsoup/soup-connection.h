@@ -59,6 +59,15 @@ SoupConnectionState soup_connection_get_state  (SoupConnection   *conn);
 void            soup_connection_set_in_use     (SoupConnection   *conn,
                                                 gboolean          in_use);
 gboolean        soup_connection_is_idle_open   (SoupConnection   *conn);
+gboolean        soup_connection_is_stale       (SoupConnection   *conn);
+gboolean        soup_connection_ping           (SoupConnection   *conn);
+guint           soup_connection_get_n_streams  (SoupConnection   *conn);
+gboolean        soup_connection_is_saturated   (SoupConnection   *conn);
+gboolean        soup_connection_can_coalesce   (SoupConnection   *conn,
+                                                GUri             *uri,
+                                                GList            *addresses);
+void            soup_connection_set_misdirected (SoupConnection  *conn,
+                                                 GUri            *uri);
 
 SoupClientMessageIO *soup_connection_setup_message_io    (SoupConnection *conn,
                                                           SoupMessage    *msg);
@@ -84,8 +93,16 @@ void                 soup_connection_complete_tls_certificate_password_request (
 guint64              soup_connection_get_id                     (SoupConnection *conn);
 GSocketAddress      *soup_connection_get_remote_address         (SoupConnection *conn);
 SoupHTTPVersion      soup_connection_get_negotiated_protocol    (SoupConnection *conn);
+SoupHTTPVersion      soup_connection_get_server_http_version    (SoupConnection *conn);
+void                 soup_connection_set_server_http_version    (SoupConnection *conn,
+                                                                 SoupHTTPVersion version);
 gboolean             soup_connection_is_reusable                (SoupConnection *conn);
 GThread             *soup_connection_get_owner                  (SoupConnection *conn);
+void                 soup_connection_set_tls_session            (SoupConnection       *conn,
+                                                                 GTlsClientConnection *session);
+void                 soup_connection_set_warm                   (SoupConnection *conn,
+                                                                 gboolean        warm);
+gint64               soup_connection_get_idle_deadline          (SoupConnection *conn);
 
 void soup_connection_set_http2_initial_window_size        (SoupConnection *conn,
                                                            int             window_size);
@@ -0,0 +1,260 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-db-writer.c: batched writes to a sqlite database
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "soup-db-writer.h"
+
+/* A SoupDBWriter queues the changes of a persistent feature in a hash
+ * table, keyed by whatever the feature coalesces its changes on, and
+ * writes them in a single transaction from a background thread, either
+ * after FLUSH_TIMEOUT or once FLUSH_THRESHOLD keys are pending.
+ *
+ * The feature adds its changes between soup_db_writer_lock_pending()
+ * and soup_db_writer_unlock_pending(); the write func is then called
+ * for each of them with the database lock held.
+ */
+
+#define FLUSH_TIMEOUT G_TIME_SPAN_SECOND /* Delay before writing the changes */
+#define FLUSH_THRESHOLD 256              /* Number of pending keys written without delay */
+
+struct _SoupDBWriter {
+	char *thread_name;
+	GDestroyNotify change_free;
+	SoupDBWriterOpenFunc open_func;
+	SoupDBWriterWriteFunc write_func;
+	gpointer user_data;
+
+	/* Held while using the database, taken before pending_mutex */
+	GMutex db_mutex;
+
+	GMutex pending_mutex;
+	GCond pending_cond;
+	GHashTable *pending;
+	gboolean scheduled;
+	gint64 flush_time;
+	gboolean flush_now;
+	gboolean shutdown;
+	GThread *thread;
+};
+
+static GHashTable *
+pending_new (SoupDBWriter *writer)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, writer->change_free);
+}
+
+SoupDBWriter *
+soup_db_writer_new (const char            *thread_name,
+		    GDestroyNotify         change_free,
+		    SoupDBWriterOpenFunc   open_func,
+		    SoupDBWriterWriteFunc  write_func,
+		    gpointer               user_data)
+{
+	SoupDBWriter *writer = g_new0 (SoupDBWriter, 1);
+
+	writer->thread_name = g_strdup (thread_name);
+	writer->change_free = change_free;
+	writer->open_func = open_func;
+	writer->write_func = write_func;
+	writer->user_data = user_data;
+	g_mutex_init (&writer->db_mutex);
+	g_mutex_init (&writer->pending_mutex);
+	g_cond_init (&writer->pending_cond);
+	writer->pending = pending_new (writer);
+
+	return writer;
+}
+
+/* Stops the background thread and writes the changes still pending */
+void
+soup_db_writer_free (SoupDBWriter *writer)
+{
+	if (writer->thread) {
+		g_mutex_lock (&writer->pending_mutex);
+		writer->shutdown = TRUE;
+		g_cond_signal (&writer->pending_cond);
+		g_mutex_unlock (&writer->pending_mutex);
+		g_thread_join (writer->thread);
+	}
+	soup_db_writer_flush (writer);
+
+	g_hash_table_destroy (writer->pending);
+	g_cond_clear (&writer->pending_cond);
+	g_mutex_clear (&writer->pending_mutex);
+	g_mutex_clear (&writer->db_mutex);
+	g_free (writer->thread_name);
+	g_free (writer);
+}
+
+void
+soup_db_writer_lock (SoupDBWriter *writer)
+{
+	g_mutex_lock (&writer->db_mutex);
+}
+
+void
+soup_db_writer_unlock (SoupDBWriter *writer)
+{
+	g_mutex_unlock (&writer->db_mutex);
+}
+
+/* Returns the pending changes, which can be used until
+ * soup_db_writer_unlock_pending().
+ */
+GHashTable *
+soup_db_writer_lock_pending (SoupDBWriter *writer)
+{
+	g_mutex_lock (&writer->pending_mutex);
+
+	return writer->pending;
+}
+
+static gpointer writer_thread (gpointer user_data);
+
+/* @queued tells whether changes were added, so they must be written */
+void
+soup_db_writer_unlock_pending (SoupDBWriter *writer,
+			       gboolean      queued)
+{
+	if (queued && g_hash_table_size (writer->pending) > 0) {
+		if (g_hash_table_size (writer->pending) >= FLUSH_THRESHOLD)
+			writer->flush_now = TRUE;
+		if (!writer->thread)
+			writer->thread = g_thread_new (writer->thread_name, writer_thread, writer);
+		if (!writer->scheduled) {
+			writer->scheduled = TRUE;
+			writer->flush_time = g_get_monotonic_time () + FLUSH_TIMEOUT;
+			g_cond_signal (&writer->pending_cond);
+		} else if (writer->flush_now)
+			g_cond_signal (&writer->pending_cond);
+	}
+
+	g_mutex_unlock (&writer->pending_mutex);
+}
+
+/* Writes all the pending changes in a single transaction */
+void
+soup_db_writer_flush (SoupDBWriter *writer)
+{
+	GHashTable *pending;
+	GHashTableIter iter;
+	const char *key;
+	gpointer change;
+	sqlite3 *db;
+	char *error = NULL;
+
+	g_mutex_lock (&writer->db_mutex);
+
+	g_mutex_lock (&writer->pending_mutex);
+	if (g_hash_table_size (writer->pending) == 0) {
+		g_mutex_unlock (&writer->pending_mutex);
+		g_mutex_unlock (&writer->db_mutex);
+		return;
+	}
+	pending = g_steal_pointer (&writer->pending);
+	writer->pending = pending_new (writer);
+	writer->scheduled = FALSE;
+	writer->flush_now = FALSE;
+	g_mutex_unlock (&writer->pending_mutex);
+
+	db = writer->open_func (writer->user_data);
+	if (!db)
+		goto out;
+
+	if (sqlite3_exec (db, "BEGIN TRANSACTION;", NULL, NULL, &error)) {
+		g_warning ("Failed to execute query: %s", error);
+		sqlite3_free (error);
+		goto out;
+	}
+
+	g_hash_table_iter_init (&iter, pending);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&key, &change))
+		writer->write_func (db, key, change, writer->user_data);
+
+	if (sqlite3_exec (db, "COMMIT TRANSACTION;", NULL, NULL, &error)) {
+		g_warning ("Failed to execute query: %s", error);
+		sqlite3_free (error);
+		sqlite3_exec (db, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+	}
+
+out:
+	g_mutex_unlock (&writer->db_mutex);
+	g_hash_table_destroy (pending);
+}
+
+static gpointer
+writer_thread (gpointer user_data)
+{
+	SoupDBWriter *writer = user_data;
+
+	g_mutex_lock (&writer->pending_mutex);
+	while (!writer->shutdown) {
+		if (g_hash_table_size (writer->pending) == 0) {
+			g_cond_wait (&writer->pending_cond, &writer->pending_mutex);
+			continue;
+		}
+
+		if (!writer->flush_now &&
+		    g_cond_wait_until (&writer->pending_cond, &writer->pending_mutex, writer->flush_time))
+			continue;
+
+		g_mutex_unlock (&writer->pending_mutex);
+		soup_db_writer_flush (writer);
+		g_mutex_lock (&writer->pending_mutex);
+	}
+	g_mutex_unlock (&writer->pending_mutex);
+
+	return NULL;
+}
+
+static void
+try_create_table (sqlite3    *db,
+		  const char *create_table)
+{
+	char *error = NULL;
+
+	if (sqlite3_exec (db, create_table, NULL, NULL, &error)) {
+		g_warning ("Failed to execute query: %s", error);
+		sqlite3_free (error);
+	}
+}
+
+/* Creates the table with @create_table if @sql cannot be prepared,
+ * which happens when the database is new.
+ */
+sqlite3_stmt *
+soup_db_prepare_statement (sqlite3    *db,
+			   const char *sql,
+			   const char *create_table)
+{
+	sqlite3_stmt *stmt = NULL;
+	gboolean try_create = TRUE;
+
+try_prepare:
+	if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		if (try_create) {
+			try_create = FALSE;
+			try_create_table (db, create_table);
+			goto try_prepare;
+		}
+		g_warning ("Failed to prepare query: %s", sqlite3_errmsg (db));
+		return NULL;
+	}
+
+	return stmt;
+}
+
+void
+soup_db_step_statement (sqlite3      *db,
+			sqlite3_stmt *stmt)
+{
+	if (sqlite3_step (stmt) != SQLITE_DONE)
+		g_warning ("Failed to execute query: %s", sqlite3_errmsg (db));
+	sqlite3_reset (stmt);
+	sqlite3_clear_bindings (stmt);
+}
@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-db-writer.h: batched writes to a sqlite database
+ */
+
+#pragma once
+
+#include <sqlite3.h>
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+typedef struct _SoupDBWriter SoupDBWriter;
+
+/* Returns the database with the statements needed by the write func
+ * prepared, or %NULL if the changes cannot be written.
+ */
+typedef sqlite3 *(*SoupDBWriterOpenFunc)  (gpointer    user_data);
+typedef void     (*SoupDBWriterWriteFunc) (sqlite3    *db,
+					   const char *key,
+					   gpointer    change,
+					   gpointer    user_data);
+
+SoupDBWriter *soup_db_writer_new            (const char            *thread_name,
+					     GDestroyNotify         change_free,
+					     SoupDBWriterOpenFunc   open_func,
+					     SoupDBWriterWriteFunc  write_func,
+					     gpointer               user_data);
+void          soup_db_writer_free           (SoupDBWriter          *writer);
+
+void          soup_db_writer_lock           (SoupDBWriter          *writer);
+void          soup_db_writer_unlock         (SoupDBWriter          *writer);
+
+GHashTable   *soup_db_writer_lock_pending   (SoupDBWriter          *writer);
+void          soup_db_writer_unlock_pending (SoupDBWriter          *writer,
+					     gboolean               queued);
+
+void          soup_db_writer_flush          (SoupDBWriter          *writer);
+
+sqlite3_stmt *soup_db_prepare_statement     (sqlite3               *db,
+					     const char            *sql,
+					     const char            *create_table);
+void          soup_db_step_statement        (sqlite3               *db,
+					     sqlite3_stmt          *stmt);
+
+G_END_DECLS
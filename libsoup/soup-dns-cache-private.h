@@ -0,0 +1,21 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-dns-cache-private.h: session-level host name resolution cache
+ */
+
+#pragma once
+
+#include "soup-dns-cache.h"
+
+G_BEGIN_DECLS
+
+GSocketConnectable *soup_dns_cache_create_connectable (SoupDNSCache *cache,
+						       GUri         *uri);
+GList              *soup_dns_cache_get_cached_addresses (SoupDNSCache *cache,
+							 const char   *hostname);
+
+void                soup_dns_cache_advance_clock        (SoupDNSCache *cache,
+							 GTimeSpan     span);
+void                soup_dns_cache_wait_for_lookups     (SoupDNSCache *cache);
+
+G_END_DECLS
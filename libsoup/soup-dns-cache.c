@@ -0,0 +1,1099 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-dns-cache.c: session-level host name resolution cache
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "soup-dns-cache-private.h"
+#include "soup.h"
+#include "soup-session-feature-private.h"
+
+/**
+ * SoupDNSCache:
+ *
+ * Caches the addresses of the hosts a [class@Session] connects to.
+ *
+ * Without a #SoupDNSCache, every new connection resolves the name of
+ * the remote host again. Once a #SoupDNSCache is added to a session
+ * with [method@Session.add_feature], the addresses of a host are kept
+ * for [property@DNSCache:ttl] seconds, and lookups that failed are
+ * remembered for [property@DNSCache:negative-ttl] seconds, so that
+ * connections to the same hosts in the meantime skip name resolution
+ * entirely.
+ *
+ * Names that are looked up often are resolved again in the background
+ * shortly before they expire, so that they do not go through the
+ * resolver on the connection path. [method@DNSCache.prefetch] can be
+ * used to resolve names that are going to be needed ahead of time.
+ *
+ * The cached addresses also let a session send requests for several
+ * hosts on a single HTTP/2 connection, when the hosts resolve to the
+ * address of the connection and its certificate is valid for them.
+ *
+ * Names are resolved with [property@DNSCache:resolver], or the default
+ * [class@Gio.Resolver] when it is not set. The cache is not used when
+ * the session has a [property@Session:remote-connectable], or for
+ * connections going through a proxy, as the proxy resolves the name
+ * in that case.
+ *
+ * Since: 3.8
+ */
+
+#define DNS_CACHE_DEFAULT_TTL 60
+#define DNS_CACHE_DEFAULT_NEGATIVE_TTL 5
+#define DNS_CACHE_MAX_ENTRIES 256
+#define DNS_CACHE_MAX_THREADS 4
+
+/* Names that have been used this many times since they were resolved
+ * are refreshed when less than a quarter of their TTL is left.
+ */
+#define DNS_CACHE_POPULAR_HITS 3
+
+typedef struct {
+	char *hostname;
+	GList *addresses;
+	GError *error;
+	gint64 expires;
+	guint hits;
+	GList link;
+} SoupDNSCacheEntry;
+
+typedef struct {
+	GSList *waiters;
+	guint generation;
+} SoupDNSCacheLookup;
+
+/* The task data of an async lookup queued behind a lookup in
+ * progress, so that it can leave the queue when cancelled.
+ */
+typedef struct {
+	char *hostname;
+	GSource *cancel_source;
+} SoupDNSCacheWaiter;
+
+struct _SoupDNSCache {
+	GObject parent;
+
+	GResolver *resolver;
+	guint ttl;
+	guint negative_ttl;
+
+	GMutex mutex;
+	GHashTable *entries;
+	GQueue lru;
+	GHashTable *lookups;
+	GCond lookups_cond;
+	guint generation;
+	GThreadPool *pool;
+	GTimeSpan clock_offset;
+};
+
+enum {
+	PROP_0,
+
+	PROP_RESOLVER,
+	PROP_TTL,
+	PROP_NEGATIVE_TTL,
+
+	LAST_PROPERTY
+};
+
+static GParamSpec *properties[LAST_PROPERTY] = { NULL, };
+
+static void soup_dns_cache_session_feature_init (SoupSessionFeatureInterface *feature_interface, gpointer interface_data);
+static void resolve_in_thread (char *hostname, SoupDNSCache *cache);
+
+G_DEFINE_FINAL_TYPE_WITH_CODE (SoupDNSCache, soup_dns_cache, G_TYPE_OBJECT,
+			       G_IMPLEMENT_INTERFACE (SOUP_TYPE_SESSION_FEATURE,
+						      soup_dns_cache_session_feature_init))
+
+static void
+entry_free (SoupDNSCacheEntry *entry)
+{
+	g_free (entry->hostname);
+	g_resolver_free_addresses (entry->addresses);
+	g_clear_error (&entry->error);
+	g_free (entry);
+}
+
+static void
+lookup_free (SoupDNSCacheLookup *lookup)
+{
+	g_assert (lookup->waiters == NULL);
+	g_free (lookup);
+}
+
+static void
+waiter_free (SoupDNSCacheWaiter *waiter)
+{
+	g_free (waiter->hostname);
+	if (waiter->cancel_source) {
+		g_source_destroy (waiter->cancel_source);
+		g_source_unref (waiter->cancel_source);
+	}
+	g_free (waiter);
+}
+
+static void
+soup_dns_cache_init (SoupDNSCache *cache)
+{
+	cache->ttl = DNS_CACHE_DEFAULT_TTL;
+	cache->negative_ttl = DNS_CACHE_DEFAULT_NEGATIVE_TTL;
+
+	g_mutex_init (&cache->mutex);
+	g_cond_init (&cache->lookups_cond);
+	cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+						(GDestroyNotify)entry_free);
+	cache->lookups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+						(GDestroyNotify)lookup_free);
+	cache->pool = g_thread_pool_new ((GFunc)resolve_in_thread, cache,
+					 DNS_CACHE_MAX_THREADS, FALSE, NULL);
+}
+
+static void
+soup_dns_cache_finalize (GObject *object)
+{
+	SoupDNSCache *cache = SOUP_DNS_CACHE (object);
+
+	/* Lookups with waiters keep the cache alive, so this only
+	 * waits for background refreshes.
+	 */
+	g_thread_pool_free (cache->pool, FALSE, TRUE);
+
+	g_clear_object (&cache->resolver);
+	g_hash_table_destroy (cache->entries);
+	g_hash_table_destroy (cache->lookups);
+	g_cond_clear (&cache->lookups_cond);
+	g_mutex_clear (&cache->mutex);
+
+	G_OBJECT_CLASS (soup_dns_cache_parent_class)->finalize (object);
+}
+
+static void
+soup_dns_cache_set_property (GObject *object, guint prop_id,
+			     const GValue *value, GParamSpec *pspec)
+{
+	SoupDNSCache *cache = SOUP_DNS_CACHE (object);
+
+	switch (prop_id) {
+	case PROP_RESOLVER:
+		soup_dns_cache_set_resolver (cache, g_value_get_object (value));
+		break;
+	case PROP_TTL:
+		soup_dns_cache_set_ttl (cache, g_value_get_uint (value));
+		break;
+	case PROP_NEGATIVE_TTL:
+		soup_dns_cache_set_negative_ttl (cache, g_value_get_uint (value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+soup_dns_cache_get_property (GObject *object, guint prop_id,
+			     GValue *value, GParamSpec *pspec)
+{
+	SoupDNSCache *cache = SOUP_DNS_CACHE (object);
+
+	switch (prop_id) {
+	case PROP_RESOLVER:
+		g_value_set_object (value, cache->resolver);
+		break;
+	case PROP_TTL:
+		g_value_set_uint (value, cache->ttl);
+		break;
+	case PROP_NEGATIVE_TTL:
+		g_value_set_uint (value, cache->negative_ttl);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+soup_dns_cache_class_init (SoupDNSCacheClass *cache_class)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (cache_class);
+
+	object_class->finalize = soup_dns_cache_finalize;
+	object_class->set_property = soup_dns_cache_set_property;
+	object_class->get_property = soup_dns_cache_get_property;
+
+	/**
+	 * SoupDNSCache:resolver: (attributes org.gtk.Property.get=soup_dns_cache_get_resolver org.gtk.Property.set=soup_dns_cache_set_resolver)
+	 *
+	 * The resolver used to look up names, or %NULL to use the
+	 * default [class@Gio.Resolver].
+	 *
+	 * Since: 3.8
+	 */
+	properties[PROP_RESOLVER] =
+		g_param_spec_object ("resolver",
+				     "Resolver",
+				     "The resolver used to look up names",
+				     G_TYPE_RESOLVER,
+				     G_PARAM_READWRITE |
+				     G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupDNSCache:ttl: (attributes org.gtk.Property.get=soup_dns_cache_get_ttl org.gtk.Property.set=soup_dns_cache_set_ttl)
+	 *
+	 * The number of seconds the addresses of a host are kept, or 0
+	 * to not cache them.
+	 *
+	 * Since: 3.8
+	 */
+	properties[PROP_TTL] =
+		g_param_spec_uint ("ttl",
+				   "TTL",
+				   "The number of seconds addresses are kept",
+				   0, G_MAXUINT, DNS_CACHE_DEFAULT_TTL,
+				   G_PARAM_READWRITE |
+				   G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * SoupDNSCache:negative-ttl: (attributes org.gtk.Property.get=soup_dns_cache_get_negative_ttl org.gtk.Property.set=soup_dns_cache_set_negative_ttl)
+	 *
+	 * The number of seconds a failed lookup is remembered, or 0 to
+	 * try again on every connection.
+	 *
+	 * Since: 3.8
+	 */
+	properties[PROP_NEGATIVE_TTL] =
+		g_param_spec_uint ("negative-ttl",
+				   "Negative TTL",
+				   "The number of seconds failed lookups are kept",
+				   0, G_MAXUINT, DNS_CACHE_DEFAULT_NEGATIVE_TTL,
+				   G_PARAM_READWRITE |
+				   G_PARAM_STATIC_STRINGS);
+
+	g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
+}
+
+static void
+soup_dns_cache_session_feature_init (SoupSessionFeatureInterface *feature_interface,
+				     gpointer                     interface_data)
+{
+}
+
+static GResolver *
+get_resolver_locked (SoupDNSCache *cache)
+{
+	return cache->resolver ? g_object_ref (cache->resolver) : g_resolver_get_default ();
+}
+
+/* The clock entries expire by, which tests can move forward */
+static gint64
+get_time_locked (SoupDNSCache *cache)
+{
+	return g_get_monotonic_time () + cache->clock_offset;
+}
+
+static void
+remove_entry_locked (SoupDNSCache      *cache,
+		     SoupDNSCacheEntry *entry)
+{
+	g_queue_unlink (&cache->lru, &entry->link);
+	g_hash_table_remove (cache->entries, entry->hostname);
+}
+
+static void
+store_result_locked (SoupDNSCache *cache,
+		     const char   *hostname,
+		     GList        *addresses,
+		     GError       *error)
+{
+	SoupDNSCacheEntry *entry;
+	gint64 now = get_time_locked (cache);
+	guint ttl;
+
+	entry = g_hash_table_lookup (cache->entries, hostname);
+
+	/* A background refresh failed: keep using the addresses
+	 * we have until they expire.
+	 */
+	if (error && entry && !entry->error && entry->expires > now)
+		return;
+
+	ttl = error ? cache->negative_ttl : cache->ttl;
+	if (ttl == 0) {
+		if (entry)
+			remove_entry_locked (cache, entry);
+		return;
+	}
+
+	if (entry) {
+		g_queue_unlink (&cache->lru, &entry->link);
+		g_clear_pointer (&entry->addresses, g_resolver_free_addresses);
+		g_clear_error (&entry->error);
+	} else {
+		entry = g_new0 (SoupDNSCacheEntry, 1);
+		entry->hostname = g_strdup (hostname);
+		entry->link.data = entry;
+		g_hash_table_insert (cache->entries, entry->hostname, entry);
+	}
+
+	entry->addresses = g_list_copy_deep (addresses, (GCopyFunc)g_object_ref, NULL);
+	entry->error = error ? g_error_copy (error) : NULL;
+	entry->expires = now + (gint64)ttl * G_USEC_PER_SEC;
+	entry->hits = 0;
+	g_queue_push_head_link (&cache->lru, &entry->link);
+
+	while (g_hash_table_size (cache->entries) > DNS_CACHE_MAX_ENTRIES)
+		remove_entry_locked (cache, g_queue_peek_tail (&cache->lru));
+}
+
+static void
+start_lookup_locked (SoupDNSCache *cache,
+		     const char   *hostname,
+		     GTask        *waiter)
+{
+	SoupDNSCacheLookup *lookup;
+
+	lookup = g_hash_table_lookup (cache->lookups, hostname);
+	if (!lookup) {
+		lookup = g_new0 (SoupDNSCacheLookup, 1);
+		lookup->generation = cache->generation;
+		g_hash_table_insert (cache->lookups, g_strdup (hostname), lookup);
+		g_thread_pool_push (cache->pool, g_strdup (hostname), NULL);
+	}
+
+	if (waiter)
+		lookup->waiters = g_slist_prepend (lookup->waiters, waiter);
+}
+
+/* Returns %TRUE if @cache had an answer for @hostname, either
+ * @addresses or @error.
+ */
+static gboolean
+lookup_cached_locked (SoupDNSCache *cache,
+		      const char   *hostname,
+		      GList       **addresses,
+		      GError      **error)
+{
+	SoupDNSCacheEntry *entry;
+	gint64 now = get_time_locked (cache);
+
+	entry = g_hash_table_lookup (cache->entries, hostname);
+	if (!entry)
+		return FALSE;
+
+	if (entry->expires <= now) {
+		remove_entry_locked (cache, entry);
+		return FALSE;
+	}
+
+	g_queue_unlink (&cache->lru, &entry->link);
+	g_queue_push_head_link (&cache->lru, &entry->link);
+	entry->hits++;
+
+	if (entry->error) {
+		g_propagate_error (error, g_error_copy (entry->error));
+		return TRUE;
+	}
+
+	*addresses = g_list_copy_deep (entry->addresses, (GCopyFunc)g_object_ref, NULL);
+
+	if (entry->hits >= DNS_CACHE_POPULAR_HITS &&
+	    entry->expires - now < (gint64)cache->ttl * G_USEC_PER_SEC / 4)
+		start_lookup_locked (cache, hostname, NULL);
+
+	return TRUE;
+}
+
+static void
+resolve_in_thread (char         *hostname,
+		   SoupDNSCache *cache)
+{
+	SoupDNSCacheLookup *lookup;
+	GResolver *resolver;
+	GList *addresses;
+	GError *error = NULL;
+	gpointer key;
+	GSList *w;
+
+	g_mutex_lock (&cache->mutex);
+	resolver = get_resolver_locked (cache);
+	g_mutex_unlock (&cache->mutex);
+
+	addresses = g_resolver_lookup_by_name (resolver, hostname, NULL, &error);
+	g_object_unref (resolver);
+
+	g_mutex_lock (&cache->mutex);
+	g_hash_table_steal_extended (cache->lookups, hostname, &key, (gpointer *)&lookup);
+	g_free (key);
+	/* Results of lookups started before the cache was cleared
+	 * are still given to the waiters, but not kept.
+	 */
+	if (lookup->generation == cache->generation)
+		store_result_locked (cache, hostname, addresses, error);
+	g_cond_broadcast (&cache->lookups_cond);
+	g_mutex_unlock (&cache->mutex);
+
+	for (w = lookup->waiters; w; w = w->next) {
+		GTask *task = w->data;
+		SoupDNSCacheWaiter *waiter = g_task_get_task_data (task);
+
+		/* The waiter is out of the queue now */
+		g_source_destroy (waiter->cancel_source);
+
+		if (error) {
+			g_task_return_error (task, g_error_copy (error));
+		} else {
+			g_task_return_pointer (task,
+					       g_list_copy_deep (addresses, (GCopyFunc)g_object_ref, NULL),
+					       (GDestroyNotify)g_resolver_free_addresses);
+		}
+		g_object_unref (task);
+	}
+	g_clear_pointer (&lookup->waiters, g_slist_free);
+	lookup_free (lookup);
+
+	g_resolver_free_addresses (addresses);
+	g_clear_error (&error);
+	g_free (hostname);
+}
+
+static GList *
+soup_dns_cache_lookup (SoupDNSCache *cache,
+		       const char   *hostname,
+		       GCancellable *cancellable,
+		       GError      **error)
+{
+	GResolver *resolver;
+	GList *addresses = NULL;
+	GError *my_error = NULL;
+	gboolean cached;
+	char *key;
+
+	key = g_ascii_strdown (hostname, -1);
+
+	g_mutex_lock (&cache->mutex);
+	cached = lookup_cached_locked (cache, key, &addresses, error);
+	resolver = get_resolver_locked (cache);
+	g_mutex_unlock (&cache->mutex);
+
+	if (!cached) {
+		addresses = g_resolver_lookup_by_name (resolver, key, cancellable, &my_error);
+		if (!g_error_matches (my_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_mutex_lock (&cache->mutex);
+			store_result_locked (cache, key, addresses, my_error);
+			g_mutex_unlock (&cache->mutex);
+		}
+		if (my_error)
+			g_propagate_error (error, my_error);
+	}
+
+	g_object_unref (resolver);
+	g_free (key);
+
+	return addresses;
+}
+
+static gboolean
+waiter_cancelled_cb (GCancellable *cancellable,
+		     GTask        *task)
+{
+	SoupDNSCache *cache = g_task_get_source_object (task);
+	SoupDNSCacheWaiter *waiter = g_task_get_task_data (task);
+	SoupDNSCacheLookup *lookup;
+
+	g_mutex_lock (&cache->mutex);
+	lookup = g_hash_table_lookup (cache->lookups, waiter->hostname);
+	if (!lookup || !g_slist_find (lookup->waiters, task)) {
+		/* The lookup finished meanwhile */
+		g_mutex_unlock (&cache->mutex);
+		return G_SOURCE_REMOVE;
+	}
+	/* The lookup itself goes on, its result is still cached */
+	lookup->waiters = g_slist_remove (lookup->waiters, task);
+	g_mutex_unlock (&cache->mutex);
+
+	g_task_return_error_if_cancelled (task);
+	g_object_unref (task);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+soup_dns_cache_lookup_async (SoupDNSCache       *cache,
+			     const char         *hostname,
+			     GCancellable       *cancellable,
+			     GAsyncReadyCallback callback,
+			     gpointer            user_data)
+{
+	GTask *task;
+	GList *addresses = NULL;
+	GError *error = NULL;
+	char *key;
+
+	task = g_task_new (cache, cancellable, callback, user_data);
+	g_task_set_source_tag (task, soup_dns_cache_lookup_async);
+
+	if (g_task_return_error_if_cancelled (task)) {
+		g_object_unref (task);
+		return;
+	}
+
+	key = g_ascii_strdown (hostname, -1);
+
+	g_mutex_lock (&cache->mutex);
+	if (!lookup_cached_locked (cache, key, &addresses, &error)) {
+		SoupDNSCacheWaiter *waiter;
+
+		waiter = g_new0 (SoupDNSCacheWaiter, 1);
+		waiter->hostname = key;
+		waiter->cancel_source = g_cancellable_source_new (cancellable);
+		g_task_set_task_data (task, waiter, (GDestroyNotify)waiter_free);
+		g_task_attach_source (task, waiter->cancel_source,
+				      (GSourceFunc)waiter_cancelled_cb);
+
+		start_lookup_locked (cache, key, task);
+		g_mutex_unlock (&cache->mutex);
+		return;
+	}
+	g_mutex_unlock (&cache->mutex);
+	g_free (key);
+
+	if (error)
+		g_task_return_error (task, error);
+	else
+		g_task_return_pointer (task, addresses, (GDestroyNotify)g_resolver_free_addresses);
+	g_object_unref (task);
+}
+
+static GList *
+soup_dns_cache_lookup_finish (SoupDNSCache *cache,
+			      GAsyncResult *result,
+			      GError      **error)
+{
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * soup_dns_cache_new:
+ *
+ * Creates a new #SoupDNSCache, to be added to a session with
+ * [method@Session.add_feature].
+ *
+ * Returns: (transfer full): a new #SoupDNSCache
+ *
+ * Since: 3.8
+ */
+SoupDNSCache *
+soup_dns_cache_new (void)
+{
+	return g_object_new (SOUP_TYPE_DNS_CACHE, NULL);
+}
+
+/**
+ * soup_dns_cache_set_resolver: (attributes org.gtk.Method.set_property=resolver)
+ * @cache: a #SoupDNSCache
+ * @resolver: (nullable): a #GResolver, or %NULL
+ *
+ * Sets the resolver used by @cache to look up names. The names that
+ * were already cached are forgotten.
+ *
+ * Since: 3.8
+ */
+void
+soup_dns_cache_set_resolver (SoupDNSCache *cache,
+			     GResolver    *resolver)
+{
+	g_return_if_fail (SOUP_IS_DNS_CACHE (cache));
+	g_return_if_fail (!resolver || G_IS_RESOLVER (resolver));
+
+	g_mutex_lock (&cache->mutex);
+	if (cache->resolver == resolver) {
+		g_mutex_unlock (&cache->mutex);
+		return;
+	}
+	g_set_object (&cache->resolver, resolver);
+	g_mutex_unlock (&cache->mutex);
+
+	soup_dns_cache_clear (cache);
+
+	g_object_notify_by_pspec (G_OBJECT (cache), properties[PROP_RESOLVER]);
+}
+
+/**
+ * soup_dns_cache_get_resolver: (attributes org.gtk.Method.get_property=resolver)
+ * @cache: a #SoupDNSCache
+ *
+ * Gets the resolver used by @cache to look up names.
+ *
+ * Returns: (transfer none) (nullable): the #GResolver, or %NULL if
+ *   the default resolver is used
+ *
+ * Since: 3.8
+ */
+GResolver *
+soup_dns_cache_get_resolver (SoupDNSCache *cache)
+{
+	g_return_val_if_fail (SOUP_IS_DNS_CACHE (cache), NULL);
+
+	return cache->resolver;
+}
+
+/**
+ * soup_dns_cache_set_ttl: (attributes org.gtk.Method.set_property=ttl)
+ * @cache: a #SoupDNSCache
+ * @ttl: a number of seconds
+ *
+ * Sets the number of seconds the addresses of a host are kept. It
+ * applies to the names resolved from now on.
+ *
+ * Since: 3.8
+ */
+void
+soup_dns_cache_set_ttl (SoupDNSCache *cache,
+			guint         ttl)
+{
+	g_return_if_fail (SOUP_IS_DNS_CACHE (cache));
+
+	if (cache->ttl == ttl)
+		return;
+
+	cache->ttl = ttl;
+	g_object_notify_by_pspec (G_OBJECT (cache), properties[PROP_TTL]);
+}
+
+/**
+ * soup_dns_cache_get_ttl: (attributes org.gtk.Method.get_property=ttl)
+ * @cache: a #SoupDNSCache
+ *
+ * Gets the number of seconds the addresses of a host are kept.
+ *
+ * Returns: the TTL in seconds
+ *
+ * Since: 3.8
+ */
+guint
+soup_dns_cache_get_ttl (SoupDNSCache *cache)
+{
+	g_return_val_if_fail (SOUP_IS_DNS_CACHE (cache), 0);
+
+	return cache->ttl;
+}
+
+/**
+ * soup_dns_cache_set_negative_ttl: (attributes org.gtk.Method.set_property=negative-ttl)
+ * @cache: a #SoupDNSCache
+ * @negative_ttl: a number of seconds
+ *
+ * Sets the number of seconds a failed lookup is remembered. It
+ * applies to the lookups that fail from now on.
+ *
+ * Since: 3.8
+ */
+void
+soup_dns_cache_set_negative_ttl (SoupDNSCache *cache,
+				 guint         negative_ttl)
+{
+	g_return_if_fail (SOUP_IS_DNS_CACHE (cache));
+
+	if (cache->negative_ttl == negative_ttl)
+		return;
+
+	cache->negative_ttl = negative_ttl;
+	g_object_notify_by_pspec (G_OBJECT (cache), properties[PROP_NEGATIVE_TTL]);
+}
+
+/**
+ * soup_dns_cache_get_negative_ttl: (attributes org.gtk.Method.get_property=negative-ttl)
+ * @cache: a #SoupDNSCache
+ *
+ * Gets the number of seconds a failed lookup is remembered.
+ *
+ * Returns: the negative TTL in seconds
+ *
+ * Since: 3.8
+ */
+guint
+soup_dns_cache_get_negative_ttl (SoupDNSCache *cache)
+{
+	g_return_val_if_fail (SOUP_IS_DNS_CACHE (cache), 0);
+
+	return cache->negative_ttl;
+}
+
+/**
+ * soup_dns_cache_prefetch:
+ * @cache: a #SoupDNSCache
+ * @hostnames: (array zero-terminated=1): the names to resolve
+ *
+ * Starts resolving the names in @hostnames that are not in @cache
+ * yet, in the background, so that the first connections to them do
+ * not have to wait for it.
+ *
+ * Since: 3.8
+ */
+void
+soup_dns_cache_prefetch (SoupDNSCache       *cache,
+			 const char * const *hostnames)
+{
+	gint64 now;
+	guint i;
+
+	g_return_if_fail (SOUP_IS_DNS_CACHE (cache));
+	g_return_if_fail (hostnames != NULL);
+
+	g_mutex_lock (&cache->mutex);
+	now = get_time_locked (cache);
+	for (i = 0; hostnames[i]; i++) {
+		SoupDNSCacheEntry *entry;
+		char *key;
+
+		if (g_hostname_is_ip_address (hostnames[i]))
+			continue;
+
+		key = g_ascii_strdown (hostnames[i], -1);
+		entry = g_hash_table_lookup (cache->entries, key);
+		if (!entry || entry->expires <= now)
+			start_lookup_locked (cache, key, NULL);
+		g_free (key);
+	}
+	g_mutex_unlock (&cache->mutex);
+}
+
+/**
+ * soup_dns_cache_clear:
+ * @cache: a #SoupDNSCache
+ *
+ * Forgets all the names in @cache.
+ *
+ * Since: 3.8
+ */
+void
+soup_dns_cache_clear (SoupDNSCache *cache)
+{
+	g_return_if_fail (SOUP_IS_DNS_CACHE (cache));
+
+	g_mutex_lock (&cache->mutex);
+	cache->generation++;
+	g_hash_table_remove_all (cache->entries);
+	g_queue_init (&cache->lru);
+	g_mutex_unlock (&cache->mutex);
+}
+
+/* A GNetworkAddress whose addresses come from a SoupDNSCache. Being a
+ * GNetworkAddress, TLS connections still get its hostname as server
+ * identity and proxies still get its URI.
+ */
+#define SOUP_TYPE_DNS_CACHE_ADDRESS (soup_dns_cache_address_get_type ())
+G_DECLARE_FINAL_TYPE (SoupDNSCacheAddress, soup_dns_cache_address, SOUP, DNS_CACHE_ADDRESS, GNetworkAddress)
+
+struct _SoupDNSCacheAddress {
+	GNetworkAddress parent;
+
+	SoupDNSCache *cache;
+};
+
+#define SOUP_TYPE_DNS_CACHE_ADDRESS_ENUMERATOR (soup_dns_cache_address_enumerator_get_type ())
+G_DECLARE_FINAL_TYPE (SoupDNSCacheAddressEnumerator, soup_dns_cache_address_enumerator, SOUP, DNS_CACHE_ADDRESS_ENUMERATOR, GSocketAddressEnumerator)
+
+struct _SoupDNSCacheAddressEnumerator {
+	GSocketAddressEnumerator parent;
+
+	SoupDNSCacheAddress *addr;
+	GList *addresses;
+	GList *next;
+	gboolean resolved;
+};
+
+static void soup_dns_cache_address_connectable_init (GSocketConnectableIface *iface);
+
+G_DEFINE_FINAL_TYPE_WITH_CODE (SoupDNSCacheAddress, soup_dns_cache_address, G_TYPE_NETWORK_ADDRESS,
+			       G_IMPLEMENT_INTERFACE (G_TYPE_SOCKET_CONNECTABLE,
+						      soup_dns_cache_address_connectable_init))
+
+G_DEFINE_FINAL_TYPE (SoupDNSCacheAddressEnumerator, soup_dns_cache_address_enumerator, G_TYPE_SOCKET_ADDRESS_ENUMERATOR)
+
+/* Alternates address families, starting with the one the resolver
+ * preferred (RFC 8305, section 4), so that connection attempts are
+ * raced across families.
+ */
+static GList *
+interleave_address_families (GList *addresses)
+{
+	GQueue families[2] = { G_QUEUE_INIT, G_QUEUE_INIT };
+	GSocketFamily first;
+	GList *l, *result = NULL;
+	guint i;
+
+	if (!addresses)
+		return NULL;
+
+	first = g_inet_address_get_family (addresses->data);
+	for (l = addresses; l; l = l->next)
+		g_queue_push_tail (&families[g_inet_address_get_family (l->data) == first ? 0 : 1], l->data);
+	g_list_free (addresses);
+
+	for (i = 0; !g_queue_is_empty (&families[0]) || !g_queue_is_empty (&families[1]); i++) {
+		GInetAddress *address = g_queue_pop_head (&families[i % 2]);
+
+		if (address)
+			result = g_list_prepend (result, address);
+	}
+
+	return g_list_reverse (result);
+}
+
+static void
+enumerator_set_addresses (SoupDNSCacheAddressEnumerator *enumerator,
+			  GList                         *addresses)
+{
+	enumerator->addresses = interleave_address_families (addresses);
+	enumerator->next = enumerator->addresses;
+	enumerator->resolved = TRUE;
+}
+
+static GSocketAddress *
+enumerator_next_address (SoupDNSCacheAddressEnumerator *enumerator)
+{
+	GInetAddress *address;
+
+	if (!enumerator->next)
+		return NULL;
+
+	address = enumerator->next->data;
+	enumerator->next = enumerator->next->next;
+
+	return g_inet_socket_address_new (address, g_network_address_get_port (G_NETWORK_ADDRESS (enumerator->addr)));
+}
+
+/* IP literals are not looked up, nor cached */
+static gboolean
+enumerator_parse_literal (SoupDNSCacheAddressEnumerator *enumerator)
+{
+	const char *hostname = g_network_address_get_hostname (G_NETWORK_ADDRESS (enumerator->addr));
+	GInetAddress *address;
+
+	if (!g_hostname_is_ip_address (hostname))
+		return FALSE;
+
+	address = g_inet_address_new_from_string (hostname);
+	if (!address)
+		return FALSE;
+
+	enumerator_set_addresses (enumerator, g_list_prepend (NULL, address));
+	return TRUE;
+}
+
+static GSocketAddress *
+soup_dns_cache_address_enumerator_next (GSocketAddressEnumerator *address_enumerator,
+					GCancellable             *cancellable,
+					GError                  **error)
+{
+	SoupDNSCacheAddressEnumerator *enumerator = SOUP_DNS_CACHE_ADDRESS_ENUMERATOR (address_enumerator);
+
+	if (!enumerator->resolved && !enumerator_parse_literal (enumerator)) {
+		GList *addresses;
+
+		addresses = soup_dns_cache_lookup (enumerator->addr->cache,
+						   g_network_address_get_hostname (G_NETWORK_ADDRESS (enumerator->addr)),
+						   cancellable, error);
+		if (!addresses)
+			return NULL;
+
+		enumerator_set_addresses (enumerator, addresses);
+	}
+
+	return enumerator_next_address (enumerator);
+}
+
+static void
+lookup_ready_cb (SoupDNSCache *cache,
+		 GAsyncResult *result,
+		 GTask        *task)
+{
+	SoupDNSCacheAddressEnumerator *enumerator = g_task_get_source_object (task);
+	GList *addresses;
+	GError *error = NULL;
+
+	addresses = soup_dns_cache_lookup_finish (cache, result, &error);
+	if (!addresses) {
+		g_task_return_error (task, error);
+	} else {
+		enumerator_set_addresses (enumerator, addresses);
+		g_task_return_pointer (task, enumerator_next_address (enumerator), g_object_unref);
+	}
+	g_object_unref (task);
+}
+
+static void
+soup_dns_cache_address_enumerator_next_async (GSocketAddressEnumerator *address_enumerator,
+					      GCancellable             *cancellable,
+					      GAsyncReadyCallback       callback,
+					      gpointer                  user_data)
+{
+	SoupDNSCacheAddressEnumerator *enumerator = SOUP_DNS_CACHE_ADDRESS_ENUMERATOR (address_enumerator);
+	GTask *task;
+
+	task = g_task_new (enumerator, cancellable, callback, user_data);
+	g_task_set_source_tag (task, soup_dns_cache_address_enumerator_next_async);
+
+	if (!enumerator->resolved && !enumerator_parse_literal (enumerator)) {
+		soup_dns_cache_lookup_async (enumerator->addr->cache,
+					     g_network_address_get_hostname (G_NETWORK_ADDRESS (enumerator->addr)),
+					     cancellable,
+					     (GAsyncReadyCallback)lookup_ready_cb,
+					     task);
+		return;
+	}
+
+	g_task_return_pointer (task, enumerator_next_address (enumerator), g_object_unref);
+	g_object_unref (task);
+}
+
+static GSocketAddress *
+soup_dns_cache_address_enumerator_next_finish (GSocketAddressEnumerator *address_enumerator,
+					       GAsyncResult             *result,
+					       GError                  **error)
+{
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+soup_dns_cache_address_enumerator_init (SoupDNSCacheAddressEnumerator *enumerator)
+{
+}
+
+static void
+soup_dns_cache_address_enumerator_finalize (GObject *object)
+{
+	SoupDNSCacheAddressEnumerator *enumerator = SOUP_DNS_CACHE_ADDRESS_ENUMERATOR (object);
+
+	g_object_unref (enumerator->addr);
+	g_resolver_free_addresses (enumerator->addresses);
+
+	G_OBJECT_CLASS (soup_dns_cache_address_enumerator_parent_class)->finalize (object);
+}
+
+static void
+soup_dns_cache_address_enumerator_class_init (SoupDNSCacheAddressEnumeratorClass *enumerator_class)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (enumerator_class);
+	GSocketAddressEnumeratorClass *address_enumerator_class = G_SOCKET_ADDRESS_ENUMERATOR_CLASS (enumerator_class);
+
+	object_class->finalize = soup_dns_cache_address_enumerator_finalize;
+	address_enumerator_class->next = soup_dns_cache_address_enumerator_next;
+	address_enumerator_class->next_async = soup_dns_cache_address_enumerator_next_async;
+	address_enumerator_class->next_finish = soup_dns_cache_address_enumerator_next_finish;
+}
+
+static GSocketAddressEnumerator *
+soup_dns_cache_address_enumerate (GSocketConnectable *connectable)
+{
+	SoupDNSCacheAddressEnumerator *enumerator;
+
+	enumerator = g_object_new (SOUP_TYPE_DNS_CACHE_ADDRESS_ENUMERATOR, NULL);
+	enumerator->addr = g_object_ref (SOUP_DNS_CACHE_ADDRESS (connectable));
+
+	return G_SOCKET_ADDRESS_ENUMERATOR (enumerator);
+}
+
+static void
+soup_dns_cache_address_connectable_init (GSocketConnectableIface *iface)
+{
+	GSocketConnectableIface *parent_iface = g_type_interface_peek_parent (iface);
+
+	/* proxy_enumerate() comes back to enumerate() for direct
+	 * connections.
+	 */
+	iface->enumerate = soup_dns_cache_address_enumerate;
+	iface->proxy_enumerate = parent_iface->proxy_enumerate;
+	iface->to_string = parent_iface->to_string;
+}
+
+static void
+soup_dns_cache_address_init (SoupDNSCacheAddress *addr)
+{
+}
+
+static void
+soup_dns_cache_address_finalize (GObject *object)
+{
+	SoupDNSCacheAddress *addr = SOUP_DNS_CACHE_ADDRESS (object);
+
+	g_clear_object (&addr->cache);
+
+	G_OBJECT_CLASS (soup_dns_cache_address_parent_class)->finalize (object);
+}
+
+static void
+soup_dns_cache_address_class_init (SoupDNSCacheAddressClass *addr_class)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (addr_class);
+
+	object_class->finalize = soup_dns_cache_address_finalize;
+}
+
+GSocketConnectable *
+soup_dns_cache_create_connectable (SoupDNSCache *cache,
+				   GUri         *uri)
+{
+	SoupDNSCacheAddress *addr;
+
+	addr = g_object_new (SOUP_TYPE_DNS_CACHE_ADDRESS,
+			     "hostname", g_uri_get_host (uri),
+			     "port", g_uri_get_port (uri),
+			     "scheme", g_uri_get_scheme (uri),
+			     NULL);
+	addr->cache = g_object_ref (cache);
+
+	return G_SOCKET_CONNECTABLE (addr);
+}
+
+/* Returns the cached addresses of @hostname without blocking, or %NULL
+ * if it has not been resolved yet. Unlike a lookup, this is not a use
+ * of @hostname: it doesn't keep the entry in the cache or refresh it.
+ */
+GList *
+soup_dns_cache_get_cached_addresses (SoupDNSCache *cache,
+				     const char   *hostname)
+{
+	SoupDNSCacheEntry *entry;
+	GList *addresses = NULL;
+	char *key;
+
+	key = g_ascii_strdown (hostname, -1);
+	g_mutex_lock (&cache->mutex);
+	entry = g_hash_table_lookup (cache->entries, key);
+	if (entry && !entry->error && entry->expires > get_time_locked (cache))
+		addresses = g_list_copy_deep (entry->addresses, (GCopyFunc)g_object_ref, NULL);
+	g_mutex_unlock (&cache->mutex);
+	g_free (key);
+
+	return addresses;
+}
+
+/* Moves the clock of @cache forward by @span, for tests to expire
+ * names without waiting.
+ */
+void
+soup_dns_cache_advance_clock (SoupDNSCache *cache,
+			      GTimeSpan     span)
+{
+	g_mutex_lock (&cache->mutex);
+	cache->clock_offset += span;
+	g_mutex_unlock (&cache->mutex);
+}
+
+/* Waits until the lookups in progress, including the background
+ * ones, have finished and their results are stored.
+ */
+void
+soup_dns_cache_wait_for_lookups (SoupDNSCache *cache)
+{
+	g_mutex_lock (&cache->mutex);
+	while (g_hash_table_size (cache->lookups) > 0)
+		g_cond_wait (&cache->lookups_cond, &cache->mutex);
+	g_mutex_unlock (&cache->mutex);
+}
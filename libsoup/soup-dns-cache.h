@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-dns-cache.h: session-level host name resolution cache
+ */
+
+#pragma once
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+#define SOUP_TYPE_DNS_CACHE (soup_dns_cache_get_type ())
+SOUP_AVAILABLE_IN_3_8
+G_DECLARE_FINAL_TYPE (SoupDNSCache, soup_dns_cache, SOUP, DNS_CACHE, GObject)
+
+SOUP_AVAILABLE_IN_3_8
+SoupDNSCache *soup_dns_cache_new              (void);
+
+SOUP_AVAILABLE_IN_3_8
+void          soup_dns_cache_set_resolver     (SoupDNSCache       *cache,
+					       GResolver          *resolver);
+SOUP_AVAILABLE_IN_3_8
+GResolver    *soup_dns_cache_get_resolver     (SoupDNSCache       *cache);
+
+SOUP_AVAILABLE_IN_3_8
+void          soup_dns_cache_set_ttl          (SoupDNSCache       *cache,
+					       guint               ttl);
+SOUP_AVAILABLE_IN_3_8
+guint         soup_dns_cache_get_ttl          (SoupDNSCache       *cache);
+
+SOUP_AVAILABLE_IN_3_8
+void          soup_dns_cache_set_negative_ttl (SoupDNSCache       *cache,
+					       guint               negative_ttl);
+SOUP_AVAILABLE_IN_3_8
+guint         soup_dns_cache_get_negative_ttl (SoupDNSCache       *cache);
+
+SOUP_AVAILABLE_IN_3_8
+void          soup_dns_cache_prefetch         (SoupDNSCache       *cache,
+					       const char * const *hostnames);
+SOUP_AVAILABLE_IN_3_8
+void          soup_dns_cache_clear            (SoupDNSCache       *cache);
+
+G_END_DECLS
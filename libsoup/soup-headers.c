@@ -507,6 +507,48 @@ sort_by_qval (const void *a, const void *b)
 		return -1;
 }
 
+/* Parses the qvalue of a single list @item, truncating @item before
+ * its "q" parameter.
+ */
+static double
+parse_qvalue (char *item)
+{
+	char *semi;
+	const char *param, *equal, *value;
+	double qval = 1.0;
+
+	for (semi = strchr (item, ';'); semi; semi = strchr (semi + 1, ';')) {
+		param = skip_lws (semi + 1);
+		if (*param != 'q')
+			continue;
+		equal = skip_lws (param + 1);
+		if (!equal || *equal != '=')
+			continue;
+		value = skip_lws (equal + 1);
+		if (!value)
+			continue;
+
+		if (value[0] != '0' && value[0] != '1')
+			continue;
+		qval = (double)(value[0] - '0');
+		if (value[0] == '0' && value[1] == '.') {
+			if (g_ascii_isdigit (value[2])) {
+				qval += (double)(value[2] - '0') / 10;
+				if (g_ascii_isdigit (value[3])) {
+					qval += (double)(value[3] - '0') / 100;
+					if (g_ascii_isdigit (value[4]))
+						qval += (double)(value[4] - '0') / 1000;
+				}
+			}
+		}
+
+		*semi = '\0';
+		break;
+	}
+
+	return qval;
+}
+
 /**
  * soup_header_parse_quality_list:
  * @header: a header value
@@ -530,8 +572,7 @@ soup_header_parse_quality_list (const char *header, GSList **unacceptable)
 	GSList *unsorted;
 	QualityItem *array;
 	GSList *sorted, *iter;
-	char *item, *semi;
-	const char *param, *equal, *value;
+	char *item;
 	double qval;
 	int n;
 
@@ -544,35 +585,7 @@ soup_header_parse_quality_list (const char *header, GSList **unacceptable)
 	array = g_new0 (QualityItem, g_slist_length (unsorted));
 	for (iter = unsorted, n = 0; iter; iter = iter->next) {
 		item = iter->data;
-		qval = 1.0;
-		for (semi = strchr (item, ';'); semi; semi = strchr (semi + 1, ';')) {
-			param = skip_lws (semi + 1);
-			if (*param != 'q')
-				continue;
-			equal = skip_lws (param + 1);
-			if (!equal || *equal != '=')
-				continue;
-			value = skip_lws (equal + 1);
-			if (!value)
-				continue;
-
-			if (value[0] != '0' && value[0] != '1')
-				continue;
-			qval = (double)(value[0] - '0');
-			if (value[0] == '0' && value[1] == '.') {
-				if (g_ascii_isdigit (value[2])) {
-					qval += (double)(value[2] - '0') / 10;
-					if (g_ascii_isdigit (value[3])) {
-						qval += (double)(value[3] - '0') / 100;
-						if (g_ascii_isdigit (value[4]))
-							qval += (double)(value[4] - '0') / 1000;
-					}
-				}
-			}
-
-			*semi = '\0';
-			break;
-		}
+		qval = parse_qvalue (item);
 
 		if (qval == 0.0) {
 			if (unacceptable) {
@@ -596,6 +609,65 @@ soup_header_parse_quality_list (const char *header, GSList **unacceptable)
 	return sorted;
 }
 
+/* Chooses which of @offers to use for a header like Accept-Encoding,
+ * with the same qvalue parsing as soup_header_parse_quality_list(). The
+ * offer with the highest qvalue wins and ties go to the earlier offer,
+ * so @offers is in order of preference. "*" applies to the offers that
+ * are not listed. Returns the index of the chosen offer, or -1 if none
+ * is acceptable or "identity" is explicitly preferred to all of them.
+ */
+int
+soup_header_choose_quality_item (const char         *header,
+				 const char * const *offers)
+{
+	GSList *items, *iter;
+	double *qvals;
+	double wildcard = 0, identity = 0, best_qval = 0;
+	guint n_offers, i;
+	int best = -1;
+
+	g_return_val_if_fail (header != NULL, -1);
+
+	n_offers = g_strv_length ((char **)offers);
+	qvals = g_new (double, n_offers);
+	for (i = 0; i < n_offers; i++)
+		qvals[i] = -1;
+
+	items = soup_header_parse_list (header);
+	for (iter = items; iter; iter = iter->next) {
+		char *item = iter->data;
+		double qval = parse_qvalue (item);
+		gsize len = strcspn (item, "; \t");
+
+		if (len == 1 && item[0] == '*')
+			wildcard = qval;
+		else if (len == 8 && !g_ascii_strncasecmp (item, "identity", len))
+			identity = qval;
+		else {
+			for (i = 0; i < n_offers; i++) {
+				if (strlen (offers[i]) == len &&
+				    !g_ascii_strncasecmp (item, offers[i], len))
+					qvals[i] = qval;
+			}
+		}
+	}
+	soup_header_free_list (items);
+
+	for (i = 0; i < n_offers; i++) {
+		double qval = qvals[i] >= 0 ? qvals[i] : wildcard;
+
+		if (qval > best_qval) {
+			best_qval = qval;
+			best = i;
+		}
+	}
+	g_free (qvals);
+
+	if (identity > best_qval)
+		return -1;
+	return best;
+}
+
 /**
  * soup_header_free_list: (skip)
  * @list: a #GSList returned from [func@header_parse_list] or
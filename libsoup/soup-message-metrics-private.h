@@ -16,6 +16,7 @@ struct _SoupMessageMetrics {
         guint64 connect_start;
         guint64 connect_end;
         guint64 tls_start;
+        guint64 tls_end;
         guint64 request_start;
         guint64 response_start;
         guint64 response_end;
@@ -26,6 +27,8 @@ struct _SoupMessageMetrics {
         guint64 response_header_bytes_received;
         guint64 response_body_size;
         guint64 response_body_bytes_received;
+
+        gboolean tls_session_resumed;
 };
 
 SoupMessageMetrics *soup_message_metrics_new   (void);
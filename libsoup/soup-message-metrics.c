@@ -139,6 +139,11 @@ soup_message_metrics_get_dns_end (SoupMessageMetrics *metrics)
  * Get the time immediately before the [class@Message] started to
  * establish the connection to the server.
  *
+ * When the server has several addresses, connection attempts to them
+ * are raced and this is the start of the first attempt, so the time
+ * until [method@MessageMetrics.get_connect_end] includes any attempt
+ * to an unreachable address.
+ *
  * It will be 0 if no network connection was required to fetch the resource (a
  * persistent connection was used or resource was loaded from the local disk
  * cache).
@@ -196,6 +201,29 @@ soup_message_metrics_get_tls_start (SoupMessageMetrics *metrics)
         return metrics->tls_start;
 }
 
+/**
+ * soup_message_metrics_get_tls_end:
+ * @metrics: a #SoupMessageMetrics
+ *
+ * Get the time immediately after the [class@Message] completed the
+ * TLS handshake.
+ *
+ * It will be 0 if no TLS handshake was required to fetch the resource
+ * (connection was not secure, a persistent connection was used or resource was
+ * loaded from the local disk cache), or if the handshake failed.
+ *
+ * Returns: the tls end time
+ *
+ * Since: 3.8
+ */
+guint64
+soup_message_metrics_get_tls_end (SoupMessageMetrics *metrics)
+{
+        g_return_val_if_fail (metrics != NULL, 0);
+
+        return metrics->tls_end;
+}
+
 /**
  * soup_message_metrics_get_request_start:
  * @metrics: a #SoupMessageMetrics
@@ -274,7 +302,8 @@ soup_message_metrics_get_request_header_bytes_sent (SoupMessageMetrics *metrics)
  * @metrics: a #SoupMessageMetrics
  *
  * Get the request body size in bytes. This is the size of the original body
- * given to the request before any encoding is applied.
+ * given to the request before any encoding is applied, including the
+ * compression set with [method@Message.set_request_body_encoding].
  *
  * This value is available right before [signal@Message::wrote-body] signal is
  * emitted, but you might get an intermediate value if called before.
@@ -372,3 +401,26 @@ soup_message_metrics_get_response_body_bytes_received (SoupMessageMetrics *metri
 
         return metrics->response_body_bytes_received;
 }
+
+/**
+ * soup_message_metrics_get_tls_session_resumed:
+ * @metrics: a #SoupMessageMetrics
+ *
+ * Gets whether the TLS handshake of the connection used to fetch the
+ * resource resumed a previous session with the server, skipping the
+ * full handshake.
+ *
+ * It will be %FALSE if no TLS handshake was required to fetch the
+ * resource, or if the TLS backend does not report session resumption.
+ *
+ * Returns: %TRUE if the TLS session was resumed
+ *
+ * Since: 3.8
+ */
+gboolean
+soup_message_metrics_get_tls_session_resumed (SoupMessageMetrics *metrics)
+{
+        g_return_val_if_fail (metrics != NULL, FALSE);
+
+        return metrics->tls_session_resumed;
+}
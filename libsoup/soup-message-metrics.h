@@ -39,6 +39,9 @@ guint64             soup_message_metrics_get_connect_end    (SoupMessageMetrics
 SOUP_AVAILABLE_IN_ALL
 guint64             soup_message_metrics_get_tls_start      (SoupMessageMetrics *metrics);
 
+SOUP_AVAILABLE_IN_3_8
+guint64             soup_message_metrics_get_tls_end        (SoupMessageMetrics *metrics);
+
 SOUP_AVAILABLE_IN_ALL
 guint64             soup_message_metrics_get_request_start  (SoupMessageMetrics *metrics);
 
@@ -66,6 +69,9 @@ guint64             soup_message_metrics_get_response_body_size             (Sou
 SOUP_AVAILABLE_IN_ALL
 guint64             soup_message_metrics_get_response_body_bytes_received   (SoupMessageMetrics *metrics);
 
+SOUP_AVAILABLE_IN_3_8
+gboolean            soup_message_metrics_get_tls_session_resumed            (SoupMessageMetrics *metrics);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(SoupMessageMetrics, soup_message_metrics_free)
 
 G_END_DECLS
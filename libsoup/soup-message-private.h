@@ -120,6 +120,8 @@ gboolean            soup_message_try_sniff_content      (SoupMessage        *msg
                                                          GCancellable       *cancellable,
                                                          GError            **error);
 GInputStream       *soup_message_get_request_body_stream (SoupMessage        *msg);
+void                soup_message_clear_request_body_encoder    (SoupMessage  *msg);
+gint64              soup_message_get_request_body_bytes_encoded (SoupMessage  *msg);
 
 void                soup_message_set_reason_phrase       (SoupMessage        *msg,
                                                           const char         *reason_phrase);
@@ -134,6 +136,7 @@ typedef enum {
         SOUP_MESSAGE_METRICS_CONNECT_START,
         SOUP_MESSAGE_METRICS_CONNECT_END,
         SOUP_MESSAGE_METRICS_TLS_START,
+        SOUP_MESSAGE_METRICS_TLS_END,
         SOUP_MESSAGE_METRICS_REQUEST_START,
         SOUP_MESSAGE_METRICS_RESPONSE_START,
         SOUP_MESSAGE_METRICS_RESPONSE_END
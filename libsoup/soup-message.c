@@ -19,6 +19,7 @@
 #include "soup-message-metrics-private.h"
 #include "soup-uri-utils-private.h"
 #include "content-sniffer/soup-content-sniffer-stream.h"
+#include "content-decoder/soup-compressor-wrapper.h"
 
 /**
  * SoupMessage:
@@ -58,6 +59,8 @@ typedef struct {
 	SoupMessageHeaders *response_headers;
 
 	GInputStream      *request_body_stream;
+        char              *request_body_encoding;
+        SoupCompressorWrapper *request_body_encoder;
         const char        *method;
         char              *reason_phrase;
         SoupStatus         status_code;
@@ -152,6 +155,7 @@ enum {
 	PROP_SITE_FOR_COOKIES,
 	PROP_IS_TOP_LEVEL_NAVIGATION,
         PROP_IS_OPTIONS_PING,
+        PROP_REQUEST_BODY_ENCODING,
 
 	LAST_PROPERTY
 };
@@ -212,6 +216,8 @@ soup_message_finalize (GObject *object)
 	soup_message_headers_unref (priv->request_headers);
 	soup_message_headers_unref (priv->response_headers);
 	g_clear_object (&priv->request_body_stream);
+        g_clear_object (&priv->request_body_encoder);
+        g_free (priv->request_body_encoding);
 
 	g_free (priv->reason_phrase);
 
@@ -249,6 +255,9 @@ soup_message_set_property (GObject *object, guint prop_id,
 	case PROP_IS_OPTIONS_PING:
                 soup_message_set_is_options_ping (msg, g_value_get_boolean (value));
 		break;
+        case PROP_REQUEST_BODY_ENCODING:
+                soup_message_set_request_body_encoding (msg, g_value_get_string (value));
+                break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -317,6 +326,9 @@ soup_message_get_property (GObject *object, guint prop_id,
 	case PROP_IS_OPTIONS_PING:
                 g_value_set_boolean (value, priv->is_options_ping);
                 break;
+        case PROP_REQUEST_BODY_ENCODING:
+                g_value_set_string (value, priv->request_body_encoding);
+                break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -950,6 +962,22 @@ soup_message_class_init (SoupMessageClass *message_class)
 				      G_PARAM_READWRITE |
 				      G_PARAM_STATIC_STRINGS);
 
+        /**
+         * SoupMessage:request-body-encoding: (attributes org.gtk.Property.get=soup_message_get_request_body_encoding org.gtk.Property.set=soup_message_set_request_body_encoding)
+         *
+         * The content coding the request body is compressed with
+         * when it is sent, or %NULL to send it as it is.
+         *
+         * Since: 3.8
+         */
+        properties[PROP_REQUEST_BODY_ENCODING] =
+                g_param_spec_string ("request-body-encoding",
+                                     "Request Body Encoding",
+                                     "The content coding the request body is compressed with",
+                                     NULL,
+                                     G_PARAM_READWRITE |
+                                     G_PARAM_STATIC_STRINGS);
+
         g_object_class_install_properties (object_class, LAST_PROPERTY, properties);
 }
 
@@ -1152,6 +1180,7 @@ soup_message_set_request_body (SoupMessage  *msg,
         SoupMessagePrivate *priv = soup_message_get_instance_private (msg);
 
         g_clear_object (&priv->request_body_stream);
+        soup_message_clear_request_body_encoder (msg);
 
         if (stream) {
                 if (content_type) {
@@ -1265,6 +1294,7 @@ soup_message_restarted (SoupMessage *msg)
         SoupMessagePrivate *priv = soup_message_get_instance_private (msg);
 
 	g_clear_object (&priv->request_body_stream);
+        soup_message_clear_request_body_encoder (msg);
 
 	g_signal_emit (msg, signals[RESTARTED], 0);
 }
@@ -1587,6 +1617,7 @@ soup_message_set_metrics_timestamp_for_network_event (SoupMessage       *msg,
                 soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_TLS_START);
                 break;
         case G_SOCKET_CLIENT_TLS_HANDSHAKED:
+                soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_TLS_END);
                 break;
         case G_SOCKET_CLIENT_COMPLETE:
                 soup_message_set_metrics_timestamp (msg, SOUP_MESSAGE_METRICS_CONNECT_END);
@@ -1594,6 +1625,24 @@ soup_message_set_metrics_timestamp_for_network_event (SoupMessage       *msg,
         }
 }
 
+/* GTlsConnection has no API for this, but glib-networking exposes
+ * whether the last handshake resumed a session as a property.
+ */
+static gboolean
+soup_tls_connection_get_session_resumed (GIOStream *connection)
+{
+        gboolean resumed = FALSE;
+
+        if (!G_IS_TLS_CONNECTION (connection))
+                return FALSE;
+
+        if (!g_object_class_find_property (G_OBJECT_GET_CLASS (connection), "session-reused"))
+                return FALSE;
+
+        g_object_get (connection, "session-reused", &resumed, NULL);
+        return resumed;
+}
+
 static void
 re_emit_connection_event (SoupMessage       *msg,
                           GSocketClientEvent event,
@@ -1601,6 +1650,13 @@ re_emit_connection_event (SoupMessage       *msg,
 {
         soup_message_set_metrics_timestamp_for_network_event (msg, event);
 
+        if (event == G_SOCKET_CLIENT_TLS_HANDSHAKED) {
+                SoupMessagePrivate *priv = soup_message_get_instance_private (msg);
+
+                if (priv->metrics)
+                        priv->metrics->tls_session_resumed = soup_tls_connection_get_session_resumed (connection);
+        }
+
 	g_signal_emit (msg, signals[NETWORK_EVENT], 0,
 		       event, connection);
 }
@@ -2846,6 +2902,44 @@ soup_message_io_get_cancellable (SoupMessage *msg)
         return soup_client_message_io_get_cancellable (priv->io_data, msg);
 }
 
+/* Called right before the request is sent on a connection to a
+ * server speaking @server_http_version: replaces the request body
+ * stream with one that compresses it, if that was asked for with
+ * soup_message_set_request_body_encoding().
+ */
+static void
+soup_message_setup_request_body_encoding (SoupMessage    *msg,
+                                          SoupHTTPVersion server_http_version)
+{
+        SoupMessagePrivate *priv = soup_message_get_instance_private (msg);
+        GInputStream *stream;
+
+        if (!priv->request_body_encoding || !priv->request_body_stream || priv->request_body_encoder)
+                return;
+
+        /* Already compressed by the caller */
+        if (soup_message_headers_get_one_common (priv->request_headers, SOUP_HEADER_CONTENT_ENCODING))
+                return;
+
+        /* The compressed length is unknown, so the body must be chunked */
+        if (server_http_version == SOUP_HTTP_1_0)
+                return;
+
+        if (soup_message_headers_get_encoding (priv->request_headers) == SOUP_ENCODING_CONTENT_LENGTH &&
+            soup_message_headers_get_content_length (priv->request_headers) == 0)
+                return;
+
+        priv->request_body_encoder = soup_compressor_wrapper_new (priv->request_body_encoding, FALSE);
+        stream = g_converter_input_stream_new (priv->request_body_stream,
+                                               G_CONVERTER (priv->request_body_encoder));
+        g_object_unref (priv->request_body_stream);
+        priv->request_body_stream = stream;
+
+        soup_message_headers_replace_common (priv->request_headers, SOUP_HEADER_CONTENT_ENCODING,
+                                             priv->request_body_encoding);
+        soup_message_headers_set_encoding (priv->request_headers, SOUP_ENCODING_CHUNKED);
+}
+
 void
 soup_message_send_item (SoupMessage              *msg,
                         SoupMessageQueueItem     *item,
@@ -2855,6 +2949,7 @@ soup_message_send_item (SoupMessage              *msg,
         SoupMessagePrivate *priv = soup_message_get_instance_private (msg);
         SoupConnection *connection = g_weak_ref_get (&priv->connection);
 
+        soup_message_setup_request_body_encoding (msg, soup_connection_get_server_http_version (connection));
         priv->io_data = soup_connection_setup_message_io (connection, msg);
         g_object_unref (connection);
         soup_client_message_io_send_item (priv->io_data, item, completion_cb, user_data);
@@ -2921,6 +3016,32 @@ soup_message_get_request_body_stream (SoupMessage *msg)
         return priv->request_body_stream;
 }
 
+void
+soup_message_clear_request_body_encoder (SoupMessage *msg)
+{
+        SoupMessagePrivate *priv = soup_message_get_instance_private (msg);
+
+        if (!priv->request_body_encoder)
+                return;
+
+        g_clear_object (&priv->request_body_encoder);
+        soup_message_headers_remove_common (priv->request_headers, SOUP_HEADER_CONTENT_ENCODING);
+}
+
+/* Returns the number of uncompressed request body bytes consumed
+ * so far when the request body is being compressed, or -1.
+ */
+gint64
+soup_message_get_request_body_bytes_encoded (SoupMessage *msg)
+{
+        SoupMessagePrivate *priv = soup_message_get_instance_private (msg);
+
+        if (!priv->request_body_encoder)
+                return -1;
+
+        return soup_compressor_wrapper_get_bytes_read (priv->request_body_encoder);
+}
+
 /**
  * soup_message_get_method: (attributes org.gtk.Method.get_property=method)
  * @msg: The #SoupMessage
@@ -3193,13 +3314,21 @@ soup_message_set_metrics_timestamp (SoupMessage           *msg,
                 metrics->fetch_start = timestamp;
                 break;
         case SOUP_MESSAGE_METRICS_DNS_START:
-                metrics->dns_start = timestamp;
+                /* The socket client may go back to the resolver for
+                 * more addresses while connecting, and it starts a
+                 * connection attempt per address when racing them, so
+                 * keep the first timestamp of each phase.
+                 */
+                if (metrics->dns_start == 0)
+                        metrics->dns_start = timestamp;
                 break;
         case SOUP_MESSAGE_METRICS_DNS_END:
-                metrics->dns_end = timestamp;
+                if (metrics->dns_end == 0)
+                        metrics->dns_end = timestamp;
                 break;
         case SOUP_MESSAGE_METRICS_CONNECT_START:
-                metrics->connect_start = timestamp;
+                if (metrics->connect_start == 0)
+                        metrics->connect_start = timestamp;
                 break;
         case SOUP_MESSAGE_METRICS_CONNECT_END:
                 metrics->connect_end = timestamp;
@@ -3207,6 +3336,9 @@ soup_message_set_metrics_timestamp (SoupMessage           *msg,
         case SOUP_MESSAGE_METRICS_TLS_START:
                 metrics->tls_start = timestamp;
                 break;
+        case SOUP_MESSAGE_METRICS_TLS_END:
+                metrics->tls_end = timestamp;
+                break;
         case SOUP_MESSAGE_METRICS_REQUEST_START:
                 metrics->request_start = timestamp;
                 break;
@@ -3356,3 +3488,65 @@ soup_message_get_force_http1 (SoupMessage *msg)
 
 	return soup_message_get_force_http_version (msg) == SOUP_HTTP_1_1;
 }
+
+/**
+ * soup_message_set_request_body_encoding: (attributes org.gtk.Method.set_property=request-body-encoding)
+ * @msg: The #SoupMessage
+ * @coding: (nullable): a content coding like "gzip", or %NULL
+ *
+ * Sets the content coding that the request body of @msg is compressed
+ * with while it is sent. The body is compressed as it is read from the
+ * stream given to [method@Message.set_request_body], so its size does
+ * not need to be known in advance; the request is sent with chunked
+ * encoding on HTTP/1.1 and with a "Content-Encoding" header. Bodies
+ * that already have a "Content-Encoding", and requests to servers
+ * that answered with HTTP/1.0, are sent as they are.
+ *
+ * "gzip" and "deflate" are always supported, and "br" and "zstd" are
+ * when libsoup was built with them. Note that the server must support
+ * the coding; there is no negotiation for request bodies.
+ *
+ * The uncompressed and sent sizes of the body are available from
+ * [method@MessageMetrics.get_request_body_size] and
+ * [method@MessageMetrics.get_request_body_bytes_sent].
+ *
+ * Since: 3.8
+ */
+void
+soup_message_set_request_body_encoding (SoupMessage *msg,
+                                        const char  *coding)
+{
+        SoupMessagePrivate *priv;
+
+        g_return_if_fail (SOUP_IS_MESSAGE (msg));
+        g_return_if_fail (coding == NULL || soup_compressor_wrapper_supports_coding (coding));
+
+        priv = soup_message_get_instance_private (msg);
+        if (g_strcmp0 (priv->request_body_encoding, coding) == 0)
+                return;
+
+        g_free (priv->request_body_encoding);
+        priv->request_body_encoding = g_strdup (coding);
+        g_object_notify_by_pspec (G_OBJECT (msg), properties[PROP_REQUEST_BODY_ENCODING]);
+}
+
+/**
+ * soup_message_get_request_body_encoding: (attributes org.gtk.Method.get_property=request-body-encoding)
+ * @msg: The #SoupMessage
+ *
+ * Gets the content coding the request body of @msg is compressed with.
+ *
+ * Returns: (nullable): the content coding, or %NULL
+ *
+ * Since: 3.8
+ */
+const char *
+soup_message_get_request_body_encoding (SoupMessage *msg)
+{
+        SoupMessagePrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_MESSAGE (msg), NULL);
+
+        priv = soup_message_get_instance_private (msg);
+        return priv->request_body_encoding;
+}
@@ -201,4 +201,10 @@ void                soup_message_set_force_http1      (SoupMessage *msg,
 SOUP_AVAILABLE_IN_3_4
 gboolean            soup_message_get_force_http1      (SoupMessage *msg);
 
+SOUP_AVAILABLE_IN_3_8
+void                soup_message_set_request_body_encoding (SoupMessage *msg,
+                                                            const char  *coding);
+SOUP_AVAILABLE_IN_3_8
+const char         *soup_message_get_request_body_encoding (SoupMessage *msg);
+
 G_END_DECLS
@@ -70,6 +70,9 @@ guint soup_message_headers_get_ranges_internal (SoupMessageHeaders  *hdrs,
 						SoupRange          **ranges,
 						int                 *length);
 
+int soup_header_choose_quality_item (const char         *header,
+				     const char * const *offers);
+
 gboolean           soup_host_matches_host    (const gchar *host,
 					      const gchar *compare_with);
 
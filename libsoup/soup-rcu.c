@@ -0,0 +1,101 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-rcu.c: pointer to immutable data shared with concurrent readers
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "soup-rcu.h"
+
+/* A SoupRcuPointer points to data that is never modified once
+ * published: writers build a new version and replace the pointer, so
+ * readers never wait for a writer, and never take a lock.
+ *
+ * Readers only increment the counter of the current epoch before
+ * loading the pointer, and decrement it when they are done. A writer
+ * replacing the data then waits for a grace period before freeing the
+ * old version: it moves new readers to the other counter and waits for
+ * the previous one to drain, twice, so that every reader that could
+ * have loaded the old pointer is done with it. Readers are expected to
+ * hold the data for a short time, as writers spin meanwhile.
+ *
+ * The free func frees a whole version of the data. Writers must be
+ * serialized by the caller, and must not replace the data from within
+ * a read section.
+ */
+
+void
+soup_rcu_pointer_init (SoupRcuPointer *rcu,
+		       GDestroyNotify  free_func)
+{
+	rcu->data = NULL;
+	rcu->readers[0] = rcu->readers[1] = 0;
+	rcu->epoch = 0;
+	rcu->free_func = free_func;
+}
+
+void
+soup_rcu_pointer_clear (SoupRcuPointer *rcu)
+{
+	soup_rcu_pointer_replace (rcu, NULL);
+}
+
+/* Returns the current data, which is valid until the matching
+ * soup_rcu_pointer_read_unlock() with the returned @slot, even if it
+ * is replaced meanwhile.
+ */
+gpointer
+soup_rcu_pointer_read_lock (SoupRcuPointer *rcu,
+			    guint          *slot)
+{
+	*slot = (guint)g_atomic_int_get (&rcu->epoch) & 1;
+	g_atomic_int_inc (&rcu->readers[*slot]);
+
+	return g_atomic_pointer_get (&rcu->data);
+}
+
+void
+soup_rcu_pointer_read_unlock (SoupRcuPointer *rcu,
+			      guint           slot)
+{
+	g_atomic_int_dec_and_test (&rcu->readers[slot]);
+}
+
+/* Returns the current data, for writers */
+gpointer
+soup_rcu_pointer_get (SoupRcuPointer *rcu)
+{
+	return rcu->data;
+}
+
+static void
+wait_for_readers (SoupRcuPointer *rcu)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		guint slot = (guint)g_atomic_int_add (&rcu->epoch, 1) & 1;
+
+		while (g_atomic_int_get (&rcu->readers[slot]) > 0)
+			g_thread_yield ();
+	}
+}
+
+/* Publishes @data, that must not be modified anymore, and frees the
+ * previous version once no reader uses it.
+ */
+void
+soup_rcu_pointer_replace (SoupRcuPointer *rcu,
+			  gpointer        data)
+{
+	gpointer old_data = rcu->data;
+
+	g_atomic_pointer_set (&rcu->data, data);
+	if (!old_data)
+		return;
+
+	wait_for_readers (rcu);
+	rcu->free_func (old_data);
+}
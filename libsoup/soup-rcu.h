@@ -0,0 +1,33 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * soup-rcu.h: pointer to immutable data shared with concurrent readers
+ */
+
+#pragma once
+
+#include "soup-types.h"
+
+G_BEGIN_DECLS
+
+typedef struct {
+	gpointer data;
+	/* Readers that started before and after the last epoch change */
+	gint readers[2];
+	gint epoch;
+	GDestroyNotify free_func;
+} SoupRcuPointer;
+
+void     soup_rcu_pointer_init        (SoupRcuPointer *rcu,
+				       GDestroyNotify  free_func);
+void     soup_rcu_pointer_clear       (SoupRcuPointer *rcu);
+
+gpointer soup_rcu_pointer_read_lock   (SoupRcuPointer *rcu,
+				       guint          *slot);
+void     soup_rcu_pointer_read_unlock (SoupRcuPointer *rcu,
+				       guint           slot);
+
+gpointer soup_rcu_pointer_get         (SoupRcuPointer *rcu);
+void     soup_rcu_pointer_replace     (SoupRcuPointer *rcu,
+				       gpointer        data);
+
+G_END_DECLS
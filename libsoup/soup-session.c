@@ -74,6 +74,7 @@ typedef struct {
 	gboolean tlsdb_use_default;
 
 	guint io_timeout, idle_timeout;
+        guint tcp_keepalive;
 	GInetSocketAddress *local_addr;
 
 	GProxyResolver *proxy_resolver;
@@ -139,6 +140,9 @@ enum {
 	PROP_IDLE_TIMEOUT,
 	PROP_LOCAL_ADDRESS,
 	PROP_TLS_INTERACTION,
+        PROP_TCP_KEEPALIVE,
+        PROP_HEALTH_CHECK_INTERVAL,
+        PROP_MAX_HTTP2_CONNS_PER_HOST,
 
 	LAST_PROPERTY
 };
@@ -330,6 +334,7 @@ soup_session_dispose (GObject *object)
 	SoupSession *session = SOUP_SESSION (object);
 	SoupSessionPrivate *priv = soup_session_get_instance_private (session);
 
+        soup_connection_manager_stop_warming (priv->conn_manager);
 	soup_session_abort (session);
 	g_warn_if_fail (soup_connection_manager_get_num_conns (priv->conn_manager) == 0);
 
@@ -391,7 +396,8 @@ soup_session_ensure_socket_props (SoupSession *session)
 	priv->socket_props = soup_socket_properties_new (priv->local_addr,
 							 priv->tls_interaction,
 							 priv->io_timeout,
-							 priv->idle_timeout);
+							 priv->idle_timeout,
+							 priv->tcp_keepalive);
 	if (!priv->proxy_use_default)
 		soup_socket_properties_set_proxy_resolver (priv->socket_props, priv->proxy_resolver);
 	if (!priv->tlsdb_use_default)
@@ -458,6 +464,15 @@ soup_session_set_property (GObject *object, guint prop_id,
 	case PROP_IDLE_TIMEOUT:
 		soup_session_set_idle_timeout (session, g_value_get_uint (value));
 		break;
+        case PROP_TCP_KEEPALIVE:
+                soup_session_set_tcp_keepalive (session, g_value_get_uint (value));
+                break;
+        case PROP_HEALTH_CHECK_INTERVAL:
+                soup_session_set_health_check_interval (session, g_value_get_uint (value));
+                break;
+        case PROP_MAX_HTTP2_CONNS_PER_HOST:
+                soup_session_set_max_http2_conns_per_host (session, g_value_get_uint (value));
+                break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -507,6 +522,15 @@ soup_session_get_property (GObject *object, guint prop_id,
 	case PROP_IDLE_TIMEOUT:
 		g_value_set_uint (value, soup_session_get_idle_timeout (session));
 		break;
+        case PROP_TCP_KEEPALIVE:
+                g_value_set_uint (value, soup_session_get_tcp_keepalive (session));
+                break;
+        case PROP_HEALTH_CHECK_INTERVAL:
+                g_value_set_uint (value, soup_session_get_health_check_interval (session));
+                break;
+        case PROP_MAX_HTTP2_CONNS_PER_HOST:
+                g_value_set_uint (value, soup_session_get_max_http2_conns_per_host (session));
+                break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -855,6 +879,184 @@ soup_session_get_idle_timeout (SoupSession *session)
 	return priv->idle_timeout;
 }
 
+/**
+ * soup_session_set_tcp_keepalive: (attributes org.gtk.Method.set_property=tcp-keepalive)
+ * @session: a #SoupSession
+ * @keepalive: a time in seconds, or 0
+ *
+ * Set the time in seconds a connection has to be inactive before TCP
+ * keepalive probes are sent on it, for new connections of @session.
+ *
+ * See [property@Session:tcp-keepalive] for more information.
+ *
+ * Since: 3.8
+ */
+void
+soup_session_set_tcp_keepalive (SoupSession *session,
+                                guint        keepalive)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_if_fail (SOUP_IS_SESSION (session));
+
+        priv = soup_session_get_instance_private (session);
+        if (priv->tcp_keepalive == keepalive)
+                return;
+
+        priv->tcp_keepalive = keepalive;
+        socket_props_changed (session);
+        g_object_notify_by_pspec (G_OBJECT (session), properties[PROP_TCP_KEEPALIVE]);
+}
+
+/**
+ * soup_session_get_tcp_keepalive: (attributes org.gtk.Method.get_property=tcp-keepalive)
+ * @session: a #SoupSession
+ *
+ * Get the time in seconds a connection has to be inactive before TCP
+ * keepalive probes are sent on it.
+ *
+ * Returns: the time in seconds, or 0 if TCP keepalive is disabled
+ *
+ * Since: 3.8
+ */
+guint
+soup_session_get_tcp_keepalive (SoupSession *session)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
+
+        priv = soup_session_get_instance_private (session);
+        return priv->tcp_keepalive;
+}
+
+/**
+ * soup_session_set_health_check_interval: (attributes org.gtk.Method.set_property=health-check-interval)
+ * @session: a #SoupSession
+ * @interval: an interval in seconds, or 0
+ *
+ * Set the interval in seconds at which the idle connections of @session
+ * are checked.
+ *
+ * See [property@Session:health-check-interval] for more information.
+ *
+ * Since: 3.8
+ */
+void
+soup_session_set_health_check_interval (SoupSession *session,
+                                        guint        interval)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_if_fail (SOUP_IS_SESSION (session));
+
+        priv = soup_session_get_instance_private (session);
+        if (soup_connection_manager_get_health_check_interval (priv->conn_manager) == interval)
+                return;
+
+        soup_connection_manager_set_health_check_interval (priv->conn_manager, interval);
+        g_object_notify_by_pspec (G_OBJECT (session), properties[PROP_HEALTH_CHECK_INTERVAL]);
+}
+
+/**
+ * soup_session_get_health_check_interval: (attributes org.gtk.Method.get_property=health-check-interval)
+ * @session: a #SoupSession
+ *
+ * Get the interval in seconds at which the idle connections of @session
+ * are checked.
+ *
+ * Returns: the interval in seconds, or 0 if health checks are disabled
+ *
+ * Since: 3.8
+ */
+guint
+soup_session_get_health_check_interval (SoupSession *session)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
+
+        priv = soup_session_get_instance_private (session);
+        return soup_connection_manager_get_health_check_interval (priv->conn_manager);
+}
+
+/**
+ * soup_session_get_n_stale_connections:
+ * @session: a #SoupSession
+ *
+ * Gets the number of idle connections of @session that were found
+ * closed by the server, or unresponsive, and discarded before being
+ * reused.
+ *
+ * Each of them is a request that would otherwise have failed, or
+ * have been sent again on a new connection.
+ *
+ * Returns: the number of stale connections discarded
+ *
+ * Since: 3.8
+ */
+guint64
+soup_session_get_n_stale_connections (SoupSession *session)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
+
+        priv = soup_session_get_instance_private (session);
+        return soup_connection_manager_get_n_stale_conns (priv->conn_manager);
+}
+
+/**
+ * soup_session_set_max_http2_conns_per_host: (attributes org.gtk.Method.set_property=max-http2-conns-per-host)
+ * @session: a #SoupSession
+ * @max_conns: the maximum number of HTTP/2 connections
+ *
+ * Set the maximum number of HTTP/2 connections @session opens to a
+ * single host.
+ *
+ * See [property@Session:max-http2-conns-per-host] for more information.
+ *
+ * Since: 3.8
+ */
+void
+soup_session_set_max_http2_conns_per_host (SoupSession *session,
+                                           guint        max_conns)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_if_fail (SOUP_IS_SESSION (session));
+        g_return_if_fail (max_conns > 0);
+
+        priv = soup_session_get_instance_private (session);
+        if (soup_connection_manager_get_max_http2_conns_per_host (priv->conn_manager) == max_conns)
+                return;
+
+        soup_connection_manager_set_max_http2_conns_per_host (priv->conn_manager, max_conns);
+        g_object_notify_by_pspec (G_OBJECT (session), properties[PROP_MAX_HTTP2_CONNS_PER_HOST]);
+}
+
+/**
+ * soup_session_get_max_http2_conns_per_host: (attributes org.gtk.Method.get_property=max-http2-conns-per-host)
+ * @session: a #SoupSession
+ *
+ * Get the maximum number of HTTP/2 connections @session opens to a
+ * single host.
+ *
+ * Returns: the maximum number of HTTP/2 connections per host
+ *
+ * Since: 3.8
+ */
+guint
+soup_session_get_max_http2_conns_per_host (SoupSession *session)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_SESSION (session), 1);
+
+        priv = soup_session_get_instance_private (session);
+        return soup_connection_manager_get_max_http2_conns_per_host (priv->conn_manager);
+}
+
 /**
  * soup_session_set_user_agent: (attributes org.gtk.Method.set_property=user-agent)
  * @session: a #SoupSession
@@ -1259,6 +1461,15 @@ misdirected_handler (SoupMessage *msg,
 {
 	SoupMessageQueueItem *item = user_data;
 	SoupSession *session = item->session;
+        SoupSessionPrivate *priv = soup_session_get_instance_private (session);
+        SoupConnection *conn;
+
+        /* Don't coalesce requests for this host on the connection again */
+        conn = soup_message_get_connection (msg);
+        if (conn) {
+                soup_connection_manager_set_misdirected (priv->conn_manager, conn, soup_message_get_uri (msg));
+                g_object_unref (conn);
+        }
 
         /* HTTP/2 messages may get the misdirected request status and MAY
          * try a new connection */
@@ -2455,6 +2666,80 @@ soup_session_class_init (SoupSessionClass *session_class)
 				   G_PARAM_READWRITE |
 				   G_PARAM_STATIC_STRINGS);
 
+        /**
+         * SoupSession:tcp-keepalive: (attributes org.gtk.Property.get=soup_session_get_tcp_keepalive org.gtk.Property.set=soup_session_set_tcp_keepalive)
+         *
+         * Time (in seconds) a connection has to be inactive before TCP
+         * keepalive probes are sent on it, or 0 to not enable TCP
+         * keepalive.
+         *
+         * Keepalive probes let the operating system notice peers that
+         * went away without closing the connection, and keep NAT and
+         * firewall mappings of idle connections alive. The connection is
+         * reset after three unanswered probes.
+         *
+         * Like [property@Session:idle-timeout], this only affects
+         * newly-created connections.
+         *
+         * Since: 3.8
+         */
+        properties[PROP_TCP_KEEPALIVE] =
+                g_param_spec_uint ("tcp-keepalive",
+                                   "TCP Keepalive",
+                                   "Inactivity time before sending TCP keepalive probes",
+                                   0, G_MAXUINT, 0,
+                                   G_PARAM_READWRITE |
+                                   G_PARAM_STATIC_STRINGS);
+
+        /**
+         * SoupSession:health-check-interval: (attributes org.gtk.Property.get=soup_session_get_health_check_interval org.gtk.Property.set=soup_session_set_health_check_interval)
+         *
+         * Interval (in seconds) at which idle connections are checked in
+         * the background, or 0 to only check them when they are about
+         * to be reused.
+         *
+         * Idle connections the server closed are discarded. Idle HTTP/2
+         * connections are also sent a PING frame, and discarded if
+         * nothing was received from the server by the next check.
+         *
+         * See [method@Session.get_n_stale_connections].
+         *
+         * Since: 3.8
+         */
+        properties[PROP_HEALTH_CHECK_INTERVAL] =
+                g_param_spec_uint ("health-check-interval",
+                                   "Health Check Interval",
+                                   "Interval at which idle connections are checked",
+                                   0, G_MAXUINT, 0,
+                                   G_PARAM_READWRITE |
+                                   G_PARAM_STATIC_STRINGS);
+
+        /**
+         * SoupSession:max-http2-conns-per-host: (attributes org.gtk.Property.get=soup_session_get_max_http2_conns_per_host org.gtk.Property.set=soup_session_set_max_http2_conns_per_host)
+         *
+         * The maximum number of HTTP/2 connections to open to a single
+         * host.
+         *
+         * Requests to a host are multiplexed on its least loaded HTTP/2
+         * connection. Another connection is only opened when all of them
+         * are saturated: the server's limit of concurrent streams is
+         * reached, or the connection-level flow control window is
+         * exhausted. Once this limit is reached, requests are queued on
+         * the least loaded connection instead.
+         *
+         * New connections also count against
+         * [property@Session:max-conns-per-host].
+         *
+         * Since: 3.8
+         */
+        properties[PROP_MAX_HTTP2_CONNS_PER_HOST] =
+                g_param_spec_uint ("max-http2-conns-per-host",
+                                   "Max HTTP/2 Connection Count Per Host",
+                                   "The maximum number of HTTP/2 connections that the session can open at once to a given host",
+                                   1, G_MAXUINT, 1,
+                                   G_PARAM_READWRITE |
+                                   G_PARAM_STATIC_STRINGS);
+
 	/**
 	 * SoupSession:tls-database: (attributes org.gtk.Property.get=soup_session_get_tls_database org.gtk.Property.set=soup_session_set_tls_database)
 	 *
@@ -3915,3 +4200,70 @@ soup_session_preconnect_finish (SoupSession  *session,
 
         return g_task_propagate_boolean (G_TASK (result), error);
 }
+
+/**
+ * soup_session_set_min_idle_connections:
+ * @session: a #SoupSession
+ * @uri: a #GUri of the origin
+ * @n_connections: the number of idle connections to keep, or 0
+ *
+ * Keeps at least @n_connections idle connections to the origin of @uri
+ * ready to be used.
+ *
+ * @session opens the connections in the background, including the TLS
+ * handshake for https, as with [method@Session.preconnect_async]. Idle
+ * connections that are closed by the server are replaced, and the ones
+ * about to be closed by [property@Session:idle-timeout] are replaced in
+ * advance, so that requests sent after a period of inactivity don't
+ * have to wait for a new connection. Connections are not dropped for
+ * staying unused after being opened, as other preconnected connections
+ * are. When opening a connection fails, it is retried with an
+ * increasing delay.
+ *
+ * The number of connections is limited by
+ * [property@Session:max-conns-per-host] and [property@Session:max-conns].
+ *
+ * Passing 0 as @n_connections removes the policy for the origin. The
+ * connections already open are then handled like any other.
+ *
+ * Since: 3.8
+ */
+void
+soup_session_set_min_idle_connections (SoupSession *session,
+                                       GUri        *uri,
+                                       guint        n_connections)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_if_fail (SOUP_IS_SESSION (session));
+        g_return_if_fail (SOUP_URI_IS_VALID (uri));
+        g_return_if_fail (soup_uri_is_http (uri) || soup_uri_is_https (uri));
+
+        priv = soup_session_get_instance_private (session);
+        soup_connection_manager_set_min_idle_conns (priv->conn_manager, uri, n_connections);
+}
+
+/**
+ * soup_session_get_min_idle_connections:
+ * @session: a #SoupSession
+ * @uri: a #GUri of the origin
+ *
+ * Gets the number of idle connections @session keeps ready for the
+ * origin of @uri. See [method@Session.set_min_idle_connections].
+ *
+ * Returns: the minimum number of idle connections, or 0
+ *
+ * Since: 3.8
+ */
+guint
+soup_session_get_min_idle_connections (SoupSession *session,
+                                       GUri        *uri)
+{
+        SoupSessionPrivate *priv;
+
+        g_return_val_if_fail (SOUP_IS_SESSION (session), 0);
+        g_return_val_if_fail (SOUP_URI_IS_VALID (uri), 0);
+
+        priv = soup_session_get_instance_private (session);
+        return soup_connection_manager_get_min_idle_conns (priv->conn_manager, uri);
+}
@@ -104,6 +104,30 @@ void                soup_session_set_idle_timeout         (SoupSession     *sess
 SOUP_AVAILABLE_IN_ALL
 guint               soup_session_get_idle_timeout         (SoupSession     *session);
 
+SOUP_AVAILABLE_IN_3_8
+void                soup_session_set_tcp_keepalive        (SoupSession     *session,
+                                                           guint            keepalive);
+
+SOUP_AVAILABLE_IN_3_8
+guint               soup_session_get_tcp_keepalive        (SoupSession     *session);
+
+SOUP_AVAILABLE_IN_3_8
+void                soup_session_set_health_check_interval (SoupSession    *session,
+                                                            guint           interval);
+
+SOUP_AVAILABLE_IN_3_8
+guint               soup_session_get_health_check_interval (SoupSession    *session);
+
+SOUP_AVAILABLE_IN_3_8
+guint64             soup_session_get_n_stale_connections  (SoupSession     *session);
+
+SOUP_AVAILABLE_IN_3_8
+void                soup_session_set_max_http2_conns_per_host (SoupSession *session,
+                                                               guint        max_conns);
+
+SOUP_AVAILABLE_IN_3_8
+guint               soup_session_get_max_http2_conns_per_host (SoupSession *session);
+
 SOUP_AVAILABLE_IN_ALL
 void                soup_session_set_user_agent           (SoupSession     *session,
 							   const char      *user_agent);
@@ -244,5 +268,13 @@ gboolean   soup_session_preconnect_finish (SoupSession        *session,
 					   GAsyncResult       *result,
 					   GError            **error);
 
+SOUP_AVAILABLE_IN_3_8
+void       soup_session_set_min_idle_connections (SoupSession *session,
+                                                  GUri        *uri,
+                                                  guint        n_connections);
+SOUP_AVAILABLE_IN_3_8
+guint      soup_session_get_min_idle_connections (SoupSession *session,
+                                                  GUri        *uri);
+
 
 G_END_DECLS
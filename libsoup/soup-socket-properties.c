@@ -14,7 +14,8 @@ SoupSocketProperties *
 soup_socket_properties_new (GInetSocketAddress *local_addr,
 			    GTlsInteraction    *tls_interaction,
 			    guint               io_timeout,
-			    guint               idle_timeout)
+			    guint               idle_timeout,
+			    guint               tcp_keepalive)
 {
 	SoupSocketProperties *props;
 
@@ -28,6 +29,7 @@ soup_socket_properties_new (GInetSocketAddress *local_addr,
 
 	props->io_timeout = io_timeout;
 	props->idle_timeout = idle_timeout;
+	props->tcp_keepalive = tcp_keepalive;
 
 	return props;
 }
@@ -19,6 +19,7 @@ typedef struct {
 
 	guint io_timeout;
 	guint idle_timeout;
+	guint tcp_keepalive;
 } SoupSocketProperties;
 
 GType soup_socket_properties_get_type (void);
@@ -27,7 +28,8 @@ GType soup_socket_properties_get_type (void);
 SoupSocketProperties *soup_socket_properties_new                (GInetSocketAddress   *local_addr,
 								 GTlsInteraction      *tls_interaction,
 								 guint                 io_timeout,
-								 guint                 idle_timeout);
+								 guint                 idle_timeout,
+								 guint                 tcp_keepalive);
 
 SoupSocketProperties *soup_socket_properties_ref                (SoupSocketProperties *props);
 void                  soup_socket_properties_unref              (SoupSocketProperties *props);
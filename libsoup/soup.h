@@ -18,6 +18,7 @@
 #include "cookies/soup-cookie-jar-db.h"
 #include "cookies/soup-cookie-jar-text.h"
 #include "soup-date-utils.h"
+#include "soup-dns-cache.h"
 #include "soup-enum-types.h"
 #include "soup-form.h"
 #include "soup-headers.h"
@@ -33,6 +34,7 @@
 #include "server/soup-auth-domain.h"
 #include "server/soup-auth-domain-basic.h"
 #include "server/soup-auth-domain-digest.h"
+#include "server/soup-content-encoder.h"
 #include "server/soup-server.h"
 #include "server/soup-server-message.h"
 #include "soup-session.h"
@@ -1866,6 +1866,252 @@ do_multiple_digest_algorithms (void)
 	soup_test_server_quit_unref (server);
 }
 
+typedef struct {
+        char *nonce;
+        char *last_nc;
+        gboolean send_nextnonce;
+        int n_nonces;
+        int n_challenges;
+        int n_authenticates;
+} NonceRotationData;
+
+static void
+nonce_rotation_new_nonce (NonceRotationData *data)
+{
+        g_free (data->nonce);
+        data->nonce = g_strdup_printf ("nonce%d", ++data->n_nonces);
+}
+
+static void
+nonce_rotation_server_callback (SoupServer        *server,
+                                SoupServerMessage *msg,
+                                const char        *path,
+                                GHashTable        *query,
+                                gpointer           user_data)
+{
+        NonceRotationData *data = user_data;
+        SoupMessageHeaders *response_headers;
+        const char *header;
+        GHashTable *params = NULL;
+        const char *nonce = NULL;
+        char *value;
+
+        response_headers = soup_server_message_get_response_headers (msg);
+        header = soup_message_headers_get_one (soup_server_message_get_request_headers (msg),
+                                               "Authorization");
+        if (header && g_str_has_prefix (header, "Digest ")) {
+                params = soup_header_parse_param_list (header + strlen ("Digest "));
+                nonce = g_hash_table_lookup (params, "nonce");
+                g_free (data->last_nc);
+                data->last_nc = g_strdup (g_hash_table_lookup (params, "nc"));
+        }
+
+        if (g_strcmp0 (nonce, data->nonce) == 0) {
+                if (data->send_nextnonce) {
+                        nonce_rotation_new_nonce (data);
+                        value = g_strdup_printf ("nextnonce=\"%s\"", data->nonce);
+                        soup_message_headers_append (response_headers,
+                                                     "Authentication-Info", value);
+                        g_free (value);
+                }
+                server_callback (server, msg, path, query, NULL);
+        } else {
+                value = g_strdup_printf ("Digest realm=\"rotate\", nonce=\"%s\", qop=\"auth\"%s",
+                                         data->nonce, nonce ? ", stale=true" : "");
+                soup_message_headers_append (response_headers,
+                                             "WWW-Authenticate", value);
+                g_free (value);
+                soup_server_message_set_status (msg, SOUP_STATUS_UNAUTHORIZED, NULL);
+                data->n_challenges++;
+        }
+
+        if (params)
+                soup_header_free_param_list (params);
+}
+
+static gboolean
+nonce_rotation_authenticate (SoupMessage *msg,
+                             SoupAuth    *auth,
+                             gboolean     retrying,
+                             gpointer     user_data)
+{
+        NonceRotationData *data = user_data;
+
+        data->n_authenticates++;
+        soup_auth_authenticate (auth, "user", "good");
+        return TRUE;
+}
+
+static void
+nonce_rotation_send (SoupSession       *session,
+                     GUri              *uri,
+                     NonceRotationData *data)
+{
+        SoupMessage *msg;
+
+        msg = soup_message_new_from_uri ("GET", uri);
+        g_signal_connect (msg, "authenticate",
+                          G_CALLBACK (nonce_rotation_authenticate), data);
+        soup_test_session_send_message (session, msg);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        g_object_unref (msg);
+}
+
+static void
+do_digest_nonce_rotation_test (void)
+{
+        SoupSession *session;
+        SoupServer *server;
+        NonceRotationData data = { 0, };
+        SoupMessage *msg;
+        GUri *uri;
+
+        server = soup_test_server_new (SOUP_TEST_SERVER_DEFAULT);
+        soup_server_add_handler (server, NULL,
+                                 nonce_rotation_server_callback, &data, NULL);
+        uri = soup_test_server_get_uri (server, "http", NULL);
+        session = soup_test_session_new (NULL);
+
+        nonce_rotation_new_nonce (&data);
+        nonce_rotation_send (session, uri, &data);
+        g_assert_cmpint (data.n_challenges, ==, 1);
+        g_assert_cmpint (data.n_authenticates, ==, 1);
+        g_assert_cmpstr (data.last_nc, ==, "00000001");
+
+        /* Known protection space: sent preemptively, nc keeps counting */
+        nonce_rotation_send (session, uri, &data);
+        g_assert_cmpint (data.n_challenges, ==, 1);
+        g_assert_cmpstr (data.last_nc, ==, "00000002");
+
+        /* A stale nonce costs one round trip, but the cached
+         * credentials are reused and the count restarts. The requeued
+         * message is authorized twice, but only handles the
+         * Authentication-Info of its response once.
+         */
+        nonce_rotation_new_nonce (&data);
+        msg = soup_message_new_from_uri ("GET", uri);
+        g_signal_connect (msg, "authenticate",
+                          G_CALLBACK (nonce_rotation_authenticate), &data);
+        soup_test_session_send_message (session, msg);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        g_assert_nonnull (soup_message_get_auth (msg));
+        g_assert_cmpuint (g_signal_handlers_disconnect_matched (msg, G_SIGNAL_MATCH_DATA,
+                                                                0, 0, NULL, NULL,
+                                                                soup_message_get_auth (msg)), ==, 1);
+        g_object_unref (msg);
+        g_assert_cmpint (data.n_challenges, ==, 2);
+        g_assert_cmpint (data.n_authenticates, ==, 1);
+        g_assert_cmpstr (data.last_nc, ==, "00000001");
+
+        /* With nextnonce, the following requests use the new nonce
+         * right away and never get challenged.
+         */
+        data.send_nextnonce = TRUE;
+        nonce_rotation_send (session, uri, &data);
+        g_assert_cmpstr (data.last_nc, ==, "00000002");
+        nonce_rotation_send (session, uri, &data);
+        g_assert_cmpstr (data.last_nc, ==, "00000001");
+        nonce_rotation_send (session, uri, &data);
+        g_assert_cmpstr (data.last_nc, ==, "00000001");
+        g_assert_cmpint (data.n_challenges, ==, 2);
+        g_assert_cmpint (data.n_authenticates, ==, 1);
+
+        soup_test_session_abort_unref (session);
+        g_uri_unref (uri);
+        soup_test_server_quit_unref (server);
+        g_free (data.nonce);
+        g_free (data.last_nc);
+}
+
+static gboolean
+preemptive_basic_authenticate (SoupMessage *msg,
+                               SoupAuth    *auth,
+                               gboolean     retrying,
+                               gpointer     user_data)
+{
+        int *n_authenticates = user_data;
+
+        (*n_authenticates)++;
+        soup_auth_authenticate (auth, "user", "good-basic");
+        return TRUE;
+}
+
+static void
+preemptive_basic_send (SoupSession *session,
+                       GUri        *uri,
+                       int         *n_authenticates)
+{
+        SoupMessage *msg;
+
+        msg = soup_message_new_from_uri ("GET", uri);
+        g_signal_connect (msg, "authenticate",
+                          G_CALLBACK (preemptive_basic_authenticate), n_authenticates);
+        soup_test_session_send_message (session, msg);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        g_object_unref (msg);
+}
+
+static void
+do_preemptive_basic_test (void)
+{
+        SoupSession *session;
+        SoupServer *server;
+        SoupAuthDomain *basic_auth_domain;
+        GUri *server_uri, *uri, *bad_uri;
+        int n_authenticates = 0;
+
+        server = soup_test_server_new (SOUP_TEST_SERVER_IN_THREAD);
+        soup_server_add_handler (server, NULL,
+                                 server_callback, NULL, NULL);
+        server_uri = soup_test_server_get_uri (server, "http", NULL);
+
+        basic_auth_domain = soup_auth_domain_basic_new (
+                "realm", "auth-test",
+                "auth-callback", server_basic_auth_callback,
+                NULL);
+        soup_auth_domain_add_path (basic_auth_domain, "/");
+        soup_server_add_auth_domain (server, basic_auth_domain);
+        g_object_unref (basic_auth_domain);
+
+        session = soup_test_session_new (NULL);
+
+        uri = g_uri_parse_relative (server_uri, "/dir/a", SOUP_HTTP_URI_FLAGS, NULL);
+        preemptive_basic_send (session, uri, &n_authenticates);
+        g_assert_cmpint (n_authenticates, ==, 1);
+        preemptive_basic_send (session, uri, &n_authenticates);
+        g_assert_cmpint (n_authenticates, ==, 1);
+        g_uri_unref (uri);
+
+        /* Inside the recorded protection space */
+        uri = g_uri_parse_relative (server_uri, "/dir/b/c", SOUP_HTTP_URI_FLAGS, NULL);
+        preemptive_basic_send (session, uri, &n_authenticates);
+        g_assert_cmpint (n_authenticates, ==, 1);
+        g_uri_unref (uri);
+
+        /* Outside of it */
+        uri = g_uri_parse_relative (server_uri, "/other", SOUP_HTTP_URI_FLAGS, NULL);
+        preemptive_basic_send (session, uri, &n_authenticates);
+        g_assert_cmpint (n_authenticates, ==, 2);
+        g_uri_unref (uri);
+
+        /* Credentials in the URI re-authenticate the recorded auth;
+         * the bad password must be sent instead of the previous
+         * Authorization value, and be corrected in the signal.
+         */
+        uri = g_uri_parse_relative (server_uri, "/dir/a", SOUP_HTTP_URI_FLAGS, NULL);
+        bad_uri = soup_uri_copy (uri, SOUP_URI_USER, "user", SOUP_URI_PASSWORD, "bad", SOUP_URI_NONE);
+        preemptive_basic_send (session, bad_uri, &n_authenticates);
+        g_assert_cmpint (n_authenticates, ==, 3);
+        preemptive_basic_send (session, uri, &n_authenticates);
+        g_assert_cmpint (n_authenticates, ==, 3);
+        g_uri_unref (bad_uri);
+        g_uri_unref (uri);
+
+        soup_test_session_abort_unref (session);
+        g_uri_unref (server_uri);
+        soup_test_server_quit_unref (server);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -1899,6 +2145,8 @@ main (int argc, char **argv)
 	g_test_add_func ("/auth/auth-uri", do_auth_uri_test);
         g_test_add_func ("/auth/cancel-request-on-authenticate", do_cancel_request_on_authenticate);
         g_test_add_func ("/auth/multiple-algorithms", do_multiple_digest_algorithms);
+        g_test_add_func ("/auth/digest-nonce-rotation", do_digest_nonce_rotation_test);
+        g_test_add_func ("/auth/preemptive-basic", do_preemptive_basic_test);
 
 	ret = g_test_run ();
 
@@ -4,6 +4,8 @@
  */
 
 #include "test-utils.h"
+#include "cache/soup-cache-private.h"
+#include "cache/soup-cache-input-stream.h"
 #include <glib/gstdio.h>
 
 static void
@@ -92,6 +94,14 @@ server_callback (SoupServer        *server,
 					     header);
 	}
 
+	header = soup_message_headers_get_one (request_headers,
+					       "Test-Set-Vary");
+	if (header) {
+		soup_message_headers_append (response_headers,
+					     "Vary",
+					     header);
+	}
+
 	if (status == SOUP_STATUS_OK) {
 		GChecksum *sum;
 		const char *body;
@@ -102,6 +112,9 @@ server_callback (SoupServer        *server,
 			g_checksum_update (sum, (guchar *)last_modified, strlen (last_modified));
 		if (etag)
 			g_checksum_update (sum, (guchar *)etag, strlen (etag));
+		header = soup_message_headers_get_one (request_headers, "Test-Variant");
+		if (header)
+			g_checksum_update (sum, (guchar *)header, strlen (header));
 		body = g_checksum_get_string (sum);
 		soup_server_message_set_response (msg, "text/plain",
 						  SOUP_MEMORY_COPY,
@@ -117,7 +130,8 @@ is_network_stream (GInputStream *stream)
 	while (G_IS_FILTER_INPUT_STREAM (stream))
 		stream = G_FILTER_INPUT_STREAM (stream)->base_stream;
 
-	return !G_IS_FILE_INPUT_STREAM (stream);
+	/* Responses in the memory tier of the cache are memory streams */
+	return !G_IS_FILE_INPUT_STREAM (stream) && !G_IS_MEMORY_INPUT_STREAM (stream);
 }
 
 static char *do_request (SoupSession        *session,
@@ -1088,6 +1102,574 @@ do_threads_test (gconstpointer data)
         g_free (cache_dir);
 }
 
+static void
+do_eviction_test_for_policy (GUri                    *base_uri,
+                             SoupCacheEvictionPolicy  policy)
+{
+        SoupSession *session;
+        SoupCache *cache;
+        char *cache_dir;
+        char *body;
+        char *path;
+        guint i;
+
+        cache_dir = g_dir_make_tmp ("cache-test-XXXXXX", NULL);
+        debug_printf (2, "  Caching to %s\n", cache_dir);
+        cache = g_object_new (SOUP_TYPE_CACHE,
+                              "cache-dir", cache_dir,
+                              "cache-type", SOUP_CACHE_SINGLE_USER,
+                              "eviction-policy", policy,
+                              NULL);
+        g_assert_cmpint (soup_cache_get_eviction_policy (cache), ==, policy);
+
+        /* Responses are 65 bytes long, so this holds exactly 10 of them */
+        soup_cache_set_max_size (cache, 650);
+        session = soup_test_session_new (NULL);
+        soup_session_add_feature (session, SOUP_SESSION_FEATURE (cache));
+
+        debug_printf (2, "  Filling the cache\n");
+        for (i = 1; i <= 10; i++) {
+                path = g_strdup_printf ("/evict/%u", i);
+                body = do_request (session, base_uri, "GET", path, NULL,
+                                   "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                                   NULL);
+                g_assert_true (last_request_hit_network);
+                g_free (body);
+                g_free (path);
+        }
+
+        debug_printf (2, "  Reusing the oldest resource\n");
+        body = do_request (session, base_uri, "GET", "/evict/1", NULL, NULL);
+        soup_test_assert (!last_request_hit_network,
+                          "Request for /evict/1 not filled from cache");
+        g_free (body);
+
+        /* The next insertion evicts the least recently used entry */
+        body = do_request (session, base_uri, "GET", "/evict/11", NULL,
+                           "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                           NULL);
+        g_free (body);
+        body = do_request (session, base_uri, "GET", "/evict/2", NULL, NULL);
+        soup_test_assert (last_request_hit_network,
+                          "Request for /evict/2 filled from cache");
+        g_free (body);
+
+        /* A scan of new resources as big as the cache flushes
+         * every entry with plain LRU, but entries that were
+         * reused survive it with segmented LRU.
+         */
+        debug_printf (2, "  Scanning new resources\n");
+        for (i = 12; i <= 21; i++) {
+                path = g_strdup_printf ("/evict/%u", i);
+                body = do_request (session, base_uri, "GET", path, NULL,
+                                   "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                                   NULL);
+                g_free (body);
+                g_free (path);
+        }
+
+        body = do_request (session, base_uri, "GET", "/evict/1", NULL, NULL);
+        if (policy == SOUP_CACHE_EVICTION_SEGMENTED_LRU)
+                soup_test_assert (!last_request_hit_network,
+                                  "Protected /evict/1 evicted by a scan");
+        else
+                soup_test_assert (last_request_hit_network,
+                                  "Least recently used /evict/1 not evicted");
+        g_free (body);
+
+        soup_test_session_abort_unref (session);
+        soup_cache_clear (cache);
+        g_rmdir (cache_dir);
+        g_object_unref (cache);
+        g_free (cache_dir);
+}
+
+static void
+do_eviction_test (gconstpointer data)
+{
+        GUri *base_uri = (GUri *)data;
+
+        debug_printf (1, "  LRU\n");
+        do_eviction_test_for_policy (base_uri, SOUP_CACHE_EVICTION_LRU);
+        debug_printf (1, "  Segmented LRU\n");
+        do_eviction_test_for_policy (base_uri, SOUP_CACHE_EVICTION_SEGMENTED_LRU);
+}
+
+static void
+do_memory_tier_test (gconstpointer data)
+{
+        GUri *base_uri = (GUri *)data;
+        SoupSession *session;
+        SoupCache *cache;
+        char *cache_dir;
+        char *body1, *cmp;
+        GDir *dir;
+        const char *name;
+
+        cache_dir = g_dir_make_tmp ("cache-test-XXXXXX", NULL);
+        debug_printf (2, "  Caching to %s\n", cache_dir);
+        cache = soup_cache_new (cache_dir, SOUP_CACHE_SINGLE_USER);
+        session = soup_test_session_new (NULL);
+        soup_session_add_feature (session, SOUP_SESSION_FEATURE (cache));
+
+        debug_printf (2, "  Initial request\n");
+        body1 = do_request (session, base_uri, "GET", "/1", NULL,
+                            "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                            NULL);
+        g_assert_true (last_request_hit_network);
+        g_assert_cmpuint (soup_cache_get_misses (cache, SOUP_CACHE_TIER_DISK), >=, 1);
+
+        /* Small entries are promoted to memory on their first hit */
+        debug_printf (2, "  Response served from disk\n");
+        cmp = do_request (session, base_uri, "GET", "/1", NULL, NULL);
+        soup_test_assert (!last_request_hit_network,
+                          "Request for /1 not filled from cache");
+        g_assert_cmpstr (body1, ==, cmp);
+        g_free (cmp);
+        g_assert_cmpuint (soup_cache_get_hits (cache, SOUP_CACHE_TIER_DISK), ==, 1);
+        g_assert_cmpuint (soup_cache_get_hits (cache, SOUP_CACHE_TIER_MEMORY), ==, 0);
+
+        /* Remove the cache files to ensure no file I/O happens */
+        dir = g_dir_open (cache_dir, 0, NULL);
+        while ((name = g_dir_read_name (dir))) {
+                char *path;
+
+                if (g_str_has_prefix (name, "soup."))
+                        continue;
+
+                path = g_build_filename (cache_dir, name, NULL);
+                g_unlink (path);
+                g_free (path);
+        }
+        g_dir_close (dir);
+
+        debug_printf (2, "  Response served from memory\n");
+        cmp = do_request (session, base_uri, "GET", "/1", NULL, NULL);
+        soup_test_assert (!last_request_hit_network,
+                          "Request for /1 not filled from cache");
+        g_assert_cmpstr (body1, ==, cmp);
+        g_free (cmp);
+        g_assert_cmpuint (soup_cache_get_hits (cache, SOUP_CACHE_TIER_DISK), ==, 1);
+        g_assert_cmpuint (soup_cache_get_hits (cache, SOUP_CACHE_TIER_MEMORY), ==, 1);
+        g_assert_cmpuint (soup_cache_get_misses (cache, SOUP_CACHE_TIER_MEMORY), >=, 2);
+
+        /* Entries bigger than the memory budget are only served from disk */
+        debug_printf (2, "  Memory tier too small\n");
+        soup_cache_set_max_memory_size (cache, 64);
+        g_assert_cmpuint (soup_cache_get_max_memory_size (cache), ==, 64);
+        g_free (do_request (session, base_uri, "GET", "/2", NULL,
+                            "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                            NULL));
+        g_free (do_request (session, base_uri, "GET", "/2", NULL, NULL));
+        g_free (do_request (session, base_uri, "GET", "/2", NULL, NULL));
+        soup_test_assert (!last_request_hit_network,
+                          "Request for /2 not filled from cache");
+        g_assert_cmpuint (soup_cache_get_hits (cache, SOUP_CACHE_TIER_DISK), ==, 3);
+        g_assert_cmpuint (soup_cache_get_hits (cache, SOUP_CACHE_TIER_MEMORY), ==, 1);
+
+        soup_test_session_abort_unref (session);
+        soup_cache_clear (cache);
+        g_rmdir (cache_dir);
+        g_object_unref (cache);
+        g_free (cache_dir);
+        g_free (body1);
+}
+
+static void
+do_vary_test (gconstpointer data)
+{
+        GUri *base_uri = (GUri *)data;
+        SoupSession *session;
+        SoupCache *cache;
+        char *cache_dir;
+        char *body_a, *body_b, *cmp;
+
+        cache_dir = g_dir_make_tmp ("cache-test-XXXXXX", NULL);
+        debug_printf (2, "  Caching to %s\n", cache_dir);
+        cache = soup_cache_new (cache_dir, SOUP_CACHE_SINGLE_USER);
+        session = soup_test_session_new (NULL);
+        soup_session_add_feature (session, SOUP_SESSION_FEATURE (cache));
+
+        debug_printf (2, "  Initial requests\n");
+        body_a = do_request (session, base_uri, "GET", "/vary", NULL,
+                             "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                             "Test-Set-Vary", "Test-Variant",
+                             "Test-Variant", "a",
+                             NULL);
+        g_assert_true (last_request_hit_network);
+        body_b = do_request (session, base_uri, "GET", "/vary", NULL,
+                             "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                             "Test-Set-Vary", "Test-Variant",
+                             "Test-Variant", "b",
+                             NULL);
+        soup_test_assert (last_request_hit_network,
+                          "Request for variant b filled from variant a");
+        g_assert_cmpstr (body_a, !=, body_b);
+
+        /* Both variants are kept */
+        debug_printf (2, "  Cached variants\n");
+        cmp = do_request (session, base_uri, "GET", "/vary", NULL,
+                          "Test-Variant", "a",
+                          NULL);
+        soup_test_assert (!last_request_hit_network,
+                          "Request for variant a not filled from cache");
+        g_assert_cmpstr (body_a, ==, cmp);
+        g_free (cmp);
+        cmp = do_request (session, base_uri, "GET", "/vary", NULL,
+                          "Test-Variant", "b",
+                          NULL);
+        soup_test_assert (!last_request_hit_network,
+                          "Request for variant b not filled from cache");
+        g_assert_cmpstr (body_b, ==, cmp);
+        g_free (cmp);
+
+        /* A missing header is a different variant too */
+        cmp = do_request (session, base_uri, "GET", "/vary", NULL, NULL);
+        soup_test_assert (last_request_hit_network,
+                          "Request without Test-Variant filled from cache");
+        g_free (cmp);
+
+        /* Vary: * never matches */
+        debug_printf (2, "  Vary: *\n");
+        cmp = do_request (session, base_uri, "GET", "/vary-any", NULL,
+                          "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                          "Test-Set-Vary", "*",
+                          NULL);
+        g_free (cmp);
+        cmp = do_request (session, base_uri, "GET", "/vary-any", NULL, NULL);
+        soup_test_assert (last_request_hit_network,
+                          "Request for /vary-any filled from cache");
+        g_free (cmp);
+
+        /* Variants survive dumping and loading the cache */
+        debug_printf (2, "  Dumping and loading the cache\n");
+        soup_cache_dump (cache);
+        soup_test_session_abort_unref (session);
+        g_object_unref (cache);
+
+        cache = soup_cache_new (cache_dir, SOUP_CACHE_SINGLE_USER);
+        soup_cache_load (cache);
+        session = soup_test_session_new (NULL);
+        soup_session_add_feature (session, SOUP_SESSION_FEATURE (cache));
+
+        cmp = do_request (session, base_uri, "GET", "/vary", NULL,
+                          "Test-Variant", "b",
+                          NULL);
+        soup_test_assert (!last_request_hit_network,
+                          "Request for variant b not filled from loaded cache");
+        g_assert_cmpstr (body_b, ==, cmp);
+        g_free (cmp);
+
+        soup_test_session_abort_unref (session);
+        soup_cache_clear (cache);
+        g_rmdir (cache_dir);
+        g_object_unref (cache);
+        g_free (cache_dir);
+        g_free (body_a);
+        g_free (body_b);
+}
+
+#define CONCURRENT_HITS_N_THREADS 8
+#define CONCURRENT_HITS_N_RESOURCES 64
+
+typedef struct {
+        SoupCache *cache;
+        SoupMessage *msgs[CONCURRENT_HITS_N_RESOURCES];
+        guint n_iterations;
+        guint n_fresh;
+} ConcurrentHitsThread;
+
+static gpointer
+concurrent_hits_thread_func (ConcurrentHitsThread *thread)
+{
+        guint i;
+
+        for (i = 0; i < thread->n_iterations; i++) {
+                SoupMessage *msg = thread->msgs[i % CONCURRENT_HITS_N_RESOURCES];
+
+                if (soup_cache_has_response (thread->cache, msg) == SOUP_CACHE_RESPONSE_FRESH)
+                        thread->n_fresh++;
+        }
+
+        return NULL;
+}
+
+static void
+do_concurrent_hits_test (gconstpointer data)
+{
+        GUri *base_uri = (GUri *)data;
+        SoupSession *session;
+        SoupCache *cache;
+        char *cache_dir;
+        ConcurrentHitsThread threads[CONCURRENT_HITS_N_THREADS];
+        GThread *thread_ids[CONCURRENT_HITS_N_THREADS];
+        guint n_iterations;
+        gint64 start, elapsed;
+        guint i, j;
+
+        cache_dir = g_dir_make_tmp ("cache-test-XXXXXX", NULL);
+        debug_printf (2, "  Caching to %s\n", cache_dir);
+        cache = soup_cache_new (cache_dir, SOUP_CACHE_SINGLE_USER);
+        session = soup_test_session_new (NULL);
+        soup_session_add_feature (session, SOUP_SESSION_FEATURE (cache));
+
+        for (i = 0; i < CONCURRENT_HITS_N_RESOURCES; i++) {
+                char *path, *body;
+
+                path = g_strdup_printf ("/hits/%u", i);
+                body = do_request (session, base_uri, "GET", path, NULL,
+                                   "Test-Set-Expires", "Fri, 01 Jan 2100 00:00:00 GMT",
+                                   NULL);
+                g_free (body);
+                g_free (path);
+        }
+
+        n_iterations = g_test_perf () ? 1000000 : 1000;
+        for (i = 0; i < CONCURRENT_HITS_N_THREADS; i++) {
+                threads[i].cache = cache;
+                threads[i].n_iterations = n_iterations;
+                threads[i].n_fresh = 0;
+                for (j = 0; j < CONCURRENT_HITS_N_RESOURCES; j++) {
+                        char *path;
+                        GUri *uri;
+
+                        path = g_strdup_printf ("/hits/%u", j);
+                        uri = g_uri_parse_relative (base_uri, path, SOUP_HTTP_URI_FLAGS, NULL);
+                        threads[i].msgs[j] = soup_message_new_from_uri ("GET", uri);
+                        g_uri_unref (uri);
+                        g_free (path);
+                }
+        }
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < CONCURRENT_HITS_N_THREADS; i++)
+                thread_ids[i] = g_thread_new ("cache-hits", (GThreadFunc)concurrent_hits_thread_func, &threads[i]);
+        for (i = 0; i < CONCURRENT_HITS_N_THREADS; i++)
+                g_thread_join (thread_ids[i]);
+        elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+        for (i = 0; i < CONCURRENT_HITS_N_THREADS; i++) {
+                g_assert_cmpuint (threads[i].n_fresh, ==, n_iterations);
+                for (j = 0; j < CONCURRENT_HITS_N_RESOURCES; j++)
+                        g_object_unref (threads[i].msgs[j]);
+        }
+
+        if (g_test_perf ()) {
+                g_test_maximized_result ((double)CONCURRENT_HITS_N_THREADS * n_iterations * G_USEC_PER_SEC / elapsed,
+                                         "%d threads: %.0f hits/s", CONCURRENT_HITS_N_THREADS,
+                                         (double)CONCURRENT_HITS_N_THREADS * n_iterations * G_USEC_PER_SEC / elapsed);
+        }
+
+        soup_test_session_abort_unref (session);
+        soup_cache_clear (cache);
+        g_rmdir (cache_dir);
+        g_object_unref (cache);
+        g_free (cache_dir);
+}
+
+typedef struct {
+        gboolean finished;
+        gsize bytes_written;
+        GError *error;
+} CachingResult;
+
+static void
+caching_finished (SoupCacheInputStream *istream,
+                  int                   bytes_written,
+                  GError               *error,
+                  CachingResult        *result)
+{
+        result->finished = TRUE;
+        result->bytes_written = bytes_written;
+        result->error = error ? g_error_copy (error) : NULL;
+}
+
+static GInputStream *
+cache_input_stream_new (GBytes        *data,
+                        GFile         *file,
+                        gint          *write_budget,
+                        CachingResult *result)
+{
+        GInputStream *base_stream, *istream;
+
+        base_stream = g_memory_input_stream_new_from_bytes (data);
+        istream = soup_cache_input_stream_new (base_stream, file, write_budget);
+        g_object_unref (base_stream);
+        g_signal_connect (istream, "caching-finished",
+                          G_CALLBACK (caching_finished), result);
+
+        return istream;
+}
+
+/* Reads @size bytes of @istream, one small chunk at a time as they
+ * would come from the network, and checks they are @data at @offset.
+ */
+static void
+read_in_chunks (GInputStream *istream,
+                GBytes       *data,
+                gsize         offset,
+                gsize         size)
+{
+        const guchar *expected = g_bytes_get_data (data, NULL);
+        guchar buffer[1024];
+        gsize total = 0;
+        GError *error = NULL;
+
+        while (total < size) {
+                gssize nread;
+
+                nread = g_input_stream_read (istream, buffer, MIN (sizeof (buffer), size - total), NULL, &error);
+                g_assert_no_error (error);
+                g_assert_cmpint (nread, >, 0);
+                g_assert_cmpmem (buffer, nread, expected + offset + total, nread);
+                total += nread;
+        }
+}
+
+static void
+read_to_end (GInputStream *istream)
+{
+        guchar buffer[1024];
+        GError *error = NULL;
+
+        g_assert_cmpint (g_input_stream_read (istream, buffer, sizeof (buffer), NULL, &error), ==, 0);
+        g_assert_no_error (error);
+}
+
+static gboolean
+timeout_cb (gboolean *timeout)
+{
+        *timeout = TRUE;
+        return G_SOURCE_REMOVE;
+}
+
+static void
+iterate_for (guint msec)
+{
+        gboolean timeout = FALSE;
+
+        g_timeout_add (msec, (GSourceFunc)timeout_cb, &timeout);
+        while (!timeout)
+                g_main_context_iteration (NULL, TRUE);
+}
+
+static GBytes *
+create_test_data (gsize size)
+{
+        guchar *data;
+        gsize i;
+
+        data = g_malloc (size);
+        for (i = 0; i < size; i++)
+                data[i] = i % 251;
+
+        return g_bytes_new_take (data, size);
+}
+
+#define WRITE_BUDGET (1024 * 1024)
+
+static void
+do_write_coalescing_test (void)
+{
+        char *cache_dir, *path, *contents;
+        gsize length;
+        GFile *file;
+        GBytes *data;
+        GInputStream *istream;
+        CachingResult result = { FALSE, 0, NULL };
+        gint write_budget = WRITE_BUDGET;
+
+        cache_dir = g_dir_make_tmp ("cache-test-XXXXXX", NULL);
+        path = g_build_filename (cache_dir, "entry", NULL);
+        file = g_file_new_for_path (path);
+        data = create_test_data (200 * 1024);
+
+        istream = cache_input_stream_new (data, file, &write_budget, &result);
+
+        /* Small reads are not written one by one... */
+        read_in_chunks (istream, data, 0, 16 * 1024);
+        iterate_for (100);
+        g_assert_cmpint (write_budget, ==, WRITE_BUDGET - 16 * 1024);
+        g_assert_false (result.finished);
+
+        /* ...but merged until there is enough to write */
+        read_in_chunks (istream, data, 16 * 1024, 64 * 1024);
+        while (write_budget != WRITE_BUDGET)
+                g_main_context_iteration (NULL, TRUE);
+
+        read_in_chunks (istream, data, 80 * 1024, 120 * 1024);
+        read_to_end (istream);
+        while (!result.finished)
+                g_main_context_iteration (NULL, TRUE);
+
+        g_assert_no_error (result.error);
+        g_assert_cmpuint (result.bytes_written, ==, g_bytes_get_size (data));
+        g_assert_cmpint (write_budget, ==, WRITE_BUDGET);
+
+        g_object_unref (istream);
+
+        g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+        g_assert_cmpmem (contents, length, g_bytes_get_data (data, NULL), g_bytes_get_size (data));
+        g_free (contents);
+
+        g_unlink (path);
+        g_rmdir (cache_dir);
+        g_bytes_unref (data);
+        g_object_unref (file);
+        g_free (path);
+        g_free (cache_dir);
+}
+
+static void
+do_pending_writes_bound_test (void)
+{
+        char *cache_dir, *path;
+        GFile *file;
+        GBytes *data;
+        GInputStream *istream;
+        CachingResult result = { FALSE, 0, NULL };
+        gint write_budget = 16 * 1024;
+
+        cache_dir = g_dir_make_tmp ("cache-test-XXXXXX", NULL);
+        path = g_build_filename (cache_dir, "entry", NULL);
+        file = g_file_new_for_path (path);
+        data = create_test_data (64 * 1024);
+
+        /* Reading more than the budget without giving the writes a chance
+         * to run drops the caching, but not the data read.
+         */
+        istream = cache_input_stream_new (data, file, &write_budget, &result);
+        read_in_chunks (istream, data, 0, g_bytes_get_size (data));
+        read_to_end (istream);
+        while (!result.finished)
+                g_main_context_iteration (NULL, TRUE);
+
+        g_assert_error (result.error, G_IO_ERROR, G_IO_ERROR_NO_SPACE);
+        g_clear_error (&result.error);
+        g_assert_cmpint (write_budget, ==, 16 * 1024);
+        g_object_unref (istream);
+        g_unlink (path);
+
+        /* The budget is available again for the next resources */
+        memset (&result, 0, sizeof (result));
+        istream = cache_input_stream_new (data, file, &write_budget, &result);
+        read_in_chunks (istream, data, 0, 8 * 1024);
+        g_assert_cmpint (write_budget, ==, 8 * 1024);
+        g_input_stream_close (istream, NULL, NULL);
+        while (!result.finished)
+                g_main_context_iteration (NULL, TRUE);
+        g_clear_error (&result.error);
+        g_assert_cmpint (write_budget, ==, 16 * 1024);
+        g_object_unref (istream);
+
+        g_unlink (path);
+        g_rmdir (cache_dir);
+        g_bytes_unref (data);
+        g_object_unref (file);
+        g_free (path);
+        g_free (cache_dir);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -1108,6 +1690,12 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/cache/leaks", base_uri, do_leaks_test);
         g_test_add_data_func ("/cache/metrics", base_uri, do_metrics_test);
         g_test_add_data_func ("/cache/threads", base_uri, do_threads_test);
+        g_test_add_data_func ("/cache/eviction", base_uri, do_eviction_test);
+        g_test_add_data_func ("/cache/concurrent-hits", base_uri, do_concurrent_hits_test);
+        g_test_add_data_func ("/cache/memory-tier", base_uri, do_memory_tier_test);
+        g_test_add_data_func ("/cache/vary", base_uri, do_vary_test);
+        g_test_add_func ("/cache/write-coalescing", do_write_coalescing_test);
+        g_test_add_func ("/cache/pending-writes-bound", do_pending_writes_bound_test);
 
 	ret = g_test_run ();
 
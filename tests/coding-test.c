@@ -5,10 +5,71 @@
  */
 
 #include "test-utils.h"
+#include "soup-content-processor.h"
+#include "soup-converter-wrapper.h"
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#include "soup-zstd-decompressor.h"
+#endif
 
 static SoupServer *server;
 static GUri *base_uri;
 
+#ifdef WITH_ZSTD
+/* Compresses @plain as @n_frames concatenated frames. With a
+ * @window_log the frames declare that window, whatever their size.
+ */
+static GBytes *
+zstd_compress (GBytes *plain,
+	       guint   n_frames,
+	       int     window_log)
+{
+	ZSTD_CCtx *cctx;
+	GByteArray *compressed;
+	const guint8 *data;
+	gsize size, frame_size, offset = 0;
+	guint8 buffer[16384];
+	guint i;
+
+	cctx = ZSTD_createCCtx ();
+	if (window_log)
+		ZSTD_CCtx_setParameter (cctx, ZSTD_c_windowLog, window_log);
+	ZSTD_CCtx_setParameter (cctx, ZSTD_c_checksumFlag, 1);
+
+	compressed = g_byte_array_new ();
+	data = g_bytes_get_data (plain, &size);
+	frame_size = size / n_frames + 1;
+	for (i = 0; i < n_frames; i++) {
+		ZSTD_inBuffer input = { data + offset, MIN (frame_size, size - offset), 0 };
+		size_t remaining;
+
+		/* Feeding the data before ending the frame keeps the
+		 * content size unknown, so the window is not shrunk.
+		 */
+		while (input.pos < input.size) {
+			ZSTD_outBuffer output = { buffer, sizeof (buffer), 0 };
+
+			remaining = ZSTD_compressStream2 (cctx, &output, &input, ZSTD_e_continue);
+			g_assert_false (ZSTD_isError (remaining));
+			g_byte_array_append (compressed, buffer, output.pos);
+		}
+		do {
+			ZSTD_outBuffer output = { buffer, sizeof (buffer), 0 };
+
+			remaining = ZSTD_compressStream2 (cctx, &output, &input, ZSTD_e_end);
+			g_assert_false (ZSTD_isError (remaining));
+			g_byte_array_append (compressed, buffer, output.pos);
+		} while (remaining != 0);
+
+		offset += input.size;
+	}
+
+	ZSTD_freeCCtx (cctx);
+	return g_byte_array_free_to_bytes (compressed);
+}
+#endif
+
 static void
 server_callback (SoupServer        *server,
 		 SoupServerMessage *msg,
@@ -38,7 +99,25 @@ server_callback (SoupServer        *server,
 
 	response_headers = soup_server_message_get_response_headers (msg);
 
-	if (codings) {
+#ifdef WITH_ZSTD
+	if (codings && soup_header_contains (options, "prefer-zstd") &&
+	    g_slist_find_custom (codings, "zstd", (GCompareFunc)g_ascii_strcasecmp)) {
+		GBytes *plain;
+
+		plain = soup_test_load_resource (path, NULL);
+		if (plain) {
+			response = zstd_compress (plain,
+						  soup_header_contains (options, "zstd-multi-frame") ? 3 : 1,
+						  0);
+			g_bytes_unref (plain);
+			soup_message_headers_append (response_headers,
+						     "Content-Encoding",
+						     "zstd");
+		}
+	}
+#endif
+
+	if (codings && !response) {
 		gboolean claim_deflate, claim_gzip;
 		const char *extension = NULL, *encoding = NULL;
 
@@ -93,6 +172,8 @@ server_callback (SoupServer        *server,
 		if (soup_header_contains (options, "prefer-deflate-zlib") ||
 		    soup_header_contains (options, "prefer-deflate-raw"))
 			encoding = "deflate";
+		else if (soup_header_contains (options, "prefer-zstd"))
+			encoding = "zstd";
 
 		soup_message_headers_replace (response_headers,
 					      "Content-Encoding",
@@ -125,6 +206,79 @@ server_callback (SoupServer        *server,
 	soup_message_body_complete (response_body);
 }
 
+/* Decodes the request body according to its Content-Encoding and
+ * echoes it back.
+ */
+static void
+upload_callback (SoupServer        *server,
+		 SoupServerMessage *msg,
+		 const char        *path,
+		 GHashTable        *query,
+		 gpointer           data)
+{
+	SoupMessageHeaders *request_headers, *response_headers;
+	GConverter *decoder = NULL;
+	GInputStream *raw, *decoded;
+	GOutputStream *output;
+	const char *coding;
+	GBytes *body;
+
+	request_headers = soup_server_message_get_request_headers (msg);
+	response_headers = soup_server_message_get_response_headers (msg);
+
+	coding = soup_message_headers_get_one (request_headers, "Content-Encoding");
+	if (!coding)
+		coding = "identity";
+	else if (!g_ascii_strcasecmp (coding, "gzip"))
+		decoder = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+	else if (!g_ascii_strcasecmp (coding, "deflate"))
+		decoder = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+#ifdef WITH_ZSTD
+	else if (!g_ascii_strcasecmp (coding, "zstd"))
+		decoder = G_CONVERTER (soup_zstd_decompressor_new ());
+#endif
+	else {
+		soup_server_message_set_status (msg, SOUP_STATUS_UNSUPPORTED_MEDIA_TYPE, NULL);
+		return;
+	}
+
+	body = soup_message_body_flatten (soup_server_message_get_request_body (msg));
+	if (decoder) {
+		raw = g_memory_input_stream_new_from_bytes (body);
+		decoded = g_converter_input_stream_new (raw, decoder);
+		output = g_memory_output_stream_new_resizable ();
+		g_bytes_unref (body);
+		if (g_output_stream_splice (output, decoded,
+					    G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+					    G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+					    NULL, NULL) == -1)
+			body = NULL;
+		else
+			body = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output));
+		g_object_unref (output);
+		g_object_unref (decoded);
+		g_object_unref (raw);
+		g_object_unref (decoder);
+
+		if (!body) {
+			soup_server_message_set_status (msg, SOUP_STATUS_BAD_REQUEST, NULL);
+			return;
+		}
+	}
+
+	soup_message_headers_append (response_headers, "X-Request-Encoding", coding);
+	if (soup_message_headers_get_encoding (request_headers) == SOUP_ENCODING_CHUNKED)
+		soup_message_headers_append (response_headers, "X-Request-Chunked", "yes");
+
+	if (soup_message_headers_header_contains (request_headers, "X-Test-Options", "http-1.0"))
+		soup_server_message_set_http_version (msg, SOUP_HTTP_1_0);
+
+	soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response (msg, "text/plain", SOUP_MEMORY_COPY,
+					  g_bytes_get_data (body, NULL), g_bytes_get_size (body));
+	g_bytes_unref (body);
+}
+
 typedef struct {
 	SoupSession *session;
 	SoupMessage *msg;
@@ -343,6 +497,592 @@ do_coding_msg_empty_test (CodingTestData *data, gconstpointer test_data)
 	g_bytes_unref (body);
 }
 
+static void
+check_request_coding (CodingTestData *data, const char *coding)
+{
+	SoupMessage *msg;
+	SoupMessageHeaders *response_headers;
+	SoupMessageMetrics *metrics;
+	GInputStream *stream;
+	GUri *uri;
+	GBytes *body;
+
+	uri = g_uri_parse_relative (base_uri, "/upload", SOUP_HTTP_URI_FLAGS, NULL);
+	msg = soup_message_new_from_uri ("POST", uri);
+	g_uri_unref (uri);
+
+	/* The length is unknown, like that of a generated upload */
+	stream = g_memory_input_stream_new_from_bytes (data->response);
+	soup_message_set_request_body (msg, "text/plain", stream, -1);
+	g_object_unref (stream);
+	soup_message_set_request_body_encoding (msg, coding);
+	soup_message_add_flags (msg, SOUP_MESSAGE_COLLECT_METRICS);
+
+	body = soup_session_send_and_read (data->session, msg, NULL, NULL);
+	soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+	g_assert_true (g_bytes_equal (body, data->response));
+
+	response_headers = soup_message_get_response_headers (msg);
+	g_assert_cmpstr (soup_message_headers_get_one (response_headers, "X-Request-Encoding"), ==, coding);
+	g_assert_cmpstr (soup_message_headers_get_one (response_headers, "X-Request-Chunked"), ==, "yes");
+
+	metrics = soup_message_get_metrics (msg);
+	g_assert_nonnull (metrics);
+	g_assert_cmpuint (soup_message_metrics_get_request_body_size (metrics), ==, g_bytes_get_size (data->response));
+	g_assert_cmpuint (soup_message_metrics_get_request_body_bytes_sent (metrics), <, soup_message_metrics_get_request_body_size (metrics));
+
+	g_bytes_unref (body);
+	g_object_unref (msg);
+}
+
+static void
+do_coding_request_test_gzip (CodingTestData *data, gconstpointer test_data)
+{
+	check_request_coding (data, "gzip");
+}
+
+static void
+do_coding_request_test_deflate (CodingTestData *data, gconstpointer test_data)
+{
+	check_request_coding (data, "deflate");
+}
+
+static GBytes *
+zlib_compress (GBytes                *plain,
+	       GZlibCompressorFormat  format)
+{
+	GConverter *compressor;
+	GOutputStream *output, *converted;
+	GBytes *compressed;
+	GError *error = NULL;
+
+	compressor = G_CONVERTER (g_zlib_compressor_new (format, -1));
+	output = g_memory_output_stream_new_resizable ();
+	converted = g_converter_output_stream_new (output, compressor);
+	g_output_stream_write_all (converted,
+				   g_bytes_get_data (plain, NULL),
+				   g_bytes_get_size (plain),
+				   NULL, NULL, &error);
+	g_assert_no_error (error);
+	g_output_stream_close (converted, NULL, &error);
+	g_assert_no_error (error);
+	compressed = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output));
+	g_object_unref (converted);
+	g_object_unref (output);
+	g_object_unref (compressor);
+
+	return compressed;
+}
+
+static void
+do_coding_request_precompressed_test (CodingTestData *data, gconstpointer test_data)
+{
+	SoupMessage *msg;
+	GBytes *compressed, *body;
+	GUri *uri;
+
+	compressed = zlib_compress (data->response, G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
+
+	uri = g_uri_parse_relative (base_uri, "/upload", SOUP_HTTP_URI_FLAGS, NULL);
+	msg = soup_message_new_from_uri ("POST", uri);
+	g_uri_unref (uri);
+
+	/* A body the caller compressed already is not compressed again */
+	soup_message_headers_append (soup_message_get_request_headers (msg),
+				     "Content-Encoding", "deflate");
+	soup_message_set_request_body_from_bytes (msg, "text/plain", compressed);
+	soup_message_set_request_body_encoding (msg, "gzip");
+
+	body = soup_session_send_and_read (data->session, msg, NULL, NULL);
+	soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+	g_assert_true (g_bytes_equal (body, data->response));
+	g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (msg), "X-Request-Encoding"), ==, "deflate");
+	g_assert_null (soup_message_headers_get_one (soup_message_get_response_headers (msg), "X-Request-Chunked"));
+
+	g_bytes_unref (body);
+	g_bytes_unref (compressed);
+	g_object_unref (msg);
+}
+
+static void
+do_coding_request_http_1_0_test (CodingTestData *data, gconstpointer test_data)
+{
+	SoupMessage *msg;
+	SoupMessageHeaders *response_headers;
+	GBytes *body;
+	GUri *uri;
+	int i;
+
+	uri = g_uri_parse_relative (base_uri, "/upload", SOUP_HTTP_URI_FLAGS, NULL);
+
+	/* Until the server has answered with HTTP/1.0 its version is
+	 * unknown, but from then on bodies are not compressed, even on
+	 * new connections.
+	 */
+	for (i = 0; i < 2; i++) {
+		msg = soup_message_new_from_uri ("POST", uri);
+		soup_message_headers_append (soup_message_get_request_headers (msg),
+					     "X-Test-Options", "http-1.0");
+		soup_message_set_request_body_from_bytes (msg, "text/plain", data->response);
+		soup_message_set_request_body_encoding (msg, "gzip");
+
+		body = soup_session_send_and_read (data->session, msg, NULL, NULL);
+		soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+		g_assert_cmpuint (soup_message_get_http_version (msg), ==, SOUP_HTTP_1_0);
+		g_assert_true (g_bytes_equal (body, data->response));
+
+		response_headers = soup_message_get_response_headers (msg);
+		if (i == 0) {
+			g_assert_cmpstr (soup_message_headers_get_one (response_headers, "X-Request-Encoding"), ==, "gzip");
+		} else {
+			g_assert_cmpstr (soup_message_headers_get_one (response_headers, "X-Request-Encoding"), ==, "identity");
+			g_assert_null (soup_message_headers_get_one (response_headers, "X-Request-Chunked"));
+		}
+
+		g_bytes_unref (body);
+		g_object_unref (msg);
+	}
+
+	g_uri_unref (uri);
+}
+
+static GInputStream *
+wrap_response (SoupContentProcessor *processor,
+	       SoupMessage          *msg,
+	       GBytes               *compressed)
+{
+	GInputStream *raw, *stream;
+	GError *error = NULL;
+
+	raw = g_memory_input_stream_new_from_bytes (compressed);
+	stream = soup_content_processor_wrap_input (processor, raw, msg, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (stream);
+	g_object_unref (raw);
+
+	return stream;
+}
+
+static GBytes *
+read_all (GInputStream *stream)
+{
+	GOutputStream *output;
+	GBytes *bytes;
+	GError *error = NULL;
+
+	output = g_memory_output_stream_new_resizable ();
+	g_output_stream_splice (output, stream,
+				G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+				G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+				NULL, &error);
+	g_assert_no_error (error);
+	bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output));
+	g_object_unref (output);
+
+	return bytes;
+}
+
+/* Returns the decoder behind the SoupConverterWrapper of @stream */
+static GConverter *
+get_decoder (GInputStream *stream)
+{
+	GConverter *decoder;
+
+	g_object_get (g_converter_input_stream_get_converter (G_CONVERTER_INPUT_STREAM (stream)),
+		      "base-converter", &decoder,
+		      NULL);
+	g_object_unref (decoder);
+
+	return decoder;
+}
+
+static void
+do_decoder_pool_test (void)
+{
+	SoupContentProcessor *processor;
+	SoupMessage *msg;
+	GInputStream *stream, *other;
+	GConverter *first;
+	GBytes *plain, *compressed, *body;
+	int i;
+
+	processor = g_object_new (SOUP_TYPE_CONTENT_DECODER, NULL);
+	msg = soup_message_new ("GET", "http://127.0.0.1/");
+	soup_message_headers_append (soup_message_get_response_headers (msg),
+				     "Content-Encoding", "gzip");
+
+	plain = soup_test_load_resource ("mbox", NULL);
+	compressed = zlib_compress (plain, G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+
+	/* Each response gets the decoder the previous one returned */
+	stream = wrap_response (processor, msg, compressed);
+	first = get_decoder (stream);
+	for (i = 0; i < 3; i++) {
+		g_assert_true (get_decoder (stream) == first);
+		body = read_all (stream);
+		g_assert_true (g_bytes_equal (body, plain));
+		g_bytes_unref (body);
+		g_object_unref (stream);
+
+		stream = wrap_response (processor, msg, compressed);
+	}
+
+	/* Responses decoded at the same time get their own */
+	other = wrap_response (processor, msg, compressed);
+	g_assert_true (get_decoder (other) != first);
+	body = read_all (other);
+	g_assert_true (g_bytes_equal (body, plain));
+	g_bytes_unref (body);
+
+	/* A response dropped before it was read does not leave state behind */
+	g_object_unref (stream);
+	stream = wrap_response (processor, msg, compressed);
+	g_assert_true (get_decoder (stream) == first);
+	body = read_all (stream);
+	g_assert_true (g_bytes_equal (body, plain));
+	g_bytes_unref (body);
+	g_object_unref (stream);
+	g_object_unref (other);
+
+	/* Decoders still in use when the feature goes away are fine */
+	stream = wrap_response (processor, msg, compressed);
+	g_object_unref (processor);
+	body = read_all (stream);
+	g_assert_true (g_bytes_equal (body, plain));
+	g_bytes_unref (body);
+	g_object_unref (stream);
+
+	g_bytes_unref (compressed);
+	g_bytes_unref (plain);
+	g_object_unref (msg);
+}
+
+#define SMALL_RESPONSE "{\"status\": \"ok\", \"items\": [1, 2, 3, 4, 5, 6, 7, 8, 9, 10], " \
+	"\"message\": \"The quick brown fox jumps over the lazy dog\"}"
+
+static void
+do_decoder_pool_throughput_test (void)
+{
+	SoupContentProcessor *processor;
+	SoupMessage *msg;
+	GBytes *plain, *compressed;
+	gint64 start;
+	double pooled_rate, fresh_rate;
+	guint n_responses, i;
+
+	/* Typical small compressed API responses */
+	plain = g_bytes_new_static (SMALL_RESPONSE, strlen (SMALL_RESPONSE));
+	compressed = zlib_compress (plain, G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+	n_responses = g_test_perf () ? 100000 : 1000;
+
+	processor = g_object_new (SOUP_TYPE_CONTENT_DECODER, NULL);
+	msg = soup_message_new ("GET", "http://127.0.0.1/");
+	soup_message_headers_append (soup_message_get_response_headers (msg),
+				     "Content-Encoding", "gzip");
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < n_responses; i++) {
+		GInputStream *stream;
+		GBytes *body;
+
+		stream = wrap_response (processor, msg, compressed);
+		body = read_all (stream);
+		g_assert_cmpuint (g_bytes_get_size (body), ==, g_bytes_get_size (plain));
+		g_bytes_unref (body);
+		g_object_unref (stream);
+	}
+	pooled_rate = n_responses * (double)G_USEC_PER_SEC / MAX (g_get_monotonic_time () - start, 1);
+
+	/* What every response used to cost: a new decoder each time */
+	start = g_get_monotonic_time ();
+	for (i = 0; i < n_responses; i++) {
+		GConverter *decoder, *wrapper;
+		GInputStream *raw, *stream;
+		GBytes *body;
+
+		decoder = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+		wrapper = soup_converter_wrapper_new (decoder, msg);
+		raw = g_memory_input_stream_new_from_bytes (compressed);
+		stream = g_converter_input_stream_new (raw, wrapper);
+		body = read_all (stream);
+		g_assert_cmpuint (g_bytes_get_size (body), ==, g_bytes_get_size (plain));
+		g_bytes_unref (body);
+		g_object_unref (stream);
+		g_object_unref (raw);
+		g_object_unref (wrapper);
+		g_object_unref (decoder);
+	}
+	fresh_rate = n_responses * (double)G_USEC_PER_SEC / MAX (g_get_monotonic_time () - start, 1);
+
+	if (g_test_perf ()) {
+		g_test_maximized_result (pooled_rate, "pooled: %.0f responses/s", pooled_rate);
+		g_test_message ("fresh decoders: %.0f responses/s", fresh_rate);
+	}
+
+	g_object_unref (msg);
+	g_object_unref (processor);
+	g_bytes_unref (compressed);
+	g_bytes_unref (plain);
+}
+
+#ifdef WITH_ZSTD
+static void
+do_coding_request_test_zstd (CodingTestData *data, gconstpointer test_data)
+{
+	check_request_coding (data, "zstd");
+}
+
+static void
+do_coding_test_zstd (CodingTestData *data, gconstpointer test_data)
+{
+	GBytes *body;
+
+	soup_message_headers_replace (soup_message_get_request_headers (data->msg),
+				      "Accept-Encoding", "zstd");
+	soup_message_headers_append (soup_message_get_request_headers (data->msg),
+				     "X-Test-Options", "prefer-zstd");
+	body = soup_session_send_and_read (data->session, data->msg, NULL, NULL);
+	check_response (data, "zstd", "text/plain", body);
+	g_bytes_unref (body);
+}
+
+static void
+do_coding_test_zstd_multi_frame (CodingTestData *data, gconstpointer test_data)
+{
+	GBytes *body;
+
+	soup_message_headers_replace (soup_message_get_request_headers (data->msg),
+				      "Accept-Encoding", "zstd");
+	soup_message_headers_append (soup_message_get_request_headers (data->msg),
+				     "X-Test-Options", "prefer-zstd, zstd-multi-frame");
+	body = soup_session_send_and_read (data->session, data->msg, NULL, NULL);
+	check_response (data, "zstd", "text/plain", body);
+	g_bytes_unref (body);
+}
+
+static void
+do_coding_test_zstd_bad_server (CodingTestData *data, gconstpointer test_data)
+{
+	GBytes *body;
+
+	soup_message_headers_replace (soup_message_get_request_headers (data->msg),
+				      "Accept-Encoding", "zstd");
+	soup_message_headers_append (soup_message_get_request_headers (data->msg),
+				     "X-Test-Options", "force-encode, prefer-zstd");
+	body = soup_session_send_and_read (data->session, data->msg, NULL, NULL);
+	check_response (data, "zstd", "text/plain", body);
+	g_bytes_unref (body);
+}
+
+/* Runs @converter over @input, @in_chunk bytes of input and
+ * @out_chunk bytes of output at a time.
+ */
+static GBytes *
+convert_bytes (GConverter *converter,
+	       GBytes     *input,
+	       gsize       in_chunk,
+	       gsize       out_chunk,
+	       GError    **error)
+{
+	GByteArray *output;
+	const guint8 *data;
+	guint8 *buffer;
+	gsize size, offset = 0, avail;
+
+	data = g_bytes_get_data (input, &size);
+	avail = MIN (in_chunk, size);
+	output = g_byte_array_new ();
+	buffer = g_malloc (out_chunk);
+
+	while (TRUE) {
+		GConverterFlags flags = G_CONVERTER_NO_FLAGS;
+		GConverterResult result;
+		GError *local_error = NULL;
+		gsize bytes_read, bytes_written;
+
+		if (offset + avail == size)
+			flags |= G_CONVERTER_INPUT_AT_END;
+
+		result = g_converter_convert (converter, data + offset, avail,
+					      buffer, out_chunk, flags,
+					      &bytes_read, &bytes_written, &local_error);
+		if (result == G_CONVERTER_ERROR) {
+			if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT) &&
+			    offset + avail < size) {
+				g_clear_error (&local_error);
+				avail = MIN (avail + in_chunk, size - offset);
+				continue;
+			}
+
+			g_propagate_error (error, local_error);
+			g_byte_array_unref (output);
+			g_free (buffer);
+			return NULL;
+		}
+
+		g_byte_array_append (output, buffer, bytes_written);
+		offset += bytes_read;
+		avail -= bytes_read;
+		if (result == G_CONVERTER_FINISHED)
+			break;
+		if (avail == 0)
+			avail = MIN (in_chunk, size - offset);
+	}
+
+	g_free (buffer);
+	return g_byte_array_free_to_bytes (output);
+}
+
+static void
+do_zstd_streaming_test (void)
+{
+	GConverter *decompressor;
+	GBytes *plain, *compressed, *truncated, *decoded;
+	GError *error = NULL;
+
+	plain = soup_test_load_resource ("mbox", &error);
+	g_assert_no_error (error);
+	compressed = zstd_compress (plain, 3, 0);
+	decompressor = G_CONVERTER (soup_zstd_decompressor_new ());
+
+	/* Frames split across every possible input and output boundary */
+	decoded = convert_bytes (decompressor, compressed, 1, 7, &error);
+	g_assert_no_error (error);
+	g_assert_true (g_bytes_equal (decoded, plain));
+	g_bytes_unref (decoded);
+
+	/* The same converter decodes a new stream once reset */
+	g_converter_reset (decompressor);
+	decoded = convert_bytes (decompressor, compressed, G_MAXSIZE, 65536, &error);
+	g_assert_no_error (error);
+	g_assert_true (g_bytes_equal (decoded, plain));
+	g_bytes_unref (decoded);
+
+	/* A truncated frame asks for more input at the end */
+	g_converter_reset (decompressor);
+	truncated = g_bytes_new_from_bytes (compressed, 0, g_bytes_get_size (compressed) - 4);
+	decoded = convert_bytes (decompressor, truncated, 512, 512, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+	g_assert_null (decoded);
+	g_clear_error (&error);
+	g_bytes_unref (truncated);
+
+	/* Not zstd at all */
+	g_converter_reset (decompressor);
+	decoded = convert_bytes (decompressor, plain, 512, 512, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null (decoded);
+	g_clear_error (&error);
+
+	g_object_unref (decompressor);
+	g_bytes_unref (compressed);
+	g_bytes_unref (plain);
+}
+
+static void
+do_zstd_window_limit_test (void)
+{
+	GConverter *decompressor;
+	GBytes *plain, *compressed, *decoded;
+	GError *error = NULL;
+
+	plain = soup_test_load_resource ("mbox", &error);
+	g_assert_no_error (error);
+	decompressor = G_CONVERTER (soup_zstd_decompressor_new ());
+
+	/* 8 MB is the largest window HTTP senders may use */
+	compressed = zstd_compress (plain, 1, 23);
+	decoded = convert_bytes (decompressor, compressed, 4096, 4096, &error);
+	g_assert_no_error (error);
+	g_assert_true (g_bytes_equal (decoded, plain));
+	g_bytes_unref (decoded);
+	g_bytes_unref (compressed);
+
+	/* Larger ones are refused rather than allocated */
+	g_converter_reset (decompressor);
+	compressed = zstd_compress (plain, 1, 25);
+	decoded = convert_bytes (decompressor, compressed, 4096, 4096, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert_null (decoded);
+	g_clear_error (&error);
+	g_bytes_unref (compressed);
+
+	g_object_unref (decompressor);
+	g_bytes_unref (plain);
+}
+
+static double
+measure_decode_throughput (GConverter *decompressor,
+			   GBytes     *compressed,
+			   GBytes     *plain,
+			   guint       n_iterations)
+{
+	gint64 start, elapsed;
+	guint i;
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < n_iterations; i++) {
+		GBytes *decoded;
+		GError *error = NULL;
+
+		g_converter_reset (decompressor);
+		decoded = convert_bytes (decompressor, compressed, 65536, 65536, &error);
+		g_assert_no_error (error);
+		g_assert_cmpuint (g_bytes_get_size (decoded), ==, g_bytes_get_size (plain));
+		g_bytes_unref (decoded);
+	}
+	elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+	return (double)g_bytes_get_size (plain) * n_iterations / elapsed;
+}
+
+static void
+do_zstd_throughput_test (void)
+{
+	GConverter *compressor, *decompressor;
+	GBytes *mbox, *plain, *zstd, *gzip;
+	GByteArray *corpus;
+	GError *error = NULL;
+	guint n_iterations;
+	double zstd_rate, gzip_rate;
+
+	mbox = soup_test_load_resource ("mbox", &error);
+	g_assert_no_error (error);
+	corpus = g_byte_array_new ();
+	while (corpus->len < (g_test_perf () ? 16 * 1024 * 1024 : 256 * 1024))
+		g_byte_array_append (corpus, g_bytes_get_data (mbox, NULL), g_bytes_get_size (mbox));
+	plain = g_byte_array_free_to_bytes (corpus);
+	g_bytes_unref (mbox);
+
+	zstd = zstd_compress (plain, 1, 0);
+	compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+	gzip = convert_bytes (compressor, plain, G_MAXSIZE, 65536, &error);
+	g_assert_no_error (error);
+	g_object_unref (compressor);
+
+	n_iterations = g_test_perf () ? 20 : 1;
+
+	decompressor = G_CONVERTER (soup_zstd_decompressor_new ());
+	zstd_rate = measure_decode_throughput (decompressor, zstd, plain, n_iterations);
+	g_object_unref (decompressor);
+
+	decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+	gzip_rate = measure_decode_throughput (decompressor, gzip, plain, n_iterations);
+	g_object_unref (decompressor);
+
+	if (g_test_perf ()) {
+		g_test_maximized_result (zstd_rate, "zstd: %.0f MB/s (ratio %.2f)", zstd_rate,
+					 (double)g_bytes_get_size (plain) / g_bytes_get_size (zstd));
+		g_test_message ("gzip: %.0f MB/s (ratio %.2f)", gzip_rate,
+				(double)g_bytes_get_size (plain) / g_bytes_get_size (gzip));
+	}
+
+	g_bytes_unref (gzip);
+	g_bytes_unref (zstd);
+	g_bytes_unref (plain);
+}
+#endif
+
 int
 main (int argc, char **argv)
 {
@@ -352,6 +1092,7 @@ main (int argc, char **argv)
 
 	server = soup_test_server_new (SOUP_TEST_SERVER_IN_THREAD);
 	soup_server_add_handler (server, NULL, server_callback, NULL, NULL);
+	soup_server_add_handler (server, "/upload", upload_callback, NULL, NULL);
 	base_uri = soup_test_server_get_uri (server, "http", NULL);
 
 	g_test_add ("/coding/message/plain", CodingTestData,
@@ -389,6 +1130,40 @@ main (int argc, char **argv)
 		    GINT_TO_POINTER (CODING_TEST_EMPTY),
 		    setup_coding_test, do_coding_msg_empty_test, teardown_coding_test);
 
+	g_test_add ("/coding/request/gzip", CodingTestData,
+		    GINT_TO_POINTER (CODING_TEST_DEFAULT),
+		    setup_coding_test, do_coding_request_test_gzip, teardown_coding_test);
+	g_test_add ("/coding/request/deflate", CodingTestData,
+		    GINT_TO_POINTER (CODING_TEST_DEFAULT),
+		    setup_coding_test, do_coding_request_test_deflate, teardown_coding_test);
+	g_test_add ("/coding/request/precompressed", CodingTestData,
+		    GINT_TO_POINTER (CODING_TEST_DEFAULT),
+		    setup_coding_test, do_coding_request_precompressed_test, teardown_coding_test);
+	g_test_add ("/coding/request/http-1.0", CodingTestData,
+		    GINT_TO_POINTER (CODING_TEST_DEFAULT),
+		    setup_coding_test, do_coding_request_http_1_0_test, teardown_coding_test);
+
+	g_test_add_func ("/coding/decoder-pool", do_decoder_pool_test);
+	g_test_add_func ("/coding/decoder-pool/throughput", do_decoder_pool_throughput_test);
+
+#ifdef WITH_ZSTD
+	g_test_add ("/coding/message/zstd", CodingTestData,
+		    GINT_TO_POINTER (CODING_TEST_DEFAULT),
+		    setup_coding_test, do_coding_test_zstd, teardown_coding_test);
+	g_test_add ("/coding/message/zstd/multi-frame", CodingTestData,
+		    GINT_TO_POINTER (CODING_TEST_DEFAULT),
+		    setup_coding_test, do_coding_test_zstd_multi_frame, teardown_coding_test);
+	g_test_add ("/coding/message/zstd/bad-server", CodingTestData,
+		    GINT_TO_POINTER (CODING_TEST_DEFAULT),
+		    setup_coding_test, do_coding_test_zstd_bad_server, teardown_coding_test);
+	g_test_add ("/coding/request/zstd", CodingTestData,
+		    GINT_TO_POINTER (CODING_TEST_DEFAULT),
+		    setup_coding_test, do_coding_request_test_zstd, teardown_coding_test);
+	g_test_add_func ("/coding/zstd/streaming", do_zstd_streaming_test);
+	g_test_add_func ("/coding/zstd/window-limit", do_zstd_window_limit_test);
+	g_test_add_func ("/coding/zstd/throughput", do_zstd_throughput_test);
+#endif
+
 	ret = g_test_run ();
 
 	g_uri_unref (base_uri);
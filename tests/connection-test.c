@@ -104,6 +104,28 @@ setup_timeout_persistent (SoupServer           *server,
 			  G_CALLBACK (timeout_request_finished), NULL);
 }
 
+static gboolean
+disconnect_idle_connection (SoupServerConnection *conn)
+{
+        soup_server_connection_disconnect (conn);
+        g_object_unref (conn);
+        return G_SOURCE_REMOVE;
+}
+
+static void
+close_after_response (SoupServerMessage *msg,
+                      gpointer           user_data)
+{
+        GSource *source;
+
+        /* Close the connection without telling the client */
+        source = g_idle_source_new ();
+        g_source_set_callback (source, (GSourceFunc)disconnect_idle_connection,
+                               g_object_ref (soup_server_message_get_connection (msg)), NULL);
+        g_source_attach (source, g_main_context_get_thread_default ());
+        g_source_unref (source);
+}
+
 static void
 server_callback (SoupServer        *server,
 		 SoupServerMessage *msg,
@@ -171,6 +193,9 @@ server_callback (SoupServer        *server,
 		setup_timeout_persistent (server, conn);
 	}
 
+        if (!strcmp (path, "/close-idle"))
+                g_signal_connect (msg, "finished", G_CALLBACK (close_after_response), NULL);
+
 	soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
 	soup_server_message_set_response (msg, "text/plain",
 					  SOUP_MEMORY_STATIC, "index", 5);
@@ -1693,6 +1718,404 @@ do_connection_http_1_1_required_test (void)
         soup_test_session_abort_unref (session);
 }
 
+/* Resolves every name to a blackholed address and to the test server,
+ * like a multi-homed host with one broken path.
+ */
+#define BLACKHOLE_ADDRESS "127.0.0.2"
+
+typedef GResolver TestDualStackResolver;
+typedef GResolverClass TestDualStackResolverClass;
+
+static GType test_dual_stack_resolver_get_type (void);
+G_DEFINE_TYPE (TestDualStackResolver, test_dual_stack_resolver, G_TYPE_RESOLVER)
+
+static GList *
+dual_stack_resolver_lookup_by_name_with_flags (GResolver                 *resolver,
+                                               const char                *hostname,
+                                               GResolverNameLookupFlags   flags,
+                                               GCancellable              *cancellable,
+                                               GError                   **error)
+{
+        GList *addresses = NULL;
+
+        if (flags & G_RESOLVER_NAME_LOOKUP_FLAGS_IPV6_ONLY) {
+                g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+                             "No IPv6 address for %s", hostname);
+                return NULL;
+        }
+
+        addresses = g_list_append (addresses, g_inet_address_new_from_string (BLACKHOLE_ADDRESS));
+        addresses = g_list_append (addresses, g_inet_address_new_from_string ("127.0.0.1"));
+
+        return addresses;
+}
+
+static GList *
+dual_stack_resolver_lookup_by_name (GResolver     *resolver,
+                                    const char    *hostname,
+                                    GCancellable  *cancellable,
+                                    GError       **error)
+{
+        return dual_stack_resolver_lookup_by_name_with_flags (resolver, hostname,
+                                                              G_RESOLVER_NAME_LOOKUP_FLAGS_DEFAULT,
+                                                              cancellable, error);
+}
+
+static void
+dual_stack_resolver_lookup_by_name_with_flags_async (GResolver                *resolver,
+                                                     const char               *hostname,
+                                                     GResolverNameLookupFlags  flags,
+                                                     GCancellable             *cancellable,
+                                                     GAsyncReadyCallback       callback,
+                                                     gpointer                  user_data)
+{
+        GTask *task;
+        GList *addresses;
+        GError *error = NULL;
+
+        task = g_task_new (resolver, cancellable, callback, user_data);
+        addresses = dual_stack_resolver_lookup_by_name_with_flags (resolver, hostname, flags, cancellable, &error);
+        if (error)
+                g_task_return_error (task, error);
+        else
+                g_task_return_pointer (task, addresses, (GDestroyNotify)g_resolver_free_addresses);
+        g_object_unref (task);
+}
+
+static void
+dual_stack_resolver_lookup_by_name_async (GResolver           *resolver,
+                                          const char          *hostname,
+                                          GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
+{
+        dual_stack_resolver_lookup_by_name_with_flags_async (resolver, hostname,
+                                                             G_RESOLVER_NAME_LOOKUP_FLAGS_DEFAULT,
+                                                             cancellable, callback, user_data);
+}
+
+static GList *
+dual_stack_resolver_lookup_by_name_finish (GResolver     *resolver,
+                                           GAsyncResult  *result,
+                                           GError       **error)
+{
+        return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+test_dual_stack_resolver_init (TestDualStackResolver *resolver)
+{
+}
+
+static void
+test_dual_stack_resolver_class_init (TestDualStackResolverClass *klass)
+{
+        klass->lookup_by_name = dual_stack_resolver_lookup_by_name;
+        klass->lookup_by_name_async = dual_stack_resolver_lookup_by_name_async;
+        klass->lookup_by_name_finish = dual_stack_resolver_lookup_by_name_finish;
+        klass->lookup_by_name_with_flags = dual_stack_resolver_lookup_by_name_with_flags;
+        klass->lookup_by_name_with_flags_async = dual_stack_resolver_lookup_by_name_with_flags_async;
+        klass->lookup_by_name_with_flags_finish = dual_stack_resolver_lookup_by_name_finish;
+}
+
+#define HAPPY_EYEBALLS_TIMEOUT 10
+
+/* Listens on BLACKHOLE_ADDRESS without ever accepting, and fills the
+ * accept queue so that the kernel drops the SYN of any further
+ * connection: connecting to it hangs until timeout instead of failing
+ * right away like an unroutable address would.
+ */
+static GSocket *
+blackhole_listener_new (guint16   port,
+                        GSocket **filler)
+{
+        GSocket *listener;
+        GInetAddress *inet_address;
+        GSocketAddress *address;
+        GError *error = NULL;
+
+        listener = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                                 G_SOCKET_PROTOCOL_DEFAULT, &error);
+        g_assert_no_error (error);
+        g_socket_set_listen_backlog (listener, 0);
+
+        inet_address = g_inet_address_new_from_string (BLACKHOLE_ADDRESS);
+        address = g_inet_socket_address_new (inet_address, port);
+        g_object_unref (inet_address);
+        if (!g_socket_bind (listener, address, FALSE, &error)) {
+                debug_printf (1, "    could not bind %s: %s\n", BLACKHOLE_ADDRESS, error->message);
+                g_error_free (error);
+                g_object_unref (address);
+                g_object_unref (listener);
+                return NULL;
+        }
+        g_socket_listen (listener, &error);
+        g_assert_no_error (error);
+
+        /* With a backlog of 0, the queue is full with one connection */
+        *filler = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                                G_SOCKET_PROTOCOL_DEFAULT, &error);
+        g_assert_no_error (error);
+        g_socket_set_blocking (*filler, FALSE);
+        if (!g_socket_connect (*filler, address, NULL, &error)) {
+                g_assert_error (error, G_IO_ERROR, G_IO_ERROR_PENDING);
+                g_clear_error (&error);
+                g_assert_true (g_socket_condition_timed_wait (*filler, G_IO_OUT, 5 * G_USEC_PER_SEC, NULL, NULL));
+                g_socket_check_connect_result (*filler, &error);
+                g_assert_no_error (error);
+        }
+        g_object_unref (address);
+
+        return listener;
+}
+
+static void
+do_one_happy_eyeballs_test (SoupSession *session,
+                            GUri        *uri,
+                            gboolean     async)
+{
+        SoupMessage *msg;
+        GBytes *body;
+        SoupMessageMetrics *metrics;
+        GSocketAddress *remote_address;
+        char *ip_address;
+        GError *error = NULL;
+
+        msg = soup_message_new_from_uri ("GET", uri);
+        soup_message_add_flags (msg, SOUP_MESSAGE_COLLECT_METRICS);
+        if (async)
+                body = soup_test_session_async_send (session, msg, NULL, &error);
+        else
+                body = soup_session_send_and_read (session, msg, NULL, &error);
+        g_assert_no_error (error);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+
+        remote_address = soup_message_get_remote_address (msg);
+        g_assert_true (G_IS_INET_SOCKET_ADDRESS (remote_address));
+        ip_address = g_inet_address_to_string (g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (remote_address)));
+        g_assert_cmpstr (ip_address, ==, "127.0.0.1");
+        g_free (ip_address);
+
+        /* connect_start is the first attempt, not the one that won */
+        metrics = soup_message_get_metrics (msg);
+        g_assert_cmpuint (soup_message_metrics_get_dns_start (metrics), >, 0);
+        g_assert_cmpuint (soup_message_metrics_get_dns_end (metrics), >=, soup_message_metrics_get_dns_start (metrics));
+        g_assert_cmpuint (soup_message_metrics_get_connect_start (metrics), >=, soup_message_metrics_get_dns_end (metrics));
+        g_assert_cmpuint (soup_message_metrics_get_connect_end (metrics), >=, soup_message_metrics_get_connect_start (metrics));
+
+        /* Waiting for the blackholed address would take the whole timeout */
+        g_assert_cmpuint (soup_message_metrics_get_connect_end (metrics) - soup_message_metrics_get_connect_start (metrics),
+                          <, HAPPY_EYEBALLS_TIMEOUT * G_USEC_PER_SEC / 4);
+
+        g_bytes_unref (body);
+        g_object_unref (msg);
+        soup_session_abort (session);
+}
+
+static void
+do_connection_happy_eyeballs_test (void)
+{
+        GResolver *default_resolver, *resolver;
+        GSocket *listener;
+        GSocket *filler;
+        SoupSession *session;
+        GUri *uri;
+
+        listener = blackhole_listener_new (g_uri_get_port (base_uri), &filler);
+        if (!listener) {
+                g_test_skip ("Cannot listen on " BLACKHOLE_ADDRESS);
+                return;
+        }
+
+        default_resolver = g_resolver_get_default ();
+        resolver = g_object_new (test_dual_stack_resolver_get_type (), NULL);
+        g_resolver_set_default (resolver);
+
+        uri = soup_uri_copy (base_uri, SOUP_URI_HOST, "dual-stack.test", SOUP_URI_NONE);
+        session = soup_test_session_new ("timeout", HAPPY_EYEBALLS_TIMEOUT, NULL);
+
+        /* Without racing the addresses, the blackholed one would hold
+         * the connection until the session timeout.
+         */
+        debug_printf (1, "    sync\n");
+        do_one_happy_eyeballs_test (session, uri, FALSE);
+        debug_printf (1, "    async\n");
+        do_one_happy_eyeballs_test (session, uri, TRUE);
+
+        soup_test_session_abort_unref (session);
+        g_uri_unref (uri);
+
+        g_resolver_set_default (default_resolver);
+        g_object_unref (default_resolver);
+        g_object_unref (resolver);
+
+        g_object_unref (filler);
+        g_object_unref (listener);
+}
+
+static gboolean
+quit_warm_loop (gpointer loop)
+{
+        g_main_loop_quit (loop);
+        return G_SOURCE_REMOVE;
+}
+
+static void
+run_warm_loop (guint msecs)
+{
+        GMainLoop *loop;
+
+        loop = g_main_loop_new (NULL, FALSE);
+        g_timeout_add (msecs, quit_warm_loop, loop);
+        g_main_loop_run (loop);
+        g_main_loop_unref (loop);
+}
+
+/* Returns whether the request didn't have to open a connection */
+static gboolean
+send_on_warm_connection (SoupSession *session,
+                         GUri        *uri)
+{
+        SoupMessage *msg;
+        GBytes *body;
+        guint64 connect_start;
+        GError *error = NULL;
+
+        msg = soup_message_new_from_uri ("GET", uri);
+        soup_message_add_flags (msg, SOUP_MESSAGE_COLLECT_METRICS);
+        body = soup_test_session_async_send (session, msg, NULL, &error);
+        g_assert_no_error (error);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        connect_start = soup_message_metrics_get_connect_start (soup_message_get_metrics (msg));
+
+        g_bytes_unref (body);
+        g_object_unref (msg);
+
+        return connect_start == 0;
+}
+
+static void
+do_connection_warm_pool_test (void)
+{
+        SoupSession *session;
+
+        session = soup_test_session_new ("idle-timeout", 3, NULL);
+
+        g_assert_cmpuint (soup_session_get_min_idle_connections (session, base_uri), ==, 0);
+        soup_session_set_min_idle_connections (session, base_uri, 1);
+        g_assert_cmpuint (soup_session_get_min_idle_connections (session, base_uri), ==, 1);
+
+        run_warm_loop (500);
+        g_assert_true (send_on_warm_connection (session, base_uri));
+
+        /* The idle connection is replaced before the idle timeout
+         * closes it, and the new one is kept open while unused.
+         */
+        run_warm_loop (4500);
+        g_assert_true (send_on_warm_connection (session, base_uri));
+
+        soup_session_set_min_idle_connections (session, base_uri, 0);
+        g_assert_cmpuint (soup_session_get_min_idle_connections (session, base_uri), ==, 0);
+
+        /* Without a policy, a new connection is needed after the idle timeout */
+        run_warm_loop (3500);
+        g_assert_false (send_on_warm_connection (session, base_uri));
+
+        soup_test_session_abort_unref (session);
+}
+
+static void
+keepalive_network_event (SoupMessage        *msg,
+                         GSocketClientEvent  event,
+                         GIOStream          *connection,
+                         gboolean           *keepalive)
+{
+        if (event != G_SOCKET_CLIENT_COMPLETE)
+                return;
+
+        *keepalive = g_socket_get_keepalive (g_socket_connection_get_socket (G_SOCKET_CONNECTION (connection)));
+}
+
+static void
+send_for_health_check (SoupSession *session,
+                       GUri        *uri,
+                       gboolean     http2)
+{
+        SoupMessage *msg;
+        GBytes *body;
+        GError *error = NULL;
+
+        msg = soup_message_new_from_uri ("GET", uri);
+        if (http2)
+                soup_message_set_force_http_version (msg, SOUP_HTTP_2_0);
+        body = soup_test_session_async_send (session, msg, NULL, &error);
+        g_assert_no_error (error);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        if (http2)
+                g_assert_cmpint (soup_message_get_http_version (msg), ==, SOUP_HTTP_2_0);
+
+        g_bytes_unref (body);
+        g_object_unref (msg);
+}
+
+static void
+do_connection_health_check_test (void)
+{
+        SoupSession *session;
+        SoupMessage *msg;
+        GBytes *body;
+        GUri *uri;
+        gboolean keepalive = FALSE;
+        GError *error = NULL;
+
+        session = soup_test_session_new ("tcp-keepalive", 30, NULL);
+        uri = g_uri_parse_relative (base_uri, "/close-idle", SOUP_HTTP_URI_FLAGS, NULL);
+
+        msg = soup_message_new_from_uri ("GET", uri);
+        g_signal_connect (msg, "network-event",
+                          G_CALLBACK (keepalive_network_event),
+                          &keepalive);
+        body = soup_test_session_async_send (session, msg, NULL, NULL);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        g_assert_true (keepalive);
+        g_bytes_unref (body);
+        g_object_unref (msg);
+        g_assert_cmpuint (soup_session_get_n_stale_connections (session), ==, 0);
+
+        /* The connection closed by the server is discarded when reused,
+         * by async and sync requests...
+         */
+        run_warm_loop (200);
+        send_for_health_check (session, uri, FALSE);
+        g_assert_cmpuint (soup_session_get_n_stale_connections (session), ==, 1);
+
+        run_warm_loop (200);
+        msg = soup_message_new_from_uri ("GET", uri);
+        body = soup_session_send_and_read (session, msg, NULL, &error);
+        g_assert_no_error (error);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        g_bytes_unref (body);
+        g_object_unref (msg);
+        g_assert_cmpuint (soup_session_get_n_stale_connections (session), ==, 2);
+
+        /* ...or before, when checked in the background */
+        soup_session_set_health_check_interval (session, 1);
+        g_assert_cmpuint (soup_session_get_health_check_interval (session), ==, 1);
+        run_warm_loop (1500);
+        g_assert_cmpuint (soup_session_get_n_stale_connections (session), ==, 3);
+
+        /* Idle http/2 connections that answer the PING are kept */
+        if (tls_available) {
+                send_for_health_check (session, base_https_uri, TRUE);
+                run_warm_loop (2500);
+                g_assert_cmpuint (soup_session_get_n_stale_connections (session), ==, 3);
+                send_for_health_check (session, base_https_uri, TRUE);
+        }
+
+        g_uri_unref (uri);
+        soup_test_session_abort_unref (session);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -1719,6 +2142,9 @@ main (int argc, char **argv)
         g_test_add_func ("/connection/metrics", do_connection_metrics_test);
         g_test_add_func ("/connection/force-http2", do_connection_force_http2_test);
         g_test_add_func ("/connection/http2/http-1-1-required", do_connection_http_1_1_required_test);
+        g_test_add_func ("/connection/happy-eyeballs", do_connection_happy_eyeballs_test);
+        g_test_add_func ("/connection/warm-pool", do_connection_warm_pool_test);
+        g_test_add_func ("/connection/health-check", do_connection_health_check_test);
 
 	ret = g_test_run ();
 
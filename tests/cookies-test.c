@@ -4,6 +4,7 @@
  */
 
 #include "test-utils.h"
+#include <glib/gstdio.h>
 
 static SoupServer *server;
 static GUri *first_party_uri, *third_party_uri;
@@ -656,6 +657,318 @@ do_cookies_threads_test (void)
         soup_test_session_abort_unref (session);
 }
 
+static void
+do_cookies_lookup_test (void)
+{
+        SoupCookieJar *jar;
+        GUri *uri;
+        char *header;
+        SoupCookie *cookie;
+
+        jar = soup_cookie_jar_new ();
+        soup_cookie_jar_add_cookie (jar, soup_cookie_new ("a", "1", ".example.com", "/", -1));
+        soup_cookie_jar_add_cookie (jar, soup_cookie_new ("b", "2", "www.example.com", "/foo", SOUP_COOKIE_MAX_AGE_ONE_HOUR));
+        soup_cookie_jar_add_cookie (jar, soup_cookie_new ("c", "3", ".www.example.com", "/", -1));
+        soup_cookie_jar_add_cookie (jar, soup_cookie_new ("d", "4", "example.com", "/", SOUP_COOKIE_MAX_AGE_ONE_HOUR));
+        soup_cookie_jar_add_cookie (jar, soup_cookie_new ("e", "5", ".other.com", "/", -1));
+
+        uri = g_uri_parse ("http://www.example.com/foo/bar", SOUP_HTTP_URI_FLAGS, NULL);
+        header = soup_cookie_jar_get_cookies (jar, uri, TRUE);
+        g_assert_cmpstr (header, ==, "b=2; a=1; c=3");
+        g_free (header);
+
+        /* The cached header must be invalidated when the jar changes */
+        soup_cookie_jar_add_cookie (jar, soup_cookie_new ("f", "6", ".example.com", "/foo", SOUP_COOKIE_MAX_AGE_ONE_HOUR));
+        header = soup_cookie_jar_get_cookies (jar, uri, TRUE);
+        g_assert_cmpstr (header, ==, "b=2; f=6; a=1; c=3");
+        g_free (header);
+
+        cookie = soup_cookie_new ("b", "2", "www.example.com", "/foo", -1);
+        soup_cookie_jar_delete_cookie (jar, cookie);
+        soup_cookie_free (cookie);
+        header = soup_cookie_jar_get_cookies (jar, uri, TRUE);
+        g_assert_cmpstr (header, ==, "f=6; a=1; c=3");
+        g_free (header);
+        g_uri_unref (uri);
+
+        uri = g_uri_parse ("http://EXAMPLE.com/", SOUP_HTTP_URI_FLAGS, NULL);
+        header = soup_cookie_jar_get_cookies (jar, uri, TRUE);
+        g_assert_cmpstr (header, ==, "a=1; d=4");
+        g_free (header);
+        g_uri_unref (uri);
+
+        uri = g_uri_parse ("http://example.org/", SOUP_HTTP_URI_FLAGS, NULL);
+        g_assert_null (soup_cookie_jar_get_cookies (jar, uri, TRUE));
+        g_uri_unref (uri);
+
+        g_object_unref (jar);
+}
+
+static SoupCookie *
+new_db_test_cookie (const char *name,
+                    const char *value)
+{
+        return soup_cookie_new (name, value, "example.com", "/", SOUP_COOKIE_MAX_AGE_ONE_HOUR);
+}
+
+typedef struct {
+        SoupCookieJar *jar;
+        GUri *uri;
+        guint n_reads;
+        gint *stop;
+} ReaderThreadData;
+
+static gpointer
+cookie_reader_thread (ReaderThreadData *data)
+{
+        while (!g_atomic_int_get (data->stop)) {
+                char *header = soup_cookie_jar_get_cookies (data->jar, data->uri, TRUE);
+
+                /* The stable cookie is there whatever the writer did */
+                g_assert_nonnull (header);
+                g_assert_nonnull (strstr (header, "stable=1"));
+                g_free (header);
+                data->n_reads++;
+        }
+
+        return NULL;
+}
+
+static void
+do_cookies_concurrent_reads_test (void)
+{
+        SoupCookieJar *jar;
+        GUri *uri;
+        ReaderThreadData data[4];
+        GThread *threads[G_N_ELEMENTS (data)];
+        gint stop = 0;
+        guint n_reads = 0, n_writes, i;
+        gint64 start, elapsed;
+        char *header, *expected;
+
+        jar = soup_cookie_jar_new ();
+        uri = g_uri_parse ("http://www.example.com/path", SOUP_HTTP_URI_FLAGS, NULL);
+        soup_cookie_jar_add_cookie (jar, soup_cookie_new ("stable", "1", ".example.com", "/", -1));
+
+        start = g_get_monotonic_time ();
+        for (i = 0; i < G_N_ELEMENTS (data); i++) {
+                data[i].jar = jar;
+                data[i].uri = uri;
+                data[i].n_reads = 0;
+                data[i].stop = &stop;
+                threads[i] = g_thread_new ("cookie-reader", (GThreadFunc)cookie_reader_thread, &data[i]);
+        }
+
+        n_writes = g_test_perf () ? 10000 : 200;
+        for (i = 0; i < n_writes; i++) {
+                char *value = g_strdup_printf ("%u", i);
+
+                soup_cookie_jar_add_cookie (jar, soup_cookie_new ("changing", value, "www.example.com", "/", -1));
+                g_free (value);
+                if (i % 100 == 0)
+                        g_usleep (1000);
+        }
+
+        g_atomic_int_set (&stop, 1);
+        for (i = 0; i < G_N_ELEMENTS (data); i++) {
+                g_thread_join (threads[i]);
+                n_reads += data[i].n_reads;
+        }
+        elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+        /* Headers computed while the jar was changing must not have
+         * been cached over the last change.
+         */
+        header = soup_cookie_jar_get_cookies (jar, uri, TRUE);
+        expected = g_strdup_printf ("changing=%u", n_writes - 1);
+        g_assert_nonnull (strstr (header, expected));
+        g_free (expected);
+        g_free (header);
+
+        if (g_test_perf ()) {
+                g_test_maximized_result ((double)n_reads * G_USEC_PER_SEC / elapsed,
+                                         "%.0f Cookie headers/s with %u readers",
+                                         (double)n_reads * G_USEC_PER_SEC / elapsed,
+                                         (guint)G_N_ELEMENTS (data));
+        }
+
+        g_uri_unref (uri);
+        g_object_unref (jar);
+}
+
+static void
+do_cookies_db_test (void)
+{
+        char *dir, *filename;
+        SoupCookieJar *jar, *reader;
+        SoupCookie *cookie;
+        GSList *cookies;
+
+        dir = g_dir_make_tmp ("cookies-test-XXXXXX", NULL);
+        filename = g_build_filename (dir, "cookies.sqlite", NULL);
+
+        jar = soup_cookie_jar_db_new (filename, FALSE);
+        soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("one", "1"));
+        soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("one", "2"));
+        soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("two", "2"));
+        cookie = new_db_test_cookie ("two", "2");
+        soup_cookie_jar_delete_cookie (jar, cookie);
+        soup_cookie_free (cookie);
+        soup_cookie_jar_db_flush (SOUP_COOKIE_JAR_DB (jar));
+
+        /* Changes must be visible from another connection once flushed */
+        soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("three", "3"));
+        soup_cookie_jar_db_flush (SOUP_COOKIE_JAR_DB (jar));
+        soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("four", "4"));
+        reader = soup_cookie_jar_db_new (filename, TRUE);
+        cookies = soup_cookie_jar_all_cookies (reader);
+        g_assert_cmpuint (g_slist_length (cookies), ==, 2);
+        g_assert_nonnull (g_slist_find_custom (cookies, "three", (GCompareFunc)find_cookie));
+        cookie = g_slist_find_custom (cookies, "one", (GCompareFunc)find_cookie)->data;
+        g_assert_cmpstr (soup_cookie_get_value (cookie), ==, "2");
+        g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
+        g_object_unref (reader);
+
+        /* Pending changes are written when the jar is destroyed */
+        g_object_unref (jar);
+        jar = soup_cookie_jar_db_new (filename, TRUE);
+        cookies = soup_cookie_jar_all_cookies (jar);
+        g_assert_cmpuint (g_slist_length (cookies), ==, 3);
+        g_assert_nonnull (g_slist_find_custom (cookies, "four", (GCompareFunc)find_cookie));
+        g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
+        g_object_unref (jar);
+
+        g_remove (filename);
+        g_rmdir (dir);
+        g_free (filename);
+        g_free (dir);
+}
+
+static void
+do_cookies_db_throughput_test (void)
+{
+        char *dir, *filename;
+        SoupCookieJar *jar;
+        GSList *cookies;
+        guint n_cookies, i;
+        gint64 start, elapsed;
+
+        dir = g_dir_make_tmp ("cookies-test-XXXXXX", NULL);
+        filename = g_build_filename (dir, "cookies.sqlite", NULL);
+        jar = soup_cookie_jar_db_new (filename, FALSE);
+
+        n_cookies = g_test_perf () ? 100000 : 1000;
+        start = g_get_monotonic_time ();
+        for (i = 0; i < n_cookies; i++) {
+                char *name = g_strdup_printf ("cookie%u", i % (n_cookies / 4));
+                char *value = g_strdup_printf ("%u", i);
+
+                soup_cookie_jar_add_cookie (jar, new_db_test_cookie (name, value));
+                g_free (name);
+                g_free (value);
+        }
+        soup_cookie_jar_db_flush (SOUP_COOKIE_JAR_DB (jar));
+        elapsed = MAX (g_get_monotonic_time () - start, 1);
+        g_object_unref (jar);
+
+        if (g_test_perf ()) {
+                g_test_maximized_result ((double)n_cookies * G_USEC_PER_SEC / elapsed,
+                                         "%.0f cookie changes/s",
+                                         (double)n_cookies * G_USEC_PER_SEC / elapsed);
+        }
+
+        jar = soup_cookie_jar_db_new (filename, TRUE);
+        cookies = soup_cookie_jar_all_cookies (jar);
+        g_assert_cmpuint (g_slist_length (cookies), ==, n_cookies / 4);
+        g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
+        g_object_unref (jar);
+
+        g_remove (filename);
+        g_rmdir (dir);
+        g_free (filename);
+        g_free (dir);
+}
+
+static void
+do_cookies_text_journal_test (void)
+{
+        char *dir, *filename, *journal;
+        SoupCookieJar *jar;
+        SoupCookie *cookie;
+        GSList *cookies;
+        guint i;
+
+        dir = g_dir_make_tmp ("cookies-test-XXXXXX", NULL);
+        filename = g_build_filename (dir, "cookies.txt", NULL);
+        journal = g_strconcat (filename, ".journal", NULL);
+
+        jar = soup_cookie_jar_text_new (filename, FALSE);
+        soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("one", "1"));
+        soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("one", "2"));
+        soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("two", "2"));
+        cookie = new_db_test_cookie ("two", "2");
+        soup_cookie_jar_delete_cookie (jar, cookie);
+        soup_cookie_free (cookie);
+        g_assert_true (g_file_test (journal, G_FILE_TEST_EXISTS));
+        g_assert_false (g_file_test (filename, G_FILE_TEST_EXISTS));
+        g_object_unref (jar);
+
+        jar = soup_cookie_jar_text_new (filename, FALSE);
+        cookies = soup_cookie_jar_all_cookies (jar);
+        g_assert_cmpuint (g_slist_length (cookies), ==, 1);
+        g_assert_cmpstr (soup_cookie_get_value (cookies->data), ==, "2");
+        g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
+
+        /* A long enough journal is compacted into the cookies file */
+        g_object_set (jar, "batch-size", 64, NULL);
+        for (i = 0; i < 2048; i++) {
+                char *value = g_strdup_printf ("%u", i);
+
+                soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("three", value));
+                g_free (value);
+        }
+        g_object_unref (jar);
+        g_assert_true (g_file_test (filename, G_FILE_TEST_EXISTS));
+
+        jar = soup_cookie_jar_text_new (filename, TRUE);
+        cookies = soup_cookie_jar_all_cookies (jar);
+        g_assert_cmpuint (g_slist_length (cookies), ==, 2);
+        cookie = g_slist_find_custom (cookies, "three", (GCompareFunc)find_cookie)->data;
+        g_assert_cmpstr (soup_cookie_get_value (cookie), ==, "2047");
+        g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
+        g_object_unref (jar);
+        g_remove (journal);
+        g_remove (filename);
+
+        /* Changes stay in the journal when the cookies file can't be
+         * rewritten, here because a directory is in the way.
+         */
+        g_assert_cmpint (g_mkdir (filename, 0700), ==, 0);
+        jar = soup_cookie_jar_text_new (filename, FALSE);
+        g_object_set (jar, "batch-size", 64, NULL);
+        for (i = 0; i < 2048; i++) {
+                char *value = g_strdup_printf ("%u", i);
+
+                soup_cookie_jar_add_cookie (jar, new_db_test_cookie ("four", value));
+                g_free (value);
+        }
+        g_object_unref (jar);
+        g_assert_cmpint (g_rmdir (filename), ==, 0);
+
+        jar = soup_cookie_jar_text_new (filename, TRUE);
+        cookies = soup_cookie_jar_all_cookies (jar);
+        g_assert_cmpuint (g_slist_length (cookies), ==, 1);
+        g_assert_cmpstr (soup_cookie_get_value (cookies->data), ==, "2047");
+        g_slist_free_full (cookies, (GDestroyNotify)soup_cookie_free);
+        g_object_unref (jar);
+
+        g_remove (journal);
+        g_rmdir (dir);
+        g_free (journal);
+        g_free (filename);
+        g_free (dir);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -686,6 +999,11 @@ main (int argc, char **argv)
 	g_test_add_func ("/cookies/secure-cookies", do_cookies_strict_secure_test);
 	g_test_add_func ("/cookies/prefix", do_cookies_prefix_test);
         g_test_add_func ("/cookies/threads", do_cookies_threads_test);
+        g_test_add_func ("/cookies/lookup", do_cookies_lookup_test);
+        g_test_add_func ("/cookies/concurrent-reads", do_cookies_concurrent_reads_test);
+        g_test_add_func ("/cookies/db", do_cookies_db_test);
+        g_test_add_func ("/cookies/db/throughput", do_cookies_db_throughput_test);
+        g_test_add_func ("/cookies/text-journal", do_cookies_text_journal_test);
 
 	ret = g_test_run ();
 
@@ -0,0 +1,388 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+/*
+ * dns-cache-test.c: tests for SoupDNSCache
+ */
+
+#include "test-utils.h"
+#include "soup-dns-cache-private.h"
+
+static GUri *base_uri;
+
+static void
+server_callback (SoupServer        *server,
+                 SoupServerMessage *msg,
+                 const char        *path,
+                 GHashTable        *query,
+                 gpointer           data)
+{
+        soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+        soup_server_message_set_response (msg, "text/plain",
+                                          SOUP_MEMORY_STATIC, "ok", 2);
+}
+
+/* Resolves every name to the test server, except the ones in
+ * .invalid, and counts the lookups of each name. While blocked,
+ * lookups don't return.
+ */
+typedef struct {
+        GResolver parent;
+
+        GMutex mutex;
+        GCond cond;
+        GHashTable *lookups;
+        gboolean blocked;
+} TestStubResolver;
+
+typedef GResolverClass TestStubResolverClass;
+
+static GType test_stub_resolver_get_type (void);
+G_DEFINE_TYPE (TestStubResolver, test_stub_resolver, G_TYPE_RESOLVER)
+
+static GList *
+stub_resolver_lookup_by_name (GResolver     *resolver,
+                              const char    *hostname,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+        TestStubResolver *stub = (TestStubResolver *)resolver;
+
+        g_mutex_lock (&stub->mutex);
+        g_hash_table_insert (stub->lookups, g_strdup (hostname),
+                             GUINT_TO_POINTER (GPOINTER_TO_UINT (g_hash_table_lookup (stub->lookups, hostname)) + 1));
+        while (stub->blocked)
+                g_cond_wait (&stub->cond, &stub->mutex);
+        g_mutex_unlock (&stub->mutex);
+
+        if (g_str_has_suffix (hostname, ".invalid")) {
+                g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+                             "No such host %s", hostname);
+                return NULL;
+        }
+
+        return g_list_prepend (NULL, g_inet_address_new_from_string ("127.0.0.1"));
+}
+
+static void
+test_stub_resolver_init (TestStubResolver *stub)
+{
+        g_mutex_init (&stub->mutex);
+        g_cond_init (&stub->cond);
+        stub->lookups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+test_stub_resolver_finalize (GObject *object)
+{
+        TestStubResolver *stub = (TestStubResolver *)object;
+
+        g_hash_table_destroy (stub->lookups);
+        g_cond_clear (&stub->cond);
+        g_mutex_clear (&stub->mutex);
+
+        G_OBJECT_CLASS (test_stub_resolver_parent_class)->finalize (object);
+}
+
+static void
+test_stub_resolver_class_init (TestStubResolverClass *klass)
+{
+        G_OBJECT_CLASS (klass)->finalize = test_stub_resolver_finalize;
+        klass->lookup_by_name = stub_resolver_lookup_by_name;
+}
+
+static guint
+get_lookups (TestStubResolver *stub,
+             const char       *hostname)
+{
+        guint lookups;
+
+        g_mutex_lock (&stub->mutex);
+        lookups = GPOINTER_TO_UINT (g_hash_table_lookup (stub->lookups, hostname));
+        g_mutex_unlock (&stub->mutex);
+
+        return lookups;
+}
+
+static void
+set_blocked (TestStubResolver *stub,
+             gboolean          blocked)
+{
+        g_mutex_lock (&stub->mutex);
+        stub->blocked = blocked;
+        g_cond_broadcast (&stub->cond);
+        g_mutex_unlock (&stub->mutex);
+}
+
+typedef struct {
+        SoupSession *session;
+        SoupDNSCache *cache;
+        TestStubResolver *resolver;
+} DNSCacheTestData;
+
+static void
+setup_dns_cache_test (DNSCacheTestData *data,
+                      gconstpointer     test_data)
+{
+        data->session = soup_test_session_new (NULL);
+        data->resolver = g_object_new (test_stub_resolver_get_type (), NULL);
+        data->cache = soup_dns_cache_new ();
+        soup_dns_cache_set_resolver (data->cache, G_RESOLVER (data->resolver));
+        soup_session_add_feature (data->session, SOUP_SESSION_FEATURE (data->cache));
+}
+
+static void
+teardown_dns_cache_test (DNSCacheTestData *data,
+                         gconstpointer     test_data)
+{
+        soup_test_session_abort_unref (data->session);
+        g_object_unref (data->cache);
+        g_object_unref (data->resolver);
+}
+
+static void
+send_to_host (SoupSession *session,
+              const char  *host,
+              gboolean     async,
+              GQuark       error_domain,
+              int          error_code)
+{
+        SoupMessage *msg;
+        GUri *uri;
+        GBytes *body;
+        GError *error = NULL;
+
+        uri = soup_uri_copy (base_uri, SOUP_URI_HOST, host, SOUP_URI_NONE);
+        msg = soup_message_new_from_uri ("GET", uri);
+        soup_message_add_flags (msg, SOUP_MESSAGE_NEW_CONNECTION);
+        if (async)
+                body = soup_test_session_async_send (session, msg, NULL, &error);
+        else
+                body = soup_session_send_and_read (session, msg, NULL, &error);
+
+        if (error_domain) {
+                g_assert_error (error, error_domain, error_code);
+                g_error_free (error);
+        } else {
+                g_assert_no_error (error);
+                soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        }
+
+        g_clear_pointer (&body, g_bytes_unref);
+        g_object_unref (msg);
+        g_uri_unref (uri);
+}
+
+static void
+do_hit_test (DNSCacheTestData *data,
+             gconstpointer     test_data)
+{
+        send_to_host (data->session, "cached.test", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "cached.test"), ==, 1);
+
+        send_to_host (data->session, "cached.test", TRUE, 0, 0);
+        send_to_host (data->session, "cached.test", FALSE, 0, 0);
+        send_to_host (data->session, "CACHED.test", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "cached.test"), ==, 1);
+
+        /* IP literals are not looked up */
+        send_to_host (data->session, "127.0.0.1", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "127.0.0.1"), ==, 0);
+
+        soup_dns_cache_clear (data->cache);
+        send_to_host (data->session, "cached.test", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "cached.test"), ==, 2);
+}
+
+static void
+do_negative_test (DNSCacheTestData *data,
+                  gconstpointer     test_data)
+{
+        send_to_host (data->session, "missing.invalid", TRUE,
+                      G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+        send_to_host (data->session, "missing.invalid", TRUE,
+                      G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+        send_to_host (data->session, "missing.invalid", FALSE,
+                      G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+        g_assert_cmpuint (get_lookups (data->resolver, "missing.invalid"), ==, 1);
+
+        soup_dns_cache_set_negative_ttl (data->cache, 0);
+        soup_dns_cache_clear (data->cache);
+        send_to_host (data->session, "missing.invalid", TRUE,
+                      G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+        send_to_host (data->session, "missing.invalid", TRUE,
+                      G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+        g_assert_cmpuint (get_lookups (data->resolver, "missing.invalid"), ==, 3);
+}
+
+static void
+do_ttl_test (DNSCacheTestData *data,
+             gconstpointer     test_data)
+{
+        soup_dns_cache_set_ttl (data->cache, 60);
+        send_to_host (data->session, "expiring.test", TRUE, 0, 0);
+        send_to_host (data->session, "expiring.test", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "expiring.test"), ==, 1);
+
+        soup_dns_cache_advance_clock (data->cache, 60 * G_USEC_PER_SEC);
+        send_to_host (data->session, "expiring.test", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "expiring.test"), ==, 2);
+
+        soup_dns_cache_set_ttl (data->cache, 0);
+        send_to_host (data->session, "uncached.test", TRUE, 0, 0);
+        send_to_host (data->session, "uncached.test", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "uncached.test"), ==, 2);
+}
+
+static void
+do_prefetch_test (DNSCacheTestData *data,
+                  gconstpointer     test_data)
+{
+        const char * const hostnames[] = { "one.test", "two.test", "127.0.0.1", NULL };
+
+        soup_dns_cache_prefetch (data->cache, hostnames);
+        soup_dns_cache_wait_for_lookups (data->cache);
+        g_assert_cmpuint (get_lookups (data->resolver, "one.test"), ==, 1);
+        g_assert_cmpuint (get_lookups (data->resolver, "two.test"), ==, 1);
+        g_assert_cmpuint (get_lookups (data->resolver, "127.0.0.1"), ==, 0);
+
+        send_to_host (data->session, "one.test", TRUE, 0, 0);
+        send_to_host (data->session, "two.test", FALSE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "one.test"), ==, 1);
+        g_assert_cmpuint (get_lookups (data->resolver, "two.test"), ==, 1);
+
+        /* Names that are already cached are not resolved again */
+        soup_dns_cache_prefetch (data->cache, hostnames);
+        soup_dns_cache_wait_for_lookups (data->cache);
+        g_assert_cmpuint (get_lookups (data->resolver, "one.test"), ==, 1);
+}
+
+static void
+do_refresh_test (DNSCacheTestData *data,
+                 gconstpointer     test_data)
+{
+        int i;
+
+        soup_dns_cache_set_ttl (data->cache, 60);
+
+        for (i = 0; i < 4; i++)
+                send_to_host (data->session, "popular.test", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "popular.test"), ==, 1);
+
+        /* Used in the last quarter of its TTL, the name is resolved
+         * again in the background...
+         */
+        soup_dns_cache_advance_clock (data->cache, 50 * G_USEC_PER_SEC);
+        send_to_host (data->session, "popular.test", TRUE, 0, 0);
+        soup_dns_cache_wait_for_lookups (data->cache);
+        g_assert_cmpuint (get_lookups (data->resolver, "popular.test"), ==, 2);
+
+        /* ...so it is still cached after the original TTL */
+        soup_dns_cache_advance_clock (data->cache, 20 * G_USEC_PER_SEC);
+        send_to_host (data->session, "popular.test", TRUE, 0, 0);
+        g_assert_cmpuint (get_lookups (data->resolver, "popular.test"), ==, 2);
+}
+
+typedef struct {
+        gboolean done;
+        GError *error;
+} NextAddressData;
+
+static void
+next_address_cb (GSocketAddressEnumerator *enumerator,
+                 GAsyncResult             *result,
+                 NextAddressData          *next)
+{
+        GSocketAddress *address;
+
+        address = g_socket_address_enumerator_next_finish (enumerator, result, &next->error);
+        g_assert_true (address || next->error);
+        g_clear_object (&address);
+        next->done = TRUE;
+}
+
+static void
+do_cancel_test (DNSCacheTestData *data,
+                gconstpointer     test_data)
+{
+        GSocketConnectable *connectable;
+        GSocketAddressEnumerator *first, *second;
+        NextAddressData first_next = { FALSE, NULL }, second_next = { FALSE, NULL };
+        GCancellable *cancellable;
+        GList *addresses;
+        GUri *uri;
+
+        uri = soup_uri_copy (base_uri, SOUP_URI_HOST, "slow.test", SOUP_URI_NONE);
+        connectable = soup_dns_cache_create_connectable (data->cache, uri);
+        first = g_socket_connectable_enumerate (connectable);
+        second = g_socket_connectable_enumerate (connectable);
+        cancellable = g_cancellable_new ();
+
+        /* The second lookup is queued behind the first one, which
+         * doesn't finish until the resolver is unblocked.
+         */
+        set_blocked (data->resolver, TRUE);
+        g_socket_address_enumerator_next_async (first, NULL,
+                                                (GAsyncReadyCallback)next_address_cb,
+                                                &first_next);
+        g_socket_address_enumerator_next_async (second, cancellable,
+                                                (GAsyncReadyCallback)next_address_cb,
+                                                &second_next);
+
+        /* Cancelling it returns right away... */
+        g_cancellable_cancel (cancellable);
+        while (!second_next.done)
+                g_main_context_iteration (NULL, TRUE);
+        g_assert_error (second_next.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+        g_clear_error (&second_next.error);
+        g_assert_false (first_next.done);
+
+        /* ...and the first one still gets the addresses */
+        set_blocked (data->resolver, FALSE);
+        while (!first_next.done)
+                g_main_context_iteration (NULL, TRUE);
+        g_assert_no_error (first_next.error);
+        g_assert_cmpuint (get_lookups (data->resolver, "slow.test"), ==, 1);
+
+        addresses = soup_dns_cache_get_cached_addresses (data->cache, "slow.test");
+        g_assert_nonnull (addresses);
+        g_resolver_free_addresses (addresses);
+
+        g_object_unref (cancellable);
+        g_object_unref (first);
+        g_object_unref (second);
+        g_object_unref (connectable);
+        g_uri_unref (uri);
+}
+
+int
+main (int argc, char **argv)
+{
+        SoupServer *server;
+        int ret;
+
+        test_init (argc, argv, NULL);
+
+        server = soup_test_server_new (SOUP_TEST_SERVER_IN_THREAD);
+        soup_server_add_handler (server, NULL, server_callback, NULL, NULL);
+        base_uri = soup_test_server_get_uri (server, "http", NULL);
+
+        g_test_add ("/dns-cache/hit", DNSCacheTestData, NULL,
+                    setup_dns_cache_test, do_hit_test, teardown_dns_cache_test);
+        g_test_add ("/dns-cache/negative", DNSCacheTestData, NULL,
+                    setup_dns_cache_test, do_negative_test, teardown_dns_cache_test);
+        g_test_add ("/dns-cache/ttl", DNSCacheTestData, NULL,
+                    setup_dns_cache_test, do_ttl_test, teardown_dns_cache_test);
+        g_test_add ("/dns-cache/prefetch", DNSCacheTestData, NULL,
+                    setup_dns_cache_test, do_prefetch_test, teardown_dns_cache_test);
+        g_test_add ("/dns-cache/refresh", DNSCacheTestData, NULL,
+                    setup_dns_cache_test, do_refresh_test, teardown_dns_cache_test);
+        g_test_add ("/dns-cache/cancel", DNSCacheTestData, NULL,
+                    setup_dns_cache_test, do_cancel_test, teardown_dns_cache_test);
+
+        ret = g_test_run ();
+
+        g_uri_unref (base_uri);
+        soup_test_server_quit_unref (server);
+
+        test_cleanup ();
+        return ret;
+}
@@ -1,6 +1,7 @@
 /* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
 
 #include "test-utils.h"
+#include "soup-misc.h"
 
 typedef struct {
 	const char *name, *value;
@@ -788,6 +789,26 @@ static struct QValueTest {
 };
 static const int num_qvaluetests = G_N_ELEMENTS (qvaluetests);
 
+static struct ChooseQualityTest {
+	const char *header_value;
+	int chosen;
+} choosequalitytests[] = {
+	/* Offers are "zstd", "br", "gzip" */
+	{ "gzip, deflate, br, zstd", 0 },
+	{ "gzip, deflate", 2 },
+	{ "gzip;q=1.0, br;q=0.8, zstd;q=0.5", 2 },
+	{ "br;q=0.8, gzip;q=0.8", 1 },
+	{ "*", 0 },
+	{ "*;q=0.5, gzip", 2 },
+	{ "zstd;q=0, *", 1 },
+	{ "deflate", -1 },
+	{ "gzip;q=0", -1 },
+	{ "identity;q=1, gzip;q=0.5", -1 },
+	{ "identity;q=0.5, GZIP", 2 },
+	{ "", -1 }
+};
+static const int num_choosequalitytests = G_N_ELEMENTS (choosequalitytests);
+
 static struct ParamListTest {
 	gboolean strict;
 	const char *header_value;
@@ -994,6 +1015,19 @@ do_qvalue_tests (void)
 	}
 }
 
+static void
+do_choose_quality_tests (void)
+{
+	static const char * const offers[] = { "zstd", "br", "gzip", NULL };
+	int i;
+
+	for (i = 0; i < num_choosequalitytests; i++) {
+		debug_printf (1, "%2d. %s\n", i + 1, choosequalitytests[i].header_value);
+		g_assert_cmpint (soup_header_choose_quality_item (choosequalitytests[i].header_value, offers),
+				 ==, choosequalitytests[i].chosen);
+	}
+}
+
 static void
 do_param_list_tests (void)
 {
@@ -1286,6 +1320,7 @@ main (int argc, char **argv)
 	g_test_add_func ("/header-parsing/request", do_request_tests);
 	g_test_add_func ("/header-parsing/response", do_response_tests);
 	g_test_add_func ("/header-parsing/qvalue", do_qvalue_tests);
+	g_test_add_func ("/header-parsing/choose-quality", do_choose_quality_tests);
 	g_test_add_func ("/header-parsing/param-list", do_param_list_tests);
 	g_test_add_func ("/header-parsing/content-disposition", do_content_disposition_tests);
 	g_test_add_func ("/header-parsing/content-type", do_content_type_tests);
@@ -187,6 +187,133 @@ do_hsts_db_large_max_age_test (void)
 	g_remove (DB_FILE);
 }
 
+static void
+do_hsts_db_lazy_load_test (void)
+{
+	SoupHSTSEnforcer *enforcer;
+	SoupHSTSPolicy *policy;
+	GList *domains;
+
+	enforcer = soup_hsts_enforcer_db_new (DB_FILE);
+	policy = soup_hsts_policy_new ("example.org", 31536000, TRUE);
+	soup_hsts_enforcer_set_policy (enforcer, policy);
+	soup_hsts_policy_free (policy);
+	policy = soup_hsts_policy_new ("example.com", 31536000, FALSE);
+	soup_hsts_enforcer_set_policy (enforcer, policy);
+	soup_hsts_policy_free (policy);
+	g_object_unref (enforcer);
+
+	enforcer = g_object_new (SOUP_TYPE_HSTS_ENFORCER_DB,
+				 "filename", DB_FILE,
+				 "lazy-load", TRUE,
+				 NULL);
+	domains = soup_hsts_enforcer_get_domains (enforcer, FALSE);
+	g_assert_null (domains);
+
+	g_assert_true (soup_hsts_enforcer_has_valid_policy (enforcer, "example.org"));
+	g_assert_false (soup_hsts_enforcer_has_valid_policy (enforcer, "www.example.com"));
+	domains = soup_hsts_enforcer_get_domains (enforcer, FALSE);
+	g_assert_cmpuint (g_list_length (domains), ==, 1);
+	g_assert_cmpstr (domains->data, ==, "example.org");
+	g_list_free_full (domains, g_free);
+
+	/* Removing a policy not loaded yet */
+	policy = soup_hsts_policy_new ("example.com", SOUP_HSTS_POLICY_MAX_AGE_PAST, FALSE);
+	soup_hsts_enforcer_set_policy (enforcer, policy);
+	soup_hsts_policy_free (policy);
+	g_assert_false (soup_hsts_enforcer_has_valid_policy (enforcer, "example.com"));
+	g_object_unref (enforcer);
+
+	enforcer = soup_hsts_enforcer_db_new (DB_FILE);
+	domains = soup_hsts_enforcer_get_domains (enforcer, FALSE);
+	g_assert_cmpuint (g_list_length (domains), ==, 1);
+	g_list_free_full (domains, g_free);
+	g_object_unref (enforcer);
+
+	g_remove (DB_FILE);
+}
+
+static void
+count_changes (SoupHSTSEnforcer *enforcer,
+	       SoupHSTSPolicy   *old_policy,
+	       SoupHSTSPolicy   *new_policy,
+	       guint            *n_changes)
+{
+	(*n_changes)++;
+}
+
+static GDateTime *
+get_stored_expiry (const char *domain,
+		   gboolean   *include_subdomains)
+{
+	SoupHSTSEnforcer *enforcer;
+	GList *policies, *l;
+	GDateTime *expires = NULL;
+
+	enforcer = soup_hsts_enforcer_db_new (DB_FILE);
+	policies = soup_hsts_enforcer_get_policies (enforcer, FALSE);
+	for (l = policies; l; l = l->next) {
+		SoupHSTSPolicy *policy = l->data;
+
+		if (strcmp (soup_hsts_policy_get_domain (policy), domain) == 0) {
+			expires = g_date_time_ref (soup_hsts_policy_get_expires (policy));
+			*include_subdomains = soup_hsts_policy_includes_subdomains (policy);
+		}
+	}
+	g_list_free_full (policies, (GDestroyNotify)soup_hsts_policy_free);
+	g_object_unref (enforcer);
+
+	return expires;
+}
+
+static void
+do_hsts_db_refresh_test (void)
+{
+	SoupHSTSEnforcer *enforcer;
+	SoupHSTSPolicy *policy;
+	GDateTime *expires;
+	gboolean include_subdomains = FALSE;
+	gint64 now;
+	guint n_changes = 0, i;
+
+	now = g_get_real_time () / G_USEC_PER_SEC;
+	enforcer = soup_hsts_enforcer_db_new (DB_FILE);
+	g_signal_connect (enforcer, "changed", G_CALLBACK (count_changes), &n_changes);
+
+	/* Refreshing a policy every few seconds is not written again */
+	for (i = 0; i < 10; i++) {
+		expires = g_date_time_new_from_unix_utc (now + 31536000 + i * 10);
+		policy = soup_hsts_policy_new_full ("example.org", 31536000, expires, FALSE);
+		g_date_time_unref (expires);
+		soup_hsts_enforcer_set_policy (enforcer, policy);
+		soup_hsts_policy_free (policy);
+	}
+	g_assert_cmpuint (n_changes, ==, 10);
+	soup_hsts_enforcer_db_flush (SOUP_HSTS_ENFORCER_DB (enforcer));
+
+	expires = get_stored_expiry ("example.org", &include_subdomains);
+	g_assert_nonnull (expires);
+	g_assert_cmpint (g_date_time_to_unix (expires), ==, now + 31536000);
+	g_assert_false (include_subdomains);
+	g_date_time_unref (expires);
+
+	/* Changing a directive is */
+	expires = g_date_time_new_from_unix_utc (now + 31536000 + 100);
+	policy = soup_hsts_policy_new_full ("example.org", 31536000, expires, TRUE);
+	g_date_time_unref (expires);
+	soup_hsts_enforcer_set_policy (enforcer, policy);
+	soup_hsts_policy_free (policy);
+	g_object_unref (enforcer);
+
+	expires = get_stored_expiry ("example.org", &include_subdomains);
+	g_assert_nonnull (expires);
+	g_assert_cmpint (g_date_time_to_unix (expires), ==, now + 31536000 + 100);
+	g_assert_true (include_subdomains);
+	g_date_time_unref (expires);
+
+	g_remove (DB_FILE);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -209,6 +336,8 @@ main (int argc, char **argv)
 	g_test_add_func ("/hsts-db/basic", do_hsts_db_persistency_test);
 	g_test_add_func ("/hsts-db/subdomains", do_hsts_db_subdomains_test);
 	g_test_add_func ("/hsts-db/large-max-age", do_hsts_db_large_max_age_test);
+	g_test_add_func ("/hsts-db/lazy-load", do_hsts_db_lazy_load_test);
+	g_test_add_func ("/hsts-db/refresh", do_hsts_db_refresh_test);
 
 	ret = g_test_run ();
 
@@ -6,6 +6,10 @@
 
 #include "test-utils.h"
 #include "soup-uri-utils-private.h"
+#include "soup-hsts-preload.h"
+#include "soup-hsts-enforcer-private.h"
+
+#include <glib/gstdio.h>
 
 GUri *http_uri;
 GUri *https_uri;
@@ -575,6 +579,174 @@ do_hsts_get_policies_test (void)
 	g_object_unref(enforcer);
 }
 
+typedef struct {
+	SoupHSTSEnforcer *enforcer;
+	gboolean done;
+	gint n_reads;
+} SnapshotReaderData;
+
+static gpointer
+snapshot_reader_thread (gpointer user_data)
+{
+	SnapshotReaderData *data = user_data;
+
+	while (!g_atomic_int_get (&data->done)) {
+		g_assert_true (soup_hsts_enforcer_must_enforce_secure_transport (data->enforcer, "www.example.com"));
+		g_assert_false (soup_hsts_enforcer_must_enforce_secure_transport (data->enforcer, "example.org"));
+		g_atomic_int_inc (&data->n_reads);
+	}
+
+	return NULL;
+}
+
+static void
+do_hsts_snapshot_test (void)
+{
+	SoupHSTSEnforcer *enforcer = soup_hsts_enforcer_new ();
+	SnapshotReaderData data = { enforcer, FALSE, 0 };
+	GThread *readers[4];
+	char *domain;
+	guint n_domains = 1000, n_builds, i;
+
+	soup_hsts_enforcer_set_session_policy (enforcer, "example.com", TRUE);
+
+	/* Every change is seen by the next read, but the snapshot is
+	 * not rebuilt for each of them.
+	 */
+	for (i = 0; i < n_domains; i++) {
+		domain = g_strdup_printf ("site%u.example.net", i);
+		soup_hsts_enforcer_set_session_policy (enforcer, domain, FALSE);
+		g_assert_true (soup_hsts_enforcer_must_enforce_secure_transport (enforcer, domain));
+		g_assert_false (soup_hsts_enforcer_must_enforce_secure_transport (enforcer, "example.org"));
+		g_free (domain);
+	}
+	n_builds = soup_hsts_enforcer_get_n_snapshot_builds (enforcer);
+	g_assert_cmpuint (n_builds, <, n_domains / 2);
+
+	/* Once policies stop changing, reads use the snapshot */
+	for (i = 0; i < 100; i++)
+		g_assert_true (soup_hsts_enforcer_must_enforce_secure_transport (enforcer, "www.example.com"));
+	n_builds = soup_hsts_enforcer_get_n_snapshot_builds (enforcer);
+	for (i = 0; i < 100; i++)
+		g_assert_true (soup_hsts_enforcer_must_enforce_secure_transport (enforcer, "www.example.com"));
+	g_assert_cmpuint (soup_hsts_enforcer_get_n_snapshot_builds (enforcer), ==, n_builds);
+
+	/* Snapshots replaced while being read stay valid */
+	for (i = 0; i < G_N_ELEMENTS (readers); i++)
+		readers[i] = g_thread_new ("snapshot-reader", snapshot_reader_thread, &data);
+	for (i = 0; i < n_domains; i++) {
+		SoupHSTSPolicy *policy;
+
+		domain = g_strdup_printf ("host%u.example.net", i);
+		policy = soup_hsts_policy_new (domain, 3600, FALSE);
+		soup_hsts_enforcer_set_policy (enforcer, policy);
+		soup_hsts_policy_free (policy);
+		policy = soup_hsts_policy_new (domain, SOUP_HSTS_POLICY_MAX_AGE_PAST, FALSE);
+		soup_hsts_enforcer_set_policy (enforcer, policy);
+		soup_hsts_policy_free (policy);
+		g_free (domain);
+	}
+	g_atomic_int_set (&data.done, TRUE);
+	for (i = 0; i < G_N_ELEMENTS (readers); i++)
+		g_thread_join (readers[i]);
+	g_assert_cmpint (data.n_reads, >, 0);
+
+	g_object_unref (enforcer);
+}
+
+/* Built by generate-hsts-preload.py from the lists in hsts-data */
+#define PRELOAD_LIST(name) (g_test_get_filename (G_TEST_BUILT, "hsts-" name ".bin", NULL))
+
+static void
+do_hsts_preload_test (void)
+{
+	SoupHSTSEnforcer *enforcer = soup_hsts_enforcer_new ();
+	SoupSession *session = hsts_session_new (enforcer);
+	SoupHSTSPreloadList *list;
+	GError *error = NULL;
+	char *filename;
+	int fd;
+
+	/* Not a preload list */
+	fd = g_file_open_tmp ("hsts-preload-XXXXXX", &filename, &error);
+	g_assert_no_error (error);
+	g_close (fd, NULL);
+	g_file_set_contents (filename, SOUP_HSTS_PRELOAD_MAGIC, -1, &error);
+	g_assert_no_error (error);
+	g_assert_false (soup_hsts_enforcer_load_preload_list (enforcer, filename, &error));
+	g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL);
+	g_clear_error (&error);
+	g_unlink (filename);
+	g_free (filename);
+
+	session_get_uri (session, "http://localhost", SOUP_STATUS_MOVED_PERMANENTLY, FALSE);
+
+	g_assert_true (soup_hsts_enforcer_load_preload_list (enforcer, PRELOAD_LIST ("preload"), &error));
+	g_assert_no_error (error);
+
+	g_assert_false (soup_hsts_enforcer_has_valid_policy (enforcer, "localhost"));
+	session_get_uri (session, "http://localhost", SOUP_STATUS_OK, TRUE);
+	session_get_uri (session, "http://subdomain.localhost", SOUP_STATUS_MOVED_PERMANENTLY, FALSE);
+
+	/* Loading another list replaces the previous one */
+	g_assert_true (soup_hsts_enforcer_load_preload_list (enforcer, PRELOAD_LIST ("preload-subdomains"), &error));
+	g_assert_no_error (error);
+
+	session_get_uri (session, "http://subdomain.localhost", SOUP_STATUS_NONE, TRUE);
+
+	soup_test_session_abort_unref (session);
+	g_object_unref (enforcer);
+
+	/* Entries of the Chromium list that are not force-https are skipped */
+	list = soup_hsts_preload_list_new (PRELOAD_LIST ("preload-subdomains"), &error);
+	g_assert_no_error (error);
+	g_assert_cmpuint (soup_hsts_preload_list_get_size (list), ==, 2);
+	g_assert_true (soup_hsts_preload_list_must_enforce (list, "www.example.org"));
+	g_assert_false (soup_hsts_preload_list_must_enforce (list, "pinned.example.com"));
+	soup_hsts_preload_list_free (list);
+}
+
+static void
+do_hsts_preload_lookup_test (void)
+{
+	SoupHSTSPreloadList *list;
+	GError *error = NULL;
+	char *host;
+	guint n_domains, n_lookups, i, n_enforced = 0;
+	gint64 start, elapsed;
+
+	/* site<i>.example<i % 97>.com, with the subdomains of the even ones */
+	n_domains = 1000;
+	list = soup_hsts_preload_list_new (PRELOAD_LIST ("preload-lookup"), &error);
+	g_assert_no_error (error);
+	g_assert_cmpuint (soup_hsts_preload_list_get_size (list), ==, n_domains);
+
+	g_assert_true (soup_hsts_preload_list_must_enforce (list, "SITE1.example1.com"));
+	g_assert_false (soup_hsts_preload_list_must_enforce (list, "www.site1.example1.com"));
+	g_assert_true (soup_hsts_preload_list_must_enforce (list, "www.site2.example2.com"));
+	g_assert_false (soup_hsts_preload_list_must_enforce (list, "example2.com"));
+	g_assert_false (soup_hsts_preload_list_must_enforce (list, "xsite2.example2.com"));
+
+	n_lookups = g_test_perf () ? 1500000 : n_domains * 10;
+	start = g_get_monotonic_time ();
+	for (i = 0; i < n_lookups; i++) {
+		host = g_strdup_printf ("www.site%u.example%u.com", i % (n_domains * 2), i % 97);
+		if (soup_hsts_preload_list_must_enforce (list, host))
+			n_enforced++;
+		g_free (host);
+	}
+	elapsed = MAX (g_get_monotonic_time () - start, 1);
+	g_assert_cmpuint (n_enforced, >, 0);
+
+	if (g_test_perf ()) {
+		g_test_maximized_result ((double)n_lookups * G_USEC_PER_SEC / elapsed,
+					 "%.0f preload lookups/s",
+					 (double)n_lookups * G_USEC_PER_SEC / elapsed);
+	}
+
+	soup_hsts_preload_list_free (list);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -622,6 +794,9 @@ main (int argc, char **argv)
 	g_test_add_func ("/hsts/idna-addresses", do_hsts_idna_addresses_test);
 	g_test_add_func ("/hsts/get-domains", do_hsts_get_domains_test);
 	g_test_add_func ("/hsts/get-policies", do_hsts_get_policies_test);
+	g_test_add_func ("/hsts/snapshot", do_hsts_snapshot_test);
+	g_test_add_func ("/hsts/preload", do_hsts_preload_test);
+	g_test_add_func ("/hsts/preload/lookup", do_hsts_preload_lookup_test);
 
 	ret = g_test_run ();
 
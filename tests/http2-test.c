@@ -19,6 +19,7 @@
 
 #include "test-utils.h"
 #include "soup-connection.h"
+#include "soup-dns-cache-private.h"
 #include "soup-message-private.h"
 #include "soup-message-headers-private.h"
 #include "soup-server-message-private.h"
@@ -515,6 +516,52 @@ do_post_file_async_test (Test *test, gconstpointer data)
         g_uri_unref (uri);
 }
 
+static void
+do_post_compressed_test (Test *test, gconstpointer data)
+{
+        GUri *uri;
+        SoupMessage *msg;
+        GInputStream *stream;
+        GBytes *response;
+        GString *text;
+        GBytes *bytes;
+        SoupMessageMetrics *metrics;
+        GError *error = NULL;
+        guint i;
+
+        text = g_string_new (NULL);
+        for (i = 0; i < 4096; i++)
+                g_string_append_printf (text, "line %u of the request body\n", i % 64);
+        bytes = g_string_free_to_bytes (text);
+
+        uri = g_uri_parse_relative (base_uri, "/echo_post_gzip", SOUP_HTTP_URI_FLAGS, NULL);
+        msg = soup_message_new_from_uri (SOUP_METHOD_POST, uri);
+
+        /* The length is unknown, so the body goes through the data provider as it is compressed */
+        stream = g_memory_input_stream_new_from_bytes (bytes);
+        soup_message_set_request_body (msg, "text/plain", stream, -1);
+        g_object_unref (stream);
+        soup_message_set_request_body_encoding (msg, "gzip");
+        soup_message_add_flags (msg, SOUP_MESSAGE_COLLECT_METRICS);
+
+        response = soup_test_session_async_send (test->session, msg, NULL, &error);
+        g_assert_no_error (error);
+        g_assert_cmpuint (soup_message_get_http_version (msg), ==, SOUP_HTTP_2_0);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+        g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (msg), "X-Request-Encoding"), ==, "gzip");
+        g_assert_true (g_bytes_equal (response, bytes));
+
+        metrics = soup_message_get_metrics (msg);
+        g_assert_nonnull (metrics);
+        g_assert_cmpuint (soup_message_metrics_get_request_body_size (metrics), ==, g_bytes_get_size (bytes));
+        g_assert_cmpuint (soup_message_metrics_get_request_body_bytes_sent (metrics), <, soup_message_metrics_get_request_body_size (metrics));
+
+        g_bytes_unref (response);
+        g_bytes_unref (bytes);
+        g_object_unref (msg);
+        g_uri_unref (uri);
+}
+
 static gboolean
 on_delayed_auth (SoupAuth *auth)
 {
@@ -712,6 +759,82 @@ do_connections_test (Test *test, gconstpointer data)
         g_main_context_unref (async_context);
 }
 
+typedef struct {
+        GHashTable *connections;
+        guint complete_count;
+} MultipleConnectionsData;
+
+static void
+on_multiple_connections_send_ready (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+        SoupSession *sess = SOUP_SESSION (source);
+        SoupMessage *msg = soup_session_get_async_result_message (sess, res);
+        MultipleConnectionsData *data = user_data;
+        GError *error = NULL;
+        GInputStream *stream;
+        GBytes *result;
+
+        stream = soup_session_send_finish (sess, res, &error);
+        g_assert_no_error (error);
+        g_assert_nonnull (stream);
+
+        g_assert_cmpuint (soup_message_get_http_version (msg), ==, SOUP_HTTP_2_0);
+        g_hash_table_add (data->connections, soup_message_get_connection (msg));
+
+        result = read_stream_to_bytes_sync (stream);
+        g_object_unref (stream);
+        g_assert_cmpstr (g_bytes_get_data (result, NULL), ==, "Hello world");
+        g_bytes_unref (result);
+
+        data->complete_count++;
+}
+
+static void
+do_multiple_connections_test (Test *test, gconstpointer data)
+{
+        MultipleConnectionsData mdata = { NULL, 0 };
+        GMainContext *async_context;
+        SoupMessage *msg;
+        GBytes *response;
+        GUri *uri;
+        GError *error = NULL;
+
+        if (g_getenv ("ASAN_OPTIONS")) {
+                g_test_skip ("Flakey on asan GitLab runner");
+                return;
+        }
+
+        g_assert_cmpuint (soup_session_get_max_http2_conns_per_host (test->session), ==, 1);
+        soup_session_set_max_http2_conns_per_host (test->session, 2);
+
+        async_context = g_main_context_ref_thread_default ();
+        mdata.connections = g_hash_table_new (NULL, NULL);
+
+        /* Get the server settings before sending more requests */
+        msg = soup_message_new_from_uri (SOUP_METHOD_GET, base_uri);
+        response = soup_test_session_async_send (test->session, msg, NULL, &error);
+        g_assert_no_error (error);
+        g_bytes_unref (response);
+        g_object_unref (msg);
+
+        /* The server allows 100 concurrent streams */
+        uri = g_uri_parse_relative (base_uri, "/slow", SOUP_HTTP_URI_FLAGS, NULL);
+        for (unsigned int i = 0; i < 150; ++i) {
+                msg = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+                soup_session_send_async (test->session, msg, G_PRIORITY_DEFAULT, NULL, on_multiple_connections_send_ready, &mdata);
+                g_object_unref (msg);
+        }
+
+        while (mdata.complete_count != 150)
+                g_main_context_iteration (async_context, TRUE);
+
+        g_assert_cmpuint (g_hash_table_size (mdata.connections), ==, 2);
+
+        g_hash_table_destroy (mdata.connections);
+        g_uri_unref (uri);
+        g_main_context_unref (async_context);
+}
+
 static void
 do_misdirected_request_test (Test *test, gconstpointer data)
 {
@@ -732,6 +855,179 @@ do_misdirected_request_test (Test *test, gconstpointer data)
         g_uri_unref (uri);
 }
 
+static SoupConnection *
+send_and_get_connection (SoupSession *session,
+                         GUri        *uri,
+                         const char  *host,
+                         const char  *path,
+                         const char  *expected_body)
+{
+        GUri *host_uri, *msg_uri;
+        SoupMessage *msg;
+        SoupConnection *conn;
+        GBytes *response;
+        GError *error = NULL;
+
+        host_uri = soup_uri_copy (uri, SOUP_URI_HOST, host, SOUP_URI_NONE);
+        msg_uri = g_uri_parse_relative (host_uri, path, SOUP_HTTP_URI_FLAGS, NULL);
+        msg = soup_message_new_from_uri (SOUP_METHOD_GET, msg_uri);
+        response = soup_test_session_async_send (session, msg, NULL, &error);
+        g_assert_no_error (error);
+        g_assert_cmpstr (g_bytes_get_data (response, NULL), ==, expected_body);
+        g_assert_cmpuint (soup_message_get_http_version (msg), ==, SOUP_HTTP_2_0);
+
+        conn = soup_message_get_connection (msg);
+        g_assert_nonnull (conn);
+        /* The session keeps the connection alive */
+        g_object_unref (conn);
+
+        g_bytes_unref (response);
+        g_object_unref (msg);
+        g_uri_unref (msg_uri);
+        g_uri_unref (host_uri);
+
+        return conn;
+}
+
+static void
+do_coalescing_test (Test *test, gconstpointer data)
+{
+        SoupDNSCache *dns_cache;
+        SoupConnection *conn, *coalesced_conn, *misdirected_conn;
+        GSocketAddress *remote_address;
+
+        dns_cache = soup_dns_cache_new ();
+        soup_session_add_feature (test->session, SOUP_SESSION_FEATURE (dns_cache));
+        g_object_unref (dns_cache);
+
+        /* The test certificate is valid for both localhost and 127.0.0.1 */
+        conn = send_and_get_connection (test->session, base_uri, "localhost", "/", "Hello world");
+        remote_address = soup_connection_get_remote_address (conn);
+        g_assert_true (G_IS_INET_SOCKET_ADDRESS (remote_address));
+        if (g_inet_address_get_family (g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (remote_address))) != G_SOCKET_FAMILY_IPV4) {
+                g_test_skip ("localhost did not connect to 127.0.0.1");
+                return;
+        }
+
+        coalesced_conn = send_and_get_connection (test->session, base_uri, "127.0.0.1", "/", "Hello world");
+        g_assert_true (coalesced_conn == conn);
+
+        /* The server refuses requests for 127.0.0.1 on the connection
+         * opened for localhost: they are sent again on a new connection,
+         * which is used from then on.
+         */
+        misdirected_conn = send_and_get_connection (test->session, base_uri, "127.0.0.1", "/misdirected_origin", "Success!");
+        g_assert_false (misdirected_conn == conn);
+        g_assert_true (send_and_get_connection (test->session, base_uri, "127.0.0.1", "/misdirected_origin", "Success!") == misdirected_conn);
+        g_assert_true (send_and_get_connection (test->session, base_uri, "localhost", "/", "Hello world") == conn);
+}
+
+/* Resolves every name to the test server and counts the lookups */
+typedef struct {
+        GResolver parent;
+
+        GMutex mutex;
+        GHashTable *lookups;
+} TestStubResolver;
+
+typedef GResolverClass TestStubResolverClass;
+
+static GType test_stub_resolver_get_type (void);
+G_DEFINE_TYPE (TestStubResolver, test_stub_resolver, G_TYPE_RESOLVER)
+
+static GList *
+stub_resolver_lookup_by_name (GResolver     *resolver,
+                              const char    *hostname,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+        TestStubResolver *stub = (TestStubResolver *)resolver;
+
+        g_mutex_lock (&stub->mutex);
+        g_hash_table_insert (stub->lookups, g_strdup (hostname),
+                             GUINT_TO_POINTER (GPOINTER_TO_UINT (g_hash_table_lookup (stub->lookups, hostname)) + 1));
+        g_mutex_unlock (&stub->mutex);
+
+        return g_list_prepend (NULL, g_inet_address_new_from_string ("127.0.0.1"));
+}
+
+static void
+test_stub_resolver_init (TestStubResolver *stub)
+{
+        g_mutex_init (&stub->mutex);
+        stub->lookups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+test_stub_resolver_finalize (GObject *object)
+{
+        TestStubResolver *stub = (TestStubResolver *)object;
+
+        g_hash_table_destroy (stub->lookups);
+        g_mutex_clear (&stub->mutex);
+
+        G_OBJECT_CLASS (test_stub_resolver_parent_class)->finalize (object);
+}
+
+static void
+test_stub_resolver_class_init (TestStubResolverClass *klass)
+{
+        G_OBJECT_CLASS (klass)->finalize = test_stub_resolver_finalize;
+        klass->lookup_by_name = stub_resolver_lookup_by_name;
+}
+
+static guint
+get_lookups (TestStubResolver *stub,
+             const char       *hostname)
+{
+        guint lookups;
+
+        g_mutex_lock (&stub->mutex);
+        lookups = GPOINTER_TO_UINT (g_hash_table_lookup (stub->lookups, hostname));
+        g_mutex_unlock (&stub->mutex);
+
+        return lookups;
+}
+
+static void
+do_coalescing_dns_cache_test (Test *test, gconstpointer data)
+{
+        TestStubResolver *resolver;
+        SoupDNSCache *dns_cache;
+        SoupConnection *conn;
+        const char *hostnames[] = { "coalesced.localhost", NULL };
+        int i;
+
+        resolver = g_object_new (test_stub_resolver_get_type (), NULL);
+        dns_cache = soup_dns_cache_new ();
+        soup_dns_cache_set_resolver (dns_cache, G_RESOLVER (resolver));
+        soup_dns_cache_set_ttl (dns_cache, 60);
+        soup_session_add_feature (test->session, SOUP_SESSION_FEATURE (dns_cache));
+
+        /* The test certificate is valid for both names */
+        conn = send_and_get_connection (test->session, base_uri, "localhost", "/", "Hello world");
+
+        /* Names are only coalesced once they are in the cache */
+        soup_dns_cache_prefetch (dns_cache, hostnames);
+        soup_dns_cache_wait_for_lookups (dns_cache);
+        g_assert_cmpuint (get_lookups (resolver, "coalesced.localhost"), ==, 1);
+
+        for (i = 0; i < 4; i++)
+                g_assert_true (send_and_get_connection (test->session, base_uri, "coalesced.localhost", "/", "Hello world") == conn);
+
+        /* Looking for a connection to coalesce is not a use of the
+         * name, so it's not refreshed like a popular one when its
+         * TTL is about to expire.
+         */
+        soup_dns_cache_advance_clock (dns_cache, 50 * G_USEC_PER_SEC);
+        g_assert_true (send_and_get_connection (test->session, base_uri, "coalesced.localhost", "/", "Hello world") == conn);
+        soup_dns_cache_wait_for_lookups (dns_cache);
+        g_assert_cmpuint (get_lookups (resolver, "coalesced.localhost"), ==, 1);
+
+        g_object_unref (dns_cache);
+        g_object_unref (resolver);
+}
+
 static void
 log_printer (SoupLogger *logger,
              SoupLoggerLogLevel level,
@@ -1250,8 +1546,15 @@ server_handler (SoupServer        *server,
                 GHashTable        *query,
                 gpointer           user_data)
 {
+        SoupServerConnection *server_conn = soup_server_message_get_connection (msg);
+        const char *host = g_uri_get_host (soup_server_message_get_uri (msg));
+
         g_assert_cmpuint (soup_server_message_get_http_version (msg), ==, SOUP_HTTP_2_0);
 
+        /* Remember the host each connection was opened for */
+        if (!g_object_get_data (G_OBJECT (server_conn), "origin-host"))
+                g_object_set_data_full (G_OBJECT (server_conn), "origin-host", g_strdup (host), g_free);
+
         if (strcmp (path, "/") == 0 || strcmp (path, "/slow") == 0 || strcmp (path, "/timeout") == 0) {
                 gboolean is_slow = path[1] == 's';
                 gboolean is_timeout = path[1] == 't';
@@ -1304,6 +1607,32 @@ server_handler (SoupServer        *server,
                                                   SOUP_MEMORY_COPY,
                                                   request_body->data,
                                                   request_body->length);
+        } else if (strcmp (path, "/echo_post_gzip") == 0) {
+                GConverter *decompressor;
+                GInputStream *raw, *decoded;
+                GBytes *request_bytes, *body;
+
+                g_assert_cmpstr (soup_message_headers_get_one (soup_server_message_get_request_headers (msg), "Content-Encoding"), ==, "gzip");
+
+                request_bytes = soup_message_body_flatten (soup_server_message_get_request_body (msg));
+                raw = g_memory_input_stream_new_from_bytes (request_bytes);
+                decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+                decoded = g_converter_input_stream_new (raw, decompressor);
+                body = read_stream_to_bytes_sync (decoded);
+
+                soup_message_headers_append (soup_server_message_get_response_headers (msg),
+                                             "X-Request-Encoding", "gzip");
+                soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+                soup_server_message_set_response (msg, "text/plain",
+                                                  SOUP_MEMORY_COPY,
+                                                  g_bytes_get_data (body, NULL),
+                                                  g_bytes_get_size (body));
+
+                g_bytes_unref (body);
+                g_object_unref (decoded);
+                g_object_unref (decompressor);
+                g_object_unref (raw);
+                g_bytes_unref (request_bytes);
         } else if (strcmp (path, "/misdirected_request") == 0) {
                 static SoupServerConnection *conn = NULL;
 
@@ -1318,6 +1647,15 @@ server_handler (SoupServer        *server,
                                                           SOUP_MEMORY_STATIC,
                                                           "Success!", 8);
                 }
+        } else if (strcmp (path, "/misdirected_origin") == 0) {
+                if (g_strcmp0 (g_object_get_data (G_OBJECT (server_conn), "origin-host"), host) != 0) {
+                        soup_server_message_set_status (msg, SOUP_STATUS_MISDIRECTED_REQUEST, NULL);
+                } else {
+                        soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+                        soup_server_message_set_response (msg, "text/plain",
+                                                          SOUP_MEMORY_STATIC,
+                                                          "Success!", 8);
+                }
         } else if (strcmp (path, "/auth") == 0) {
                 soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
                 soup_server_message_set_response (msg, "text/plain",
@@ -1441,6 +1779,10 @@ main (int argc, char **argv)
                     setup_session,
                     do_post_file_async_test,
                     teardown_session);
+        g_test_add ("/http2/post/compressed", Test, NULL,
+                    setup_session,
+                    do_post_compressed_test,
+                    teardown_session);
         g_test_add ("/http2/paused/async", Test, NULL,
                     setup_session,
                     do_paused_async_test,
@@ -1461,10 +1803,22 @@ main (int argc, char **argv)
                     setup_session,
                     do_connections_test,
                     teardown_session);
+        g_test_add ("/http2/connections/multiple", Test, NULL,
+                    setup_session,
+                    do_multiple_connections_test,
+                    teardown_session);
         g_test_add ("/http2/misdirected_request", Test, NULL,
                     setup_session,
                     do_misdirected_request_test,
                     teardown_session);
+        g_test_add ("/http2/coalescing", Test, NULL,
+                    setup_session,
+                    do_coalescing_test,
+                    teardown_session);
+        g_test_add ("/http2/coalescing/dns-cache", Test, NULL,
+                    setup_session,
+                    do_coalescing_dns_cache_test,
+                    teardown_session);
         g_test_add ("/http2/logging", Test, NULL,
                     setup_session,
                     do_logging_test,
@@ -0,0 +1,130 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*- */
+
+#include "test-utils.h"
+#include "soup-rcu.h"
+
+#define VERSION_MAGIC 0x50c0ffee
+#define N_READERS 4
+#define N_REPLACES 20000
+
+typedef struct {
+	int magic;
+	int version;
+} Version;
+
+static int n_versions_freed;
+
+static Version *
+version_new (int version)
+{
+	Version *data = g_new (Version, 1);
+
+	data->magic = VERSION_MAGIC;
+	data->version = version;
+
+	return data;
+}
+
+static void
+version_free (Version *data)
+{
+	/* Readers still holding it would see this */
+	data->magic = 0;
+	g_atomic_int_inc (&n_versions_freed);
+	g_free (data);
+}
+
+typedef struct {
+	SoupRcuPointer *rcu;
+	gboolean done;
+} ReadersData;
+
+static gpointer
+reader_thread (gpointer user_data)
+{
+	ReadersData *data = user_data;
+	int last_version = 0;
+
+	while (!g_atomic_int_get (&data->done)) {
+		Version *version;
+		guint slot;
+
+		version = soup_rcu_pointer_read_lock (data->rcu, &slot);
+		g_assert_nonnull (version);
+		g_assert_cmpint (version->magic, ==, VERSION_MAGIC);
+		/* Versions are only published forward */
+		g_assert_cmpint (version->version, >=, last_version);
+		last_version = version->version;
+		g_thread_yield ();
+		g_assert_cmpint (version->magic, ==, VERSION_MAGIC);
+		soup_rcu_pointer_read_unlock (data->rcu, slot);
+	}
+
+	return NULL;
+}
+
+static void
+do_concurrent_replace_test (void)
+{
+	SoupRcuPointer rcu;
+	ReadersData data;
+	GThread *readers[N_READERS];
+	int i;
+
+	n_versions_freed = 0;
+	soup_rcu_pointer_init (&rcu, (GDestroyNotify)version_free);
+	soup_rcu_pointer_replace (&rcu, version_new (0));
+
+	data.rcu = &rcu;
+	data.done = FALSE;
+	for (i = 0; i < N_READERS; i++)
+		readers[i] = g_thread_new ("rcu-reader", reader_thread, &data);
+
+	/* Each replaced version is freed once its readers are done */
+	for (i = 1; i <= N_REPLACES; i++) {
+		soup_rcu_pointer_replace (&rcu, version_new (i));
+		g_assert_cmpint (g_atomic_int_get (&n_versions_freed), ==, i);
+	}
+
+	g_atomic_int_set (&data.done, TRUE);
+	for (i = 0; i < N_READERS; i++)
+		g_thread_join (readers[i]);
+
+	g_assert_cmpint (((Version *)soup_rcu_pointer_get (&rcu))->version, ==, N_REPLACES);
+	soup_rcu_pointer_clear (&rcu);
+	g_assert_cmpint (n_versions_freed, ==, N_REPLACES + 1);
+}
+
+static void
+do_read_without_data_test (void)
+{
+	SoupRcuPointer rcu;
+	guint slot;
+
+	soup_rcu_pointer_init (&rcu, g_free);
+	g_assert_null (soup_rcu_pointer_read_lock (&rcu, &slot));
+	soup_rcu_pointer_read_unlock (&rcu, slot);
+
+	/* Nothing to wait for */
+	soup_rcu_pointer_replace (&rcu, g_strdup ("data"));
+	g_assert_cmpstr (soup_rcu_pointer_read_lock (&rcu, &slot), ==, "data");
+	soup_rcu_pointer_read_unlock (&rcu, slot);
+	soup_rcu_pointer_clear (&rcu);
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+
+	test_init (argc, argv, NULL);
+
+	g_test_add_func ("/rcu/empty", do_read_without_data_test);
+	g_test_add_func ("/rcu/concurrent-replace", do_concurrent_replace_test);
+
+	ret = g_test_run ();
+
+	test_cleanup ();
+
+	return ret;
+}
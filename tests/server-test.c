@@ -1355,6 +1355,272 @@ do_idle_connection_closed_test (ServerData *sd, gconstpointer test_data)
                 g_main_context_iteration (NULL, FALSE);
 }
 
+static const char *encoder_text =
+	"The quick brown fox jumps over the lazy dog. "
+	"The quick brown fox jumps over the lazy dog. "
+	"The quick brown fox jumps over the lazy dog. "
+	"The quick brown fox jumps over the lazy dog. "
+	"The quick brown fox jumps over the lazy dog. "
+	"The quick brown fox jumps over the lazy dog. "
+	"The quick brown fox jumps over the lazy dog. "
+	"The quick brown fox jumps over the lazy dog. ";
+
+static gboolean
+encoder_add_chunk (gpointer user_data)
+{
+	SoupServerMessage *msg = user_data;
+	SoupMessageBody *body = soup_server_message_get_response_body (msg);
+
+	if (body->length < 3 * strlen (encoder_text))
+		soup_message_body_append (body, SOUP_MEMORY_STATIC, encoder_text, strlen (encoder_text));
+	else
+		soup_message_body_complete (body);
+	soup_server_message_unpause (msg);
+
+	return body->complete ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+static void
+encoder_server_callback (SoupServer        *server,
+			 SoupServerMessage *msg,
+			 const char        *path,
+			 GHashTable        *query,
+			 gpointer           data)
+{
+	soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+
+	if (!strcmp (path, "/small")) {
+		soup_server_message_set_response (msg, "text/plain",
+						  SOUP_MEMORY_STATIC, "index", 5);
+	} else if (!strcmp (path, "/image")) {
+		soup_server_message_set_response (msg, "image/png",
+						  SOUP_MEMORY_STATIC, encoder_text, strlen (encoder_text));
+	} else if (!strcmp (path, "/chunked") || !strcmp (path, "/content-length")) {
+		GSource *source;
+
+		/* The body is written after the headers, either
+		 * chunked or up to its announced length.
+		 */
+		if (!strcmp (path, "/chunked")) {
+			soup_message_headers_set_encoding (soup_server_message_get_response_headers (msg),
+							   SOUP_ENCODING_CHUNKED);
+		} else {
+			soup_message_headers_set_content_length (soup_server_message_get_response_headers (msg),
+								 3 * strlen (encoder_text));
+		}
+		soup_message_headers_set_content_type (soup_server_message_get_response_headers (msg),
+						       "text/plain", NULL);
+		soup_server_message_pause (msg);
+
+		source = g_timeout_source_new (10);
+		g_source_set_callback (source, encoder_add_chunk,
+				       g_object_ref (msg), g_object_unref);
+		g_source_attach (source, g_main_context_get_thread_default ());
+		g_source_unref (source);
+	} else {
+		soup_message_headers_replace (soup_server_message_get_response_headers (msg),
+					      "ETag", "\"text\"");
+		soup_server_message_set_response (msg, "text/plain",
+						  SOUP_MEMORY_STATIC, encoder_text, strlen (encoder_text));
+	}
+}
+
+static void
+server_setup_encoder (ServerData *sd, gconstpointer test_data)
+{
+	SoupContentEncoder *encoder;
+
+	server_setup_nohandler (sd, test_data);
+	server_add_handler (sd, NULL, encoder_server_callback, NULL, NULL);
+
+	encoder = soup_content_encoder_new ();
+	soup_server_set_content_encoder (sd->server, encoder);
+	g_object_unref (encoder);
+}
+
+static GBytes *
+encoder_request (SoupSession  *session,
+		 ServerData   *sd,
+		 const char   *path,
+		 const char   *accept_encoding,
+		 SoupMessage **msg_out)
+{
+	GUri *uri;
+	SoupMessage *msg;
+	GBytes *body;
+
+	uri = g_uri_parse_relative (sd->base_uri, path, SOUP_HTTP_URI_FLAGS, NULL);
+	msg = soup_message_new_from_uri ("GET", uri);
+	g_uri_unref (uri);
+	if (accept_encoding) {
+		soup_message_headers_replace (soup_message_get_request_headers (msg),
+					      "Accept-Encoding", accept_encoding);
+	}
+
+	body = soup_test_session_async_send (session, msg, NULL, NULL);
+	soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+	*msg_out = msg;
+
+	return body;
+}
+
+/* Decodes a gzip body received without SoupContentDecoder, checking
+ * that the compressed stream is complete.
+ */
+static GBytes *
+decode_gzip_body (GBytes *body)
+{
+	GConverter *decompressor;
+	GByteArray *decoded;
+	const guint8 *data;
+	gsize size, offset = 0;
+	GConverterResult result;
+	GError *error = NULL;
+
+	decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+	decoded = g_byte_array_new ();
+	data = g_bytes_get_data (body, &size);
+	do {
+		guint8 buf[4096];
+		gsize bytes_read, bytes_written;
+
+		result = g_converter_convert (decompressor, data + offset, size - offset,
+					      buf, sizeof (buf), G_CONVERTER_INPUT_AT_END,
+					      &bytes_read, &bytes_written, &error);
+		g_assert_no_error (error);
+		offset += bytes_read;
+		g_byte_array_append (decoded, buf, bytes_written);
+	} while (result != G_CONVERTER_FINISHED);
+	g_assert_cmpuint (offset, ==, size);
+	g_object_unref (decompressor);
+
+	return g_byte_array_free_to_bytes (decoded);
+}
+
+static void
+do_content_encoder_test (ServerData *sd, gconstpointer test_data)
+{
+	SoupSession *session;
+	SoupMessage *msg;
+	SoupMessageHeaders *headers;
+	GBytes *body, *decoded;
+
+	session = soup_test_session_new (NULL);
+	soup_session_remove_feature_by_type (session, SOUP_TYPE_CONTENT_DECODER);
+
+	/* A complete body is compressed in place */
+	body = encoder_request (session, sd, "/text", "gzip", &msg);
+	headers = soup_message_get_response_headers (msg);
+	g_assert_cmpstr (soup_message_headers_get_one (headers, "Content-Encoding"), ==, "gzip");
+	g_assert_true (soup_message_headers_header_contains (headers, "Vary", "Accept-Encoding"));
+	g_assert_cmpstr (soup_message_headers_get_one (headers, "ETag"), ==, "W/\"text\"");
+	g_assert_cmpint (soup_message_headers_get_encoding (headers), ==, SOUP_ENCODING_CONTENT_LENGTH);
+	g_assert_cmpint (soup_message_headers_get_content_length (headers), ==, g_bytes_get_size (body));
+	g_assert_cmpint (g_bytes_get_size (body), <, strlen (encoder_text));
+	decoded = decode_gzip_body (body);
+	g_assert_cmpmem (g_bytes_get_data (decoded, NULL), g_bytes_get_size (decoded),
+			 encoder_text, strlen (encoder_text));
+	g_bytes_unref (decoded);
+	g_bytes_unref (body);
+	g_object_unref (msg);
+
+	/* Below min-size */
+	body = encoder_request (session, sd, "/small", "gzip", &msg);
+	headers = soup_message_get_response_headers (msg);
+	g_assert_null (soup_message_headers_get_one (headers, "Content-Encoding"));
+	g_assert_cmpmem (g_bytes_get_data (body, NULL), g_bytes_get_size (body), "index", 5);
+	g_bytes_unref (body);
+	g_object_unref (msg);
+
+	/* Not a compressible type */
+	body = encoder_request (session, sd, "/image", "gzip", &msg);
+	headers = soup_message_get_response_headers (msg);
+	g_assert_null (soup_message_headers_get_one (headers, "Content-Encoding"));
+	g_assert_null (soup_message_headers_get_one (headers, "Vary"));
+	g_bytes_unref (body);
+	g_object_unref (msg);
+
+	/* The client prefers identity */
+	body = encoder_request (session, sd, "/text", "identity, gzip;q=0.5", &msg);
+	headers = soup_message_get_response_headers (msg);
+	g_assert_null (soup_message_headers_get_one (headers, "Content-Encoding"));
+	g_assert_true (soup_message_headers_header_contains (headers, "Vary", "Accept-Encoding"));
+	g_assert_cmpstr (soup_message_headers_get_one (headers, "ETag"), ==, "\"text\"");
+	g_assert_cmpmem (g_bytes_get_data (body, NULL), g_bytes_get_size (body),
+			 encoder_text, strlen (encoder_text));
+	g_bytes_unref (body);
+	g_object_unref (msg);
+
+	soup_test_session_abort_unref (session);
+}
+
+static void
+do_content_encoder_streaming_test (ServerData *sd, gconstpointer test_data)
+{
+	const char *path = test_data;
+	SoupSession *session;
+	SoupMessage *msg;
+	SoupMessageHeaders *headers;
+	GBytes *body, *decoded;
+	GString *expected;
+
+	session = soup_test_session_new (NULL);
+	soup_session_remove_feature_by_type (session, SOUP_TYPE_CONTENT_DECODER);
+
+	/* The body is compressed as it is written, and the compressed
+	 * stream ends with the body, whether or not it had a length.
+	 */
+	body = encoder_request (session, sd, path, "gzip", &msg);
+	headers = soup_message_get_response_headers (msg);
+	g_assert_cmpstr (soup_message_headers_get_one (headers, "Content-Encoding"), ==, "gzip");
+	g_assert_cmpint (soup_message_headers_get_encoding (headers), ==, SOUP_ENCODING_CHUNKED);
+
+	expected = g_string_new (NULL);
+	g_string_append (expected, encoder_text);
+	g_string_append (expected, encoder_text);
+	g_string_append (expected, encoder_text);
+	decoded = decode_gzip_body (body);
+	g_assert_cmpmem (g_bytes_get_data (decoded, NULL), g_bytes_get_size (decoded),
+			 expected->str, expected->len);
+	g_string_free (expected, TRUE);
+	g_bytes_unref (decoded);
+	g_bytes_unref (body);
+	g_object_unref (msg);
+
+	soup_test_session_abort_unref (session);
+}
+
+static void
+do_content_encoder_cache_test (ServerData *sd, gconstpointer test_data)
+{
+	SoupSession *session;
+	SoupMessage *msg;
+	GBytes *body;
+	goffset first_length = 0;
+	int i;
+
+	soup_content_encoder_set_cache_size (soup_server_get_content_encoder (sd->server), 4);
+	session = soup_test_session_new (NULL);
+
+	for (i = 0; i < 3; i++) {
+		SoupMessageHeaders *headers;
+
+		body = encoder_request (session, sd, "/text", NULL, &msg);
+		headers = soup_message_get_response_headers (msg);
+		g_assert_cmpstr (soup_message_headers_get_one (headers, "Content-Encoding"), ==, "gzip");
+		if (i == 0)
+			first_length = soup_message_headers_get_content_length (headers);
+		else
+			g_assert_cmpint (soup_message_headers_get_content_length (headers), ==, first_length);
+		g_assert_cmpmem (g_bytes_get_data (body, NULL), g_bytes_get_size (body),
+				 encoder_text, strlen (encoder_text));
+		g_bytes_unref (body);
+		g_object_unref (msg);
+	}
+
+	soup_test_session_abort_unref (session);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -1395,6 +1661,14 @@ main (int argc, char **argv)
 		    server_setup_nohandler, do_early_multi_test, server_teardown);
 	g_test_add ("/server/steal/CONNECT", ServerData, NULL,
 		    server_setup, do_steal_connect_test, server_teardown);
+	g_test_add ("/server/content-encoder/basic", ServerData, NULL,
+		    server_setup_encoder, do_content_encoder_test, server_teardown);
+	g_test_add ("/server/content-encoder/chunked", ServerData, "/chunked",
+		    server_setup_encoder, do_content_encoder_streaming_test, server_teardown);
+	g_test_add ("/server/content-encoder/content-length", ServerData, "/content-length",
+		    server_setup_encoder, do_content_encoder_streaming_test, server_teardown);
+	g_test_add ("/server/content-encoder/cache", ServerData, NULL,
+		    server_setup_encoder, do_content_encoder_cache_test, server_teardown);
 
 	ret = g_test_run ();
 
@@ -342,6 +342,126 @@ test_disabled (gconstpointer data)
 	g_uri_unref (uri);
 }
 
+static void
+do_sniffing_data_test (void)
+{
+	static const struct {
+		const char *content_type;
+		const char *data;
+		gsize length;
+		const char *expected;
+	} tests[] = {
+		{ NULL, " \n\t<!DOCTYPE html>", 18, "text/html" },
+		{ NULL, "<!doctype\r\nhtml>", 16, "text/html" },
+		{ NULL, "<b>bold</b>", 11, "text/html" },
+		{ NULL, "<body", 5, "text/plain" },
+		{ NULL, "<?xml version=\"1.0\"?>", 21, "text/xml" },
+		{ NULL, "%PDF-1.4", 8, "application/pdf" },
+		{ NULL, "GIF89a\x01\x00", 8, "image/gif" },
+		{ NULL, "RIFF\x24\x00\x00\x00WAVEfmt ", 16, "audio/wave" },
+		{ NULL, "RIFF\x24\x00\x00\x00WEBPVP8 ", 16, "image/webp" },
+		{ NULL, "plain text, nothing binary here\r\n", 33, "text/plain" },
+		{ NULL, "plain text with a \x01 binary byte", 31, "application/octet-stream" },
+		{ "text/plain", "still plain text\x1a", 17, "application/octet-stream" },
+		{ "text/plain", "\xef\xbb\xbftext\x01", 8, "text/plain" },
+		{ "image/gif", "\x89PNG\r\n\x1a\n", 8, "image/png" },
+		{ "image/gif", "not an image", 12, "image/gif" },
+		{ "audio/x-unknown", "OggS\x00\x02", 6, "application/ogg" },
+	};
+	SoupContentSniffer *sniffer;
+	guint i;
+
+	sniffer = soup_content_sniffer_new ();
+
+	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+		SoupMessage *msg;
+		GBytes *data;
+		char *sniffed_type;
+
+		msg = soup_message_new ("GET", "http://127.0.0.1/");
+		if (tests[i].content_type) {
+			soup_message_headers_append (soup_message_get_response_headers (msg),
+						     "Content-Type", tests[i].content_type);
+		}
+		data = g_bytes_new_static (tests[i].data, tests[i].length);
+
+		sniffed_type = soup_content_sniffer_sniff (sniffer, msg, data, NULL);
+		g_assert_cmpstr (sniffed_type, ==, tests[i].expected);
+
+		g_free (sniffed_type);
+		g_bytes_unref (data);
+		g_object_unref (msg);
+	}
+
+	g_object_unref (sniffer);
+}
+
+static void
+do_sniffing_benchmark (void)
+{
+	static const char * const resources[] = {
+		"test.html", "leading_space.html", "atom.xml", "rss20.xml",
+		"text.txt", "mbox", "home.gif", "home.png", "home.jpg",
+		"tux.webp", "test.ogg", "test.wav", "test.mp4", "ps_binary.ps"
+	};
+	static const char * const content_types[] = {
+		NULL, "text/plain", "text/html", "image/png", "video/mp4"
+	};
+	SoupContentSniffer *sniffer;
+	SoupMessage *msgs[G_N_ELEMENTS (content_types)];
+	GBytes *corpus[G_N_ELEMENTS (resources)];
+	guint n_iterations, n_sniffs = 0, i, j, k;
+	gint64 start, elapsed;
+
+	sniffer = soup_content_sniffer_new ();
+
+	for (i = 0; i < G_N_ELEMENTS (resources); i++) {
+		GError *error = NULL;
+		GBytes *data;
+
+		data = soup_test_load_resource (resources[i], &error);
+		g_assert_no_error (error);
+		corpus[i] = g_bytes_new_from_bytes (data, 0, MIN (512, g_bytes_get_size (data)));
+		g_bytes_unref (data);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (content_types); i++) {
+		msgs[i] = soup_message_new ("GET", "http://127.0.0.1/");
+		if (content_types[i]) {
+			soup_message_headers_append (soup_message_get_response_headers (msgs[i]),
+						     "Content-Type", content_types[i]);
+		}
+	}
+
+	n_iterations = g_test_perf () ? 20000 : 10;
+	start = g_get_monotonic_time ();
+	for (k = 0; k < n_iterations; k++) {
+		for (i = 0; i < G_N_ELEMENTS (msgs); i++) {
+			for (j = 0; j < G_N_ELEMENTS (corpus); j++) {
+				char *sniffed_type;
+
+				sniffed_type = soup_content_sniffer_sniff (sniffer, msgs[i], corpus[j], NULL);
+				g_assert_nonnull (sniffed_type);
+				g_free (sniffed_type);
+				n_sniffs++;
+			}
+		}
+	}
+	elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+	if (g_test_perf ()) {
+		g_test_maximized_result ((double)n_sniffs * G_USEC_PER_SEC / elapsed,
+					 "%.0f sniffs/s",
+					 (double)n_sniffs * G_USEC_PER_SEC / elapsed);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (msgs); i++)
+		g_object_unref (msgs[i]);
+	for (i = 0; i < G_N_ELEMENTS (corpus); i++)
+		g_bytes_unref (corpus[i]);
+	g_object_unref (sniffer);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -517,6 +637,9 @@ main (int argc, char **argv)
 			      "/text_or_binary/home.gif",
 			      test_disabled);
 
+	g_test_add_func ("/sniffing/data", do_sniffing_data_test);
+	g_test_add_func ("/sniffing/benchmark", do_sniffing_benchmark);
+
 	ret = g_test_run ();
 
 	g_uri_unref (base_uri);
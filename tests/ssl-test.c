@@ -693,6 +693,137 @@ do_tls_interaction_preconnect_test (gconstpointer data)
         g_object_unref (certificate);
 }
 
+/* Turns off glib-networking's process-wide session cache for the
+ * connection, so that only the session copied by libsoup can be resumed.
+ */
+static void
+disable_backend_session_cache (SoupMessage        *msg,
+                               GSocketClientEvent  event,
+                               GIOStream          *connection)
+{
+        if (event == G_SOCKET_CLIENT_TLS_HANDSHAKING)
+                g_object_set (connection, "session-resumption-enabled", FALSE, NULL);
+}
+
+static gboolean
+send_with_new_tls_connection (SoupSession *session)
+{
+        SoupMessage *msg;
+        SoupMessageMetrics *metrics;
+        GBytes *body;
+        gboolean resumed;
+        GError *error = NULL;
+
+        msg = soup_message_new_from_uri ("GET", uri);
+        soup_message_add_flags (msg, SOUP_MESSAGE_NEW_CONNECTION | SOUP_MESSAGE_COLLECT_METRICS);
+        g_signal_connect (msg, "network-event",
+                          G_CALLBACK (disable_backend_session_cache), NULL);
+        body = soup_test_session_async_send (session, msg, NULL, &error);
+        g_assert_no_error (error);
+        soup_test_assert_message_status (msg, SOUP_STATUS_OK);
+
+        metrics = soup_message_get_metrics (msg);
+        g_assert_nonnull (metrics);
+        g_assert_cmpuint (soup_message_metrics_get_tls_start (metrics), >, 0);
+        g_assert_cmpuint (soup_message_metrics_get_tls_end (metrics), >=, soup_message_metrics_get_tls_start (metrics));
+        g_assert_cmpuint (soup_message_metrics_get_connect_end (metrics), >=, soup_message_metrics_get_tls_end (metrics));
+        resumed = soup_message_metrics_get_tls_session_resumed (metrics);
+
+        g_bytes_unref (body);
+        g_object_unref (msg);
+
+        return resumed;
+}
+
+static void
+send_and_read_ready_cb (SoupSession  *session,
+                        GAsyncResult *result,
+                        int          *pending)
+{
+        GBytes *body;
+        GError *error = NULL;
+
+        body = soup_session_send_and_read_finish (session, result, &error);
+        g_assert_no_error (error);
+        g_bytes_unref (body);
+        (*pending)--;
+}
+
+/* Returns the number of the two connections that resumed a session */
+static int
+send_with_concurrent_tls_connections (SoupSession *session)
+{
+        SoupMessage *msgs[2];
+        int pending = G_N_ELEMENTS (msgs);
+        int resumed = 0;
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (msgs); i++) {
+                msgs[i] = soup_message_new_from_uri ("GET", uri);
+                soup_message_add_flags (msgs[i], SOUP_MESSAGE_NEW_CONNECTION | SOUP_MESSAGE_COLLECT_METRICS);
+                g_signal_connect (msgs[i], "network-event",
+                                  G_CALLBACK (disable_backend_session_cache), NULL);
+                soup_session_send_and_read_async (session, msgs[i], G_PRIORITY_DEFAULT, NULL,
+                                                  (GAsyncReadyCallback)send_and_read_ready_cb,
+                                                  &pending);
+        }
+
+        while (pending)
+                g_main_context_iteration (NULL, TRUE);
+
+        for (i = 0; i < G_N_ELEMENTS (msgs); i++) {
+                soup_test_assert_message_status (msgs[i], SOUP_STATUS_OK);
+                if (soup_message_metrics_get_tls_session_resumed (soup_message_get_metrics (msgs[i])))
+                        resumed++;
+                g_object_unref (msgs[i]);
+        }
+
+        return resumed;
+}
+
+static void
+do_tls_session_resumption_test (gconstpointer data)
+{
+        SoupSession *session, *other_session;
+        GObjectClass *klass;
+        gboolean has_properties;
+        int i;
+
+        SOUP_TEST_SKIP_IF_NO_TLS;
+
+        klass = g_type_class_ref (g_tls_backend_get_client_connection_type (g_tls_backend_get_default ()));
+        has_properties = g_object_class_find_property (klass, "session-reused") != NULL &&
+                g_object_class_find_property (klass, "session-resumption-enabled") != NULL;
+        g_type_class_unref (klass);
+        if (!has_properties) {
+                g_test_skip ("TLS backend does not report session resumption");
+                return;
+        }
+
+        session = soup_test_session_new (NULL);
+        other_session = soup_test_session_new (NULL);
+
+        /* The first connection needs a full handshake, the following
+         * ones resume its session.
+         */
+        g_assert_false (send_with_new_tls_connection (session));
+        for (i = 0; i < 2; i++)
+                g_assert_true (send_with_new_tls_connection (session));
+
+        /* A session is only offered once: of two connections created
+         * before either has handshaked, one does a full handshake.
+         */
+        g_assert_cmpint (send_with_concurrent_tls_connections (session), ==, 1);
+        g_assert_true (send_with_new_tls_connection (session));
+
+        /* Sessions are not shared with other SoupSessions */
+        g_assert_false (send_with_new_tls_connection (other_session));
+        g_assert_true (send_with_new_tls_connection (other_session));
+
+        soup_test_session_abort_unref (other_session);
+        soup_test_session_abort_unref (session);
+}
+
 static void
 server_handler (SoupServer        *server,
 		SoupServerMessage *msg,
@@ -753,6 +884,7 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/ssl/tls-interaction", server, do_tls_interaction_test);
         g_test_add_data_func ("/ssl/tls-interaction-msg", server, do_tls_interaction_msg_test);
         g_test_add_data_func ("/ssl/tls-interaction/preconnect", server, do_tls_interaction_preconnect_test);
+        g_test_add_data_func ("/ssl/session-resumption", server, do_tls_session_resumption_test);
 
 	for (i = 0; i < G_N_ELEMENTS (strictness_tests); i++) {
 		g_test_add_data_func (strictness_tests[i].name,